@@ -0,0 +1,29 @@
+-- complain if script is sourced in psql, rather than via ALTER EXTENSION
+--\echo Use "ALTER EXTENSION nextgres_idcp UPDATE TO '0.2.0'" to load this file. \quit
+
+-- Replace the proxy workers, handing their listeners and idle sessions over
+CREATE FUNCTION _nextgres_idcp.handoff_workers()
+RETURNS boolean
+AS 'MODULE_PATHNAME', 'ng_idcp_handoff_workers'
+LANGUAGE C STRICT;
+
+REVOKE ALL ON FUNCTION _nextgres_idcp.handoff_workers() FROM PUBLIC;
+
+-- Counters of each proxy worker, published every stats_period seconds
+CREATE FUNCTION _nextgres_idcp.proxy_stats(
+  OUT worker_id integer,
+  OUT pid integer,
+  OUT n_clients integer,
+  OUT n_ssl_clients integer,
+  OUT n_pools integer,
+  OUT n_backends integer,
+  OUT n_dedicated_backends integer,
+  OUT n_idle_backends integer,
+  OUT n_idle_clients integer,
+  OUT tx_bytes bigint,
+  OUT rx_bytes bigint,
+  OUT n_transactions bigint,
+  OUT client_memory bigint)
+RETURNS SETOF record
+AS 'MODULE_PATHNAME', 'ng_idcp_proxy_stats'
+LANGUAGE C STRICT;
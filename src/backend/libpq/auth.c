@@ -0,0 +1,841 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Client authentication performed by the connection proxy.
+ *
+ * Pooled backends are started by the proxy itself, so clients have to be
+ * authenticated before they are given one. The password exchange is driven
+ * message by message from the proxy's event loop: ng_idcp_auth_start()
+ * queues the authentication request selected by nextgres_idcp.auth_type and
+ * ng_idcp_auth_exchange() consumes each client response, both appending the
+ * replies to be sent to the client. SCRAM uses the server's own mechanism
+ * implementation, so verifiers, channel binding and mock authentication of
+ * unknown users behave as they do for direct connections.
+ *
+ * Verifiers come from nextgres_idcp.auth_file if set, otherwise from
+ * nextgres_idcp.auth_query run in nextgres_idcp.auth_dbname if that is set,
+ * otherwise from pg_authid like the server's own authentication. Lookups are
+ * cached per user in shared memory for nextgres_idcp.auth_cache_ttl seconds,
+ * so a catalog access (which briefly blocks the proxy worker) is paid once
+ * per user for all workers rather than on every connection.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/pg_type_d.h"
+#include "executor/spi.h"
+#include "libpq/crypt.h"
+#include "libpq/libpq-be.h"
+#include "libpq/pqformat.h"
+#include "libpq/sasl.h"
+#include "libpq/scram.h"
+#include "miscadmin.h"
+#include "storage/fd.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+#include "utils/timestamp.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/libpq/libpq.h"
+#include "nextgres/idcp/storage/ipc.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* Values of nextgres_idcp.auth_type */
+#define AUTH_METHOD_TRUST       0
+#define AUTH_METHOD_PLAIN       1
+#define AUTH_METHOD_MD5         2
+#define AUTH_METHOD_SCRAM       3
+#define AUTH_METHOD_CERT        4
+#define AUTH_METHOD_UNSUPPORTED (-1)
+
+/* Verifiers longer than this (long plaintext passwords) are not cached */
+#define AUTH_VERIFIER_MAX       256
+
+/* Length of the salt of an MD5 password challenge */
+#define AUTH_MD5_SALT_LEN       4
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct AuthCacheEntry;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Cached verifier of a user, in a shared hash table protected by
+ * NG_IDCP_LWLOCK_AUTH_CACHE.
+ */
+typedef struct AuthCacheEntry {
+  /** Hash key: role name */
+  NameData              user_name;
+
+  /** Entry must be looked up again after this time */
+  TimestampTz           expires;
+
+  /** Role exists and has a password (negative lookups are cached too) */
+  bool                  has_verifier;
+  char                  verifier[AUTH_VERIFIER_MAX];
+} AuthCacheEntry;
+
+/*
+ * State of one client's password exchange.
+ */
+struct NgIdcpClientAuth {
+  /** Holds this structure and everything allocated during the exchange */
+  MemoryContext         ctx;
+  Port                 *port;
+
+  /** AUTH_METHOD_* actually used with this client */
+  int                   method;
+
+  /** Stored password or verifier, NULL if the role has none */
+  char                 *shadow_pass;
+
+  /** Mechanism state once the SASL initial response was received */
+  void                 *sasl_state;
+
+  char                  md5_salt[AUTH_MD5_SALT_LEN];
+};
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static void auth_append_message (StringInfo out, char msgtype,
+  const char *data, int len);
+static void auth_append_request (StringInfo out, int32 code,
+  const char *extra, int extra_len);
+static int auth_cache_entries (void);
+static bool auth_cache_get (const char *user_name, char **shadow_pass);
+static void auth_cache_put (const char *user_name, const char *shadow_pass);
+static int auth_failed (NgIdcpClientAuth *auth, StringInfo out,
+  const char *logdetail);
+static bool auth_file_lookup (const char *user_name, char **shadow_pass);
+static char *auth_file_token (char **line);
+static bool auth_lookup (const char *user_name, char **shadow_pass);
+static int auth_method (void);
+static bool auth_query_lookup (const char *user_name, char **shadow_pass);
+static int auth_sasl_exchange (NgIdcpClientAuth *auth, const char *body,
+  int len, StringInfo out, const char **logdetail);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* Verifier cache in shared memory, NULL when disabled */
+static HTAB *ng_idcp_auth_cache = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Release the state of a password exchange.
+ */
+void
+ng_idcp_auth_end (
+  NgIdcpClientAuth *auth
+) {
+  MemoryContextDelete(auth->ctx);
+} /* ng_idcp_auth_end() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Process a message sent by the client during the password exchange.
+ * Replies are appended to out. Returns NG_IDCP_AUTH_OK once the client is
+ * authenticated, NG_IDCP_AUTH_CONTINUE if another client response is
+ * expected, or NG_IDCP_AUTH_FAILED after queueing an error for the client.
+ */
+int
+ng_idcp_auth_exchange (
+  NgIdcpClientAuth     *auth,
+  char                  msgtype,
+  const char           *body,
+  int                   len,
+  StringInfo            out
+) {
+  MemoryContext oldcontext = MemoryContextSwitchTo(auth->ctx);
+  const char *logdetail = NULL;
+  volatile int status = STATUS_ERROR;
+  volatile int result = NG_IDCP_AUTH_FAILED;
+
+  if (msgtype != 'p') {
+    MemoryContextSwitchTo(oldcontext);
+    ereport(COMMERROR,
+            (errcode(ERRCODE_PROTOCOL_VIOLATION),
+             errmsg("expected password response, got message type %d",
+                    msgtype)));
+    return auth_failed(auth, out, NULL);
+  }
+
+  /* The message parsers and the SCRAM code report bad input with ERROR */
+  PG_TRY();
+  {
+    if (auth->method == AUTH_METHOD_SCRAM) {
+      result = auth_sasl_exchange(auth, body, len, out, &logdetail);
+    } else if (len == 0 || body[len - 1] != '\0' ||
+               strlen(body) != (size_t) len - 1) {
+      ereport(ERROR,
+              (errcode(ERRCODE_PROTOCOL_VIOLATION),
+               errmsg("invalid password packet size")));
+    } else if (auth->shadow_pass == NULL) {
+      logdetail = psprintf(_("User \"%s\" has no password assigned."),
+                           auth->port->user_name);
+    } else if (auth->method == AUTH_METHOD_MD5) {
+      status = md5_crypt_verify(auth->port->user_name, auth->shadow_pass,
+                                body, auth->md5_salt, AUTH_MD5_SALT_LEN,
+                                &logdetail);
+    } else {
+      status = plain_crypt_verify(auth->port->user_name, auth->shadow_pass,
+                                  body, &logdetail);
+    }
+    if (auth->method != AUTH_METHOD_SCRAM)
+      result = status == STATUS_OK ? NG_IDCP_AUTH_OK : NG_IDCP_AUTH_FAILED;
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(auth->ctx);
+    EmitErrorReport();
+    FlushErrorState();
+    result = NG_IDCP_AUTH_FAILED;
+  }
+  PG_END_TRY();
+
+  MemoryContextSwitchTo(oldcontext);
+  if (result == NG_IDCP_AUTH_FAILED)
+    return auth_failed(auth, out, logdetail);
+  return result;
+} /* ng_idcp_auth_exchange() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared verifier cache.
+ */
+void
+ng_idcp_auth_shmem_init (
+  void
+) {
+  HASHCTL info;
+  int entries = auth_cache_entries();
+
+  if (entries == 0)
+    return;
+
+  info.keysize = NAMEDATALEN;
+  info.entrysize = sizeof(AuthCacheEntry);
+  ng_idcp_auth_cache = ShmemInitHash(NEXTGRES_EXTNAME " auth cache", entries,
+                                     entries, &info,
+                                     HASH_ELEM | HASH_STRINGS);
+} /* ng_idcp_auth_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the verifier cache.
+ */
+Size
+ng_idcp_auth_shmem_size (
+  void
+) {
+  return hash_estimate_size(auth_cache_entries(), sizeof(AuthCacheEntry));
+} /* ng_idcp_auth_shmem_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Begin authentication of a client whose startup packet was parsed. The
+ * request for its credentials (or an error) is appended to out. Returns
+ * NG_IDCP_AUTH_OK if the client is admitted without a password exchange,
+ * otherwise like ng_idcp_auth_exchange() with *auth set when continuing.
+ */
+int
+ng_idcp_auth_start (
+  Port                 *port,
+  StringInfo            out,
+  NgIdcpClientAuth    **auth
+) {
+  MemoryContext ctx;
+  MemoryContext oldcontext;
+  NgIdcpClientAuth *state;
+  int method = auth_method();
+
+  *auth = NULL;
+  if (method == AUTH_METHOD_TRUST)
+    return NG_IDCP_AUTH_OK;
+
+  ctx = AllocSetContextCreate(TopMemoryContext, "client authentication",
+                              ALLOCSET_SMALL_SIZES);
+  oldcontext = MemoryContextSwitchTo(ctx);
+  state = palloc0(sizeof(NgIdcpClientAuth));
+  state->ctx = ctx;
+  state->port = port;
+  state->method = method;
+
+  if (method == AUTH_METHOD_UNSUPPORTED) {
+    MemoryContextSwitchTo(oldcontext);
+    ereport(LOG,
+            (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+             errmsg("unsupported value of \"%s\": \"%s\"",
+                    "nextgres_idcp.auth_type", gp_ng_idcp_cfg_auth_type)));
+    return auth_failed(state, out, NULL);
+  }
+
+  if (method == AUTH_METHOD_CERT) {
+    /* The CN of a verified client certificate must match the role */
+    bool ok = port->peer_cert_valid && port->peer_cn != NULL &&
+              strcmp(port->peer_cn, port->user_name) == 0;
+    MemoryContextSwitchTo(oldcontext);
+    if (!ok)
+      return auth_failed(state, out, "no matching client certificate");
+    ng_idcp_auth_end(state);
+    return NG_IDCP_AUTH_OK;
+  }
+
+  (void) auth_lookup(port->user_name, &state->shadow_pass);
+
+  /*
+   * As the server does for "md5" in pg_hba.conf, use SCRAM for roles with a
+   * SCRAM verifier so that it can be used, and for unknown roles so that
+   * they cannot be told apart from a wrong password. A plaintext secret from
+   * the auth file works with either method.
+   */
+  if (method == AUTH_METHOD_MD5 &&
+      (state->shadow_pass == NULL ||
+       get_password_type(state->shadow_pass) ==
+         PASSWORD_TYPE_SCRAM_SHA_256))
+    state->method = method = AUTH_METHOD_SCRAM;
+
+  /*
+   * The server's verifiers reject plaintext secrets, so hash one the way the
+   * chosen method expects: an MD5 hash, or a SCRAM verifier with a fresh
+   * salt. A plain password is then checked against the MD5 hash.
+   */
+  if (state->shadow_pass != NULL &&
+      get_password_type(state->shadow_pass) == PASSWORD_TYPE_PLAINTEXT)
+    state->shadow_pass = encrypt_password(
+        method == AUTH_METHOD_SCRAM ? PASSWORD_TYPE_SCRAM_SHA_256
+                                    : PASSWORD_TYPE_MD5,
+        port->user_name, state->shadow_pass);
+
+  if (method == AUTH_METHOD_SCRAM) {
+    StringInfoData mechanisms;
+
+    initStringInfo(&mechanisms);
+    pg_be_scram_mech.get_mechanisms(port, &mechanisms);
+    appendStringInfoChar(&mechanisms, '\0');
+    auth_append_request(out, AUTH_REQ_SASL, mechanisms.data, mechanisms.len);
+  } else if (method == AUTH_METHOD_MD5) {
+    if (!pg_strong_random(state->md5_salt, AUTH_MD5_SALT_LEN)) {
+      MemoryContextSwitchTo(oldcontext);
+      ereport(LOG,
+              (errmsg("could not generate random MD5 salt")));
+      return auth_failed(state, out, NULL);
+    }
+    auth_append_request(out, AUTH_REQ_MD5, state->md5_salt,
+                        AUTH_MD5_SALT_LEN);
+  } else {
+    auth_append_request(out, AUTH_REQ_PASSWORD, NULL, 0);
+  }
+
+  MemoryContextSwitchTo(oldcontext);
+  *auth = state;
+  return NG_IDCP_AUTH_CONTINUE;
+} /* ng_idcp_auth_start() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Append a protocol message.
+ */
+static void
+auth_append_message (
+  StringInfo    out,
+  char          msgtype,
+  const char   *data,
+  int           len
+) {
+  uint32 n32 = pg_hton32((uint32) len + 4);
+
+  appendStringInfoChar(out, msgtype);
+  appendBinaryStringInfo(out, (char *) &n32, sizeof(n32));
+  if (len > 0)
+    appendBinaryStringInfo(out, data, len);
+} /* auth_append_message() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Append an Authentication* request.
+ */
+static void
+auth_append_request (
+  StringInfo    out,
+  int32         code,
+  const char   *extra,
+  int           extra_len
+) {
+  StringInfoData buf;
+
+  initStringInfo(&buf);
+  pq_sendint32(&buf, code);
+  if (extra_len > 0)
+    pq_sendbytes(&buf, extra, extra_len);
+  auth_append_message(out, 'R', buf.data, buf.len);
+  pfree(buf.data);
+} /* auth_append_request() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Number of users the shared verifier cache can hold. Only the size, which
+ * is fixed at server start, sizes shared memory: auth_cache_ttl can be
+ * changed on reload and turns the cache off and on at run time.
+ */
+static int
+auth_cache_entries (
+  void
+) {
+  return g_ng_idcp_cfg_auth_cache_size;
+} /* auth_cache_entries() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Look up an unexpired cached verifier. Returns false on a miss; on a hit
+ * *shadow_pass is set (to NULL for a cached negative lookup).
+ */
+static bool
+auth_cache_get (
+  const char   *user_name,
+  char        **shadow_pass
+) {
+  AuthCacheEntry *entry;
+  bool found = false;
+
+  if (ng_idcp_auth_cache == NULL || g_ng_idcp_cfg_auth_cache_ttl <= 0)
+    return false;
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_AUTH_CACHE), LW_SHARED);
+  entry = hash_search(ng_idcp_auth_cache, user_name, HASH_FIND, NULL);
+  if (entry != NULL && entry->expires > GetCurrentTimestamp()) {
+    *shadow_pass = entry->has_verifier ? pstrdup(entry->verifier) : NULL;
+    found = true;
+  }
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_AUTH_CACHE));
+
+  return found;
+} /* auth_cache_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Remember the verifier (or absence of one) of a user. When the cache is
+ * full, expired entries are evicted; if none are, the lookup is not cached.
+ */
+static void
+auth_cache_put (
+  const char   *user_name,
+  const char   *shadow_pass
+) {
+  AuthCacheEntry *entry;
+  TimestampTz now = GetCurrentTimestamp();
+
+  if (ng_idcp_auth_cache == NULL || g_ng_idcp_cfg_auth_cache_ttl <= 0 ||
+      (shadow_pass != NULL && strlen(shadow_pass) >= AUTH_VERIFIER_MAX) ||
+      strlen(user_name) >= NAMEDATALEN)
+    return;
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_AUTH_CACHE), LW_EXCLUSIVE);
+  entry = hash_search(ng_idcp_auth_cache, user_name, HASH_FIND, NULL);
+  if (entry == NULL &&
+      hash_get_num_entries(ng_idcp_auth_cache) >= auth_cache_entries()) {
+    HASH_SEQ_STATUS status;
+    AuthCacheEntry *victim;
+
+    hash_seq_init(&status, ng_idcp_auth_cache);
+    while ((victim = hash_seq_search(&status)) != NULL) {
+      if (victim->expires <= now)
+        (void) hash_search(ng_idcp_auth_cache, &victim->user_name,
+                           HASH_REMOVE, NULL);
+    }
+  }
+  /* Never grow past the preallocated entries into other shared memory */
+  if (entry == NULL &&
+      hash_get_num_entries(ng_idcp_auth_cache) < auth_cache_entries())
+    entry = hash_search(ng_idcp_auth_cache, user_name, HASH_ENTER, NULL);
+  if (entry != NULL) {
+    entry->expires = TimestampTzPlusMilliseconds(
+      now, g_ng_idcp_cfg_auth_cache_ttl * INT64CONST(1000));
+    entry->has_verifier = shadow_pass != NULL;
+    strlcpy(entry->verifier, shadow_pass ? shadow_pass : "",
+            AUTH_VERIFIER_MAX);
+  }
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_AUTH_CACHE));
+} /* auth_cache_put() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Log a failed authentication and queue the error for the client. Always
+ * returns NG_IDCP_AUTH_FAILED.
+ */
+static int
+auth_failed (
+  NgIdcpClientAuth     *auth,
+  StringInfo            out,
+  const char           *logdetail
+) {
+  StringInfoData buf;
+  char *msg = psprintf(auth->method == AUTH_METHOD_CERT
+                         ? _("certificate authentication failed for user \"%s\"")
+                         : _("password authentication failed for user \"%s\""),
+                       auth->port->user_name);
+
+  ereport(LOG,
+          (errcode(ERRCODE_INVALID_PASSWORD),
+           errmsg_internal("%s", msg),
+           logdetail ? errdetail_log("%s", logdetail) : 0));
+
+  initStringInfo(&buf);
+  pq_sendbyte(&buf, PG_DIAG_SEVERITY);
+  pq_sendstring(&buf, "FATAL");
+  pq_sendbyte(&buf, PG_DIAG_SEVERITY_NONLOCALIZED);
+  pq_sendstring(&buf, "FATAL");
+  pq_sendbyte(&buf, PG_DIAG_SQLSTATE);
+  pq_sendstring(&buf, "28P01");
+  pq_sendbyte(&buf, PG_DIAG_MESSAGE_PRIMARY);
+  pq_sendstring(&buf, msg);
+  pq_sendbyte(&buf, '\0');
+  auth_append_message(out, 'E', buf.data, buf.len);
+  pfree(buf.data);
+  pfree(msg);
+
+  return NG_IDCP_AUTH_FAILED;
+} /* auth_failed() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Find a user in nextgres_idcp.auth_file, which lists one user per line as
+ * two double-quoted fields: "user" "password" (a doubled quote stands for a
+ * quote). Lines starting with ';' or '#' are comments. Returns false if the
+ * file cannot be read; unknown users get a NULL *shadow_pass.
+ */
+static bool
+auth_file_lookup (
+  const char   *user_name,
+  char        **shadow_pass
+) {
+  FILE *file;
+  char line[NAMEDATALEN * 2 + AUTH_VERIFIER_MAX * 2];
+  bool found = false;
+
+  file = AllocateFile(gp_ng_idcp_cfg_auth_file, "r");
+  if (file == NULL) {
+    ereport(LOG,
+            (errcode_for_file_access(),
+             errmsg("could not open file \"%s\": %m",
+                    gp_ng_idcp_cfg_auth_file)));
+    return false;
+  }
+
+  while (!found && fgets(line, sizeof(line), file) != NULL) {
+    char *cursor = line;
+    char *name;
+    char *password;
+
+    if (line[0] == ';' || line[0] == '#')
+      continue;
+    name = auth_file_token(&cursor);
+    password = name ? auth_file_token(&cursor) : NULL;
+    if (password != NULL && strcmp(name, user_name) == 0) {
+      *shadow_pass = password[0] != '\0' ? pstrdup(password) : NULL;
+      found = true;
+    }
+  }
+  FreeFile(file);
+
+  return true;
+} /* auth_file_lookup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Extract the next double-quoted field of an auth_file line, unquoting it
+ * in place. Returns NULL if there is none.
+ */
+static char *
+auth_file_token (
+  char **line
+) {
+  char *src = *line;
+  char *dst;
+  char *token;
+
+  while (*src == ' ' || *src == '\t')
+    src++;
+  if (*src != '"')
+    return NULL;
+  token = dst = ++src;
+  for (;;) {
+    if (*src == '\0' || *src == '\n' || *src == '\r')
+      return NULL;
+    if (*src == '"') {
+      if (src[1] != '"')
+        break;
+      src++;
+    }
+    *dst++ = *src++;
+  }
+  *dst = '\0';
+  *line = src + 1;
+  return token;
+} /* auth_file_token() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Find the stored password or verifier of a user, through the shared cache.
+ * *shadow_pass is set to NULL if the user is unknown or has no password.
+ * Returns false if the lookup itself failed.
+ */
+static bool
+auth_lookup (
+  const char   *user_name,
+  char        **shadow_pass
+) {
+  bool ok;
+
+  *shadow_pass = NULL;
+  if (auth_cache_get(user_name, shadow_pass))
+    return true;
+
+  if (gp_ng_idcp_cfg_auth_file != NULL && gp_ng_idcp_cfg_auth_file[0] != '\0')
+    ok = auth_file_lookup(user_name, shadow_pass);
+  else
+    ok = auth_query_lookup(user_name, shadow_pass);
+
+  /* Failed lookups are retried by the next client */
+  if (ok)
+    auth_cache_put(user_name, *shadow_pass);
+  return ok;
+} /* auth_lookup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Map nextgres_idcp.auth_type to AUTH_METHOD_*.
+ */
+static int
+auth_method (
+  void
+) {
+  const char *type = gp_ng_idcp_cfg_auth_type;
+
+  if (type == NULL || pg_strcasecmp(type, "trust") == 0 ||
+      pg_strcasecmp(type, "any") == 0)
+    return AUTH_METHOD_TRUST;
+  if (pg_strcasecmp(type, "plain") == 0 ||
+      pg_strcasecmp(type, "password") == 0)
+    return AUTH_METHOD_PLAIN;
+  if (pg_strcasecmp(type, "md5") == 0)
+    return AUTH_METHOD_MD5;
+  if (pg_strcasecmp(type, "scram-sha-256") == 0)
+    return AUTH_METHOD_SCRAM;
+  if (pg_strcasecmp(type, "cert") == 0)
+    return AUTH_METHOD_CERT;
+  return AUTH_METHOD_UNSUPPORTED;
+} /* auth_method() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Fetch a verifier from the catalogs: with nextgres_idcp.auth_query when
+ * nextgres_idcp.auth_dbname is set (the worker is then connected to that
+ * database), otherwise from pg_authid as the server does.
+ */
+static bool
+auth_query_lookup (
+  const char   *user_name,
+  char        **shadow_pass
+) {
+  MemoryContext oldcontext = CurrentMemoryContext;
+  char *volatile result = NULL;
+  volatile bool ok = false;
+
+  PG_TRY();
+  {
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+
+    if (gp_ng_idcp_cfg_auth_dbname != NULL &&
+        gp_ng_idcp_cfg_auth_dbname[0] != '\0') {
+      Oid argtypes[1] = { TEXTOID };
+      Datum values[1];
+      int ret;
+
+      values[0] = CStringGetTextDatum(user_name);
+      SPI_connect();
+      PushActiveSnapshot(GetTransactionSnapshot());
+      ret = SPI_execute_with_args(gp_ng_idcp_cfg_auth_query, 1, argtypes,
+                                  values, NULL, true, 1);
+      if (ret != SPI_OK_SELECT || SPI_tuptable->tupdesc->natts < 2)
+        ereport(ERROR,
+                (errmsg("\"%s\" must return the user name and password",
+                        "nextgres_idcp.auth_query")));
+      if (SPI_processed > 0) {
+        char *value = SPI_getvalue(SPI_tuptable->vals[0],
+                                   SPI_tuptable->tupdesc, 2);
+        if (value != NULL && value[0] != '\0')
+          result = MemoryContextStrdup(oldcontext, value);
+      }
+      SPI_finish();
+      PopActiveSnapshot();
+    } else {
+      const char *logdetail = NULL;
+      char *value = get_role_password(user_name, &logdetail);
+
+      if (value != NULL)
+        result = MemoryContextStrdup(oldcontext, value);
+    }
+
+    CommitTransactionCommand();
+    ok = true;
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(oldcontext);
+    EmitErrorReport();
+    FlushErrorState();
+    AbortCurrentTransaction();
+  }
+  PG_END_TRY();
+
+  MemoryContextSwitchTo(oldcontext);
+  *shadow_pass = result;
+  return ok;
+} /* auth_query_lookup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Process a SASLInitialResponse or SASLResponse message, as CheckSASLAuth()
+ * does for direct connections.
+ */
+static int
+auth_sasl_exchange (
+  NgIdcpClientAuth     *auth,
+  const char           *body,
+  int                   len,
+  StringInfo            out,
+  const char          **logdetail
+) {
+  StringInfoData buf;
+  const char *input;
+  int inputlen;
+  char *output = NULL;
+  int outputlen = 0;
+  int result;
+
+  buf.data = (char *) body;
+  buf.len = len;
+  buf.maxlen = len;
+  buf.cursor = 0;
+
+  if (auth->sasl_state == NULL) {
+    /* SASLInitialResponse: selected mechanism and its first message */
+    const char *mech = pq_getmsgrawstring(&buf);
+
+    auth->sasl_state = pg_be_scram_mech.init(auth->port, mech,
+                                             auth->shadow_pass);
+    inputlen = pq_getmsgint(&buf, 4);
+    input = inputlen == -1 ? NULL : pq_getmsgbytes(&buf, inputlen);
+    pq_getmsgend(&buf);
+  } else {
+    input = body;
+    inputlen = len;
+  }
+
+  result = pg_be_scram_mech.exchange(auth->sasl_state, input, inputlen,
+                                     &output, &outputlen, logdetail);
+  if (output != NULL)
+    auth_append_request(out, result == PG_SASL_EXCHANGE_SUCCESS
+                               ? AUTH_REQ_SASL_FIN : AUTH_REQ_SASL_CONT,
+                        output, outputlen);
+
+  if (result == PG_SASL_EXCHANGE_SUCCESS)
+    return NG_IDCP_AUTH_OK;
+  if (result == PG_SASL_EXCHANGE_CONTINUE)
+    return NG_IDCP_AUTH_CONTINUE;
+  return NG_IDCP_AUTH_FAILED;
+} /* auth_sasl_exchange() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
@@ -0,0 +1,1091 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Client TLS termination owned by the connection proxy.
+ *
+ * The server's SSL context is private to the server's be-secure-openssl.c
+ * and its handshake (secure_open_server()) blocks until completion, which
+ * would stall every session of a proxy worker. The proxy therefore uses its
+ * own context, configured from the client_tls_* GUCs (falling back to the
+ * server's ssl_* files), and drives SSL_accept() one step at a time from its
+ * event loop with ng_idcp_tls_start()/ng_idcp_tls_accept().
+ *
+ * The socket is attached directly (a socket BIO is required for kernel TLS)
+ * and, if enabled, OpenSSL installs the negotiated keys into the kernel.
+ * Once kTLS transmit is active the proxy writes plaintext with send();
+ * receive still goes through SSL_read() as the kernel reports TLS control
+ * records (alerts, key updates, tickets) to user space as errors on plain
+ * recv().
+ *
+ * Sessions can be resumed on any proxy worker: session ticket keys and a
+ * bounded session-ID cache live in shared memory. Ticket keys are rotated
+ * every client_tls_session_timeout seconds by whichever worker first needs
+ * a fresh one; tickets sealed with the previous key are still accepted (and
+ * renewed) until the following rotation. The session-ID cache, used by
+ * clients that do not support tickets, is direct-mapped: a new session
+ * simply replaces the one that hashed to the same slot.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "common/hashfn.h"
+#include "libpq/libpq.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/memutils.h"
+#include "utils/varlena.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+#include <time.h>
+
+#ifdef USE_OPENSSL
+#include <openssl/bio.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
+#else
+#include <openssl/hmac.h>
+#endif
+#endif
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/libpq/libpq.h"
+#include "nextgres/idcp/storage/ipc.h"
+
+#ifdef USE_OPENSSL
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* Session ticket key: name, AES-256-CBC key and HMAC-SHA256 key */
+#define TLS_TICKET_KEY_NAME_LEN 16
+#define TLS_TICKET_KEY_LEN      32
+
+/* Current and previous ticket keys */
+#define TLS_TICKET_KEYS         2
+
+/* Sessions serializing to more (large client certificates) are not cached */
+#define TLS_SESSION_MAX_DER     4096
+
+/* Required by OpenSSL to resume sessions with verified client certificates */
+#define TLS_SESSION_ID_CONTEXT  NEXTGRES_EXTNAME
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct TlsSessionEntry;
+struct TlsSharedState;
+struct TlsTicketKey;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct TlsTicketKey {
+  /** Identifies the key in tickets it sealed */
+  unsigned char         name[TLS_TICKET_KEY_NAME_LEN];
+  unsigned char         aes_key[TLS_TICKET_KEY_LEN];
+  unsigned char         hmac_key[TLS_TICKET_KEY_LEN];
+
+  /** Generation time, zero for an unused slot */
+  time_t                created;
+} TlsTicketKey;
+
+typedef struct TlsSessionEntry {
+  /** Expiration time, zero for an empty slot */
+  time_t                expires;
+  unsigned int          id_len;
+  unsigned char         id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+  int                   der_len;
+  unsigned char         der[TLS_SESSION_MAX_DER];
+} TlsSessionEntry;
+
+/*
+ * Resumption state shared by all proxy workers, protected by
+ * NG_IDCP_LWLOCK_TLS_CACHE.
+ */
+typedef struct TlsSharedState {
+  /** Index of the key sealing new tickets, -1 until the first one is made */
+  int                   current_key;
+  TlsTicketKey          keys[TLS_TICKET_KEYS];
+
+  /** Session-ID cache slots */
+  int                   n_sessions;
+  TlsSessionEntry       sessions[FLEXIBLE_ARRAY_MEMBER];
+} TlsSharedState;
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static int dummy_ssl_passwd_cb (char *buf, int size, int rwflag,
+  void *userdata);
+static int external_ssl_passwd_cb (char *buf, int size, int rwflag,
+  void *userdata);
+static bool protocol_range (const char *protocols, int *min_version,
+  int *max_version);
+static int server_protocol_version (int guc_version, int dflt);
+static const char *ssl_errmessage (unsigned long ecode);
+static void tls_enable_resumption (SSL_CTX *context);
+static int tls_session_cache_entries (void);
+static SSL_SESSION *tls_session_get_cb (SSL *ssl, const unsigned char *id,
+  int id_len, int *copy);
+static int tls_session_new_cb (SSL *ssl, SSL_SESSION *session);
+static void tls_session_remove_cb (SSL_CTX *context, SSL_SESSION *session);
+static TlsSessionEntry *tls_session_slot (const unsigned char *id,
+  unsigned int id_len);
+static int tls_ticket_cipher (unsigned char *key_name, unsigned char *iv,
+  EVP_CIPHER_CTX *cipher_ctx, int enc, TlsTicketKey *key);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int tls_ticket_key_cb (SSL *ssl, unsigned char *key_name,
+  unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, EVP_MAC_CTX *mac_ctx,
+  int enc);
+#else
+static int tls_ticket_key_cb (SSL *ssl, unsigned char *key_name,
+  unsigned char *iv, EVP_CIPHER_CTX *cipher_ctx, HMAC_CTX *mac_ctx, int enc);
+#endif
+static bool tls_ticket_key_current (TlsTicketKey *key);
+static bool tls_ticket_key_find (const unsigned char *key_name,
+  TlsTicketKey *key, bool *renew);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static SSL_CTX *ng_idcp_ssl_context = NULL;
+
+/* Resumption state in shared memory */
+static TlsSharedState *ng_idcp_tls_shared = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Create the proxy's client TLS context. Returns false (TLS is then not
+ * offered to clients) if it cannot be set up; a private key that cannot be
+ * loaded is fatal, so that clients are never silently left without TLS.
+ */
+bool
+ng_idcp_tls_init (
+  void
+) {
+  SSL_CTX *context;
+  const char *cert_file = gp_ng_idcp_cfg_client_tls_cert_file
+    ? gp_ng_idcp_cfg_client_tls_cert_file : ssl_cert_file;
+  const char *key_file = gp_ng_idcp_cfg_client_tls_key_file
+    ? gp_ng_idcp_cfg_client_tls_key_file : ssl_key_file;
+  const char *ca_file = gp_ng_idcp_cfg_client_tls_ca_file
+    ? gp_ng_idcp_cfg_client_tls_ca_file : ssl_ca_file;
+  const char *ciphers = gp_ng_idcp_cfg_client_tls_ciphers;
+  const char *curve = gp_ng_idcp_cfg_client_tls_ecdhcurve;
+  int min_version;
+  int max_version;
+
+  if (cert_file == NULL || cert_file[0] == '\0' ||
+      key_file == NULL || key_file[0] == '\0') {
+    ereport(LOG,
+            (errmsg("no client TLS certificate configured for the proxy")));
+    return false;
+  }
+
+  context = SSL_CTX_new(TLS_server_method());
+  if (context == NULL) {
+    ereport(LOG,
+            (errmsg("could not create SSL context: %s",
+                    ssl_errmessage(ERR_get_error()))));
+    return false;
+  }
+
+  /*
+   * Writes are retried with the same data from a buffer that may have moved
+   * (see channel_write()), and partial writes are handled by the caller.
+   */
+  SSL_CTX_set_mode(context, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER |
+                            SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+  /*
+   * Encrypted keys are unlocked by ssl_passphrase_command, as the server
+   * does; a background worker never prompts on a terminal.
+   */
+  if (ssl_passphrase_command[0] != '\0')
+    SSL_CTX_set_default_passwd_cb(context, external_ssl_passwd_cb);
+  else
+    SSL_CTX_set_default_passwd_cb(context, dummy_ssl_passwd_cb);
+
+  if (SSL_CTX_use_certificate_chain_file(context, cert_file) != 1) {
+    ereport(LOG,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("could not load server certificate file \"%s\": %s",
+                    cert_file, ssl_errmessage(ERR_get_error()))));
+    goto error;
+  }
+  if (SSL_CTX_use_PrivateKey_file(context, key_file, SSL_FILETYPE_PEM) != 1) {
+    unsigned long ecode = ERR_get_error();
+
+    SSL_CTX_free(context);
+    ereport(FATAL,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("could not load private key file \"%s\": %s",
+                    key_file, ssl_errmessage(ecode)),
+             ssl_passphrase_command[0] == '\0' ?
+             errhint("Encrypted keys require \"ssl_passphrase_command\".") :
+             0));
+  }
+  if (SSL_CTX_check_private_key(context) != 1) {
+    ereport(LOG,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("check of private key failed: %s",
+                    ssl_errmessage(ERR_get_error()))));
+    goto error;
+  }
+
+  if (!protocol_range(gp_ng_idcp_cfg_client_tls_protocols, &min_version,
+                      &max_version)) {
+    ereport(LOG,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("invalid value for parameter \"%s\": \"%s\"",
+                    "nextgres_idcp.client_tls_protocols",
+                    gp_ng_idcp_cfg_client_tls_protocols)));
+    goto error;
+  }
+
+  /* Stay within the server's own ssl_{min,max}_protocol_version */
+  min_version = Max(min_version,
+                    server_protocol_version(ssl_min_protocol_version,
+                                            TLS1_VERSION));
+  max_version = Min(max_version,
+                    server_protocol_version(ssl_max_protocol_version,
+                                            TLS1_3_VERSION));
+  if (min_version > max_version) {
+    ereport(LOG,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("\"%s\" allows no protocol version permitted by "
+                    "\"ssl_min_protocol_version\" and "
+                    "\"ssl_max_protocol_version\"",
+                    "nextgres_idcp.client_tls_protocols")));
+    goto error;
+  }
+  if (!SSL_CTX_set_min_proto_version(context, min_version) ||
+      !SSL_CTX_set_max_proto_version(context, max_version)) {
+    ereport(LOG,
+            (errmsg("could not set TLS protocol version range")));
+    goto error;
+  }
+
+  if (ciphers == NULL || ciphers[0] == '\0' ||
+      pg_strcasecmp(ciphers, "default") == 0)
+    ciphers = SSLCipherSuites;
+  if (SSL_CTX_set_cipher_list(context, ciphers) != 1) {
+    ereport(LOG,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("could not set the cipher list (no valid ciphers "
+                    "available)")));
+    goto error;
+  }
+
+  if (curve != NULL && curve[0] != '\0' && pg_strcasecmp(curve, "auto") != 0 &&
+      SSL_CTX_set1_groups_list(context, curve) != 1) {
+    ereport(LOG,
+            (errcode(ERRCODE_CONFIG_FILE_ERROR),
+             errmsg("ECDH: could not set curve \"%s\"", curve)));
+    goto error;
+  }
+#ifdef SSL_CTX_set_dh_auto
+  SSL_CTX_set_dh_auto(context, 1);
+#endif
+
+  if (ca_file != NULL && ca_file[0] != '\0') {
+    if (SSL_CTX_load_verify_locations(context, ca_file, NULL) != 1) {
+      ereport(LOG,
+              (errcode(ERRCODE_CONFIG_FILE_ERROR),
+               errmsg("could not load root certificate file \"%s\": %s",
+                      ca_file, ssl_errmessage(ERR_get_error()))));
+      goto error;
+    }
+
+    /* Check client certificates against the server's revocation lists */
+    if (ssl_crl_file[0] != '\0' || ssl_crl_dir[0] != '\0') {
+      X509_STORE *cvstore = SSL_CTX_get_cert_store(context);
+
+      if (cvstore == NULL ||
+          X509_STORE_load_locations(cvstore,
+              ssl_crl_file[0] != '\0' ? ssl_crl_file : NULL,
+              ssl_crl_dir[0] != '\0' ? ssl_crl_dir : NULL) != 1) {
+        ereport(LOG,
+                (errcode(ERRCODE_CONFIG_FILE_ERROR),
+                 errmsg("could not load SSL certificate revocation list "
+                        "file \"%s\" or directory \"%s\": %s",
+                        ssl_crl_file, ssl_crl_dir,
+                        ssl_errmessage(ERR_get_error()))));
+        goto error;
+      }
+      X509_STORE_set_flags(cvstore,
+                           X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+    }
+
+    /* Ask for a client certificate, as the server does */
+    SSL_CTX_set_verify(context, SSL_VERIFY_PEER | SSL_VERIFY_CLIENT_ONCE,
+                       NULL);
+  }
+
+  SSL_CTX_set_options(context, SSL_OP_NO_COMPRESSION |
+                               SSL_OP_SINGLE_DH_USE |
+                               SSL_OP_SINGLE_ECDH_USE);
+#ifdef SSL_OP_NO_RENEGOTIATION
+  SSL_CTX_set_options(context, SSL_OP_NO_RENEGOTIATION);
+#endif
+  if (g_ng_idcp_cfg_client_tls_session_timeout > 0 &&
+      ng_idcp_tls_shared != NULL) {
+    tls_enable_resumption(context);
+  } else {
+    SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+  }
+
+  if (g_ng_idcp_client_tls_ktls) {
+#ifdef SSL_OP_ENABLE_KTLS
+    SSL_CTX_set_options(context, SSL_OP_ENABLE_KTLS);
+#else
+    ereport(LOG,
+            (errmsg("OpenSSL was built without kernel TLS support: "
+                    "nextgres_idcp.client_tls_ktls has no effect")));
+#endif
+  }
+
+  ng_idcp_ssl_context = context;
+  return true;
+
+error:
+  SSL_CTX_free(context);
+  return false;
+} /* ng_idcp_tls_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Is kernel TLS used to transmit on this connection? If so, plaintext can
+ * be written to the socket directly.
+ */
+bool
+ng_idcp_tls_ktls_send (
+  Port *port
+) {
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+  return port->ssl != NULL && BIO_get_ktls_send(SSL_get_wbio(port->ssl));
+#else
+  return false;
+#endif
+} /* ng_idcp_tls_ktls_send() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Is the proxy's own TLS context in use?
+ */
+bool
+ng_idcp_tls_loaded (
+  void
+) {
+  return ng_idcp_ssl_context != NULL;
+} /* ng_idcp_tls_loaded() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Create (or, in EXEC_BACKEND children, attach to) the shared session ticket
+ * keys and session-ID cache. Called with AddinShmemInitLock held.
+ */
+void
+ng_idcp_tls_shmem_init (
+  void
+) {
+  bool found;
+
+  ng_idcp_tls_shared = ShmemInitStruct(NEXTGRES_EXTNAME " TLS sessions",
+                                       ng_idcp_tls_shmem_size(), &found);
+  if (!found) {
+    memset(ng_idcp_tls_shared, 0, ng_idcp_tls_shmem_size());
+    ng_idcp_tls_shared->current_key = -1;
+    ng_idcp_tls_shared->n_sessions = tls_session_cache_entries();
+  }
+} /* ng_idcp_tls_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for TLS session resumption.
+ */
+Size
+ng_idcp_tls_shmem_size (
+  void
+) {
+  return add_size(offsetof(TlsSharedState, sessions),
+                  mul_size(tls_session_cache_entries(),
+                           sizeof(TlsSessionEntry)));
+} /* ng_idcp_tls_shmem_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Create the TLS session for a client that asked for SSL. The handshake is
+ * then driven by ng_idcp_tls_accept().
+ */
+int
+ng_idcp_tls_start (
+  Port *port
+) {
+  Assert(!port->ssl);
+  Assert(!port->peer);
+
+  if (!(port->ssl = SSL_new(ng_idcp_ssl_context))) {
+    ereport(COMMERROR,
+            (errcode(ERRCODE_PROTOCOL_VIOLATION),
+             errmsg("could not initialize SSL connection: %s",
+                    ssl_errmessage(ERR_get_error()))));
+    return -1;
+  }
+
+  /* A socket BIO (rather than the server's custom one) is needed for kTLS */
+  if (!SSL_set_fd(port->ssl, port->sock)) {
+    ereport(COMMERROR,
+            (errcode(ERRCODE_PROTOCOL_VIOLATION),
+             errmsg("could not set SSL socket: %s",
+                    ssl_errmessage(ERR_get_error()))));
+    return -1;
+  }
+  return 0;
+} /* ng_idcp_tls_start() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Advance the server side of the TLS handshake started by ng_idcp_tls_start()
+ * on a non-blocking socket. Returns 1 once the handshake is complete, 0 if it
+ * has to be resumed when the socket becomes ready for *waitfor, and -1 on
+ * failure (already reported).
+ */
+int
+ng_idcp_tls_accept (
+  Port     *port,
+  int      *waitfor
+) {
+  int r;
+  int err;
+  unsigned long ecode;
+
+  errno = 0;
+  ERR_clear_error();
+  r = SSL_accept(port->ssl);
+  if (r <= 0) {
+    err = SSL_get_error(port->ssl, r);
+    ecode = ERR_get_error();
+    switch (err) {
+      case SSL_ERROR_WANT_READ:
+        *waitfor = WL_SOCKET_READABLE;
+        return 0;
+
+      case SSL_ERROR_WANT_WRITE:
+        *waitfor = WL_SOCKET_WRITEABLE;
+        return 0;
+
+      case SSL_ERROR_SYSCALL:
+        if (r < 0 && errno != 0)
+          ereport(COMMERROR,
+                  (errcode_for_socket_access(),
+                   errmsg("could not accept SSL connection: %m")));
+        else
+          ereport(COMMERROR,
+                  (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                   errmsg("could not accept SSL connection: EOF detected")));
+        break;
+
+      case SSL_ERROR_SSL:
+        ereport(COMMERROR,
+                (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                 errmsg("could not accept SSL connection: %s",
+                        ssl_errmessage(ecode))));
+        break;
+
+      case SSL_ERROR_ZERO_RETURN:
+        ereport(COMMERROR,
+                (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                 errmsg("could not accept SSL connection: EOF detected")));
+        break;
+
+      default:
+        ereport(COMMERROR,
+                (errcode(ERRCODE_PROTOCOL_VIOLATION),
+                 errmsg("unrecognized SSL error code: %d", err)));
+        break;
+    }
+    return -1;
+  }
+
+  port->ssl_in_use = true;
+
+  /* Get client certificate, if available. */
+  port->peer = SSL_get_peer_certificate(port->ssl);
+  port->peer_cn = NULL;
+  port->peer_cert_valid = false;
+  if (port->peer != NULL &&
+      SSL_get_verify_result(port->ssl) == X509_V_OK) {
+    char cn[NAMEDATALEN];
+    int len = X509_NAME_get_text_by_NID(X509_get_subject_name(port->peer),
+                                        NID_commonName, cn, sizeof(cn));
+    if (len > 0 && len < (int) sizeof(cn) && strlen(cn) == (size_t) len)
+      port->peer_cn = MemoryContextStrdup(TopMemoryContext, cn);
+    port->peer_cert_valid = true;
+  }
+
+  elog(DEBUG1, "client TLS connection established (%s, kTLS send %s)",
+       SSL_get_version(port->ssl),
+       ng_idcp_tls_ktls_send(port) ? "on" : "off");
+
+  return 1;
+} /* ng_idcp_tls_accept() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Passphrase callback refusing to prompt for encrypted keys.
+ */
+static int
+dummy_ssl_passwd_cb (
+  char     *buf,
+  int       size,
+  int       rwflag,
+  void     *userdata
+) {
+  Assert(size > 0);
+  buf[0] = '\0';
+  return 0;
+} /* dummy_ssl_passwd_cb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Passphrase callback running ssl_passphrase_command, like the server's own
+ * callback does on a reload.
+ */
+static int
+external_ssl_passwd_cb (
+  char     *buf,
+  int       size,
+  int       rwflag,
+  void     *userdata
+) {
+  /* same prompt as OpenSSL uses internally */
+  const char *prompt = "Enter PEM pass phrase:";
+
+  Assert(rwflag == 0);
+  return run_ssl_passphrase_command(prompt, false, buf, size);
+} /* external_ssl_passwd_cb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Translate nextgres_idcp.client_tls_protocols ("all", "secure" or a list of
+ * tlsv1.0, tlsv1.1, tlsv1.2, tlsv1.3) into an OpenSSL version range.
+ */
+static bool
+protocol_range (
+  const char   *protocols,
+  int          *min_version,
+  int          *max_version
+) {
+  char *rawstring;
+  List *elemlist;
+  ListCell *l;
+  bool ok = true;
+
+  *min_version = TLS1_2_VERSION;
+  *max_version = TLS1_3_VERSION;
+  if (protocols == NULL || pg_strcasecmp(protocols, "secure") == 0)
+    return true;
+  if (pg_strcasecmp(protocols, "all") == 0) {
+    *min_version = TLS1_VERSION;
+    return true;
+  }
+
+  rawstring = pstrdup(protocols);
+  if (!SplitIdentifierString(rawstring, ',', &elemlist)) {
+    pfree(rawstring);
+    return false;
+  }
+
+  *min_version = INT_MAX;
+  *max_version = 0;
+  foreach (l, elemlist) {
+    const char *name = (const char *) lfirst(l);
+    int version;
+
+    if (pg_strcasecmp(name, "tlsv1") == 0 ||
+        pg_strcasecmp(name, "tlsv1.0") == 0)
+      version = TLS1_VERSION;
+    else if (pg_strcasecmp(name, "tlsv1.1") == 0)
+      version = TLS1_1_VERSION;
+    else if (pg_strcasecmp(name, "tlsv1.2") == 0)
+      version = TLS1_2_VERSION;
+    else if (pg_strcasecmp(name, "tlsv1.3") == 0)
+      version = TLS1_3_VERSION;
+    else {
+      ok = false;
+      break;
+    }
+    *min_version = Min(*min_version, version);
+    *max_version = Max(*max_version, version);
+  }
+
+  list_free(elemlist);
+  pfree(rawstring);
+  return ok && *max_version != 0;
+} /* protocol_range() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Translate ssl_min_protocol_version or ssl_max_protocol_version into an
+ * OpenSSL version; "any" (PG_TLS_ANY) yields the passed default.
+ */
+static int
+server_protocol_version (
+  int   guc_version,
+  int   dflt
+) {
+  switch (guc_version) {
+    case PG_TLS1_VERSION:
+      return TLS1_VERSION;
+    case PG_TLS1_1_VERSION:
+      return TLS1_1_VERSION;
+    case PG_TLS1_2_VERSION:
+      return TLS1_2_VERSION;
+    case PG_TLS1_3_VERSION:
+      return TLS1_3_VERSION;
+    default:
+      return dflt;
+  }
+} /* server_protocol_version() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Obtain reason string for passed SSL errcode.
+ */
+static const char *
+ssl_errmessage (
+  unsigned long ecode
+) {
+  const char *errreason;
+  static char errbuf[36];
+
+  if (ecode == 0)
+    return _("no SSL error reported");
+  errreason = ERR_reason_error_string(ecode);
+  if (errreason != NULL)
+    return errreason;
+  snprintf(errbuf, sizeof(errbuf), _("SSL error code %lu"), ecode);
+  return errbuf;
+} /* ssl_errmessage() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Let clients resume their sessions on any proxy worker, with tickets sealed
+ * by the shared keys or, failing that, through the shared session-ID cache.
+ */
+static void
+tls_enable_resumption (
+  SSL_CTX *context
+) {
+  SSL_CTX_set_timeout(context, g_ng_idcp_cfg_client_tls_session_timeout);
+  SSL_CTX_set_session_id_context(context,
+                                 (const unsigned char *) TLS_SESSION_ID_CONTEXT,
+                                 strlen(TLS_SESSION_ID_CONTEXT));
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+  SSL_CTX_set_tlsext_ticket_key_evp_cb(context, tls_ticket_key_cb);
+#else
+  SSL_CTX_set_tlsext_ticket_key_cb(context, tls_ticket_key_cb);
+#endif
+#ifdef TLS1_3_VERSION
+  /* Clients reconnect one connection at a time: one ticket is enough */
+  SSL_CTX_set_num_tickets(context, 1);
+#endif
+
+  if (ng_idcp_tls_shared->n_sessions > 0) {
+    /* Every lookup goes to shared memory, so skip the per-process cache */
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER |
+                                            SSL_SESS_CACHE_NO_INTERNAL);
+    SSL_CTX_sess_set_new_cb(context, tls_session_new_cb);
+    SSL_CTX_sess_set_get_cb(context, tls_session_get_cb);
+    SSL_CTX_sess_set_remove_cb(context, tls_session_remove_cb);
+  } else {
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+  }
+} /* tls_enable_resumption() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Number of session-ID cache slots to allocate.
+ */
+static int
+tls_session_cache_entries (
+  void
+) {
+  if (g_ng_idcp_cfg_client_tls_session_timeout <= 0)
+    return 0;
+  return g_ng_idcp_cfg_client_tls_session_cache_size;
+} /* tls_session_cache_entries() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Look up a session offered by a client in the shared cache.
+ */
+static SSL_SESSION *
+tls_session_get_cb (
+  SSL                  *ssl,
+  const unsigned char  *id,
+  int                   id_len,
+  int                  *copy
+) {
+  TlsSessionEntry *entry;
+  unsigned char der[TLS_SESSION_MAX_DER];
+  const unsigned char *p = der;
+  int der_len = 0;
+
+  /* The returned session is ours to give away */
+  *copy = 0;
+
+  if (id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    return NULL;
+
+  entry = tls_session_slot(id, id_len);
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE), LW_SHARED);
+  if (entry->id_len == (unsigned int) id_len &&
+      memcmp(entry->id, id, id_len) == 0 &&
+      entry->expires > time(NULL)) {
+    der_len = entry->der_len;
+    memcpy(der, entry->der, der_len);
+  }
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE));
+
+  if (der_len == 0)
+    return NULL;
+  return d2i_SSL_SESSION(NULL, &p, der_len);
+} /* tls_session_get_cb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Store a newly established session in the shared cache, replacing whatever
+ * occupied its slot.
+ */
+static int
+tls_session_new_cb (
+  SSL          *ssl,
+  SSL_SESSION  *session
+) {
+  TlsSessionEntry *entry;
+  unsigned char der[TLS_SESSION_MAX_DER];
+  unsigned char *p = der;
+  unsigned int id_len;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+  int der_len = i2d_SSL_SESSION(session, NULL);
+
+  if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH ||
+      der_len <= 0 || der_len > TLS_SESSION_MAX_DER)
+    return 0;
+  der_len = i2d_SSL_SESSION(session, &p);
+
+  entry = tls_session_slot(id, id_len);
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE), LW_EXCLUSIVE);
+  entry->expires = (time_t) SSL_SESSION_get_time(session) +
+                   SSL_SESSION_get_timeout(session);
+  entry->id_len = id_len;
+  memcpy(entry->id, id, id_len);
+  entry->der_len = der_len;
+  memcpy(entry->der, der, der_len);
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE));
+
+  /* We did not keep a reference to the session */
+  return 0;
+} /* tls_session_new_cb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Drop a session that OpenSSL declared invalid (e.g. after a fatal alert).
+ */
+static void
+tls_session_remove_cb (
+  SSL_CTX      *context,
+  SSL_SESSION  *session
+) {
+  TlsSessionEntry *entry;
+  unsigned int id_len;
+  const unsigned char *id = SSL_SESSION_get_id(session, &id_len);
+
+  if (id_len == 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    return;
+
+  entry = tls_session_slot(id, id_len);
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE), LW_EXCLUSIVE);
+  if (entry->id_len == id_len && memcmp(entry->id, id, id_len) == 0)
+    entry->expires = 0;
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE));
+} /* tls_session_remove_cb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Cache slot of a session ID.
+ */
+static TlsSessionEntry *
+tls_session_slot (
+  const unsigned char  *id,
+  unsigned int          id_len
+) {
+  uint32 hash = hash_bytes(id, (int) id_len);
+  return &ng_idcp_tls_shared->sessions[hash % ng_idcp_tls_shared->n_sessions];
+} /* tls_session_slot() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Set up ticket encryption (enc != 0) with the current shared key, or
+ * decryption with the key named in a ticket. Returns the ticket callback
+ * result; on success *key receives the key whose HMAC half must be used.
+ */
+static int
+tls_ticket_cipher (
+  unsigned char    *key_name,
+  unsigned char    *iv,
+  EVP_CIPHER_CTX   *cipher_ctx,
+  int               enc,
+  TlsTicketKey     *key
+) {
+  bool renew = false;
+
+  if (enc) {
+    /* Without a key the session is simply not given a ticket */
+    if (!tls_ticket_key_current(key))
+      return 0;
+    if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) != 1)
+      return -1;
+    memcpy(key_name, key->name, TLS_TICKET_KEY_NAME_LEN);
+    if (EVP_EncryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key,
+                           iv) != 1)
+      return -1;
+    return 1;
+  }
+
+  /* Unknown or retired key: fall back to a full handshake */
+  if (!tls_ticket_key_find(key_name, key, &renew))
+    return 0;
+  if (EVP_DecryptInit_ex(cipher_ctx, EVP_aes_256_cbc(), NULL, key->aes_key,
+                         iv) != 1)
+    return -1;
+  return renew ? 2 : 1;
+} /* tls_ticket_cipher() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Session ticket callback sealing and opening tickets with the shared keys.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+static int
+tls_ticket_key_cb (
+  SSL              *ssl,
+  unsigned char    *key_name,
+  unsigned char    *iv,
+  EVP_CIPHER_CTX   *cipher_ctx,
+  EVP_MAC_CTX      *mac_ctx,
+  int               enc
+) {
+  TlsTicketKey key;
+  OSSL_PARAM params[2];
+  int rc = tls_ticket_cipher(key_name, iv, cipher_ctx, enc, &key);
+
+  if (rc > 0) {
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+                                                 (char *) "SHA256", 0);
+    params[1] = OSSL_PARAM_construct_end();
+    if (EVP_MAC_init(mac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                     params) != 1)
+      rc = -1;
+  }
+  explicit_bzero(&key, sizeof(key));
+  return rc;
+} /* tls_ticket_key_cb() */
+#else
+static int
+tls_ticket_key_cb (
+  SSL              *ssl,
+  unsigned char    *key_name,
+  unsigned char    *iv,
+  EVP_CIPHER_CTX   *cipher_ctx,
+  HMAC_CTX         *mac_ctx,
+  int               enc
+) {
+  TlsTicketKey key;
+  int rc = tls_ticket_cipher(key_name, iv, cipher_ctx, enc, &key);
+
+  if (rc > 0 && HMAC_Init_ex(mac_ctx, key.hmac_key, sizeof(key.hmac_key),
+                             EVP_sha256(), NULL) != 1)
+    rc = -1;
+  explicit_bzero(&key, sizeof(key));
+  return rc;
+} /* tls_ticket_key_cb() */
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Copy the key sealing new tickets, generating a new one when the current key
+ * has been in use for a whole session lifetime.
+ */
+static bool
+tls_ticket_key_current (
+  TlsTicketKey *key
+) {
+  TlsSharedState *shared = ng_idcp_tls_shared;
+  LWLock *lock = ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE);
+  time_t now = time(NULL);
+  bool found = true;
+
+  LWLockAcquire(lock, LW_SHARED);
+  if (shared->current_key >= 0 &&
+      now - shared->keys[shared->current_key].created <
+        g_ng_idcp_cfg_client_tls_session_timeout) {
+    *key = shared->keys[shared->current_key];
+    LWLockRelease(lock);
+    return true;
+  }
+  LWLockRelease(lock);
+
+  LWLockAcquire(lock, LW_EXCLUSIVE);
+  /* Another worker may have rotated the key meanwhile */
+  if (shared->current_key < 0 ||
+      now - shared->keys[shared->current_key].created >=
+        g_ng_idcp_cfg_client_tls_session_timeout) {
+    int next = (shared->current_key + 1) % TLS_TICKET_KEYS;
+    TlsTicketKey *new_key = &shared->keys[next];
+
+    if (RAND_bytes(new_key->name, sizeof(new_key->name)) == 1 &&
+        RAND_bytes(new_key->aes_key, sizeof(new_key->aes_key)) == 1 &&
+        RAND_bytes(new_key->hmac_key, sizeof(new_key->hmac_key)) == 1) {
+      new_key->created = now;
+      shared->current_key = next;
+    } else {
+      /* Keep using the previous key, if any, rather than a partial one */
+      memset(new_key, 0, sizeof(*new_key));
+      found = shared->current_key >= 0;
+    }
+  }
+  if (found)
+    *key = shared->keys[shared->current_key];
+  LWLockRelease(lock);
+
+  return found;
+} /* tls_ticket_key_current() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Copy the key named in a ticket. *renew is set when the ticket should be
+ * reissued under the current key.
+ */
+static bool
+tls_ticket_key_find (
+  const unsigned char  *key_name,
+  TlsTicketKey         *key,
+  bool                 *renew
+) {
+  TlsSharedState *shared = ng_idcp_tls_shared;
+  LWLock *lock = ng_idcp_lwlock(NG_IDCP_LWLOCK_TLS_CACHE);
+  bool found = false;
+
+  LWLockAcquire(lock, LW_SHARED);
+  for (int ii = 0; ii < TLS_TICKET_KEYS; ++ii) {
+    if (shared->keys[ii].created != 0 &&
+        memcmp(shared->keys[ii].name, key_name, TLS_TICKET_KEY_NAME_LEN) ==
+          0) {
+      *key = shared->keys[ii];
+      *renew = ii != shared->current_key;
+      found = true;
+      break;
+    }
+  }
+  LWLockRelease(lock);
+
+  return found;
+} /* tls_ticket_key_find() */
+
+#endif /* USE_OPENSSL */
+
+/* vim: set ts=2 et sw=2 ft=c: */
@@ -26,9 +26,11 @@
 #include "port/pg_bswap.h"
 #include "postmaster/postmaster.h"
 #include "storage/ipc.h"
+#include "utils/guc.h"
 #include "utils/guc_hooks.h"
 #include "utils/memutils.h"
 
+#include "nextgres/idcp.h"
 #include "nextgres/idcp/libpq/libpq.h"
 
 /*
@@ -92,7 +94,13 @@ static int  internal_putbytes(const char *s, size_t len);
 static int  internal_flush(void);
 
 static int  Lock_AF_UNIX(const char *unixSocketDir, const char *unixSocketPath);
+static pid_t Socket_Lock_Owner(const char *lockfile);
+static void RemoveSocketFile(const char *sock_path);
+static void socket_files_on_exit(int code, Datum arg);
+static void remember_socket_file(const char *sock_path);
 static int  Setup_AF_UNIX(const char *sock_path);
+static void Setup_AF_INET(pgsocket fd, const char *familyDesc,
+              const char *addrDesc);
 
 static const PQcommMethods NGPqCommSocketMethods = {
   socket_comm_reset,
@@ -498,13 +506,16 @@ ng_idcp_stream_server_port(int family, const char *hostName, unsigned short port
         break;
       }
     }
+    else
+      Setup_AF_INET(fd, familyDesc, addrDesc);
 
     /*
-     * Select appropriate accept-queue length limit.  It seems reasonable
-     * to use a value similar to the maximum number of child processes
-     * that the postmaster will permit.
+     * Select appropriate accept-queue length limit: listen_backlog, or
+     * else a value similar to the maximum number of child processes that
+     * the postmaster will permit.
      */
-    maxconn = MaxConnections * 2;
+    maxconn = g_ng_idcp_cfg_listen_backlog > 0 ?
+      g_ng_idcp_cfg_listen_backlog : MaxConnections * 2;
 
     err = listen(fd, maxconn);
     if (err < 0)
@@ -547,10 +558,28 @@ ng_idcp_stream_server_port(int family, const char *hostName, unsigned short port
 static int
 Lock_AF_UNIX(const char *unixSocketDir, const char *unixSocketPath)
 {
+  char    lockfile[MAXPGPATH];
+  pid_t    owner;
+
   /* no lock file for abstract sockets */
   if (unixSocketPath[0] == '@')
     return STATUS_OK;
 
+  /*
+   * CreateSocketLockFile() fails with FATAL when a live process other than
+   * our parent holds the lock.  That is the case while the proxy worker we
+   * replace still listens on the socket, so give up quietly instead.
+   */
+  snprintf(lockfile, sizeof(lockfile), "%s.lock", unixSocketPath);
+  owner = Socket_Lock_Owner(lockfile);
+  if (owner != 0)
+  {
+    ereport(LOG,
+        (errmsg("Unix-domain socket \"%s\" is in use by process %d",
+            unixSocketPath, (int) owner)));
+    return STATUS_ERROR;
+  }
+
   /*
    * Grab an interlock file associated with the socket file.
    *
@@ -570,18 +599,216 @@ Lock_AF_UNIX(const char *unixSocketDir, const char *unixSocketPath)
   /*
    * Remember socket file pathnames for later maintenance.
    */
-  sock_paths = lappend(sock_paths, pstrdup(unixSocketPath));
+  remember_socket_file(unixSocketPath);
 
   return STATUS_OK;
 }
 
 
+/*
+ * Socket_Lock_Owner -- PID of the live process holding a socket lock file
+ *
+ * Returns 0 if there is no lock file, or if it belongs to us, to our parent
+ * or to a process that no longer exists; CreateSocketLockFile() then takes it
+ * over, as it would.
+ */
+static pid_t
+Socket_Lock_Owner(const char *lockfile)
+{
+  char    buffer[32];
+  ssize_t    len;
+  long    pid;
+  int      fd;
+
+  fd = open(lockfile, O_RDONLY | PG_BINARY, 0);
+  if (fd < 0)
+    return 0;
+  len = read(fd, buffer, sizeof(buffer) - 1);
+  close(fd);
+  if (len <= 0)
+    return 0;
+  buffer[len] = '\0';
+
+  pid = strtol(buffer, NULL, 10);
+  if (pid <= 0 || pid == MyProcPid || pid == getppid())
+    return 0;
+  if (kill((pid_t) pid, 0) == 0 || errno != ESRCH)
+    return (pid_t) pid;
+  return 0;
+}
+
+
+/*
+ * remember_socket_file -- track a socket file to remove when we exit
+ *
+ * The lock files the postmaster's list would remove are not ours: the proxy
+ * removes its socket files and their locks itself.
+ */
+static void
+remember_socket_file(const char *sock_path)
+{
+  static bool registered = false;
+  MemoryContext oldcontext;
+
+  if (!registered)
+  {
+    on_proc_exit(socket_files_on_exit, 0);
+    registered = true;
+  }
+
+  oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+  sock_paths = lappend(sock_paths, pstrdup(sock_path));
+  MemoryContextSwitchTo(oldcontext);
+}
+
+
+/*
+ * ng_idcp_socket_file_adopt -- take over a socket handed to us by another
+ * process
+ *
+ * The lock file is rewritten with our PID, so that it keeps protecting the
+ * socket once its creator exits, and both are removed when we exit.
+ */
+void
+ng_idcp_socket_file_adopt(const char *unixSocketPath)
+{
+  char    lockfile[MAXPGPATH];
+  char    buffer[MAXPGPATH * 2 + 256];
+  char    content[MAXPGPATH * 2 + 256];
+  char     *rest;
+  ssize_t    len;
+  int      fd;
+
+  if (unixSocketPath[0] == '@')
+    return;
+
+  snprintf(lockfile, sizeof(lockfile), "%s.lock", unixSocketPath);
+  fd = open(lockfile, O_RDWR | PG_BINARY, 0);
+  if (fd >= 0)
+  {
+    len = read(fd, buffer, sizeof(buffer) - 1);
+    if (len > 0)
+    {
+      buffer[len] = '\0';
+      rest = strchr(buffer, '\n');
+      if (rest != NULL)
+      {
+        len = snprintf(content, sizeof(content), "%d%s", (int) MyProcPid,
+                 rest);
+        if (len >= (ssize_t) sizeof(content) || ftruncate(fd, 0) != 0 ||
+          pg_pwrite(fd, content, len, 0) != len)
+          ereport(LOG,
+              (errcode_for_file_access(),
+               errmsg("could not write lock file \"%s\": %m",
+                  lockfile)));
+      }
+    }
+    close(fd);
+  }
+
+  remember_socket_file(unixSocketPath);
+}
+
+
+/*
+ * ng_idcp_socket_file_release -- stop tracking a socket file
+ *
+ * With remove, the socket file and its lock file are unlinked; without, they
+ * are left to the process the socket was handed to.
+ */
+void
+ng_idcp_socket_file_release(const char *unixSocketPath, bool remove)
+{
+  ListCell   *l;
+
+  foreach(l, sock_paths)
+  {
+    char     *sock_path = (char *) lfirst(l);
+
+    if (strcmp(sock_path, unixSocketPath) != 0)
+      continue;
+    if (remove)
+      RemoveSocketFile(sock_path);
+    sock_paths = foreach_delete_current(sock_paths, l);
+    pfree(sock_path);
+  }
+}
+
+
+/*
+ * Setup_AF_INET -- configure TCP listening socket options
+ *
+ * Applies tcp_socket_buffer, tcp_defer_accept and tcp_fastopen before the
+ * socket starts listening.  Buffer sizes set here are inherited by accepted
+ * connections and determine the window scale offered in the handshake, so
+ * they are not set on the connections themselves.  Failures are only logged,
+ * as not every platform supports these options.
+ */
+static void
+Setup_AF_INET(pgsocket fd, const char *familyDesc, const char *addrDesc)
+{
+  int      val;
+
+  if (g_ng_idcp_cfg_tcp_socket_buffer > 0)
+  {
+    val = g_ng_idcp_cfg_tcp_socket_buffer;
+    if (setsockopt(fd, SOL_SOCKET, SO_RCVBUF, (char *) &val,
+             sizeof(val)) < 0)
+      ereport(LOG,
+          (errcode_for_socket_access(),
+           errmsg("%s(%s) failed for %s address \"%s\": %m",
+              "setsockopt", "SO_RCVBUF", familyDesc, addrDesc)));
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, (char *) &val,
+             sizeof(val)) < 0)
+      ereport(LOG,
+          (errcode_for_socket_access(),
+           errmsg("%s(%s) failed for %s address \"%s\": %m",
+              "setsockopt", "SO_SNDBUF", familyDesc, addrDesc)));
+  }
+
+  if (g_ng_idcp_cfg_tcp_defer_accept > 0)
+  {
+#ifdef TCP_DEFER_ACCEPT
+    val = g_ng_idcp_cfg_tcp_defer_accept;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, (char *) &val,
+             sizeof(val)) < 0)
+      ereport(LOG,
+          (errcode_for_socket_access(),
+           errmsg("%s(%s) failed for %s address \"%s\": %m",
+              "setsockopt", "TCP_DEFER_ACCEPT", familyDesc, addrDesc)));
+#else
+    elog(WARNING, "configuration item tcp_defer_accept is not supported on this platform");
+#endif
+  }
+
+  if (g_ng_idcp_cfg_tcp_fastopen > 0)
+  {
+#ifdef TCP_FASTOPEN
+    val = g_ng_idcp_cfg_tcp_fastopen;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, (char *) &val,
+             sizeof(val)) < 0)
+      ereport(LOG,
+          (errcode_for_socket_access(),
+           errmsg("%s(%s) failed for %s address \"%s\": %m",
+              "setsockopt", "TCP_FASTOPEN", familyDesc, addrDesc)));
+#else
+    elog(WARNING, "configuration item tcp_fastopen is not supported on this platform");
+#endif
+  }
+}
+
+
 /*
  * Setup_AF_UNIX -- configure unix socket permissions
+ *
+ * The proxy's nextgres_idcp.unix_socket_group and unix_socket_mode apply,
+ * not the server's settings.
  */
 static int
 Setup_AF_UNIX(const char *sock_path)
 {
+  const char *sock_group = gp_ng_idcp_cfg_unix_socket_group;
+
   /* no file system permissions for abstract sockets */
   if (sock_path[0] == '@')
     return STATUS_OK;
@@ -591,8 +818,7 @@ Setup_AF_UNIX(const char *sock_path)
    * before we listen() to avoid a window where unwanted connections could
    * get accepted.
    */
-  Assert(Unix_socket_group);
-  if (Unix_socket_group[0] != '\0')
+  if (sock_group != NULL && sock_group[0] != '\0')
   {
 #ifdef WIN32
     elog(WARNING, "configuration item unix_socket_group is not supported on this platform");
@@ -601,7 +827,7 @@ Setup_AF_UNIX(const char *sock_path)
     unsigned long val;
     gid_t    gid;
 
-    val = strtoul(Unix_socket_group, &endptr, 10);
+    val = strtoul(sock_group, &endptr, 10);
     if (*endptr == '\0')
     {            /* numeric group id */
       gid = val;
@@ -610,12 +836,12 @@ Setup_AF_UNIX(const char *sock_path)
     {            /* convert group name to id */
       struct group *gr;
 
-      gr = getgrnam(Unix_socket_group);
+      gr = getgrnam(sock_group);
       if (!gr)
       {
         ereport(LOG,
             (errmsg("group \"%s\" does not exist",
-                Unix_socket_group)));
+                sock_group)));
         return STATUS_ERROR;
       }
       gid = gr->gr_gid;
@@ -631,7 +857,7 @@ Setup_AF_UNIX(const char *sock_path)
 #endif
   }
 
-  if (chmod(sock_path, Unix_socket_permissions) == -1)
+  if (chmod(sock_path, g_ng_idcp_cfg_unix_socket_mode) == -1)
   {
     ereport(LOG,
         (errcode_for_file_access(),
@@ -645,37 +871,76 @@ Setup_AF_UNIX(const char *sock_path)
 
 /*
  * StreamConnection -- create a new connection with client using
- *    server port.  Set port->sock to the FD of the new connection.
+ *    server port.  Set port->sock to the FD of the new connection,
+ *    which is non-blocking where accept4() is available.
  *
- * ASSUME: that this doesn't need to be non-blocking because
- *    the Postmaster waits for the socket to be ready to accept().
+ * ASSUME: the server socket is non-blocking, see proxy_accept().
  *
  * RETURNS: STATUS_OK or STATUS_ERROR
  */
 int
 ng_idcp_stream_connection (pgsocket server_fd, Port *port)
 {
-  /* accept connection and fill in the client (remote) address */
+  /*
+   * Accept connection and fill in the client (remote) address.  The
+   * listening socket is non-blocking, so this never waits: the proxy calls
+   * us until the backlog is drained (EAGAIN) and deals with running out of
+   * descriptors itself, as sleeping here would stall all of its sessions.
+   * errno is preserved for the caller.
+   */
   port->raddr.salen = sizeof(port->raddr.addr);
-  if ((port->sock = accept(server_fd,
-               (struct sockaddr *) &port->raddr.addr,
-               &port->raddr.salen)) == PGINVALID_SOCKET)
+#ifdef SOCK_NONBLOCK
+  port->sock = accept4(server_fd,
+             (struct sockaddr *) &port->raddr.addr,
+             &port->raddr.salen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+  port->sock = accept(server_fd,
+            (struct sockaddr *) &port->raddr.addr,
+            &port->raddr.salen);
+#endif
+  if (port->sock == PGINVALID_SOCKET)
   {
-    ereport(LOG,
-        (errcode_for_socket_access(),
-         errmsg("could not accept new connection: %m")));
+    int      save_errno = errno;
 
-    /*
-     * If accept() fails then postmaster.c will still see the server
-     * socket as read-ready, and will immediately try again.  To avoid
-     * uselessly sucking lots of CPU, delay a bit before trying again.
-     * (The most likely reason for failure is being out of kernel file
-     * table slots; we can do little except hope some will get freed up.)
-     */
-    pg_usleep(100000L);    /* wait 0.1 sec */
+    if (save_errno != EAGAIN && save_errno != EWOULDBLOCK &&
+      save_errno != EINTR)
+      ereport(LOG,
+          (errcode_for_socket_access(),
+           errmsg("could not accept new connection: %m")));
+    errno = save_errno;
     return STATUS_ERROR;
   }
 
+  return ng_idcp_stream_setup(port);
+}
+
+/*
+ * ng_idcp_stream_setup -- finish setting up a freshly accepted connection.
+ *
+ * Split out of ng_idcp_stream_connection() so that sockets accepted by other
+ * means (e.g. io_uring multishot accept, which does not report the peer
+ * address) get the same treatment.  Fills in the remote address if the
+ * caller didn't, the local address, and the TCP socket options.
+ *
+ * RETURNS: STATUS_OK or STATUS_ERROR
+ */
+int
+ng_idcp_stream_setup(Port *port)
+{
+  /* fill in the client (remote) address if accept() didn't */
+  if (port->raddr.salen == 0)
+  {
+    port->raddr.salen = sizeof(port->raddr.addr);
+    if (getpeername(port->sock,
+            (struct sockaddr *) &port->raddr.addr,
+            &port->raddr.salen) < 0)
+    {
+      ereport(LOG,
+          (errmsg("%s() failed: %m", "getpeername")));
+      return STATUS_ERROR;
+    }
+  }
+
   /* fill in the server (local) address */
   port->laddr.salen = sizeof(port->laddr.addr);
   if (getsockname(port->sock,
@@ -691,6 +956,7 @@ ng_idcp_stream_connection (pgsocket server_fd, Port *port)
   if (port->laddr.addr.ss_family != AF_UNIX)
   {
     int      on;
+    bool    keepalive = true;
 #ifdef WIN32
     int      oldopt;
     int      optlen;
@@ -707,8 +973,13 @@ ng_idcp_stream_connection (pgsocket server_fd, Port *port)
       return STATUS_ERROR;
     }
 #endif
+    /* tcp_keepalive is on unless it is set to a false value */
     on = 1;
-    if (setsockopt(port->sock, SOL_SOCKET, SO_KEEPALIVE,
+    if (gp_ng_idcp_cfg_tcp_keepalive != NULL &&
+      !parse_bool(gp_ng_idcp_cfg_tcp_keepalive, &keepalive))
+      keepalive = true;
+    if (keepalive &&
+      setsockopt(port->sock, SOL_SOCKET, SO_KEEPALIVE,
              (char *) &on, sizeof(on)) < 0)
     {
       ereport(LOG,
@@ -761,16 +1032,18 @@ ng_idcp_stream_connection (pgsocket server_fd, Port *port)
 #endif
 
     /*
-     * Also apply the current keepalive parameters.  If we fail to set a
-     * parameter, don't error out, because these aren't universally
-     * supported.  (Note: you might think we need to reset the GUC
-     * variables to 0 in such a case, but it's not necessary because the
-     * show hooks for these variables report the truth anyway.)
+     * Also apply the proxy's keepalive parameters, rather than the
+     * server's, so that dead clients (and the backends they pin) are
+     * detected on the proxy's schedule.  If we fail to set a parameter,
+     * don't error out, because these aren't universally supported.
      */
-    (void) pq_setkeepalivesidle(tcp_keepalives_idle, port);
-    (void) pq_setkeepalivesinterval(tcp_keepalives_interval, port);
-    (void) pq_setkeepalivescount(tcp_keepalives_count, port);
-    (void) pq_settcpusertimeout(tcp_user_timeout, port);
+    if (keepalive)
+    {
+      (void) pq_setkeepalivesidle(g_ng_idcp_cfg_tcp_keepidle, port);
+      (void) pq_setkeepalivesinterval(g_ng_idcp_cfg_tcp_keepintvl, port);
+      (void) pq_setkeepalivescount(g_ng_idcp_cfg_tcp_keepcnt, port);
+    }
+    (void) pq_settcpusertimeout(g_ng_idcp_cfg_tcp_user_timeout, port);
   }
 
   return STATUS_OK;
@@ -817,7 +1090,7 @@ TouchSocketFiles(void)
 }
 
 /*
- * RemoveSocketFiles -- unlink socket files at postmaster shutdown
+ * RemoveSocketFiles -- unlink socket files and their lock files at exit
  */
 void
 RemoveSocketFiles(void)
@@ -829,13 +1102,35 @@ RemoveSocketFiles(void)
   {
     char     *sock_path = (char *) lfirst(l);
 
-    /* Ignore any error. */
-    (void) unlink(sock_path);
+    RemoveSocketFile(sock_path);
   }
   /* Since we're about to exit, no need to reclaim storage */
   sock_paths = NIL;
 }
 
+/*
+ * RemoveSocketFile -- unlink one socket file and its lock file
+ */
+static void
+RemoveSocketFile(const char *sock_path)
+{
+  char    lockfile[MAXPGPATH];
+
+  /* Ignore any error. */
+  (void) unlink(sock_path);
+  snprintf(lockfile, sizeof(lockfile), "%s.lock", sock_path);
+  (void) unlink(lockfile);
+}
+
+/*
+ * socket_files_on_exit -- on_proc_exit callback for RemoveSocketFiles
+ */
+static void
+socket_files_on_exit(int code, Datum arg)
+{
+  RemoveSocketFiles();
+}
+
 
 /* --------------------------------
  * Low-level I/O routines begin here.
@@ -22,6 +22,9 @@
  *
  * This file represents a background worker that coordinates individual
  * connection pool listeners responsible for handling incoming requests.
+ *
+ * The controller is connected to nextgres_idcp.database_name, where it reads
+ * the pool configuration tables for the proxy workers (see poolconfig.c).
  */
 
 /* ========================================================================= */
@@ -41,6 +44,7 @@
 #include "storage/latch.h"
 #include "storage/lwlock.h"
 #include "storage/proc.h"
+#include "storage/procarray.h"
 #include "storage/shmem.h"
 
 /* these headers are used by this particular worker's code */
@@ -49,18 +53,35 @@
 #include "fmgr.h"
 #include "lib/stringinfo.h"
 #include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
 #include "utils/snapmgr.h"
+#include "utils/timestamp.h"
 
 /* --------------------------- System Inclusions --------------------------- */
 
+#include <signal.h>
+
 /* --------------------------- Project Inclusions -------------------------- */
 
 #include "nextgres/idcp.h"
+#include "nextgres/idcp/postmaster/handoff.h"
+#include "nextgres/idcp/postmaster/proxy.h"
+#include "nextgres/idcp/storage/ipc.h"
+#include "nextgres/idcp/util/poolconfig.h"
 
 /* ========================================================================= */
 /* -- LOCAL DEFINITIONS ---------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * A worker that keeps failing is restarted after a delay, doubled with each
+ * consecutive failure. One that stayed up for a while is restarted at once.
+ */
+#define PROXY_RESTART_DELAY_MIN 1000   /* milliseconds */
+#define PROXY_RESTART_DELAY_MAX 60000  /* milliseconds */
+#define PROXY_RESTART_HEALTHY   60000  /* milliseconds */
+
 /* ========================================================================= */
 /* -- LOCAL MACROS --------------------------------------------------------- */
 /* ========================================================================= */
@@ -69,10 +90,32 @@
 /* -- LOCAL TYPEDEFS ------------------------------------------------------- */
 /* ========================================================================= */
 
+struct ProxyWorker;
+
 /* ========================================================================= */
 /* -- LOCAL STRUCTURES ----------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * Entry of the worker table, by worker id.
+ */
+typedef struct ProxyWorker {
+  /** Handle of the worker, NULL until it is (re)started */
+  BackgroundWorkerHandle *handle;
+
+  /** Pid of the worker, 0 if it didn't start */
+  pid_t                 pid;
+
+  /** When the worker was started, 0 before the first start */
+  TimestampTz           started_at;
+
+  /** Earliest time to start the worker again */
+  TimestampTz           restart_at;
+
+  /** Consecutive failures, see PROXY_RESTART_DELAY_MIN */
+  int                   n_failures;
+} ProxyWorker;
+
 /* ========================================================================= */
 /* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
 /* ========================================================================= */
@@ -83,6 +126,15 @@
 
 static void idcp_controller_sighup_handler (SIGNAL_ARGS);
 static void idcp_controller_sigterm_handler (SIGNAL_ARGS);
+static bool idcp_controller_handoff_workers (Datum main_arg);
+static void idcp_controller_schedule_restart (ProxyWorker *worker,
+  TimestampTz now);
+static bool idcp_controller_start_worker (Datum main_arg, int worker_id,
+  pid_t old_pid);
+static bool idcp_controller_stop_workers (void);
+static bool idcp_controller_supervise_workers (Datum main_arg,
+  long *timeout);
+static void idcp_controller_worker_exited (int worker_id, TimestampTz now);
 
 PGDLLEXPORT void ng_idcp_controller_main(Datum main_arg)
     pg_attribute_noreturn();
@@ -100,11 +152,15 @@ PGDLLEXPORT void ng_idcp_controller_main(Datum main_arg)
 /* ========================================================================= */
 
 /** Flag indicating the coordinator should be reloaded. */
-static volatile sig_atomic_t got_sighup = true;
+static volatile sig_atomic_t got_sighup = false;
 
 /** Flag indicating the coordinator should be terminated. */
 static volatile sig_atomic_t got_sigterm = false;
 
+/** Worker table, by worker id */
+static ProxyWorker *proxy_workers = NULL;
+static int n_proxy_workers = 0;
+
 /* ========================================================================= */
 /* -- STATIC ASSERTIONS ---------------------------------------------------- */
 /* ========================================================================= */
@@ -117,7 +173,8 @@ void
 ng_idcp_controller_main (
   Datum db_oid
 ) {
-  bool proxy_workers_started = false;
+  TimestampTz next_config_refresh = 0;
+  uint32 handoff_requests;
 
   /* Register functions for SIGTERM/SIGHUP management */
   pqsignal(SIGHUP, idcp_controller_sighup_handler);
@@ -126,76 +183,79 @@ ng_idcp_controller_main (
   /* We're now ready to receive signals */
   BackgroundWorkerUnblockSignals();
 
-  /* Connect to our database */
-  BackgroundWorkerInitializeConnectionByOid(db_oid, InvalidOid, 0);
+  /* Connect to the database holding our configuration tables */
+  BackgroundWorkerInitializeConnection(gp_ng_idcp_cfg_database_name, NULL, 0);
+
+  /* Handoffs are requested through our latch */
+  ng_idcp_handoff_set_controller();
+  handoff_requests = ng_idcp_handoff_requests();
+
+  /*
+   * The postmaster sets our latch whenever one of the workers, which report
+   * to us through bgw_notify_pid, starts or exits.
+   */
+  n_proxy_workers = g_ng_idcp_cfg_thread_count;
+  proxy_workers = MemoryContextAllocZero(TopMemoryContext,
+    sizeof(ProxyWorker) * n_proxy_workers);
 
   while (!got_sigterm) {
-    while (got_sighup) {
+    long timeout = 1000L;
+    TimestampTz now;
+
+    if (got_sighup) {
       got_sighup = false;
-      (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
-                      1000L, PG_WAIT_EXTENSION);
-      ResetLatch(MyLatch);
-    }
+      elog(LOG, "received SIGHUP");
+      ProcessConfigFile(PGC_SIGHUP);
 
-    /* Run the background process main loop interrupt handler */
-    HandleMainLoopInterrupts();
+      /* Reloading also reads the configuration tables again */
+      next_config_refresh = 0;
 
-    /* Signal our workers */
-    if (proxy_workers_started) {
+      /*
+       * The postmaster signals the proxy workers as well, and they apply the
+       * new settings in place. Only a forced restart needs us.
+       */
+      if (g_ng_idcp_restart_pooler_on_reload) {
+        ereport(LOG, errmsg("Restarting proxy workers"));
+        if (!idcp_controller_handoff_workers(db_oid))
+          goto main_loop_exit;
+      }
     }
 
-    /* Wait on worker responses */
-    if (proxy_workers_started) {
+    /* Replace the workers when _nextgres_idcp.handoff_workers() asks us to */
+    if (ng_idcp_handoff_requests() != handoff_requests) {
+      handoff_requests = ng_idcp_handoff_requests();
+      ereport(LOG, errmsg("Handing proxy workers off to new workers"));
+      if (!idcp_controller_handoff_workers(db_oid))
+        goto main_loop_exit;
     }
 
-    if (!proxy_workers_started) {
-      BackgroundWorker worker = {
-        .bgw_name = NEXTGRES_EXTNAME "_worker",
-        .bgw_type = NEXTGRES_EXTNAME,
-        .bgw_function_name = "ng_idcp_proxy_main",
-        .bgw_notify_pid = MyProcPid,
-        .bgw_main_arg = db_oid,
-        .bgw_restart_time = BGW_NEVER_RESTART,
-        .bgw_flags =
-            BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION,
-        .bgw_start_time = BgWorkerStart_RecoveryFinished};
-      strncpy(worker.bgw_library_name, MyBgworkerEntry->bgw_library_name,
-        BGW_MAXLEN - 1);
-      for (int ii = 0; ii < g_ng_idcp_cfg_thread_count; ++ii) {
-        BackgroundWorkerHandle *handle;
-        pid_t worker_pid;
-
-        RegisterDynamicBackgroundWorker(&worker, &handle);
-        if (WaitForBackgroundWorkerStartup(handle, &worker_pid) ==
-            BGWH_POSTMASTER_DIED) {
-          goto main_loop_exit;
-        }
-
-        /* We should put these puppies into a list for later signal handling */
-      }
-
-      /*
-       * We should check to make sure all started, but they always do in our
-       * evaluation, so this is a later addition.
-       */
+    /* Run the background process main loop interrupt handler */
+    HandleMainLoopInterrupts();
 
-      proxy_workers_started = true;
+    /* Publish the pool configuration, before the workers first start */
+    now = GetCurrentTimestamp();
+    if (now >= next_config_refresh) {
+      (void) ng_idcp_pool_config_load();
+      next_config_refresh = g_ng_idcp_cfg_config_refresh_interval > 0
+        ? TimestampTzPlusMilliseconds(now,
+            g_ng_idcp_cfg_config_refresh_interval * 1000L)
+        : DT_NOEND;
     }
+    timeout = Min(timeout,
+                  TimestampDifferenceMilliseconds(now, next_config_refresh));
+
+    /* Start the workers, and restart those that exited */
+    if (!idcp_controller_supervise_workers(db_oid, &timeout))
+      goto main_loop_exit;
 
     (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
-                    1000L, PG_WAIT_EXTENSION);
+                    timeout, PG_WAIT_EXTENSION);
     ResetLatch(MyLatch);
   }
 
 main_loop_exit:
-  if (proxy_workers_started) {
-    ereport(LOG, errmsg("Shutting down proxy workers"));
-
-    /*
-     * Per earlier comment, we should iterate the dynamic bgworker list and
-     * signal each one accordingly...
-     */
-  }
+  ereport(LOG, errmsg("Shutting down proxy workers"));
+  (void) idcp_controller_stop_workers();
 
   ereport(LOG, errmsg("Exiting " NEXTGRES_EXTNAME));
 
@@ -214,7 +274,7 @@ static void
 idcp_controller_sighup_handler (
   SIGNAL_ARGS
 ) {
-  elog(LOG, "received SIGHUP");
+  int save_errno = errno;
 
   got_sighup = true;
 
@@ -222,6 +282,8 @@ idcp_controller_sighup_handler (
     SetLatch(&MyProc->procLatch);
   }
 
+  errno = save_errno;
+
 } /* idcp_controller_sighup_handler() */
 
 /* ------------------------------------------------------------------------- */
@@ -242,5 +304,247 @@ idcp_controller_sigterm_handler (
 
 } /* idcp_controller_sigterm_handler() */
 
-/* vim: set ts=2 et sw=2 ft=c: */
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Replace each running proxy worker by a new one, which takes over its
+ * listening sockets and idle sessions; the old worker exits once it has
+ * nothing left to serve. Returns false if the postmaster died.
+ */
+static bool
+idcp_controller_handoff_workers (
+  Datum main_arg
+) {
+  for (int ii = 0; ii < n_proxy_workers; ++ii) {
+    pid_t old_pid = 0;
+
+    /* Workers that are down are left to idcp_controller_supervise_workers */
+    if (proxy_workers[ii].handle == NULL ||
+        GetBackgroundWorkerPid(proxy_workers[ii].handle, &old_pid) !=
+          BGWH_STARTED)
+      continue;
+    if (!idcp_controller_start_worker(main_arg, ii, old_pid))
+      return false;
+  }
+  return true;
+} /* idcp_controller_handoff_workers() */
 
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Schedule the next start of a worker that is down.
+ */
+static void
+idcp_controller_schedule_restart (
+  ProxyWorker  *worker,
+  TimestampTz   now
+) {
+  int delay = 0;
+
+  if (worker->n_failures > 0) {
+    delay = PROXY_RESTART_DELAY_MAX;
+    if (worker->n_failures < 8)
+      delay = Min(PROXY_RESTART_DELAY_MIN << (worker->n_failures - 1),
+                  PROXY_RESTART_DELAY_MAX);
+  }
+  worker->n_failures += 1;
+  worker->restart_at = TimestampTzPlusMilliseconds(now, delay);
+} /* idcp_controller_schedule_restart() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Start proxy worker worker_id and wait until it runs. If old_pid is set,
+ * the new worker takes over from that process, which is asked to hand off
+ * to it; the old worker is no longer supervised. Returns false if the
+ * postmaster died.
+ */
+static bool
+idcp_controller_start_worker (
+  Datum     main_arg,
+  int       worker_id,
+  pid_t     old_pid
+) {
+  ProxyWorker *entry = &proxy_workers[worker_id];
+  BackgroundWorker worker = {
+    .bgw_name = NEXTGRES_EXTNAME "_worker",
+    .bgw_type = NEXTGRES_EXTNAME,
+    .bgw_function_name = "ng_idcp_proxy_main",
+    .bgw_notify_pid = MyProcPid,
+    .bgw_main_arg = main_arg,
+    .bgw_restart_time = BGW_NEVER_RESTART,
+    .bgw_flags =
+        BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION,
+    .bgw_start_time = BgWorkerStart_RecoveryFinished};
+  NgIdcpProxyArgs args = {.worker_id = worker_id, .takeover = old_pid != 0};
+  BackgroundWorkerHandle *handle;
+  pid_t pid = 0;
+
+  strncpy(worker.bgw_library_name, MyBgworkerEntry->bgw_library_name,
+    BGW_MAXLEN - 1);
+  StaticAssertStmt(sizeof(args) <= BGW_EXTRALEN, "proxy arguments too long");
+  memcpy(worker.bgw_extra, &args, sizeof(args));
+
+  if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
+    ereport(LOG,
+            (errmsg("could not register proxy worker %d", worker_id),
+             errhint("Consider increasing max_worker_processes.")));
+    return true;
+  }
+  if (WaitForBackgroundWorkerStartup(handle, &pid) == BGWH_POSTMASTER_DIED)
+    return false;
+
+  if (old_pid != 0) {
+    /* Keep the old worker if its replacement died at once */
+    if (pid == 0 && entry->handle != NULL) {
+      pfree(handle);
+      return true;
+    }
+
+    /* The old worker connects to the pid it finds here */
+    ng_idcp_handoff_set_target(worker_id, pid);
+    if (kill(old_pid, SIGUSR2) < 0)
+      ereport(LOG,
+              (errmsg("could not signal proxy worker %d (pid %d): %m",
+                      worker_id, (int) old_pid)));
+  }
+
+  if (entry->handle != NULL)
+    pfree(entry->handle);
+  entry->handle = handle;
+  entry->pid = pid;
+  entry->started_at = GetCurrentTimestamp();
+  if (pid != 0)
+    ng_idcp_handoff_set_worker(worker_id, pid);
+  return true;
+} /* idcp_controller_start_worker() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Terminate the proxy workers and wait until they are gone. Client sessions
+ * of the workers are closed with them. Returns false if the postmaster died.
+ */
+static bool
+idcp_controller_stop_workers (
+  void
+) {
+  bool postmaster_alive = true;
+
+  for (int ii = 0; ii < n_proxy_workers; ++ii) {
+    if (proxy_workers[ii].handle != NULL)
+      TerminateBackgroundWorker(proxy_workers[ii].handle);
+  }
+  for (int ii = 0; ii < n_proxy_workers; ++ii) {
+    if (proxy_workers[ii].handle == NULL)
+      continue;
+    if (postmaster_alive &&
+        WaitForBackgroundWorkerShutdown(proxy_workers[ii].handle) ==
+          BGWH_POSTMASTER_DIED)
+      postmaster_alive = false;
+    pfree(proxy_workers[ii].handle);
+    proxy_workers[ii].handle = NULL;
+  }
+  n_proxy_workers = 0;
+
+  return postmaster_alive;
+} /* idcp_controller_stop_workers() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Start the workers that are down: initially all of them, then those that
+ * exited, with a growing delay for a worker that keeps failing. On its
+ * first start, a worker takes over from the one a previous controller left
+ * running, if any. *timeout is lowered to the next scheduled restart.
+ * Returns false if the postmaster died.
+ */
+static bool
+idcp_controller_supervise_workers (
+  Datum     main_arg,
+  long     *timeout
+) {
+  TimestampTz now = GetCurrentTimestamp();
+
+  for (int ii = 0; ii < n_proxy_workers; ++ii) {
+    ProxyWorker *worker = &proxy_workers[ii];
+    pid_t old_pid = 0;
+    pid_t pid;
+
+    if (worker->handle != NULL) {
+      if (GetBackgroundWorkerPid(worker->handle, &pid) != BGWH_STOPPED)
+        continue;
+      idcp_controller_worker_exited(ii, now);
+    }
+
+    if (worker->restart_at > now) {
+      *timeout = Min(*timeout,
+                     TimestampDifferenceMilliseconds(now, worker->restart_at));
+      continue;
+    }
+
+    if (worker->started_at == 0) {
+      old_pid = ng_idcp_handoff_worker(ii);
+      if (old_pid != 0 && BackendPidGetProc(old_pid) == NULL)
+        old_pid = 0;
+      if (old_pid != 0)
+        ereport(LOG,
+                (errmsg("taking over proxy worker %d (pid %d) of a previous "
+                        "controller", ii, (int) old_pid)));
+    }
+    if (!idcp_controller_start_worker(main_arg, ii, old_pid))
+      return false;
+
+    now = GetCurrentTimestamp();
+    if (worker->handle == NULL) {
+      /* Registration failed: try again later */
+      idcp_controller_schedule_restart(worker, now);
+      *timeout = Min(*timeout,
+                     TimestampDifferenceMilliseconds(now, worker->restart_at));
+    }
+  }
+  return true;
+} /* idcp_controller_supervise_workers() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A supervised worker exited: terminate the pooled backends it left behind,
+ * which would hold on to their connection slots until their current query
+ * ends, give back the max_db_connections and max_user_connections slots it
+ * held for them, and schedule its restart.
+ */
+static void
+idcp_controller_worker_exited (
+  int           worker_id,
+  TimestampTz   now
+) {
+  ProxyWorker *worker = &proxy_workers[worker_id];
+
+  ereport(LOG,
+          (errmsg("proxy worker %d (pid %d) exited", worker_id,
+                  (int) worker->pid)));
+  if (worker->pid != 0) {
+    int n_orphans = ng_idcp_backend_registry_reclaim(worker->pid);
+
+    if (n_orphans > 0)
+      ereport(LOG,
+              (errmsg("terminated %d orphaned pooled backends of proxy "
+                      "worker %d", n_orphans, worker_id)));
+  }
+
+  pfree(worker->handle);
+  worker->handle = NULL;
+  worker->pid = 0;
+
+  if (worker->started_at + PROXY_RESTART_HEALTHY * INT64CONST(1000) <= now)
+    worker->n_failures = 0;
+  idcp_controller_schedule_restart(worker, now);
+  if (worker->restart_at > now)
+    ereport(LOG,
+            (errmsg("restarting proxy worker %d in %ld ms", worker_id,
+                    TimestampDifferenceMilliseconds(now,
+                                                    worker->restart_at))));
+} /* idcp_controller_worker_exited() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
@@ -0,0 +1,687 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Handing a proxy worker's sockets over to its replacement.
+ *
+ * _nextgres_idcp.handoff_workers() asks the controller to replace every
+ * proxy worker without dropping a client, much like an online restart of
+ * PgBouncer. The controller starts the replacement, publishes its pid here
+ * and signals the worker being replaced, which then connects to the UNIX
+ * socket the replacement listens on. File descriptors of listening sockets,
+ * idle pooled backends and idle client sessions are passed over it with
+ * SCM_RIGHTS, each with a small description of the pool it belongs to.
+ *
+ * The pid of each running worker is published here as well, so that a
+ * controller restarted after a failure finds the workers of its predecessor
+ * and has them hand off to workers it supervises.
+ *
+ * This file has the transport and the shared state; what is handed over and
+ * when is decided by the proxy loop.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "fmgr.h"
+#include "libpq/pqformat.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/postmaster/handoff.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* Socket a replacement worker listens on, relative to the data directory */
+#define HANDOFF_SOCKET_FORMAT \
+  PG_STAT_TMP_DIR "/" NEXTGRES_EXTNAME ".%d.handoff"
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct HandoffHeader;
+struct HandoffShared;
+struct HandoffWorker;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Header of each message. The file descriptor, if any, travels with its
+ * first byte.
+ */
+typedef struct HandoffHeader {
+  /** NG_IDCP_HANDOFF_* */
+  uint32                kind;
+
+  /** Length of the payload following the header */
+  uint32                length;
+} HandoffHeader;
+
+/* Shared state of a proxy worker id */
+typedef struct HandoffWorker {
+  /** Pid of the worker serving this id, 0 if none was started */
+  pid_t                 pid;
+
+  /** Pid of its replacement, 0 if none is starting */
+  pid_t                 target_pid;
+} HandoffWorker;
+
+typedef struct HandoffShared {
+  /** Protects controller_latch and workers */
+  slock_t               mutex;
+
+  /** Latch of the controller, NULL while it is not running */
+  Latch                *controller_latch;
+
+  /** Number of handoffs requested with _nextgres_idcp.handoff_workers() */
+  pg_atomic_uint32      requests;
+
+  /** Number of entries in workers (nextgres_idcp.thread_count) */
+  int                   n_workers;
+
+  /** By worker id */
+  HandoffWorker         workers[FLEXIBLE_ARRAY_MEMBER];
+} HandoffShared;
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+PG_FUNCTION_INFO_V1(ng_idcp_handoff_workers);
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static void handoff_clear_controller (int code, Datum arg);
+static bool handoff_read (pgsocket sock, char *buf, size_t len);
+static void handoff_socket_path (pid_t pid, struct sockaddr_un *addr);
+static void handoff_unlink (int code, Datum arg);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static HandoffShared *ng_idcp_handoff = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Accept a predecessor's connection on the handoff socket. Reads time out,
+ * so that a predecessor dying halfway doesn't hang its replacement.
+ */
+pgsocket
+ng_idcp_handoff_accept (
+  pgsocket listen_sock
+) {
+  struct timeval timeout;
+  pgsocket sock;
+
+  do {
+    sock = accept(listen_sock, NULL, NULL);
+  } while (sock == PGINVALID_SOCKET && errno == EINTR);
+  if (sock == PGINVALID_SOCKET)
+    return PGINVALID_SOCKET;
+
+  /* The listening socket may be non-blocking, the connection is not */
+  if (!pg_set_block(sock)) {
+    closesocket(sock);
+    return PGINVALID_SOCKET;
+  }
+  timeout.tv_sec = NG_IDCP_HANDOFF_TIMEOUT / 1000;
+  timeout.tv_usec = 0;
+  (void) setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  return sock;
+} /* ng_idcp_handoff_accept() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Connect to the handoff socket of the worker with the given pid. Returns
+ * PGINVALID_SOCKET if it is not listening (yet).
+ */
+pgsocket
+ng_idcp_handoff_connect (
+  pid_t pid
+) {
+  struct sockaddr_un addr;
+  struct timeval timeout;
+  pgsocket sock;
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == PGINVALID_SOCKET) {
+    ereport(LOG,
+            (errcode_for_socket_access(),
+             errmsg("could not create handoff socket: %m")));
+    return PGINVALID_SOCKET;
+  }
+
+  handoff_socket_path(pid, &addr);
+  if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+    closesocket(sock);
+    return PGINVALID_SOCKET;
+  }
+
+  /* Don't hang on a replacement that stopped reading */
+  timeout.tv_sec = NG_IDCP_HANDOFF_TIMEOUT / 1000;
+  timeout.tv_usec = 0;
+  (void) setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  return sock;
+} /* ng_idcp_handoff_connect() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read a string written by ng_idcp_handoff_put_string().
+ */
+char *
+ng_idcp_handoff_get_string (
+  StringInfo buf
+) {
+  int len = (int) pq_getmsgint(buf, 4);
+
+  if (len < 0)
+    return NULL;
+  return pnstrdup(pq_getmsgbytes(buf, len), len);
+} /* ng_idcp_handoff_get_string() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Listen for a predecessor handing off to this process. The socket is
+ * removed when the process exits.
+ */
+pgsocket
+ng_idcp_handoff_listen (
+  void
+) {
+  static bool unlink_registered = false;
+  struct sockaddr_un addr;
+  pgsocket sock;
+
+  sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (sock == PGINVALID_SOCKET) {
+    ereport(LOG,
+            (errcode_for_socket_access(),
+             errmsg("could not create handoff socket: %m")));
+    return PGINVALID_SOCKET;
+  }
+
+  handoff_socket_path(MyProcPid, &addr);
+  (void) unlink(addr.sun_path);
+  if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+      listen(sock, 4) < 0) {
+    ereport(LOG,
+            (errcode_for_socket_access(),
+             errmsg("could not listen on handoff socket \"%s\": %m",
+                    addr.sun_path)));
+    closesocket(sock);
+    return PGINVALID_SOCKET;
+  }
+
+  if (!unlink_registered) {
+    on_proc_exit(handoff_unlink, (Datum) 0);
+    unlink_registered = true;
+  }
+  return sock;
+} /* ng_idcp_handoff_listen() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Append a string, which may be NULL, to a message payload.
+ */
+void
+ng_idcp_handoff_put_string (
+  StringInfo    buf,
+  const char   *str
+) {
+  if (str == NULL) {
+    pq_sendint32(buf, (uint32) -1);
+    return;
+  }
+  pq_sendint32(buf, (uint32) strlen(str));
+  appendBinaryStringInfo(buf, str, strlen(str));
+} /* ng_idcp_handoff_put_string() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Receive a message into payload (with its cursor reset), and the file
+ * descriptor passed with it, if any, into *fd. Returns the kind of the
+ * message, or -1 when the connection is closed or broken.
+ */
+int
+ng_idcp_handoff_recv (
+  pgsocket      sock,
+  StringInfo    payload,
+  pgsocket     *fd
+) {
+  union {
+    struct cmsghdr  hdr;
+    char            buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  HandoffHeader header;
+  struct cmsghdr *cmsg;
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t rc;
+
+  *fd = PGINVALID_SOCKET;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &header;
+  iov.iov_len = sizeof(header);
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  /* Descriptors must not leak into backends the postmaster forks */
+  do {
+#ifdef MSG_CMSG_CLOEXEC
+    rc = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+#else
+    rc = recvmsg(sock, &msg, 0);
+#endif
+  } while (rc < 0 && errno == EINTR);
+  if (rc <= 0)
+    return -1;
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+       cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  if ((size_t) rc < sizeof(header) &&
+      !handoff_read(sock, (char *) &header + rc, sizeof(header) - rc))
+    goto broken;
+
+  resetStringInfo(payload);
+  enlargeStringInfo(payload, header.length);
+  if (!handoff_read(sock, payload->data, header.length))
+    goto broken;
+  payload->len = header.length;
+  payload->data[payload->len] = '\0';
+
+  return (int) header.kind;
+
+broken:
+  if (*fd != PGINVALID_SOCKET) {
+    closesocket(*fd);
+    *fd = PGINVALID_SOCKET;
+  }
+  return -1;
+} /* ng_idcp_handoff_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Number of handoffs requested so far. The controller performs one whenever
+ * this moved since it last looked.
+ */
+uint32
+ng_idcp_handoff_requests (
+  void
+) {
+  return pg_atomic_read_u32(&ng_idcp_handoff->requests);
+} /* ng_idcp_handoff_requests() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Send a message, passing fd along with it unless it is PGINVALID_SOCKET.
+ * The caller still owns (and eventually closes) its copy of fd.
+ */
+bool
+ng_idcp_handoff_send (
+  pgsocket      sock,
+  int           kind,
+  StringInfo    payload,
+  pgsocket      fd
+) {
+  union {
+    struct cmsghdr  hdr;
+    char            buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  HandoffHeader header;
+  StringInfoData data;
+  struct msghdr msg;
+  struct iovec iov;
+  ssize_t rc;
+  int sent;
+
+  header.kind = kind;
+  header.length = payload != NULL ? payload->len : 0;
+  initStringInfo(&data);
+  appendBinaryStringInfo(&data, (char *) &header, sizeof(header));
+  if (payload != NULL)
+    appendBinaryStringInfo(&data, payload->data, payload->len);
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = data.data;
+  iov.iov_len = data.len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (fd != PGINVALID_SOCKET) {
+    struct cmsghdr *cmsg;
+
+    memset(&control, 0, sizeof(control));
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+  }
+
+  do {
+    rc = sendmsg(sock, &msg, 0);
+  } while (rc < 0 && errno == EINTR);
+
+  /* The descriptor went with the first byte: send the rest plainly */
+  for (sent = rc; rc > 0 && sent < data.len; sent += rc) {
+    do {
+      rc = send(sock, data.data + sent, data.len - sent, 0);
+    } while (rc < 0 && errno == EINTR);
+  }
+  pfree(data.data);
+
+  if (rc <= 0) {
+    ereport(LOG,
+            (errcode_for_socket_access(),
+             errmsg("could not send handoff message: %m")));
+    return false;
+  }
+  return true;
+} /* ng_idcp_handoff_send() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Register the calling process as the controller performing handoffs.
+ */
+void
+ng_idcp_handoff_set_controller (
+  void
+) {
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  ng_idcp_handoff->controller_latch = MyLatch;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+
+  before_shmem_exit(handoff_clear_controller, (Datum) 0);
+} /* ng_idcp_handoff_set_controller() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Publish the pid of the process replacing a worker.
+ */
+void
+ng_idcp_handoff_set_target (
+  int       worker_id,
+  pid_t     pid
+) {
+  Assert(worker_id >= 0 && worker_id < ng_idcp_handoff->n_workers);
+
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  ng_idcp_handoff->workers[worker_id].target_pid = pid;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+} /* ng_idcp_handoff_set_target() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Publish the pid of the worker now serving a worker id.
+ */
+void
+ng_idcp_handoff_set_worker (
+  int       worker_id,
+  pid_t     pid
+) {
+  Assert(worker_id >= 0 && worker_id < ng_idcp_handoff->n_workers);
+
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  ng_idcp_handoff->workers[worker_id].pid = pid;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+} /* ng_idcp_handoff_set_worker() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Create or attach to the handoff state.
+ */
+void
+ng_idcp_handoff_shmem_init (
+  void
+) {
+  bool found;
+
+  ng_idcp_handoff = ShmemInitStruct(NEXTGRES_EXTNAME " handoff",
+                                    ng_idcp_handoff_shmem_size(), &found);
+  if (!found) {
+    memset(ng_idcp_handoff, 0, ng_idcp_handoff_shmem_size());
+    SpinLockInit(&ng_idcp_handoff->mutex);
+    pg_atomic_init_u32(&ng_idcp_handoff->requests, 0);
+    ng_idcp_handoff->n_workers = Max(g_ng_idcp_cfg_thread_count, 1);
+  }
+} /* ng_idcp_handoff_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the handoff state.
+ */
+Size
+ng_idcp_handoff_shmem_size (
+  void
+) {
+  return MAXALIGN(add_size(offsetof(HandoffShared, workers),
+                           mul_size(sizeof(HandoffWorker),
+                                    Max(g_ng_idcp_cfg_thread_count, 1))));
+} /* ng_idcp_handoff_shmem_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Pid of the process replacing a worker, 0 if there is none.
+ */
+pid_t
+ng_idcp_handoff_target (
+  int worker_id
+) {
+  pid_t pid;
+
+  if (worker_id < 0 || worker_id >= ng_idcp_handoff->n_workers)
+    return 0;
+
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  pid = ng_idcp_handoff->workers[worker_id].target_pid;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+  return pid;
+} /* ng_idcp_handoff_target() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Pid of the worker last started for a worker id, 0 if there is none. The
+ * process may have exited since.
+ */
+pid_t
+ng_idcp_handoff_worker (
+  int worker_id
+) {
+  pid_t pid;
+
+  if (worker_id < 0 || worker_id >= ng_idcp_handoff->n_workers)
+    return 0;
+
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  pid = ng_idcp_handoff->workers[worker_id].pid;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+  return pid;
+} /* ng_idcp_handoff_worker() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * SQL function _nextgres_idcp.handoff_workers(): ask the controller to
+ * replace the proxy workers, handing their clients over. Returns false if
+ * the controller is not running.
+ */
+Datum
+ng_idcp_handoff_workers (
+  PG_FUNCTION_ARGS
+) {
+  Latch *latch;
+
+  if (ng_idcp_handoff == NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("the connection pool is not running"),
+             errhint("Add " NEXTGRES_EXTNAME " to shared_preload_libraries "
+                     "and set nextgres_idcp.thread_count > 0.")));
+
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  latch = ng_idcp_handoff->controller_latch;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+  if (latch == NULL)
+    PG_RETURN_BOOL(false);
+
+  pg_atomic_fetch_add_u32(&ng_idcp_handoff->requests, 1);
+  SetLatch(latch);
+  PG_RETURN_BOOL(true);
+} /* ng_idcp_handoff_workers() */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+static void
+handoff_clear_controller (
+  int       code,
+  Datum     arg
+) {
+  SpinLockAcquire(&ng_idcp_handoff->mutex);
+  ng_idcp_handoff->controller_latch = NULL;
+  SpinLockRelease(&ng_idcp_handoff->mutex);
+} /* handoff_clear_controller() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read exactly len bytes from a blocking socket.
+ */
+static bool
+handoff_read (
+  pgsocket      sock,
+  char         *buf,
+  size_t        len
+) {
+  while (len > 0) {
+    ssize_t rc = recv(sock, buf, len, 0);
+
+    if (rc < 0 && errno == EINTR)
+      continue;
+    if (rc <= 0)
+      return false;
+    buf += rc;
+    len -= rc;
+  }
+  return true;
+} /* handoff_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+handoff_socket_path (
+  pid_t                 pid,
+  struct sockaddr_un   *addr
+) {
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path, sizeof(addr->sun_path), HANDOFF_SOCKET_FORMAT,
+           (int) pid);
+} /* handoff_socket_path() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+handoff_unlink (
+  int       code,
+  Datum     arg
+) {
+  struct sockaddr_un addr;
+
+  handoff_socket_path(MyProcPid, &addr);
+  (void) unlink(addr.sun_path);
+} /* handoff_unlink() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
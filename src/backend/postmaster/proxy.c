@@ -62,11 +62,15 @@
 #include "access/htup_details.h"
 #include "access/xlog.h"
 #include "commands/defrem.h"
+#include "common/hashfn.h"
 #include "common/ip.h"
+#include "common/pg_prng.h"
 #include "common/string.h"
 #include "funcapi.h"
 #include "internal/libpq-int.h"
+#include "lib/ilist.h"
 #include "libpq-fe.h"
+#include "libpq/auth.h"
 #include "libpq/libpq-be.h"
 #include "libpq/libpq.h"
 #include "libpq/pqformat.h"
@@ -74,6 +78,7 @@
 #include "miscadmin.h"
 #include "parser/parse_expr.h"
 #include "pgstat.h"
+#include "postmaster/bgworker.h"
 #include "postmaster/fork_process.h"
 #include "postmaster/interrupt.h"
 #include "postmaster/postmaster.h"
@@ -82,6 +87,8 @@
 #include "storage/latch.h"
 #include "storage/proc.h"
 #include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
 #include "tcop/pquery.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
@@ -97,38 +104,132 @@
 /* --------------------------- System Inclusions --------------------------- */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <grp.h>
+#include <netinet/tcp.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#ifdef NG_IDCP_USE_IO_URING
+#include <liburing.h>
+#include <poll.h>
+#endif
+
 /* --------------------------- Project Inclusions -------------------------- */
 
 #include "nextgres/idcp.h"
+#include "nextgres/idcp/libpq/framing.h"
 #include "nextgres/idcp/libpq/libpq.h"
+#include "nextgres/idcp/postmaster/handoff.h"
 #include "nextgres/idcp/postmaster/postmaster.h"
 #include "nextgres/idcp/postmaster/proxy.h"
+#include "nextgres/idcp/storage/ipc.h"
+#include "nextgres/idcp/util/poolconfig.h"
 
 /* ========================================================================= */
 /* -- LOCAL DEFINITIONS ---------------------------------------------------- */
 /* ========================================================================= */
 
+#define ACCEPT_BUDGET           64   /* connections accepted per wakeup */
 #define DB_HASH_SIZE            101
 #define INIT_BUF_SIZE           (64 * 1024)
 #define MAXLISTEN               64
 #define MAX_READY_EVENTS        128
 #define PROXY_WAIT_TIMEOUT      1000 /* 1 second */
-#define WL_SOCKET_EDGE          (1 << 7)
+#define THROTTLE_RETRY_INTERVAL 10   /* milliseconds */
+#define HANDOFF_RETRY_INTERVAL  100  /* milliseconds */
+
+/*
+ * On Linux channels are registered once with EPOLLET and their interest set is
+ * never modified. Elsewhere the WaitEventSet is level-triggered and readable/
+ * writable interest is toggled on backpressure transitions.
+ */
+#ifdef __linux__
+#define PROXY_USE_EPOLL_ET
+#endif
+
+/* Socket events of a channel with nothing pending in either direction */
+#define CHANNEL_EVENTS          (WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE)
 
 /* Channel state */
 #define ACTIVE_CHANNEL_MAGIC    0xDEFA1234U
 #define REMOVED_CHANNEL_MAGIC   0xDEADDEEDU
 
+/* Channels are allocated from a slab growing by this many slots */
+#define CHANNEL_SLAB_CHUNK      256
+
+/* Encryption negotiation state of a new client */
+#define NEGOTIATION_NONE        0 /* reading startup packet or established */
+#define NEGOTIATION_REPLY       1 /* SSLRequest/GSSENCRequest answer pending */
+#define NEGOTIATION_TLS         2 /* TLS handshake in progress */
+
+#ifdef NG_IDCP_USE_IO_URING
+/* io_uring event loop */
+#define URING_QUEUE_DEPTH       4096
+#define URING_BUF_GROUP         0
+#define URING_BUF_COUNT         512               /* must be a power of two */
+#define URING_BUF_SIZE          (16 * 1024)
+#define URING_MAX_BACKLOG       (1024 * 1024)
+#define URING_ACCEPT_RETRY_MS   100
+
+/* Operation tags kept in the low bits of io_uring user data */
+#define URING_OP_RECV           0
+#define URING_OP_POLLIN         1
+#define URING_OP_POLLOUT        2
+#define URING_OP_ACCEPT         3
+#define URING_OP_CANCEL         4
+#define URING_OP_WAKEUP         5
+#define URING_OP_MASK           7
+#endif
+
 /* ========================================================================= */
 /* -- LOCAL MACROS --------------------------------------------------------- */
 /* ========================================================================= */
 
 #define NULLSTR(s) ((s) ? (s) : "?")
 
+#define CHANNEL_SOCKET(chan) \
+  ((chan)->client_port ? (chan)->client_port->sock : (chan)->backend_socket)
+
+#define CHANNEL_OPS(chan)       (&channel_ops[(chan)->kind])
+
+#ifdef PROXY_USE_EPOLL_ET
+/*
+ * epoll user data identifies a channel by its slab slot and generation, so
+ * that events still queued for a removed channel are dropped without
+ * dereferencing it, even once its slot was reused. Channel generations are
+ * never 0, which tags listening sockets (by index) and the handoff socket.
+ */
+#define EVENT_DATA(gen, slot)   (((uint64) (gen) << 32) | (uint64) (slot))
+#define EVENT_DATA_GEN(data)    ((uint32) ((data) >> 32))
+#define EVENT_DATA_SLOT(data)   ((uint32) (data))
+#define EVENT_HANDOFF_SLOT      MAXLISTEN
+#define EVENT_WAKEUP_SLOT       (MAXLISTEN + 1)
+#endif
+
+/* BackendKeyData message: type, length, pid and secret key */
+#define HANDSHAKE_KEY_DATA_SIZE 13
+
+/*
+ * In session mode a backend stays with its client until it disconnects.
+ * Statement mode is handled like transaction mode.
+ */
+#define POOL_IS_SESSION(pool) \
+  ((pool)->settings.pool_mode == NG_IDCP_POOL_MODE_SESSION)
+
+#ifdef NG_IDCP_USE_IO_URING
+#define URING_DATA(ptr, op)     ((uint64) (uintptr_t) (ptr) | (uint64) (op))
+#define URING_DATA_OP(data)     ((int) ((data) & URING_OP_MASK))
+#define URING_DATA_PTR(data)    ((void *) (uintptr_t) ((data) & ~(uint64) URING_OP_MASK))
+#define URING_ACCEPT_DATA(idx)  (((uint64) (idx) << 3) | URING_OP_ACCEPT)
+#define URING_ACCEPT_INDEX(data) ((int) ((data) >> 3))
+#endif
+
 /*
  * #define ELOG(severity, fmt,...) elog(severity, "PROXY: " fmt, ##
  * __VA_ARGS__)
@@ -140,25 +241,89 @@
 /* ========================================================================= */
 
 struct Channel;
+struct InternedName;
 struct PoolerStateContext;
 struct Proxy;
 struct SessionPool;
 struct SessionPoolKey;
+struct StartupOption;
 
 /* ========================================================================= */
 /* -- LOCAL STRUCTURES ----------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * Pools are keyed by database, role and the startup parameters their backends
+ * were started with. Names are interned (see proxy_intern()) so that the key
+ * is compared and hashed as a small blob.
+ */
 typedef struct SessionPoolKey {
-  char                  database[NAMEDATALEN];
-  char                  username[NAMEDATALEN];
+  const char           *database;
+  const char           *username;
+
+  /** Hash of the normalized startup parameters, 0 with proxying_gucs */
+  uint64                options_hash;
 } SessionPoolKey;
 
+/* Database or role name shared by the pool keys, see proxy_intern() */
+typedef struct InternedName {
+  char                  name[NAMEDATALEN];
+
+  /** Number of pools whose key refers to the name */
+  int                   refcount;
+} InternedName;
+
+/* Startup parameter of a client, see startup_options_normalize() */
+typedef struct StartupOption {
+  char                 *name;
+  char                 *value;
+} StartupOption;
+
+/*
+ * Kind of a channel, which selects its I/O operations (see channel_ops).
+ * Backends are 0 so that a zeroed channel is one; clients change kind as
+ * their connection is set up.
+ */
+typedef enum ChannelKind {
+  CHANNEL_BACKEND,
+  CHANNEL_CLIENT,
+#ifdef USE_SSL
+  CHANNEL_CLIENT_TLS,
+  CHANNEL_CLIENT_KTLS,
+#endif
+#ifdef NG_IDCP_USE_IO_URING
+  CHANNEL_BACKEND_URING,
+  CHANNEL_CLIENT_URING,
+#endif
+  CHANNEL_KIND_COUNT
+} ChannelKind;
+
+/*
+ * I/O operations of a channel kind. Relaying dispatches through them once
+ * instead of testing for clients, TLS and io_uring on every call.
+ */
+typedef struct ChannelOps {
+  /** Read messages and pass them on to the peer, see channel_read() */
+  bool                (*read) (struct Channel *chan);
+
+  /** Receive into buf, returning the count, 0 on EOF or -1 with errno */
+  ssize_t             (*recv) (struct Channel *chan, char *buf, size_t size);
+
+  /** Send from buf, returning the count or -1 with errno */
+  ssize_t             (*send) (struct Channel *chan, const char *buf,
+                               size_t size);
+} ChannelOps;
+
 /*
  * Channels represent both clients and backends
  */
 typedef struct Channel {
   int                   magic;
+
+  /** Slot in the proxy's channel slab, reused with the next generation */
+  uint32                slot;
+  uint32                generation;
+
   char                 *buf;
   int                   rx_pos;
   int                   tx_pos;
@@ -171,6 +336,12 @@ typedef struct Channel {
   /** Not null for client, null for server */
   Port                 *client_port;
 
+  /**
+   * Everything allocated for a client (Port, startup parameters, GUCs) is
+   * released with this context, a child of the pool's once it is known
+   */
+  MemoryContext         memctx;
+
   pgsocket              backend_socket;
   PGPROC               *backend_proc;
   int                   backend_pid;
@@ -178,6 +349,9 @@ typedef struct Channel {
   /** ready for query */
   bool                  backend_is_ready;
 
+  /** server_reset_query was sent and is not answered yet */
+  bool                  is_resetting;
+
   /** client interrupts query execution */
   bool                  is_interrupted;
 
@@ -190,8 +364,74 @@ typedef struct Channel {
   /** inside transaction body */
   bool                  in_transaction;
 
-  /* emulate epoll EPOLLET (edge-triggered) flag */
-  bool                  edge_triggered;
+  /** Socket events armed in the (level-triggered) wait event set */
+  uint32                armed_events;
+
+  /** Coalesce writes to this (plain TCP client) socket with MSG_MORE */
+  bool                  coalesce;
+
+  /** Data was sent with MSG_MORE and is held back until flushed */
+  bool                  corked;
+
+  /** Last write hit EAGAIN: retry it once the socket is writable */
+  bool                  write_blocked;
+
+  /** Startup, negotiation or authentication is not finished yet */
+  bool                  is_setup;
+
+  /** ChannelKind, which selects channel_ops */
+  uint8                 kind;
+
+  /** Encryption negotiation state (NEGOTIATION_*) */
+  uint8                 negotiation;
+
+  /** Answer to SSLRequest/GSSENCRequest not yet sent to the client */
+  char                  negotiation_reply;
+
+  /** SSLRequest/GSSENCRequest may no longer be sent */
+  bool                  ssl_done;
+  bool                  gss_done;
+
+  /** Password exchange in progress, NULL once the client is admitted */
+  NgIdcpClientAuth     *auth;
+
+  /** Outcome of the last authentication step (NG_IDCP_AUTH_*) */
+  int                   auth_status;
+
+  /** Authentication and handshake messages not yet sent (from cursor) */
+  StringInfo            auth_out;
+
+  /** Handshake response was sent from the pool's template */
+  bool                  is_admitted;
+
+#ifdef NG_IDCP_USE_IO_URING
+  /** Data is delivered by multishot recv completions, never read directly */
+  bool                  uring_recv;
+
+  /** Multishot recv is armed */
+  bool                  uring_recv_armed;
+
+  /** Multishot recv was cancelled because too much data is backlogged */
+  bool                  uring_recv_paused;
+
+  /** Multishot readiness poll is armed (TLS and not yet connected clients) */
+  bool                  uring_pollin_armed;
+
+  /** One-shot POLLOUT is armed waiting for socket buffer space */
+  bool                  uring_pollout_armed;
+
+  /** Peer closed the connection (or recv failed) after the backlog */
+  bool                  uring_eof;
+
+  /** Error reported by the terminating recv completion, if any */
+  int                   uring_errno;
+
+  /** Number of io_uring requests referencing this channel */
+  int                   uring_ops;
+
+  /** Received data not yet consumed by channel_read() */
+  StringInfoData        uring_backlog;
+#endif
 
   /*
    * We need to save startup packet response to be able to send it to new
@@ -200,6 +440,13 @@ typedef struct Channel {
   int                   handshake_response_size;
   char                 *handshake_response;
 
+  /**
+   * BackendKeyData issued to the client, see client_issue_key(). Clients are
+   * not tied to one backend, so they never see a backend's own key.
+   */
+  int32                 key_pid;
+  int32                 key_secret;
+
   /** time of last backend activity */
   TimestampTz           backend_last_activity;
 
@@ -209,8 +456,16 @@ typedef struct Channel {
   /** previous value of "gucs" to perform rollback in case of error */
   char                 *prev_gucs;
 
+  /** Socket was passed to a replacement worker, see channel_handed_off() */
+  bool                  is_handed_off;
+
+  /** Membership in proxy->channels */
+  dlist_node            proxy_node;
+
   /** the linked backend channel (when this is a client) */
   struct Channel       *peer;
+
+  /** Pending clients, idle backends, hangout list or free slab slots */
   struct Channel       *next;
   struct Proxy         *proxy;
   struct SessionPool   *pool;
@@ -222,24 +477,42 @@ typedef struct Channel {
  * session pools for reach role/dbname combination.
  */
 typedef struct Proxy {
-  /** Temporary memory context used for parsing startup packet */
-  MemoryContext         parse_ctx;
-
   /** Set of socket descriptors of backends and clients socket descriptors */
   WaitEventSet         *wait_events;
 
-  /** Session pool map with dbname/role used as a key */
+  /** Channel slab: chunks of CHANNEL_SLAB_CHUNK slots, never released */
+  Channel             **channel_chunks;
+  int                   n_channel_chunks;
+
+  /** Free slab slots, linked through next */
+  Channel              *free_channels;
+
+#ifdef PROXY_USE_EPOLL_ET
+  /** Edge-triggered epoll instance replacing wait_events on Linux */
+  int                   epoll_fd;
+#endif
+
+  /** Session pool map with dbname/role/startup parameters used as a key */
   HTAB                 *pools;
 
+  /** Interned database and role names referenced by pool keys */
+  HTAB                 *names;
+
+  /** Lowercase names of nextgres_idcp.ignore_startup_parameters */
+  List                 *ignored_startup_parameters;
+
   /**
    * Number of accepted, but not yet established connections (startup packet is
    * not received and db/role are not known)
    */
   int                   n_accepted_connections;
 
-  /** Maximal number of backends per database */
+  /** Maximal number of backends per pool, unless configured per database */
   int                   max_backends;
 
+  /** Generation of the pool configuration applied to the pools */
+  uint64                config_generation;
+
   /** Shutdown flag */
   bool                  shutdown;
 
@@ -251,6 +524,69 @@ typedef struct Proxy {
 
   /** Time of last check for idle worker timeout expration */
   TimestampTz           last_idle_timeout_check;
+
+  /** Time the pool statistics were last logged, see proxy_log_stats() */
+  TimestampTz           last_stats_log;
+
+  /** Client channels with output held back by MSG_MORE */
+  List                 *corked;
+
+  /** Pools whose pending clients wait for a database or role backend slot */
+  List                 *throttled;
+
+  /**
+   * Listening sockets. Slots of sockets closed by a reload are left as
+   * PGINVALID_SOCKET, as the slot identifies the socket in the event loop.
+   */
+  pgsocket              listen_sockets[MAXLISTEN];
+  int                   n_listen_sockets;
+
+  /** Addresses and port the listening sockets were opened for */
+  char                 *listen_addresses;
+  int                   listen_port;
+
+  /** Unix listening socket and its path, see proxy_open_unix_socket() */
+  pgsocket              unix_socket;
+  char                 *unix_socket_path;
+
+  /** Descriptor given up to shed connections when out of descriptors */
+  int                   spare_fd;
+
+  /** All registered channels */
+  dlist_head            channels;
+
+  /** Handing off to a replacement worker, see proxy_handoff() */
+  bool                  handoff;
+
+  /** Listening sockets were handed off: exit once the sessions are gone */
+  bool                  handoff_listeners_sent;
+
+  /** Next handoff batch, and when to give up if nobody takes the first */
+  TimestampTz           handoff_retry_at;
+  TimestampTz           handoff_deadline;
+
+  /** Socket a predecessor hands its sessions to, see proxy_takeover() */
+  pgsocket              handoff_listen;
+
+#ifdef PROXY_USE_EPOLL_ET
+  /** Read end of the pipe signal handlers wake the loop with */
+  int                   wakeup_fd;
+#endif
+
+#ifdef NG_IDCP_USE_IO_URING
+  /** io_uring instance, NULL when the WaitEventSet loop is used */
+  struct io_uring      *uring;
+
+  /** Provided buffer ring shared by all multishot recv requests */
+  struct io_uring_buf_ring *uring_buf_ring;
+  char                 *uring_bufs;
+
+  /** Multishot accept is armed on the listening socket */
+  bool                  uring_accept_armed[MAXLISTEN];
+
+  /** Earliest time to re-arm a terminated multishot accept */
+  TimestampTz           uring_accept_retry_at;
+#endif
 } Proxy;
 
 /*
@@ -265,9 +601,22 @@ typedef struct SessionPool {
   /** List of clients waiting for free backend */
   Channel              *pending_clients;
 
+  /**
+   * Handshake response of the first backend of the pool (AuthenticationOk,
+   * ParameterStatus, ReadyForQuery), sent to new clients before they are
+   * bound to a backend. The backend's BackendKeyData is stripped: each
+   * client gets its own, inserted at handshake_key_offset.
+   */
+  char                 *handshake_template;
+  int                   handshake_template_size;
+  int                   handshake_key_offset;
+
   /** Owner of this pool */
   Proxy                *proxy;
 
+  /** Parent of the memory contexts of the pool's clients */
+  MemoryContext         memctx;
+
   /** Total number of launched backends */
   int                   n_launched_backends;
 
@@ -286,6 +635,12 @@ typedef struct SessionPool {
   /** Number of clients waiting for free backend */
   int                   n_pending_clients;
 
+  /** Pending clients wait for max_db/user_connections (in proxy->throttled) */
+  bool                  is_throttled;
+
+  /** Pool size, mode and limits, see pool_configure() */
+  NgIdcpPoolSettings    settings;
+
   /** List of startup options specified in startup packet */
   List                 *startup_gucs;
 
@@ -298,23 +653,63 @@ typedef struct PoolerStateContext {
   TupleDesc ret_desc;
 } PoolerStateContext;
 
+/*
+ * Counters of the proxy workers as of their last stats_period, read by
+ * _nextgres_idcp.proxy_stats().
+ */
+typedef struct ProxyStatsShared {
+  /** Protects workers */
+  slock_t               mutex;
+
+  /** Number of entries in workers (nextgres_idcp.thread_count) */
+  int                   n_workers;
+
+  /** By worker id */
+  ConnectionProxyState  workers[FLEXIBLE_ARRAY_MEMBER];
+} ProxyStatsShared;
+
 /* ========================================================================= */
 /* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
 /* ========================================================================= */
 
+PG_FUNCTION_INFO_V1(ng_idcp_proxy_stats);
+
 /* ========================================================================= */
 /* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
 /* ========================================================================= */
 
+static bool backend_read(Channel *chan);
+static ssize_t backend_recv(Channel *chan, char *buf, size_t size);
+static void backend_register(Channel *chan);
+static ssize_t backend_send(Channel *chan, const char *buf, size_t size);
 static Channel *backend_start(SessionPool *pool, char **error);
 static Channel *channel_create(Proxy *proxy);
 static List *string_list_copy(List *orig);
 static bool backend_reschedule(Channel *chan, bool is_new);
+static bool backend_reset(Channel *chan);
+static void channel_arm(Channel *chan, uint32 events);
+static void channel_flush(Channel *chan);
 static bool channel_read(Channel *chan);
+static ssize_t channel_recv(Channel *chan);
 static bool channel_register(Proxy *proxy, Channel *chan);
 static bool channel_write(Channel *chan, bool synchronous);
 static bool client_attach(Channel *chan);
+static bool client_admit(Channel *chan);
+static void client_auth_end(Channel *chan);
+static bool client_auth_flush(Channel *chan);
+static bool client_auth_start(Channel *chan);
 static bool client_connect(Channel *chan, int startup_packet_size);
+static void client_enter_pool(Channel *chan);
+static bool client_handshake(Channel *chan);
+static int client_negotiate(Channel *chan, int msg_len);
+static bool client_read(Channel *chan);
+static ssize_t client_recv(Channel *chan, char *buf, size_t size);
+static ssize_t client_send(Channel *chan, const char *buf, size_t size);
+#ifdef USE_SSL
+static ssize_t client_send_ktls(Channel *chan, const char *buf, size_t size);
+static ssize_t client_tls_recv(Channel *chan, char *buf, size_t size);
+static ssize_t client_tls_send(Channel *chan, const char *buf, size_t size);
+#endif
 static bool is_transaction_start(char *stmt);
 static bool is_transactional_statement(char *stmt);
 static bool string_equal(char const *a, char const *b);
@@ -322,17 +717,92 @@ static bool string_list_equal(List *a, List *b);
 static char *string_append(char *dst, char const *src);
 static size_t string_length(char const *str);
 static size_t string_list_length(List *list);
-static ssize_t socket_write(Channel *chan, char const *buf, size_t size);
+static int startup_option_compare(const void *a, const void *b);
+static uint64 startup_options_hash(List *gucs, const char *cmdline_options);
+static List *startup_options_normalize(Proxy *proxy, List *guc_options);
+static ssize_t socket_write(Channel *chan, char const *buf, size_t size,
+                            bool more);
+static bool channel_can_handoff(Channel *chan);
+static void channel_free(Channel *chan);
+static void channel_handed_off(Channel *chan);
 static void channel_hangout(Channel *chan, char const *op);
+static Channel *channel_lookup(Proxy *proxy, uint32 slot);
 static void channel_remove(Channel *chan);
-static void proxy_add_client(Proxy *proxy, Port *port);
+static void channel_slab_grow(Proxy *proxy);
+static void channel_wait_writable(Channel *chan);
+static Channel *proxy_add_client(Proxy *proxy, Port *port);
+static void proxy_config_refresh(Proxy *proxy, bool force);
+static void proxy_adopt_backend(Proxy *proxy, StringInfo msg, pgsocket sock);
+static void proxy_adopt_client(Proxy *proxy, StringInfo msg, pgsocket sock);
+static void proxy_handle_sighup(SIGNAL_ARGS);
 static void proxy_handle_sigterm(SIGNAL_ARGS);
+static void proxy_handle_sigusr2(SIGNAL_ARGS);
+static void proxy_handoff(Proxy *proxy);
+static bool proxy_handoff_channel(pgsocket conn, Channel *chan);
+static int proxy_handoff_receive(Proxy *proxy);
+static const char *proxy_intern(Proxy *proxy, const char *name);
+static void proxy_unintern(Proxy *proxy, const char *name);
 static void proxy_loop(Proxy *proxy);
+static void proxy_wakeup(void);
+#ifdef PROXY_USE_EPOLL_ET
+static void proxy_wakeup_drain(Proxy *proxy);
+#endif
 static void report_error_to_client(Channel *chan, char const *error);
 static void *libpq_connectdb(char const *keywords[], char const *values[],
                              char **error);
 static Proxy *proxy_create (ConnectionProxyState *state, int max_backends);
-static void proxy_add_listen_socket(Proxy *proxy, pgsocket socket);
+static void proxy_accept(Proxy *proxy, pgsocket listen_socket);
+static bool proxy_add_listen_socket(Proxy *proxy, pgsocket socket,
+                                    int elevel);
+static void proxy_flush(Proxy *proxy);
+static bool proxy_listen(Proxy *proxy, int elevel);
+static const char *proxy_listen_addresses(void);
+static void proxy_log_stats(Proxy *proxy);
+static int proxy_open_listen_sockets(const char *addresses, int port,
+                                     pgsocket sockets[], int elevel);
+static pgsocket proxy_open_unix_socket(int port);
+static void proxy_set_unix_socket(Proxy *proxy, pgsocket sock,
+                                  const char *path);
+static bool proxy_unix_socket_path(int port, char *path);
+static void proxy_reload(Proxy *proxy);
+static void proxy_release_backends(int code, Datum arg);
+static void proxy_remove_listen_socket(Proxy *proxy, int idx, bool drain);
+static void proxy_retry_throttled(Proxy *proxy);
+static bool proxy_shed_connection(Proxy *proxy, pgsocket listen_socket);
+static bool proxy_takeover(Proxy *proxy);
+static void proxy_wait_events(Proxy *proxy);
+static void pool_configure(SessionPool *pool);
+static SessionPool *pool_enter(Proxy *proxy, SessionPoolKey *key,
+                               List *startup_gucs,
+                               const char *cmdline_options);
+static void pool_evict_idle_backend(SessionPool *pool, int kind);
+static SessionPool *pool_handoff_get(Proxy *proxy, StringInfo msg);
+static void pool_handoff_put(StringInfo msg, SessionPool *pool);
+static void pool_admit_pending(SessionPool *pool);
+static void pool_release_backend(SessionPool *pool);
+static void pool_remove_if_unused(SessionPool *pool);
+static bool pool_reserve_backend(SessionPool *pool);
+static void pool_save_handshake(SessionPool *pool, Channel *backend);
+static void client_issue_key(Channel *chan);
+static void handshake_set_key(Channel *client, char *msgs, int size);
+#ifdef NG_IDCP_USE_IO_URING
+static bool proxy_uring_init(Proxy *proxy);
+static struct io_uring_sqe *proxy_uring_get_sqe(Proxy *proxy);
+static void proxy_uring_accept_complete(Proxy *proxy, int idx, int res,
+                                        uint32 flags);
+static void proxy_uring_arm_accept(Proxy *proxy, int idx);
+static void proxy_uring_arm_wakeup(Proxy *proxy);
+static void proxy_uring_wait(Proxy *proxy);
+static void channel_uring_arm_pollin(Channel *chan);
+static void channel_uring_arm_pollout(Channel *chan);
+static void channel_uring_arm_recv(Channel *chan);
+static void channel_uring_cancel(Channel *chan, int op);
+static void channel_uring_poll_complete(Channel *chan, int op, int res,
+                                        uint32 flags);
+static ssize_t channel_uring_recv(Channel *chan, char *buf, size_t size);
+static void channel_uring_recv_complete(Channel *chan, int res, uint32 flags);
+static void channel_uring_start_recv(Channel *chan);
+#endif
 
 /* ========================================================================= */
 /* -- PUBLIC VARIABLES ----------------------------------------------------- */
@@ -352,10 +822,39 @@ int MyProxyId;
 pgsocket MyProxySocket;
 ConnectionProxyState *ProxyState = NULL;
 
+/* Set by SIGUSR2: the controller started a replacement for this worker */
+static volatile sig_atomic_t handoff_pending = false;
+
+/* Write end of the wakeup pipe, see proxy_wakeup() */
+static int proxy_wakeup_fd = -1;
+
+static ProxyStatsShared *ng_idcp_proxy_shared = NULL;
+
+static const ChannelOps channel_ops[CHANNEL_KIND_COUNT] = {
+  [CHANNEL_BACKEND] = {backend_read, backend_recv, backend_send},
+  [CHANNEL_CLIENT] = {client_read, client_recv, client_send},
+#ifdef USE_SSL
+  /* kTLS receive is left to OpenSSL, which handles non-data records */
+  [CHANNEL_CLIENT_TLS] = {client_read, client_tls_recv, client_tls_send},
+  [CHANNEL_CLIENT_KTLS] = {client_read, client_tls_recv, client_send_ktls},
+#endif
+#ifdef NG_IDCP_USE_IO_URING
+  [CHANNEL_BACKEND_URING] = {backend_read, channel_uring_recv, backend_send},
+  [CHANNEL_CLIENT_URING] = {client_read, channel_uring_recv, client_send},
+#endif
+};
+
 /* ========================================================================= */
 /* -- STATIC ASSERTIONS ---------------------------------------------------- */
 /* ========================================================================= */
 
+#ifdef NG_IDCP_USE_IO_URING
+StaticAssertDecl((URING_BUF_COUNT & (URING_BUF_COUNT - 1)) == 0,
+                 "io_uring buffer ring size must be a power of two");
+StaticAssertDecl(MAXIMUM_ALIGNOF > URING_OP_MASK,
+                 "io_uring operation tag must fit in palloc alignment");
+#endif
+
 /* ========================================================================= */
 /* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
 /* ========================================================================= */
@@ -364,117 +863,322 @@ PGDLLEXPORT void
 ng_idcp_proxy_main (
   Datum db_oid
 ) {
-  static int ListenSocket[MAXLISTEN];
-  int i;
-  int nsockets = 0;
-  Proxy *proxy = NULL;
+  NgIdcpProxyArgs args;
+
+  memcpy(&args, MyBgworkerEntry->bgw_extra, sizeof(args));
+  MyProxyId = args.worker_id;
 
   pqsignal(SIGTERM, proxy_handle_sigterm);
+  pqsignal(SIGHUP, proxy_handle_sighup);
+  pqsignal(SIGUSR2, proxy_handle_sigusr2);
+  BackgroundWorkerUnblockSignals();
 
   ProxyState = calloc(32, sizeof(*ProxyState));
 
-  for (i = 0; i < MAXLISTEN; i++) {
-    ListenSocket[i] = PGINVALID_SOCKET;
-  }
+  /* Client authentication looks up password verifiers in the catalogs */
+  BackgroundWorkerInitializeConnection(
+    (gp_ng_idcp_cfg_auth_dbname && gp_ng_idcp_cfg_auth_dbname[0] != '\0')
+      ? gp_ng_idcp_cfg_auth_dbname : NULL, NULL, 0);
+
+#ifdef USE_SSL
+  /* TLS handshakes are driven by the proxy loop using its own context */
+  if ((LoadedSSL || g_ng_idcp_client_tls_ktls) && !ng_idcp_tls_init())
+    elog(LOG, "proxy TLS context is not available: TLS is not offered to "
+              "clients");
+#endif
+
+  proxy = proxy_create(&ProxyState[0], g_ng_idcp_cfg_session_pool_size);
+  before_shmem_exit(proxy_release_backends, PointerGetDatum(proxy));
 
   /*
-   * Establish input sockets.
+   * Establish input sockets, unless the worker being replaced hands its own
+   * over.
    */
-  if (ListenAddresses) {
-    char *rawstring;
-    List *elemlist;
-    ListCell *l;
-    int success = 0;
-    int status;
+  if (!args.takeover || !proxy_takeover(proxy))
+    proxy_listen(proxy, FATAL);
+  proxy_loop(proxy);
+
+  proc_exit(0);
+
+} /* ng_idcp_proxy_main() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Create or attach to the published worker counters.
+ */
+void
+ng_idcp_proxy_shmem_init (
+  void
+) {
+  bool found;
+
+  ng_idcp_proxy_shared = ShmemInitStruct(NEXTGRES_EXTNAME " proxy stats",
+                                         ng_idcp_proxy_shmem_size(), &found);
+  if (!found) {
+    memset(ng_idcp_proxy_shared, 0, ng_idcp_proxy_shmem_size());
+    SpinLockInit(&ng_idcp_proxy_shared->mutex);
+    ng_idcp_proxy_shared->n_workers = Max(g_ng_idcp_cfg_thread_count, 1);
+  }
+} /* ng_idcp_proxy_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the published worker counters.
+ */
+Size
+ng_idcp_proxy_shmem_size (
+  void
+) {
+  return MAXALIGN(add_size(offsetof(ProxyStatsShared, workers),
+                           mul_size(sizeof(ConnectionProxyState),
+                                    Max(g_ng_idcp_cfg_thread_count, 1))));
+} /* ng_idcp_proxy_shmem_size() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
 
-    /* Need a modifiable copy of ListenAddresses */
-    rawstring = pstrdup(ListenAddresses);
+/*
+ * SQL function _nextgres_idcp.proxy_stats(): counters of each proxy worker
+ * as of its last stats_period. Workers publish nothing while stats_period
+ * is 0.
+ */
+Datum
+ng_idcp_proxy_stats (
+  PG_FUNCTION_ARGS
+) {
+  ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+  int ii;
+
+  if (ng_idcp_proxy_shared == NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("the connection pool is not running"),
+             errhint("Add " NEXTGRES_EXTNAME " to shared_preload_libraries "
+                     "and set nextgres_idcp.thread_count > 0.")));
+
+  InitMaterializedSRF(fcinfo, 0);
+  for (ii = 0; ii < ng_idcp_proxy_shared->n_workers; ii++) {
+    ConnectionProxyState state;
+    Datum values[13];
+    bool nulls[13] = {0};
+
+    SpinLockAcquire(&ng_idcp_proxy_shared->mutex);
+    state = ng_idcp_proxy_shared->workers[ii];
+    SpinLockRelease(&ng_idcp_proxy_shared->mutex);
+    if (state.pid == 0)
+      continue;
+
+    values[0] = Int32GetDatum(ii);
+    values[1] = Int32GetDatum(state.pid);
+    values[2] = Int32GetDatum(state.n_clients);
+    values[3] = Int32GetDatum(state.n_ssl_clients);
+    values[4] = Int32GetDatum(state.n_pools);
+    values[5] = Int32GetDatum(state.n_backends);
+    values[6] = Int32GetDatum(state.n_dedicated_backends);
+    values[7] = Int32GetDatum(state.n_idle_backends);
+    values[8] = Int32GetDatum(state.n_idle_clients);
+    values[9] = Int64GetDatum((int64) state.tx_bytes);
+    values[10] = Int64GetDatum((int64) state.rx_bytes);
+    values[11] = Int64GetDatum((int64) state.n_transactions);
+    values[12] = Int64GetDatum((int64) state.client_memory);
+    tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc, values, nulls);
+  }
+  return (Datum) 0;
+} /* ng_idcp_proxy_stats() */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Read from a backend and pass its complete messages on to its client, the
+ * read operation of backend channels. Only ReadyForQuery and ErrorResponse
+ * are looked at, so replies stream through with one length check per
+ * message.
+ */
+static bool
+backend_read (
+  Channel *chan
+) {
+  int msg_start;
+
+  while (chan->tx_size == 0) /* there is no pending write op */
+  {
+    ssize_t rc = channel_recv(chan);
 
-    /* Parse string into list of hostnames */
-    if (!SplitGUCList(rawstring, ',', &elemlist)) {
-      /* syntax error in list */
-      ereport(FATAL, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
-                      errmsg("invalid list syntax in parameter \"%s\"",
-                             "listen_addresses")));
+    ELOG(LOG, "%p: read %d: %m", chan, (int)rc);
+    if (rc <= 0) {
+      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        channel_hangout(chan, "read");
+      return false; /* wait for more data */
     }
+    /* resume reading if it was disabled by a pending write */
+    channel_arm(chan, chan->armed_events | WL_SOCKET_READABLE);
 
-    foreach (l, elemlist) {
-      char *curhost = (char *)lfirst(l);
+    ELOG(LOG,
+         "Receive reply %c %d bytes from backend %d (%p:ready=%d) to client "
+         "%d",
+         chan->buf[0] ? chan->buf[0] : '?', (int)rc + chan->rx_pos,
+         chan->backend_pid, chan, chan->backend_is_ready,
+         chan->peer ? chan->peer->client_port->sock : -1);
 
-      if (strcmp(curhost, "*") == 0) {
-        status = ng_idcp_stream_server_port(
-          AF_UNSPEC, NULL, (unsigned short)g_ng_idcp_cfg_listen_port,
-          NULL, ListenSocket, MAXLISTEN);
-      } else {
-        status = ng_idcp_stream_server_port(
-          AF_UNSPEC, curhost,
-          (unsigned short)g_ng_idcp_cfg_listen_port, NULL,
-          ListenSocket, MAXLISTEN);
+    chan->rx_pos += rc;
+    msg_start = 0;
+
+    /* Loop through all received messages */
+    while (chan->rx_pos - msg_start >= NG_IDCP_MSG_HEADER_SIZE) {
+      int msg_len = ng_idcp_msg_length(chan->buf + msg_start, false);
+
+      if (msg_start + msg_len > chan->buf_size) {
+        /* Reallocate buffer to fit complete message body */
+        chan->buf_size = msg_start + msg_len;
+        chan->buf = repalloc(chan->buf, chan->buf_size);
       }
+      if (chan->rx_pos - msg_start < msg_len)
+        break; /* Incomplete message. */
 
-      if (status == STATUS_OK) {
-        success++;
-      } else {
-        ereport(FATAL, (errmsg("could not create listen socket for \"%s\"",
-                               ListenAddresses)));
+      if (ng_idcp_msg_is_ready_idle(chan->buf + msg_start)) {
+        /* Ready for query && transaction block status is idle */
+
+        /* Should be last message */
+        Assert(chan->rx_pos - msg_start == msg_len);
+
+        chan->backend_is_ready = true; /* Backend is ready for query */
+        if (!chan->is_resetting)
+          chan->proxy->state->n_transactions += 1;
+        if (chan->peer) {
+          chan->peer->in_transaction = false;
+        }
+      } else if (chan->buf[msg_start] == 'E') {
+        /* Error */
+        if (chan->is_resetting) {
+          /* Don't hand out a backend whose session state may remain */
+          channel_hangout(chan, "reset");
+          return false;
+        }
+        if (chan->peer && chan->peer->prev_gucs) {
+          /* Undo GUC assignment */
+          pfree(chan->peer->gucs);
+          chan->peer->gucs = chan->peer->prev_gucs;
+          chan->peer->prev_gucs = NULL;
+        }
       }
+      msg_start += msg_len;
+    }
+    if (msg_start != 0 && chan->is_resetting) {
+      /* Answer to server_reset_query: nobody to pass it on to */
+      memmove(chan->buf, chan->buf + msg_start, chan->rx_pos - msg_start);
+      chan->rx_pos -= msg_start;
+      if (chan->backend_is_ready) {
+        chan->is_resetting = false;
+        return backend_reschedule(chan, true);
+      }
+    } else if (msg_start != 0) {
+      /* Has some complete messages to send to the client */
+      if (chan->peer == NULL) {
+        /*
+         * We are not expecting messages from idle backend. Assume that it
+         * some error or shutdown.
+         */
+        channel_hangout(chan, "idle");
+        return false;
+      }
+      Assert(chan->tx_pos == 0);
+      Assert(chan->rx_pos >= msg_start);
+      chan->tx_size = msg_start;
+      if (!channel_write(chan->peer, true)) {
+        return false;
+      }
+    }
+    /* If backend is out of transaction, then reschedule it */
+    if (chan->backend_is_ready &&
+        !(chan->peer != NULL && POOL_IS_SESSION(chan->pool))) {
+      return backend_reschedule(chan, false);
     }
 
-    if (!success && elemlist != NIL)
-      ereport(FATAL, (errmsg("could not create any TCP/IP sockets")));
-
-    list_free(elemlist);
-    pfree(rawstring);
+    /* Do not try to read more data if edge-triggered mode is not supported */
+    if (!WaitEventUseEpoll) {
+      break;
+    }
   }
+  return true;
+} /* backend_read() */
 
-  /* How many server sockets do we need to wait for? */
-  while (nsockets < MAXLISTEN && ListenSocket[nsockets] != PGINVALID_SOCKET)
-    ++nsockets;
+/* ------------------------------------------------------------------------- */
 
-  proxy = proxy_create(&ProxyState[0], SessionPoolSize);
+static ssize_t
+backend_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  return recv(chan->backend_socket, buf, size, 0);
+} /* backend_recv() */
 
-  for (i = 0; i < nsockets; i++) {
-    proxy_add_listen_socket(proxy, ListenSocket[i]);
-  }
-  proxy_loop(proxy);
+/* ------------------------------------------------------------------------- */
 
-  proc_exit(0);
+static ssize_t
+backend_send (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  return send(chan->backend_socket, buf, size, 0);
+} /* backend_send() */
 
-} /* ng_idcp_proxy_main() */
+/* ------------------------------------------------------------------------- */
 
-/* ========================================================================= */
-/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
-/* ========================================================================= */
+/*
+ * Resolve the PGPROC of a backend and record the backend in the shared
+ * registry, so that the controller can terminate it and give back its
+ * database and role slots should this worker die.
+ */
+static void
+backend_register (
+  Channel *chan
+) {
+  if (chan->backend_proc != NULL)
+    return;
+  Assert(chan->backend_pid != 0);
+  chan->backend_proc = BackendPidGetProc(chan->backend_pid);
+  if (chan->backend_proc != NULL)
+    ng_idcp_backend_registry_add(chan->backend_proc, chan->backend_pid,
+                                 chan->pool->key.database,
+                                 chan->pool->key.username);
+} /* backend_register() */
 
-/* ========================================================================= */
-/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
-/* ========================================================================= */
+/* ------------------------------------------------------------------------- */
 
 /**
  * Backend is ready for next command outside transaction block (idle state).
  * Now if backend is not tainted it is possible to schedule some other client
- * to this backend.
+ * to this backend. Unless it is new or was just reset (is_new), a backend
+ * released in session mode, or in any mode with server_reset_query_always,
+ * is first reset with server_reset_query, see backend_reset().
  */
 static bool
 backend_reschedule (
   Channel  *chan,
   bool      is_new
 ) {
-  Channel *pending = chan->pool->pending_clients;
+  Channel *pending;
 
   chan->backend_is_ready = false;
 
-  /* Lazy resolving of PGPROC entry */
-  if (chan->backend_proc == NULL) {
-    Assert(chan->backend_pid != 0);
-    chan->backend_proc = BackendPidGetProc(chan->backend_pid);
+  /* Clients that only wait for the handshake no longer need a backend */
+  if (chan->pool->handshake_template != NULL)
+    pool_admit_pending(chan->pool);
+  pending = chan->pool->pending_clients;
 
-    /*
-     * If backend completes execution of some query, then it has definitely
-     * registered itself in procarray.
-     */
-    Assert(chan->backend_proc);
-  }
+  /*
+   * Lazy resolving of PGPROC entry. If backend completes execution of some
+   * query, then it has definitely registered itself in procarray.
+   */
+  backend_register(chan);
+  Assert(chan->backend_proc);
 
   if (chan->peer) {
     chan->peer->peer = NULL;
@@ -482,6 +1186,11 @@ backend_reschedule (
     chan->pool->proxy->state->n_idle_clients += 1;
     chan->peer->is_idle = true;
   }
+  if (!is_new && gp_ng_idcp_cfg_server_reset_query != NULL &&
+      gp_ng_idcp_cfg_server_reset_query[0] != '\0' &&
+      (POOL_IS_SESSION(chan->pool) ||
+       g_ng_idcp_cfg_server_reset_query_always))
+    return backend_reset(chan);
   if (pending) {
     /* Has pending clients: serve one of them */
     ELOG(LOG, "Backed %d is reassigned to client %p", chan->backend_pid,
@@ -499,6 +1208,7 @@ backend_reschedule (
       Assert(chan->handshake_response_size < chan->buf_size);
       memcpy(chan->buf, chan->handshake_response,
              chan->handshake_response_size);
+      handshake_set_key(pending, chan->buf, chan->handshake_response_size);
       chan->rx_pos = chan->tx_size = chan->handshake_response_size;
       ELOG(LOG, "Simulate response for startup packet to client %p", pending);
       chan->backend_is_ready = true;
@@ -510,6 +1220,14 @@ backend_reschedule (
       Assert(pending->tx_pos == 0 && pending->rx_pos >= pending->tx_size);
       return channel_write(chan, false); /* Send pending request to backend */
     }
+  } else if (chan->pool->n_launched_backends >
+             chan->pool->settings.pool_size) {
+    /* Pool was shrunk by a configuration change: retire the backend */
+    ELOG(LOG, "Retire backend %d of shrunk pool", chan->backend_pid);
+    chan->peer = NULL;
+    chan->is_interrupted =
+        true; /* interrupted flags makes channel_write to send 'X' message */
+    return channel_write(chan, false);
   } else /* return backend to the list of idle backends */
   {
     ELOG(LOG, "Backed %d is idle", chan->backend_pid);
@@ -527,10 +1245,51 @@ backend_reschedule (
 /* ------------------------------------------------------------------------- */
 
 /*
- * Start new backend for particular pool associated with dbname/role
- * combination. Backend is forked using BackendStartup function.
+ * Send server_reset_query to a backend released by its client, so that the
+ * next client doesn't inherit its settings, prepared statements, temporary
+ * tables, locks or listens. backend_read() drops the answer and reschedules
+ * the backend on ReadyForQuery; a backend that fails to reset is closed.
  */
-static Channel *
+static bool
+backend_reset (
+  Channel *chan
+) {
+  StringInfoData msg;
+  uint32 length;
+  ssize_t rc;
+
+  ELOG(LOG, "Reset backend %d", chan->backend_pid);
+  chan->peer = NULL;
+  chan->is_resetting = true;
+
+  initStringInfo(&msg);
+  pq_sendbyte(&msg, 'Q');
+  pq_sendint32(&msg, 0);
+  appendBinaryStringInfo(&msg, gp_ng_idcp_cfg_server_reset_query,
+                         strlen(gp_ng_idcp_cfg_server_reset_query) + 1);
+  length = pg_hton32(msg.len - 1);
+  memcpy(msg.data + 1, &length, sizeof(length));
+
+  /* The backend is idle, so its socket buffer can take the whole query */
+  rc = socket_write(chan, msg.data, msg.len, false);
+  pfree(msg.data);
+  if (rc != msg.len) {
+    if (!chan->is_disconnected)
+      channel_hangout(chan, "reset");
+    return false;
+  }
+  return true;
+} /* backend_reset() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Start new backend for particular pool associated with dbname/role
+ * combination. Backend is forked using BackendStartup function. The caller
+ * must have reserved a slot with pool_reserve_backend(), which is given back
+ * if the backend can't be started.
+ */
+static Channel *
 backend_start (
   SessionPool    *pool,
   char          **error
@@ -562,7 +1321,6 @@ backend_start (
   PGconn *conn;
   char *msg;
   int int32_buf;
-  int msg_len;
   ListCell *gucopts;
   char *dst = options;
 
@@ -589,8 +1347,10 @@ backend_start (
   *dst = '\0';
   conn = libpq_connectdb(keywords, values, error);
   pfree(options);
-  if (!conn)
+  if (!conn) {
+    pool_release_backend(pool);
     return NULL;
+  }
 
   chan = channel_create(pool->proxy);
   chan->pool = pool;
@@ -608,25 +1368,32 @@ backend_start (
   msg = chan->handshake_response;
   while (*msg != 'K') /* Scan handshake response until we reach PID message */
   {
-    memcpy(&int32_buf, ++msg, sizeof(int32_buf));
-    msg_len = ntohl(int32_buf);
-    msg += msg_len;
+    msg += ng_idcp_msg_length(msg, false);
     Assert(msg < chan->handshake_response + chan->handshake_response_size);
   }
   memcpy(&int32_buf, msg + 5, sizeof(int32_buf));
   chan->backend_pid = ntohl(int32_buf);
 
+  /* The channel owns the socket now: free the connection without closing it */
+  conn->sock = PGINVALID_SOCKET;
+  PQfinish(conn);
+
   if (channel_register(pool->proxy, chan)) {
     pool->proxy->state->n_backends += 1;
     pool->n_launched_backends += 1;
+    backend_register(chan);
+    pool_save_handshake(pool, chan);
   } else {
     *error = strdup("Too much sessios: try to increase 'max_sessions' "
                     "configuration parameter");
     /* Too much sessions, error report was already logged */
+    pool_release_backend(pool);
     closesocket(chan->backend_socket);
     chan->magic = REMOVED_CHANNEL_MAGIC;
+    pfree(chan->handshake_response);
+    chan->handshake_response = NULL;
     pfree(chan->buf);
-    pfree(chan);
+    channel_free(chan);
     chan = NULL;
   }
   return chan;
@@ -634,6 +1401,56 @@ backend_start (
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * Set the socket events the channel waits for. Only level-triggered wait
+ * event sets need this: the interest set is changed only when it differs from
+ * what is already armed, so steady-state I/O doesn't cost a system call.
+ * Edge-triggered epoll and io_uring registrations are never modified.
+ */
+static void
+channel_arm (
+  Channel  *chan,
+  uint32    events
+) {
+#ifndef PROXY_USE_EPOLL_ET
+  if (chan->armed_events != events && chan->proxy->wait_events != NULL) {
+    ModifyWaitEvent(chan->proxy->wait_events, chan->event_pos, events, NULL);
+    chan->armed_events = events;
+  }
+#endif
+} /* channel_arm() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Whether a channel can be passed to a replacement worker: an idle session,
+ * done with authentication and outside a transaction, with nothing buffered
+ * in either direction, so that all of its state is in the socket and a few
+ * strings. With io_uring, data may already have been received for it, so
+ * only the epoll loop hands off sessions.
+ */
+static bool
+channel_can_handoff (
+  Channel *chan
+) {
+#ifdef NG_IDCP_USE_IO_URING
+  if (chan->proxy->uring != NULL)
+    return false;
+#endif
+  if (chan->is_disconnected || chan->is_handed_off || chan->pool == NULL ||
+      chan->peer != NULL || !chan->is_idle || chan->rx_pos != 0 ||
+      chan->tx_size != 0 || chan->corked)
+    return false;
+  if (!chan->client_port)
+    return !chan->is_interrupted;
+  return chan->auth == NULL && chan->auth_out == NULL &&
+         chan->negotiation == NEGOTIATION_NONE &&
+         !chan->client_port->ssl_in_use && !chan->in_transaction &&
+         chan->prev_gucs == NULL;
+} /* channel_can_handoff() */
+
+/* ------------------------------------------------------------------------- */
+
 /*
  * Create new channel.
  */
@@ -641,17 +1458,91 @@ static Channel *
 channel_create (
   Proxy *proxy
 ) {
-  Channel *chan = (Channel *)palloc0(sizeof(Channel));
+  Channel *chan;
+  uint32 slot;
+  uint32 generation;
+
+  if (proxy->free_channels == NULL)
+    channel_slab_grow(proxy);
+  chan = proxy->free_channels;
+  proxy->free_channels = chan->next;
+
+  slot = chan->slot;
+  generation = chan->generation;
+  memset(chan, 0, sizeof(Channel));
+  chan->slot = slot;
+  chan->generation = generation;
   chan->magic = ACTIVE_CHANNEL_MAGIC;
   chan->proxy = proxy;
   chan->buf = palloc(INIT_BUF_SIZE);
   chan->buf_size = INIT_BUF_SIZE;
   chan->tx_pos = chan->rx_pos = chan->tx_size = 0;
+  chan->armed_events = CHANNEL_EVENTS;
   return chan;
 } /* channel_create() */
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * Push out output held back by MSG_MORE. Enabling TCP_NODELAY (which is
+ * already set) makes the kernel transmit pending partial segments at once.
+ */
+static void
+channel_flush (
+  Channel *chan
+) {
+  int on = 1;
+
+  if (!chan->corked)
+    return;
+  chan->corked = false;
+  if (setsockopt(chan->client_port->sock, IPPROTO_TCP, TCP_NODELAY,
+                 (char *) &on, sizeof(on)) < 0)
+    ELOG(LOG, "%p: setsockopt(TCP_NODELAY) failed: %m", chan);
+} /* channel_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Return the slot of a removed channel to the slab. Events still queued for
+ * it carry the old generation and are ignored.
+ */
+static void
+channel_free (
+  Channel *chan
+) {
+  Proxy *proxy = chan->proxy;
+
+  Assert(chan->magic == REMOVED_CHANNEL_MAGIC);
+  if (++chan->generation == 0)
+    chan->generation = 1;
+  chan->next = proxy->free_channels;
+  proxy->free_channels = chan;
+} /* channel_free() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Forget a channel whose socket was passed to a replacement worker. The
+ * socket stays open in the replacement, so only this worker's copy is
+ * closed when the channel is removed.
+ */
+static void
+channel_handed_off (
+  Channel *chan
+) {
+#ifdef PROXY_USE_EPOLL_ET
+  /* Events of a shared socket would keep being reported here */
+  if (epoll_ctl(chan->proxy->epoll_fd, EPOLL_CTL_DEL, CHANNEL_SOCKET(chan),
+                NULL) < 0)
+    ELOG(LOG, "%p: failed to remove handed off channel: %m", chan);
+#endif
+  chan->is_handed_off = true;
+  channel_hangout(chan, "handoff");
+} /* channel_handed_off() */
+
+/* ------------------------------------------------------------------------- */
+
 /*
  * Handle communication failure for this channel.
  * It is not possible to remove channel immediately because it can be triggered
@@ -664,9 +1555,18 @@ channel_hangout (
 ) {
   Channel **ipp;
   Channel *peer = chan->peer;
-  if (chan->is_disconnected || chan->pool == NULL)
+  if (chan->is_disconnected)
     return;
 
+  if (chan->pool == NULL) {
+    /* Client has not been authenticated yet, see client_enter_pool() */
+    ELOG(LOG, "Hangout new client %p due to %s error: %m", chan, op);
+    chan->next = chan->proxy->hangout;
+    chan->proxy->hangout = chan;
+    chan->is_disconnected = true;
+    return;
+  }
+
   if (chan->client_port) {
     ELOG(LOG, "Hangout client %p due to %s error: %m", chan, op);
     for (ipp = &chan->pool->pending_clients; *ipp != NULL;
@@ -704,8 +1604,9 @@ channel_hangout (
 
   if (chan->client_port && peer) /* If it is client connected to backend. */
   {
-    if (!chan->is_interrupted) /* Client didn't sent 'X' command, so do it for
-                                  him. */
+    if (!chan->is_interrupted &&
+        !peer->backend_is_ready) /* Client didn't sent 'X' command inside a
+                                    transaction, so do it for him. */
     {
       ELOG(LOG, "Send terminate command to backend %p (pid %d)", peer,
            peer->backend_pid);
@@ -726,6 +1627,21 @@ channel_hangout (
 
 /* ------------------------------------------------------------------------- */
 
+/*
+ * Get the channel in a slab slot, which may be free or reused.
+ */
+static Channel *
+channel_lookup (
+  Proxy    *proxy,
+  uint32    slot
+) {
+  Assert(slot < (uint32) proxy->n_channel_chunks * CHANNEL_SLAB_CHUNK);
+  return &proxy->channel_chunks[slot / CHANNEL_SLAB_CHUNK]
+                               [slot % CHANNEL_SLAB_CHUNK];
+} /* channel_lookup() */
+
+/* ------------------------------------------------------------------------- */
+
 /*
  * Try to read more data from the channel and send it to the peer.
  */
@@ -733,145 +1649,1206 @@ static bool
 channel_read (
   Channel *chan
 ) {
-  int msg_start;
-  while (chan->tx_size == 0) /* there is no pending write op */
+  return CHANNEL_OPS(chan)->read(chan);
+} /* channel_read() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Receive as much data as fits into the channel buffer. Returns the number of
+ * bytes received, 0 on EOF or -1 with errno set (EAGAIN when no data is
+ * available yet).
+ */
+static ssize_t
+channel_recv (
+  Channel *chan
+) {
+  return CHANNEL_OPS(chan)->recv(chan, chan->buf + chan->rx_pos,
+                                 chan->buf_size - chan->rx_pos);
+} /* channel_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Register new channel in wait event set.
+ */
+static bool
+channel_register (
+  Proxy      *proxy,
+  Channel    *chan
+) {
+  pgsocket sock = CHANNEL_SOCKET(chan);
+  /* Using edge epoll mode requires non-blocking sockets */
+  pg_set_noblock(sock);
+  dlist_push_tail(&proxy->channels, &chan->proxy_node);
+#ifdef NG_IDCP_USE_IO_URING
+  if (proxy->uring != NULL) {
+    /*
+     * Clients are polled for readiness until the startup packet (and any TLS
+     * handshake) is done; backends receive through multishot recv at once.
+     */
+    if (chan->client_port) {
+      channel_uring_arm_pollin(chan);
+    } else {
+      chan->kind = CHANNEL_BACKEND_URING;
+      chan->uring_recv = true;
+      initStringInfo(&chan->uring_backlog);
+      channel_uring_arm_recv(chan);
+    }
+    return true;
+  }
+#endif
+#ifdef PROXY_USE_EPOLL_ET
   {
-    ssize_t rc;
-    bool handshake = false;
-#ifdef USE_SSL
-    int waitfor = 0;
-    if (chan->client_port && chan->client_port->ssl_in_use)
-      rc = be_tls_read(chan->client_port, chan->buf + chan->rx_pos,
-                       chan->buf_size - chan->rx_pos, &waitfor);
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.u64 = EVENT_DATA(chan->generation, chan->slot);
+    if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+      elog(WARNING,
+           "PROXY: Failed to add new client: %m - %d clients, %d backends.",
+           proxy->state->n_clients, proxy->state->n_backends);
+      dlist_delete(&chan->proxy_node);
+      return false;
+    }
+    return true;
+  }
+#endif
+  chan->event_pos = AddWaitEventToSet(proxy->wait_events, CHANNEL_EVENTS,
+                                      sock, NULL, chan);
+  if (chan->event_pos < 0) {
+    elog(WARNING,
+         "PROXY: Failed to add new client - too much sessions: %d clients, %d "
+         "backends. "
+         "Try to increase 'max_sessions' configuration parameter.",
+         proxy->state->n_clients, proxy->state->n_backends);
+    dlist_delete(&chan->proxy_node);
+    return false;
+  }
+  return true;
+} /* channel_register() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Perform delayed deletion of channel
+ */
+static void
+channel_remove (
+  Channel *chan
+) {
+  Assert(chan->is_disconnected); /* should be marked as disconnected by
+                                    channel_hangout */
+
+  dlist_delete(&chan->proxy_node);
+
+  // JHH FIXME
+  //  DeleteWaitEventFromSet(chan->proxy->wait_events, chan->event_pos);
+  if (chan->client_port) {
+    if (chan->pool)
+      chan->pool->n_connected_clients -= 1;
     else
+      chan->proxy->n_accepted_connections -= 1;
+    chan->proxy->state->n_clients -= 1;
+    chan->proxy->state->n_ssl_clients -= chan->client_port->ssl_in_use;
+#ifdef USE_SSL
+    /* Also releases the TLS state of an unfinished handshake */
+    be_tls_close(chan->client_port);
 #endif
-      rc = chan->client_port
-               ? secure_raw_read(chan->client_port, chan->buf + chan->rx_pos,
-                                 chan->buf_size - chan->rx_pos)
-               : recv(chan->backend_socket, chan->buf + chan->rx_pos,
-                      chan->buf_size - chan->rx_pos, 0);
-    ELOG(LOG, "%p: read %d: %m", chan, (int)rc);
+    client_auth_end(chan);
+    closesocket(chan->client_port->sock);
+    /* Port, startup parameters and GUCs */
+    MemoryContextDelete(chan->memctx);
+  } else {
+    chan->proxy->state->n_backends -= 1;
+    chan->pool->n_launched_backends -= 1;
+    /* A handed off backend keeps its slot with the replacement worker */
+    if (!chan->is_handed_off)
+      pool_release_backend(chan->pool);
+    if (chan->backend_proc != NULL)
+      ng_idcp_backend_registry_remove(chan->backend_proc, chan->backend_pid);
+    closesocket(chan->backend_socket);
+    pfree(chan->handshake_response);
 
-    if (rc <= 0) {
-      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
-        channel_hangout(chan, "read");
-      return false; /* wait for more data */
-    } else if (chan->edge_triggered) {
-      /* resume accepting all events */
-      ModifyWaitEvent(
-          chan->proxy->wait_events, chan->event_pos,
-          WL_SOCKET_READABLE | WL_SOCKET_WRITEABLE | WL_SOCKET_EDGE, NULL);
-      chan->edge_triggered = false;
+    if (!chan->is_handed_off && chan->pool->pending_clients &&
+        pool_reserve_backend(chan->pool)) {
+      char *error;
+      /* Try to start new backend instead of terminated */
+      Channel *new_backend = backend_start(chan->pool, &error);
+      if (new_backend != NULL) {
+        ELOG(LOG, "Spawn new backend %p instead of terminated %p", new_backend,
+             chan);
+        backend_reschedule(new_backend, true);
+      } else
+        free(error);
     }
+  }
+  if (chan->pool != NULL)
+    pool_remove_if_unused(chan->pool);
+  chan->magic = REMOVED_CHANNEL_MAGIC;
+  if (chan->corked)
+    chan->proxy->corked = list_delete_ptr(chan->proxy->corked, chan);
+  pfree(chan->buf);
+#ifdef NG_IDCP_USE_IO_URING
+  if (chan->uring_backlog.data != NULL)
+    pfree(chan->uring_backlog.data);
+  if (chan->uring_ops > 0) {
+    /*
+     * The kernel still references this channel: cancel its requests and
+     * free it when the last completion arrives.
+     */
+    if (chan->uring_recv_armed)
+      channel_uring_cancel(chan, URING_OP_RECV);
+    if (chan->uring_pollin_armed)
+      channel_uring_cancel(chan, URING_OP_POLLIN);
+    if (chan->uring_pollout_armed)
+      channel_uring_cancel(chan, URING_OP_POLLOUT);
+    return;
+  }
+#endif
+  channel_free(chan);
+} /* channel_remove() */
 
-    if (!chan->client_port)
-      ELOG(LOG,
-           "Receive reply %c %d bytes from backend %d (%p:ready=%d) to client "
-           "%d",
-           chan->buf[0] ? chan->buf[0] : '?', (int)rc + chan->rx_pos,
-           chan->backend_pid, chan, chan->backend_is_ready,
-           chan->peer ? chan->peer->client_port->sock : -1);
-    else
-      ELOG(LOG,
-           "Receive command %c %d bytes from client %d to backend %d "
-           "(%p:ready=%d)",
-           chan->buf[0] ? chan->buf[0] : '?', (int)rc + chan->rx_pos,
-           chan->client_port->sock, chan->peer ? chan->peer->backend_pid : -1,
-           chan->peer, chan->peer ? chan->peer->backend_is_ready : -1);
+/* ------------------------------------------------------------------------- */
 
-    chan->rx_pos += rc;
-    msg_start = 0;
+/*
+ * Add a chunk of free slots to the channel slab. Chunks stay in place for the
+ * life of the worker, so a slot can always be looked up (and its generation
+ * checked) however stale the reference to it is.
+ */
+static void
+channel_slab_grow (
+  Proxy *proxy
+) {
+  MemoryContext proxy_memctx = GetMemoryChunkContext(proxy);
+  Channel *chunk;
+  uint32 base = (uint32) proxy->n_channel_chunks * CHANNEL_SLAB_CHUNK;
+  int i;
 
-    /* Loop through all received messages */
-    while (chan->rx_pos - msg_start >= 5) /* has message code + length */
-    {
-      int msg_len;
-      uint32 new_msg_len;
+  if (proxy->channel_chunks == NULL)
+    proxy->channel_chunks = MemoryContextAlloc(proxy_memctx,
+                                               sizeof(Channel *));
+  else
+    proxy->channel_chunks =
+        repalloc(proxy->channel_chunks,
+                 (proxy->n_channel_chunks + 1) * sizeof(Channel *));
+  chunk = MemoryContextAllocZero(proxy_memctx,
+                                 CHANNEL_SLAB_CHUNK * sizeof(Channel));
+  proxy->channel_chunks[proxy->n_channel_chunks++] = chunk;
+
+  /* Lowest slots first */
+  for (i = CHANNEL_SLAB_CHUNK - 1; i >= 0; i--) {
+    chunk[i].magic = REMOVED_CHANNEL_MAGIC;
+    chunk[i].slot = base + i;
+    chunk[i].generation = 1;
+    chunk[i].next = proxy->free_channels;
+    proxy->free_channels = &chunk[i];
+  }
+} /* channel_slab_grow() */
 
-      if (chan->pool == NULL) {
-        /* process startup packet */
-        Assert(msg_start == 0);
-        memcpy(&msg_len, chan->buf + msg_start, sizeof(msg_len));
-        msg_len = ntohl(msg_len);
-        handshake = true;
-      } else {
-        ELOG(LOG, "%p receive message %c", chan, chan->buf[msg_start]);
-        memcpy(&msg_len, chan->buf + msg_start + 1, sizeof(msg_len));
-        msg_len = ntohl(msg_len) + 1;
-      }
+/* ------------------------------------------------------------------------- */
 
-      if (msg_start + msg_len > chan->buf_size) {
-        /* Reallocate buffer to fit complete message body */
-        chan->buf_size = msg_start + msg_len;
-        chan->buf = repalloc(chan->buf, chan->buf_size);
-      }
+#ifdef NG_IDCP_USE_IO_URING
 
-      if (chan->rx_pos - msg_start >= msg_len) {
-        /* Message is completely fetched */
-        if (chan->pool == NULL) {
-          /* receive startup packet */
-          Assert(chan->client_port);
-          if (!client_connect(chan, msg_len)) {
-            /* Some trouble with processing startup packet */
-            chan->is_disconnected = true;
-            channel_remove(chan);
-            return false;
-          }
-        } else if (!chan->client_port) {
-          /* Message from backend */
-          if (chan->buf[msg_start] == 'Z' && chan->buf[msg_start + 5] == 'I') {
-            /* Ready for query && transaction block status is idle */
-
-            /* Should be last message */
-            Assert(chan->rx_pos - msg_start == msg_len);
-
-            chan->backend_is_ready = true; /* Backend is ready for query */
-            chan->proxy->state->n_transactions += 1;
-            if (chan->peer) {
-              chan->peer->in_transaction = false;
-            }
-          } else if (chan->buf[msg_start] == 'E') {
-            /* Error */
-            if (chan->peer && chan->peer->prev_gucs) {
-              /* Undo GUC assignment */
-              pfree(chan->peer->gucs);
-              chan->peer->gucs = chan->peer->prev_gucs;
-              chan->peer->prev_gucs = NULL;
-            }
-          }
-        } else if (chan->client_port) {
-          /* Message from client */
-          switch (chan->buf[msg_start]) {
-            /* one-packet queries */
-            case 'Q':    /* Query */
-              if ((ProxyingGUCs || MultitenantProxy) && !chan->in_transaction) {
-                char *stmt = &chan->buf[msg_start + 5];
-                if (chan->prev_gucs) {
-                  pfree(chan->prev_gucs);
-                  chan->prev_gucs = NULL;
-                }
-                if (ProxyingGUCs &&
-                    ((pg_strncasecmp(stmt, "set", 3) == 0 &&
-                      pg_strncasecmp(stmt + 3, " local", 6) != 0) ||
-                     pg_strncasecmp(stmt, "reset", 5) == 0)) {
-                  char *new_msg;
-                  chan->prev_gucs = chan->gucs ? chan->gucs : pstrdup("");
-                  if (pg_strncasecmp(stmt, "reset", 5) == 0) {
-                    char *semi = strchr(stmt + 5, ';');
-                    if (semi)
-                      *semi = '\0';
-                    chan->gucs = psprintf("%sset local%s=default;",
-                                          chan->prev_gucs, stmt + 5);
-                  } else {
-                    char *param = stmt + 3;
-                    if (pg_strncasecmp(param, " session", 8) == 0)
-                      param += 8;
-                    chan->gucs =
-                        psprintf("%sset local%s%c", chan->prev_gucs, param,
-                                 chan->buf[chan->rx_pos - 2] == ';' ? ' ' : ';');
-                  }
-                  new_msg = chan->gucs + strlen(chan->prev_gucs);
-                  Assert(msg_start + strlen(new_msg) * 2 + 6 < chan->buf_size);
+/*
+ * Arm a multishot readiness poll. Used for clients whose reads have to go
+ * through channel_recv()'s own recv path: before the startup packet has been
+ * processed and for TLS connections.
+ */
+static void
+channel_uring_arm_pollin (
+  Channel *chan
+) {
+  struct io_uring_sqe *sqe;
+
+  if (chan->uring_pollin_armed)
+    return;
+
+  sqe = proxy_uring_get_sqe(chan->proxy);
+  io_uring_prep_poll_multishot(sqe, CHANNEL_SOCKET(chan), POLLIN);
+  io_uring_sqe_set_data64(sqe, URING_DATA(chan, URING_OP_POLLIN));
+  chan->uring_pollin_armed = true;
+  chan->uring_ops += 1;
+} /* channel_uring_arm_pollin() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Arm a one-shot POLLOUT after a write hit EAGAIN.
+ */
+static void
+channel_uring_arm_pollout (
+  Channel *chan
+) {
+  struct io_uring_sqe *sqe;
+
+  if (chan->uring_pollout_armed)
+    return;
+
+  sqe = proxy_uring_get_sqe(chan->proxy);
+  io_uring_prep_poll_add(sqe, CHANNEL_SOCKET(chan), POLLOUT);
+  io_uring_sqe_set_data64(sqe, URING_DATA(chan, URING_OP_POLLOUT));
+  chan->uring_pollout_armed = true;
+  chan->uring_ops += 1;
+} /* channel_uring_arm_pollout() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Arm a multishot recv selecting buffers from the proxy's buffer ring. It
+ * stays armed across completions until cancelled, EOF or buffer exhaustion.
+ */
+static void
+channel_uring_arm_recv (
+  Channel *chan
+) {
+  struct io_uring_sqe *sqe;
+
+  if (chan->uring_recv_armed)
+    return;
+
+  sqe = proxy_uring_get_sqe(chan->proxy);
+  io_uring_prep_recv_multishot(sqe, CHANNEL_SOCKET(chan), NULL, 0, 0);
+  sqe->flags |= IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUF_GROUP;
+  io_uring_sqe_set_data64(sqe, URING_DATA(chan, URING_OP_RECV));
+  chan->uring_recv_armed = true;
+  chan->uring_ops += 1;
+} /* channel_uring_arm_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Cancel the channel's request of the given kind. Its final completion
+ * (-ECANCELED) is still delivered and accounted for in uring_ops.
+ */
+static void
+channel_uring_cancel (
+  Channel  *chan,
+  int       op
+) {
+  struct io_uring_sqe *sqe = proxy_uring_get_sqe(chan->proxy);
+
+  io_uring_prep_cancel64(sqe, URING_DATA(chan, op), 0);
+  io_uring_sqe_set_data64(sqe, URING_DATA(NULL, URING_OP_CANCEL));
+} /* channel_uring_cancel() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Handle completion of a readiness poll.
+ */
+static void
+channel_uring_poll_complete (
+  Channel  *chan,
+  int       op,
+  int       res,
+  uint32    flags
+) {
+  bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+  if (!more) {
+    if (op == URING_OP_POLLIN)
+      chan->uring_pollin_armed = false;
+    else
+      chan->uring_pollout_armed = false;
+    chan->uring_ops -= 1;
+  }
+
+  if (chan->magic != ACTIVE_CHANNEL_MAGIC) {
+    /* Channel was removed: release it with its last request */
+    if (chan->uring_ops == 0)
+      channel_free(chan);
+    return;
+  }
+
+  if (res == -ECANCELED)
+    return;
+
+  if (op == URING_OP_POLLOUT) {
+    ELOG(LOG, "Channel %p is writable", chan);
+    channel_write(chan, false);
+  } else if (!chan->uring_recv) {
+    /* Readiness is ignored once data is delivered by multishot recv */
+    if (!more)
+      channel_uring_arm_pollin(chan);
+    ELOG(LOG, "Channel %p is readable", chan);
+    channel_read(chan);
+  }
+} /* channel_uring_poll_complete() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Receive operation of channels served by multishot recv: the data was
+ * already received by the completions and is taken from the backlog.
+ */
+static ssize_t
+channel_uring_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  ssize_t rc;
+  StringInfo backlog = &chan->uring_backlog;
+  int avail = backlog->len - backlog->cursor;
+
+  if (avail == 0) {
+    if (!chan->uring_eof) {
+      errno = EAGAIN;
+      return -1;
+    }
+    if (chan->uring_errno != 0) {
+      errno = chan->uring_errno;
+      return -1;
+    }
+    return 0;
+  }
+
+  rc = Min((size_t) avail, size);
+  if (rc == 0) {
+    errno = EAGAIN;
+    return -1;
+  }
+  memcpy(buf, backlog->data + backlog->cursor, rc);
+  backlog->cursor += rc;
+  if (backlog->cursor == backlog->len) {
+    resetStringInfo(backlog);
+  } else if (backlog->cursor > backlog->len / 2) {
+    backlog->len -= backlog->cursor;
+    memmove(backlog->data, backlog->data + backlog->cursor, backlog->len);
+    backlog->data[backlog->len] = '\0';
+    backlog->cursor = 0;
+  }
+
+  /* Resume receiving once the backlog is drained */
+  if (chan->uring_recv_paused
+      && backlog->len - backlog->cursor < URING_MAX_BACKLOG / 2) {
+    chan->uring_recv_paused = false;
+    if (!chan->uring_recv_armed && !chan->uring_eof)
+      channel_uring_arm_recv(chan);
+  }
+  return rc;
+} /* channel_uring_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Handle completion of a multishot recv: append the received data to the
+ * channel backlog, give the buffer back to the ring and let channel_read()
+ * forward it.
+ */
+static void
+channel_uring_recv_complete (
+  Channel  *chan,
+  int       res,
+  uint32    flags
+) {
+  Proxy *proxy = chan->proxy;
+  bool more = (flags & IORING_CQE_F_MORE) != 0;
+
+  if (res > 0) {
+    int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    char *data = proxy->uring_bufs + (size_t) bid * URING_BUF_SIZE;
+
+    if (chan->magic == ACTIVE_CHANNEL_MAGIC)
+      appendBinaryStringInfo(&chan->uring_backlog, data, res);
+
+    io_uring_buf_ring_add(proxy->uring_buf_ring, data, URING_BUF_SIZE, bid,
+                          io_uring_buf_ring_mask(URING_BUF_COUNT), 0);
+    io_uring_buf_ring_advance(proxy->uring_buf_ring, 1);
+  } else if (res == 0) {
+    chan->uring_eof = true;
+  } else if (res != -ENOBUFS && res != -ECANCELED) {
+    chan->uring_eof = true;
+    chan->uring_errno = -res;
+  }
+
+  if (!more) {
+    chan->uring_recv_armed = false;
+    chan->uring_ops -= 1;
+  }
+
+  if (chan->magic != ACTIVE_CHANNEL_MAGIC) {
+    /* Channel was removed: release it with its last request */
+    if (chan->uring_ops == 0)
+      channel_free(chan);
+    return;
+  }
+
+  if (!chan->uring_recv_armed && !chan->uring_eof && !chan->uring_recv_paused) {
+    /* Terminated by buffer exhaustion: the ring is replenished by now */
+    channel_uring_arm_recv(chan);
+  } else if (chan->uring_recv_armed && !chan->uring_recv_paused
+             && chan->uring_backlog.len - chan->uring_backlog.cursor
+                  > URING_MAX_BACKLOG) {
+    /* Peer doesn't drain: stop receiving until channel_recv() catches up */
+    chan->uring_recv_paused = true;
+    channel_uring_cancel(chan, URING_OP_RECV);
+  }
+
+  channel_read(chan);
+} /* channel_uring_recv_complete() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Switch a connected plain client from readiness polling to multishot recv.
+ */
+static void
+channel_uring_start_recv (
+  Channel *chan
+) {
+  chan->kind = CHANNEL_CLIENT_URING;
+  chan->uring_recv = true;
+  initStringInfo(&chan->uring_backlog);
+  if (chan->uring_pollin_armed)
+    channel_uring_cancel(chan, URING_OP_POLLIN);
+  channel_uring_arm_recv(chan);
+} /* channel_uring_start_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+#endif /* NG_IDCP_USE_IO_URING */
+
+/*
+ * Socket send buffer is full: get notified when it becomes writable.
+ */
+static void
+channel_wait_writable (
+  Channel *chan
+) {
+  chan->write_blocked = true;
+#ifdef NG_IDCP_USE_IO_URING
+  if (chan->proxy->uring != NULL)
+    channel_uring_arm_pollout(chan);
+  else
+#endif
+    channel_arm(chan, chan->armed_events | WL_SOCKET_WRITEABLE);
+} /* channel_wait_writable() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Try to send some data to the channel.
+ * Data is located in the peer buffer. Because of using edge-triggered mode we
+ * have have to use non-blocking IO and try to write all available data. Once
+ * write is completed we should try to read more data from source socket.
+ * "synchronous" flag is used to avoid infinite recursion or reads-writers.
+ * Returns true if there is nothing to do or operation is successfully
+ * completed, false in case of error or socket buffer is full.
+ */
+static bool
+channel_write (
+  Channel  *chan,
+  bool      synchronous
+) {
+  Channel *peer = chan->peer;
+  if (chan->is_setup) {
+    if (chan->auth_out != NULL) {
+      /* Authentication messages were waiting for the socket */
+      return client_auth_flush(chan);
+    }
+    if (chan->negotiation != NEGOTIATION_NONE) {
+      /* Negotiation was waiting for the socket to become writable */
+      return client_handshake(chan) &&
+             chan->negotiation == NEGOTIATION_NONE && channel_read(chan);
+    }
+  }
+  if (chan->is_interrupted && !chan->client_port) {
+    /* Send terminate command to the backend. */
+    char const terminate[] = {'X', 0, 0, 0, 4};
+    if (socket_write(chan, terminate, sizeof(terminate), false) <= 0)
+      return false;
+    channel_hangout(chan, "terminate");
+    return true;
+  }
+  if (peer == NULL)
+    return false;
+
+  while (peer->tx_pos < peer->tx_size) /* has something to write */
+  {
+    /*
+     * Hold back responses until ReadyForQuery (which is always the last,
+     * 6 byte message of a batch) so that they leave in as few segments as
+     * possible. Whatever is still held back is flushed by proxy_flush().
+     */
+    int tx_size = peer->tx_size;
+    bool more = chan->coalesce &&
+                !ng_idcp_msgs_end_with_ready(peer->buf, tx_size);
+    ssize_t rc = socket_write(chan, peer->buf + peer->tx_pos,
+                              tx_size - peer->tx_pos, more);
+
+    ELOG(LOG, "%p: write %d tx_pos=%d, tx_size=%d: %m", chan, (int)rc,
+         peer->tx_pos, peer->tx_size);
+    if (rc <= 0)
+      return false;
+
+    if (!chan->client_port)
+      ELOG(LOG, "Send command %c from client %d to backend %d (%p:ready=%d)",
+           peer->buf[peer->tx_pos], peer->client_port->sock, chan->backend_pid,
+           chan, chan->backend_is_ready);
+    else
+      ELOG(LOG, "Send reply %c to client %d from backend %d (%p:ready=%d)",
+           peer->buf[peer->tx_pos], chan->client_port->sock, peer->backend_pid,
+           peer, peer->backend_is_ready);
+
+    if (chan->client_port)
+      chan->proxy->state->tx_bytes += rc;
+    else
+      chan->proxy->state->rx_bytes += rc;
+    peer->tx_pos += rc;
+  }
+  if (peer->tx_size != 0) {
+    /* Copy rest of received data to the beginning of the buffer */
+    chan->backend_is_ready = false;
+    Assert(peer->rx_pos >= peer->tx_size);
+    memmove(peer->buf, peer->buf + peer->tx_size,
+            peer->rx_pos - peer->tx_size);
+    peer->rx_pos -= peer->tx_size;
+    peer->tx_pos = peer->tx_size = 0;
+    if (peer->backend_is_ready && !POOL_IS_SESSION(peer->pool)) {
+      Assert(peer->rx_pos == 0);
+      backend_reschedule(peer, false);
+      return true;
+    }
+  }
+  return synchronous ||
+         channel_read(peer); /* write is not invoked from read */
+} /* channel_write() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Admit an authenticated client. Once the pool has a handshake template, it
+ * is sent right away and the client stays idle until its first query binds
+ * it to a backend (see channel_read()). Otherwise the client is attached to
+ * a backend, whose saved handshake response is sent (AuthenticationOk,
+ * parameter status, backend key data and ReadyForQuery), or once one is
+ * assigned if none is available yet. Either way the client gets its own
+ * BackendKeyData, see client_issue_key().
+ */
+static bool
+client_admit (
+  Channel *chan
+) {
+  SessionPool *pool;
+  Channel *backend;
+
+  if (chan->pool == NULL)
+    client_enter_pool(chan);
+  pool = chan->pool;
+
+  chan->rx_pos = 0; /* Skip startup packet */
+  client_issue_key(chan);
+  if (pool->handshake_template != NULL) {
+    char key_data[HANDSHAKE_KEY_DATA_SIZE];
+
+    uint32 length = pg_hton32(HANDSHAKE_KEY_DATA_SIZE - 1);
+
+    key_data[0] = 'K';
+    memcpy(key_data + 1, &length, sizeof(length));
+    handshake_set_key(chan, key_data, sizeof(key_data));
+    if (chan->auth_out == NULL)
+      chan->auth_out = makeStringInfo();
+    appendBinaryStringInfo(chan->auth_out, pool->handshake_template,
+                           pool->handshake_key_offset);
+    appendBinaryStringInfo(chan->auth_out, key_data, sizeof(key_data));
+    appendBinaryStringInfo(chan->auth_out,
+                           pool->handshake_template +
+                             pool->handshake_key_offset,
+                           pool->handshake_template_size -
+                             pool->handshake_key_offset);
+    chan->auth_status = NG_IDCP_AUTH_OK;
+    chan->is_admitted = true;
+    ELOG(LOG, "Send handshake template to client %p", chan);
+    return client_auth_flush(chan);
+  }
+
+  chan->is_setup = false;
+  client_attach(chan);
+  backend = chan->peer;
+  if (backend != NULL) /* Backend was assigned */
+  {
+    /* Ensure backend hasn't already sent handshake responses */
+    Assert(backend->handshake_response != NULL);
+    Assert(backend->handshake_response_size < backend->buf_size);
+    memcpy(backend->buf, backend->handshake_response,
+      backend->handshake_response_size);
+    handshake_set_key(chan, backend->buf, backend->handshake_response_size);
+    backend->rx_pos = backend->tx_size = backend->handshake_response_size;
+    backend->backend_is_ready = true;
+    elog(DEBUG1, "Send handshake response to the client");
+    return channel_write(chan, false);
+  }
+
+  /*
+   * Handshake response will be send to client later when backend is
+   * assigned
+   */
+  elog(DEBUG1, "Handshake response will be sent to the client later "
+               "when backed is assigned");
+  return false;
+} /* client_admit() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Attach client to backend. Return true if new backend is attached, false
+ * otherwise.
+ */
+static bool
+client_attach (
+  Channel *chan
+) {
+  Channel *idle_backend = chan->pool->idle_backends;
+  chan->is_idle = false;
+  chan->pool->n_idle_clients -= 1;
+  chan->pool->proxy->state->n_idle_clients -= 1;
+  if (idle_backend) {
+    /* has some idle backend */
+    Assert(!idle_backend->client_port);
+    Assert(chan != idle_backend);
+    chan->peer = idle_backend;
+    idle_backend->peer = chan;
+    chan->pool->idle_backends = idle_backend->next;
+    chan->pool->n_idle_backends -= 1;
+    chan->pool->proxy->state->n_idle_backends -= 1;
+    idle_backend->is_idle = false;
+    if (g_ng_idcp_cfg_idle_worker_timeout_in_ms)
+      chan->backend_last_activity = GetCurrentTimestamp();
+    ELOG(LOG, "Attach client %p to backend %p (pid %d)", chan, idle_backend,
+         idle_backend->backend_pid);
+  } else /* all backends are busy */
+  {
+    if (chan->pool->n_launched_backends < chan->pool->settings.pool_size &&
+        pool_reserve_backend(chan->pool)) {
+      char *error;
+      /* Try to start new backend */
+      idle_backend = backend_start(chan->pool, &error);
+      if (idle_backend != NULL) {
+        ELOG(LOG, "Start new backend %p (pid %d) for client %p", idle_backend,
+             idle_backend->backend_pid, chan);
+        Assert(chan != idle_backend);
+        chan->peer = idle_backend;
+        idle_backend->peer = chan;
+        if (g_ng_idcp_cfg_idle_worker_timeout_in_ms)
+          idle_backend->backend_last_activity = GetCurrentTimestamp();
+        return true;
+      } else {
+        if (error) {
+          report_error_to_client(chan, error);
+          free(error);
+        }
+        channel_hangout(chan, "connect");
+        return false;
+      }
+    }
+    /* Postpone handshake until some backend is available */
+    ELOG(LOG, "Client %p is waiting for available backends", chan);
+    chan->next = chan->pool->pending_clients;
+    chan->pool->pending_clients = chan;
+    chan->pool->n_pending_clients += 1;
+  }
+  return false;
+} /* client_attach() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Release the authentication state of a client.
+ */
+static void
+client_auth_end (
+  Channel *chan
+) {
+  if (chan->auth != NULL) {
+    ng_idcp_auth_end(chan->auth);
+    chan->auth = NULL;
+  }
+  if (chan->auth_out != NULL) {
+    pfree(chan->auth_out->data);
+    pfree(chan->auth_out);
+    chan->auth_out = NULL;
+  }
+} /* client_auth_end() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Send pending authentication messages, then act on the outcome of the last
+ * step: wait for the client's next response, disconnect it, or admit it.
+ */
+static bool
+client_auth_flush (
+  Channel *chan
+) {
+  StringInfo out = chan->auth_out;
+
+  while (out->cursor < out->len) {
+    ssize_t rc = socket_write(chan, out->data + out->cursor,
+                              out->len - out->cursor, false);
+    if (rc <= 0)
+      return false; /* disconnected, or waiting until writable */
+    chan->proxy->state->tx_bytes += rc;
+    out->cursor += rc;
+  }
+  resetStringInfo(out);
+
+  switch (chan->auth_status) {
+    case NG_IDCP_AUTH_CONTINUE:
+      /* Collect the client's response */
+      return channel_read(chan);
+    case NG_IDCP_AUTH_FAILED:
+      channel_hangout(chan, "authentication");
+      return false;
+    default:
+      client_auth_end(chan);
+      if (!chan->is_admitted)
+        return client_admit(chan);
+      /* Once the handshake is out, go on with the client's queries */
+      chan->is_setup = false;
+      return channel_read(chan);
+  }
+} /* client_auth_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Begin authentication of a client whose startup packet was accepted.
+ * Returns true if it can be admitted right away, otherwise the exchange is
+ * continued by client_auth_flush().
+ */
+static bool
+client_auth_start (
+  Channel *chan
+) {
+  StringInfo out = chan->auth_out ? chan->auth_out : makeStringInfo();
+
+  chan->auth_status = ng_idcp_auth_start(chan->client_port, out, &chan->auth);
+  if (chan->auth_status == NG_IDCP_AUTH_OK && out->len == 0) {
+    pfree(out->data);
+    pfree(out);
+    chan->auth_out = NULL;
+    return true;
+  }
+  chan->auth_out = out;
+  return false;
+} /* client_auth_start() */
+
+/* ------------------------------------------------------------------------- */
+
+/**
+ * Parse client's startup packet. The client is assigned to the pool of its
+ * dbname/role once it is authenticated, see client_enter_pool().
+ */
+static bool
+client_connect (
+  Channel    *chan,
+  int         startup_packet_size
+) {
+  NgIdcpStartupPacket packet;
+  Port *port = chan->client_port;
+  char *error;
+
+  Assert(port);
+
+  /*
+   * The packet is parsed straight from the channel buffer (skipping its
+   * length word) into the client's own memory context.
+   */
+  if (ng_idcp_startup_packet_parse(chan->memctx, chan->buf + 4,
+                                   startup_packet_size - 4, &packet,
+                                   &error) != STATUS_OK) {
+    if (error != NULL) {
+      elog(WARNING, "PROXY: rejected startup packet: %s", error);
+      report_error_to_client(chan, error);
+    }
+    return false;
+  }
+  if (packet.replication) {
+    report_error_to_client(chan, "WAL sender should not be connected "
+                                 "through proxy");
+    return false;
+  }
+  port->proto = packet.proto;
+  port->database_name = packet.database_name;
+  port->user_name = packet.user_name;
+  port->cmdline_options = packet.cmdline_options;
+  port->application_name = packet.application_name;
+  port->guc_options = packet.guc_options;
+
+  /* Sent ahead of the authentication exchange, see client_auth_start() */
+  chan->auth_out = packet.negotiate;
+
+#ifdef NG_IDCP_USE_IO_URING
+  /* Plain clients switch from readiness polling to multishot recv */
+  if (chan->proxy->uring != NULL && !chan->client_port->ssl_in_use)
+    channel_uring_start_recv(chan);
+#endif
+  return true;
+} /* client_connect() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Assign an authenticated client to the pool of its dbname/role and startup
+ * parameters, creating the pool for the first such client. Pools and names
+ * are only created for authenticated clients, so that the proxy's memory
+ * can't be grown by logins that fail.
+ */
+static void
+client_enter_pool (
+  Channel *chan
+) {
+  SessionPoolKey key;
+  MemoryContext proxy_ctx;
+  List *startup_gucs = NIL;
+
+  /* Session GUCs and the normalized startup parameters are the client's */
+  proxy_ctx = MemoryContextSwitchTo(chan->memctx);
+
+  memset(&key, 0, sizeof(key));
+  key.database = proxy_intern(chan->proxy, chan->client_port->database_name);
+  if (MultitenantProxy) {
+    chan->gucs = psprintf("set local role %s;", chan->client_port->user_name);
+    key.username = proxy_intern(chan->proxy, "");
+  } else
+    key.username = proxy_intern(chan->proxy, chan->client_port->user_name);
+
+  if (!ProxyingGUCs) {
+    /*
+     * Startup parameters are given to the backends of a pool, so clients
+     * asking for different ones need different pools.
+     */
+    startup_gucs = startup_options_normalize(chan->proxy,
+                                             chan->client_port->guc_options);
+    key.options_hash = startup_options_hash(startup_gucs,
+                                            chan->client_port->cmdline_options);
+  }
+
+  ELOG(LOG, "Client %p connects to %s/%s", chan, key.database, key.username);
+
+  chan->pool = pool_enter(chan->proxy, &key, startup_gucs,
+                          chan->client_port->cmdline_options);
+  MemoryContextSetParent(chan->memctx, chan->pool->memctx);
+  if (ProxyingGUCs) {
+    ListCell *gucopts = list_head(chan->client_port->guc_options);
+    while (gucopts) {
+      char *name;
+      char *value;
+
+      name = lfirst(gucopts);
+      gucopts = lnext(chan->client_port->guc_options, gucopts);
+
+      value = lfirst(gucopts);
+      gucopts = lnext(chan->client_port->guc_options, gucopts);
+
+      chan->gucs = psprintf("%sset local %s='%s';",
+                            chan->gucs ? chan->gucs : "", name, value);
+    }
+  }
+  MemoryContextSwitchTo(proxy_ctx);
+  chan->pool->n_connected_clients += 1;
+  chan->proxy->n_accepted_connections -= 1;
+  chan->pool->n_idle_clients += 1;
+  chan->pool->proxy->state->n_idle_clients += 1;
+  chan->is_idle = true;
+} /* client_enter_pool() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Advance encryption negotiation of a new client without blocking: send the
+ * answer to its SSLRequest/GSSENCRequest and step the TLS handshake. Returns
+ * false if the client was disconnected; negotiation is complete once
+ * chan->negotiation is NEGOTIATION_NONE, otherwise it is resumed on the next
+ * socket event.
+ */
+static bool
+client_handshake (
+  Channel *chan
+) {
+  Port *port = chan->client_port;
+
+  if (chan->negotiation == NEGOTIATION_REPLY) {
+    ssize_t rc = send(port->sock, &chan->negotiation_reply, 1, 0);
+    if (rc != 1) {
+      if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                     errno == EINTR)) {
+        channel_wait_writable(chan);
+        return true;
+      }
+      ereport(COMMERROR,
+              (errcode_for_socket_access(),
+               errmsg("failed to send encryption negotiation response: %m")));
+      channel_hangout(chan, "negotiation");
+      return false;
+    }
+    if (chan->negotiation_reply != 'S') {
+      chan->negotiation = NEGOTIATION_NONE;
+      return true;
+    }
+#ifdef USE_SSL
+    if (ng_idcp_tls_start(port) < 0) {
+      channel_hangout(chan, "TLS handshake");
+      return false;
+    }
+#endif
+    chan->negotiation = NEGOTIATION_TLS;
+  }
+
+#ifdef USE_SSL
+  if (chan->negotiation == NEGOTIATION_TLS) {
+    int waitfor = 0;
+    int rc = ng_idcp_tls_accept(port, &waitfor);
+    if (rc < 0) {
+      channel_hangout(chan, "TLS handshake");
+      return false;
+    }
+    if (rc == 0) {
+      /* Readable events are always delivered; ask for writable ones */
+      if (waitfor & WL_SOCKET_WRITEABLE)
+        channel_wait_writable(chan);
+      return true;
+    }
+    chan->negotiation = NEGOTIATION_NONE;
+    if (ng_idcp_tls_ktls_send(port)) {
+      chan->kind = CHANNEL_CLIENT_KTLS;
+    } else {
+      /* MSG_MORE cannot hold back records written by OpenSSL */
+      chan->kind = CHANNEL_CLIENT_TLS;
+      chan->coalesce = false;
+    }
+    chan->proxy->state->n_ssl_clients += 1;
+  }
+#endif
+
+  return true;
+} /* client_handshake() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Check whether a complete startup-phase packet is an SSLRequest or
+ * GSSENCRequest. If so, the answer is queued for client_handshake() and 1 is
+ * returned; -1 means the request is not acceptable, 0 that this is a regular
+ * startup (or cancel) packet.
+ *
+ * GSSAPI encryption is always declined: secure_open_gssapi() runs the whole
+ * exchange with blocking reads, which would stall the proxy. Clients then
+ * continue with TLS or an unencrypted connection, as they would with a
+ * server built without GSSAPI.
+ */
+static int
+client_negotiate (
+  Channel    *chan,
+  int         msg_len
+) {
+  Port *port = chan->client_port;
+  ProtocolVersion proto;
+  char reply = 'N';
+
+  if (msg_len != 8)
+    return 0;
+  memcpy(&proto, chan->buf + 4, sizeof(proto));
+  proto = pg_ntoh32(proto);
+
+  if (proto == NEGOTIATE_SSL_CODE) {
+    if (chan->ssl_done) {
+      ereport(COMMERROR,
+              (errcode(ERRCODE_PROTOCOL_VIOLATION),
+               errmsg("unexpected SSL negotiation request")));
+      return -1;
+    }
+#ifdef USE_SSL
+    /* No SSL when disabled or on Unix sockets */
+    if (ng_idcp_tls_loaded() && port->laddr.addr.ss_family != AF_UNIX)
+      reply = 'S';
+#endif
+    /* GSS request may only follow if SSL was rejected */
+    chan->ssl_done = true;
+    chan->gss_done = chan->gss_done || reply == 'S';
+  } else if (proto == NEGOTIATE_GSS_CODE) {
+    if (chan->gss_done) {
+      ereport(COMMERROR,
+              (errcode(ERRCODE_PROTOCOL_VIOLATION),
+               errmsg("unexpected GSSAPI negotiation request")));
+      return -1;
+    }
+    chan->gss_done = true;
+  } else {
+    return 0;
+  }
+
+  /*
+   * At this point we should have no data already buffered. If we do, it was
+   * received before the encryption handshake, so it wasn't encrypted and
+   * indeed may have been injected by a man-in-the-middle.
+   */
+  if (chan->rx_pos > msg_len) {
+    ereport(COMMERROR,
+            (errcode(ERRCODE_PROTOCOL_VIOLATION),
+             errmsg("received unencrypted data after encryption request"),
+             errdetail("This could be either a client-software bug or "
+                       "evidence of an attempted man-in-the-middle attack.")));
+    return -1;
+  }
+
+  chan->rx_pos = 0;
+  chan->negotiation_reply = reply;
+  chan->negotiation = NEGOTIATION_REPLY;
+  return 1;
+} /* client_negotiate() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read from a client and pass its complete messages on to its backend, the
+ * read operation of client channels. Until the client is admitted this also
+ * takes the startup packet and the authentication exchange.
+ */
+static bool
+client_read (
+  Channel *chan
+) {
+  int msg_start;
+
+  if (chan->is_setup && chan->negotiation != NEGOTIATION_NONE) {
+    /* Encryption negotiation must finish before the startup packet */
+    if (!client_handshake(chan) || chan->negotiation != NEGOTIATION_NONE)
+      return false;
+  }
+
+  while (chan->tx_size == 0) /* there is no pending write op */
+  {
+    ssize_t rc;
+    bool handshake = false;
+
+    rc = channel_recv(chan);
+    ELOG(LOG, "%p: read %d: %m", chan, (int)rc);
+
+    if (rc <= 0) {
+      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        channel_hangout(chan, "read");
+      return false; /* wait for more data */
+    }
+    /* resume reading if it was disabled by a pending write */
+    channel_arm(chan, chan->armed_events | WL_SOCKET_READABLE);
+
+    ELOG(LOG,
+         "Receive command %c %d bytes from client %d to backend %d "
+         "(%p:ready=%d)",
+         chan->buf[0] ? chan->buf[0] : '?', (int)rc + chan->rx_pos,
+         chan->client_port->sock, chan->peer ? chan->peer->backend_pid : -1,
+         chan->peer, chan->peer ? chan->peer->backend_is_ready : -1);
+
+    chan->rx_pos += rc;
+    msg_start = 0;
+
+    /* Loop through all received messages */
+    while (chan->rx_pos - msg_start >= NG_IDCP_MSG_HEADER_SIZE)
+    {
+      int msg_len;
+
+      if (chan->is_setup && chan->client_port->user_name == NULL) {
+        /* process startup packet */
+        Assert(msg_start == 0);
+        handshake = true;
+      } else if (chan->pool == NULL && chan->auth == NULL) {
+        /* Authenticated, leave queries buffered until admitted */
+        break;
+      } else {
+        ELOG(LOG, "%p receive message %c", chan, chan->buf[msg_start]);
+      }
+      msg_len = ng_idcp_msg_length(chan->buf + msg_start, handshake);
+      if (handshake && (msg_len < (int) (4 + sizeof(ProtocolVersion)) ||
+                        msg_len > MAX_STARTUP_PACKET_LENGTH)) {
+        /* Don't buffer whatever a bogus length word asks for */
+        channel_hangout(chan, "startup packet");
+        return false;
+      }
+      if (!handshake && chan->auth != NULL &&
+          (msg_len < NG_IDCP_MSG_HEADER_SIZE ||
+           msg_len > PG_MAX_AUTH_TOKEN_LENGTH + NG_IDCP_MSG_HEADER_SIZE)) {
+        /* Nor before the client is authenticated */
+        channel_hangout(chan, "authentication");
+        return false;
+      }
+
+      if (msg_start + msg_len > chan->buf_size) {
+        /* Reallocate buffer to fit complete message body */
+        chan->buf_size = msg_start + msg_len;
+        chan->buf = repalloc(chan->buf, chan->buf_size);
+      }
+
+      if (chan->rx_pos - msg_start >= msg_len) {
+        /* Message is completely fetched */
+        if (handshake) {
+          /* receive startup packet */
+          switch (client_negotiate(chan, msg_len)) {
+            case 1:
+              /* Answer SSLRequest/GSSENCRequest, then read startup packet */
+              return channel_read(chan);
+            case -1:
+              channel_hangout(chan, "negotiation");
+              return false;
+            default:
+              break;
+          }
+          if (!client_connect(chan, msg_len)) {
+            /* Some trouble with processing startup packet */
+            chan->is_disconnected = true;
+            channel_remove(chan);
+            return false;
+          }
+          if (!client_auth_start(chan)) {
+            /* Credentials are checked before a backend is assigned */
+            chan->rx_pos = 0;
+            return client_auth_flush(chan);
+          }
+        } else if (chan->is_setup && chan->auth != NULL) {
+          /* Response to an authentication request */
+          chan->auth_status = ng_idcp_auth_exchange(
+            chan->auth, chan->buf[msg_start], chan->buf + msg_start + 5,
+            msg_len - 5, chan->auth_out);
+          chan->rx_pos = 0;
+          return client_auth_flush(chan);
+        } else {
+          /* Message from client */
+          switch (chan->buf[msg_start]) {
+            /* one-packet queries */
+            case 'Q':    /* Query */
+              if ((ProxyingGUCs || MultitenantProxy) && !chan->in_transaction) {
+                char *stmt = &chan->buf[msg_start + 5];
+                if (chan->prev_gucs) {
+                  pfree(chan->prev_gucs);
+                  chan->prev_gucs = NULL;
+                }
+                if (ProxyingGUCs &&
+                    ((pg_strncasecmp(stmt, "set", 3) == 0 &&
+                      pg_strncasecmp(stmt + 3, " local", 6) != 0) ||
+                     pg_strncasecmp(stmt, "reset", 5) == 0)) {
+                  char *new_msg;
+                  MemoryContext old_ctx = MemoryContextSwitchTo(chan->memctx);
+
+                  chan->prev_gucs = chan->gucs ? chan->gucs : pstrdup("");
+                  if (pg_strncasecmp(stmt, "reset", 5) == 0) {
+                    char *semi = strchr(stmt + 5, ';');
+                    if (semi)
+                      *semi = '\0';
+                    chan->gucs = psprintf("%sset local%s=default;",
+                                          chan->prev_gucs, stmt + 5);
+                  } else {
+                    char *param = stmt + 3;
+                    if (pg_strncasecmp(param, " session", 8) == 0)
+                      param += 8;
+                    chan->gucs =
+                        psprintf("%sset local%s%c", chan->prev_gucs, param,
+                                 chan->buf[chan->rx_pos - 2] == ';' ? ' ' : ';');
+                  }
+                  MemoryContextSwitchTo(old_ctx);
+                  new_msg = chan->gucs + strlen(chan->prev_gucs);
+                  Assert(msg_start + strlen(new_msg) * 2 + 6 < chan->buf_size);
                   /*
                    * We need to send SET command to check if it is correct.
                    * To avoid "SET LOCAL can only be used in transaction blocks"
@@ -879,9 +2856,7 @@ channel_read (
                    * command.
                    */
                   msg_len = sprintf(stmt, "%s%s", new_msg, new_msg) + 6;
-                  new_msg_len = pg_hton32(msg_len - 1);
-                  memcpy(&chan->buf[msg_start + 1], &new_msg_len,
-                         sizeof(new_msg_len));
+                  ng_idcp_msg_set_length(chan->buf + msg_start, msg_len);
                   chan->rx_pos = msg_start + msg_len;
                 } else if (chan->gucs && is_transactional_statement(stmt)) {
                   size_t gucs_len = strlen(chan->gucs);
@@ -908,763 +2883,2418 @@ channel_read (
                   }
                   chan->rx_pos += gucs_len;
                   msg_len += gucs_len;
-                  new_msg_len = pg_hton32(msg_len - 1);
-                  memcpy(&chan->buf[msg_start + 1], &new_msg_len,
-                         sizeof(new_msg_len));
+                  ng_idcp_msg_set_length(chan->buf + msg_start, msg_len);
                 } else if (is_transaction_start(stmt))
                   chan->in_transaction = true;
               }
               break;
 
-            case 'F':    /* FunctionCall */
-              break;
+            case 'F':    /* FunctionCall */
+              break;
+
+            /* request immediate response from server */
+            case 'S':    /* Sync */
+              break;
+
+            case 'H':    /* Flush */
+              break;
+
+            /* copy end markers */
+            case 'c':    /* CopyDone(F/B) */
+            case 'f':    /* CopyFail(F/B) */
+              break;
+
+            /*
+             * extended protocol allows server (and thus pooler)
+             * to buffer packets until sync or flush is sent by client
+             */
+            case 'P':    /* Parse */
+              break;
+
+            case 'E':    /* Execute */
+              break;
+
+            case 'C':    /* Close */
+              break;
+
+            case 'B':    /* Bind */
+              break;
+
+            case 'D':    /* Describe */
+              break;
+
+            case 'd':    /* CopyData(F/B) */
+              break;
+
+            case 'X':  /* Terminate */
+              {
+                Channel *backend = chan->peer;
+                elog(DEBUG1, "Receive 'X' to backend %d",
+                     backend != NULL ? backend->backend_pid : 0);
+                chan->is_interrupted = true;
+                if (backend != NULL && !backend->backend_is_ready) {
+                  /* If client send abort inside transaction, then mark backend as
+                   * tainted */
+                  chan->proxy->state->n_dedicated_backends += 1;
+                  chan->pool->n_dedicated_backends += 1;
+                }
+                if (backend != NULL && backend->backend_is_ready) {
+                  /* Session ends outside a transaction: reset and keep
+                   * the backend */
+                  backend_reschedule(backend, false);
+                  backend = NULL;
+                }
+                if (backend == NULL) {
+                  /* Skip terminate message to idle and non-tainted backends */
+                  channel_hangout(chan, "terminate");
+                  return false;
+                }
+              }
+              break;
+
+            /* client wants to go away */
+            default:
+              elog(WARNING, "unknown pkt from client: %c", chan->buf[msg_start]);
+          }
+
+        }
+        msg_start += msg_len;
+      } else {
+        break; /* Incomplete message. */
+      }
+    }
+    elog(DEBUG1, "Message size %d", msg_start);
+    if (msg_start != 0) {
+      /* Has some complete messages to send to peer */
+      if (chan->peer == NULL)
+      {
+        /* client is not yet connected to backend */
+        if (handshake) {
+          /* Send handshake response to the client */
+          return client_admit(chan);
+        }
+        client_attach(chan);
+        if (chan->peer == NULL) {
+          /* Backend was not assigned */
+          chan->tx_size = msg_start;
+          /* query will be send later once backend is assigned */
+          elog(DEBUG1, "Query will be sent to this client later when backed "
+                       "is assigned");
+          return false;
+        }
+      }
+      Assert(chan->tx_pos == 0);
+      Assert(chan->rx_pos >= msg_start);
+      chan->tx_size = msg_start;
+      if (!channel_write(chan->peer, true)) {
+        return false;
+      }
+    }
+
+    /* Do not try to read more data if edge-triggered mode is not supported */
+    if (!WaitEventUseEpoll) {
+      break;
+    }
+  }
+  return true;
+} /* client_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  return secure_raw_read(chan->client_port, buf, size);
+} /* client_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_send (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  return secure_raw_write(chan->client_port, buf, size);
+} /* client_send() */
+
+#ifdef USE_SSL
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Send to a client whose TLS records are produced by the kernel: plaintext
+ * goes to the socket, see ng_idcp_tls_ktls_send().
+ */
+static ssize_t
+client_send_ktls (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  return send(chan->client_port->sock, buf, size, 0);
+} /* client_send_ktls() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_tls_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  int waitfor = 0;
+
+  return be_tls_read(chan->client_port, buf, size, &waitfor);
+} /* client_tls_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_tls_send (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  int waitfor = 0;
+
+  return be_tls_write(chan->client_port, (char *) buf, size, &waitfor);
+} /* client_tls_send() */
+#endif
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+is_transactional_statement (
+  char *stmt
+) {
+  static char const *const non_tx_stmts[] = {
+    "create tablespace",
+    "create database",
+    "cluster",
+    "drop",
+    "discard",
+    "reindex",
+    "rollback",
+    "vacuum",
+    NULL
+  };
+  int i;
+  for (i = 0; non_tx_stmts[i]; i++) {
+    if (pg_strncasecmp(stmt, non_tx_stmts[i], strlen(non_tx_stmts[i])) == 0) {
+      return false;
+    }
+  }
+  return true;
+} /* is_transactional_statement() */
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+is_transaction_start (
+  char *stmt
+) {
+  return pg_strncasecmp(stmt, "begin", 5) == 0 ||
+         pg_strncasecmp(stmt, "start", 5) == 0;
+} /* is_transaction_start() */
+
+/* ------------------------------------------------------------------------- */
+
+static void *
+libpq_connectdb (
+  char const   *keywords[],
+  char const   *values[],
+  char        **error
+) {
+  PGconn *conn = PQconnectdbParams(keywords, values, false);
+  if (conn && PQstatus(conn) != CONNECTION_OK) {
+    ereport(WARNING,
+            (errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
+             errmsg("could not setup local connect to server"),
+             errdetail_internal("%s", pchomp(PQerrorMessage(conn)))));
+    *error = strdup(PQerrorMessage(conn));
+    PQfinish(conn);
+    return NULL;
+  }
+  *error = NULL;
+  return conn;
+} /* libpq_connectdb() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Answer the clients that were queued before the pool had a handshake
+ * template and still wait for their handshake response, rather than for a
+ * backend to run a query.
+ */
+static void
+pool_admit_pending (
+  SessionPool *pool
+) {
+  Channel **ipp = &pool->pending_clients;
+  Channel *admit = NULL;
+
+  while (*ipp != NULL) {
+    Channel *client = *ipp;
+
+    if (client->tx_size != 0) {
+      ipp = &client->next;
+      continue;
+    }
+    *ipp = client->next;
+    pool->n_pending_clients -= 1;
+    client->next = admit;
+    admit = client;
+  }
+
+  while (admit != NULL) {
+    Channel *client = admit;
+
+    admit = client->next;
+    client->next = NULL;
+    /* client_attach() counted the client as busy */
+    client->is_idle = true;
+    pool->n_idle_clients += 1;
+    pool->proxy->state->n_idle_clients += 1;
+    client_admit(client);
+  }
+} /* pool_admit_pending() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Look up the settings of a pool in the configuration snapshot. Without a
+ * configured pool size the worker's default applies.
+ */
+static void
+pool_configure (
+  SessionPool *pool
+) {
+  ng_idcp_pool_config_lookup(pool->key.database, pool->key.username,
+                             &pool->settings);
+  if (pool->settings.pool_size <= 0)
+    pool->settings.pool_size = pool->proxy->max_backends;
+} /* pool_configure() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Look up the pool for a key, creating it for the first connection to this
+ * role/dbname/parameters. A pool found by the hash of the startup parameters
+ * must also have the same parameters: on a collision the next hash value is
+ * tried, so that colliding parameters still get pools of their own.
+ */
+static SessionPool *
+pool_enter (
+  Proxy            *proxy,
+  SessionPoolKey   *key,
+  List             *startup_gucs,
+  const char       *cmdline_options
+) {
+  SessionPool *pool;
+  bool found;
+
+  for (;;) {
+    pool = (SessionPool *) hash_search(proxy->pools, key, HASH_ENTER, &found);
+    if (!found || ProxyingGUCs ||
+        (string_list_equal(pool->startup_gucs, startup_gucs) &&
+         string_equal(pool->cmdline_options, cmdline_options)))
+      break;
+    /* 64-bit hash collision: should never happen in practice */
+    elog(LOG, "PROXY: startup parameters collide with those of another pool");
+    if (++key->options_hash == 0)
+      key->options_hash = 1;
+  }
+
+  if (!found) {
+    proxy->state->n_pools += 1;
+    memset((char *)pool + sizeof(SessionPoolKey), 0,
+           sizeof(SessionPool) - sizeof(SessionPoolKey));
+    pool->proxy = proxy;
+    pool->memctx = AllocSetContextCreate(GetMemoryChunkContext(proxy),
+                                         "Proxy pool", ALLOCSET_SMALL_SIZES);
+    if (!ProxyingGUCs) {
+      MemoryContext old_ctx = MemoryContextSwitchTo(pool->memctx);
+
+      pool->startup_gucs = string_list_copy(startup_gucs);
+      if (cmdline_options)
+        pool->cmdline_options = pstrdup(cmdline_options);
+      MemoryContextSwitchTo(old_ctx);
+    }
+    /* The key refers to the interned names */
+    ((InternedName *) key->database)->refcount += 1;
+    ((InternedName *) key->username)->refcount += 1;
+    pool_configure(pool);
+  }
+  return pool;
+} /* pool_enter() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Make room for a throttled pool: terminate an idle backend of another pool
+ * of this worker that counts against the same database (or role) limit.
+ * Its slot is taken over when the pool is retried.
+ */
+static void
+pool_evict_idle_backend (
+  SessionPool  *pool,
+  int           kind
+) {
+  HASH_SEQ_STATUS seq;
+  SessionPool *other;
+
+  hash_seq_init(&seq, pool->proxy->pools);
+  while ((other = hash_seq_search(&seq)) != NULL) {
+    Channel *chan;
+
+    /* Names are interned, so they can be compared by address */
+    if (other == pool ||
+        (kind == NG_IDCP_CONN_LIMIT_DATABASE
+           ? other->key.database != pool->key.database
+           : other->key.username != pool->key.username))
+      continue;
+    for (chan = other->idle_backends; chan != NULL; chan = chan->next) {
+      if (!chan->is_interrupted) {
+        ELOG(LOG, "Terminate idle backend %p (pid %d) to free a slot", chan,
+             chan->backend_pid);
+        hash_seq_term(&seq);
+        chan->is_interrupted =
+            true; /* interrupted flags makes channel_write to send 'X'
+                     message */
+        channel_write(chan, false);
+        return;
+      }
+    }
+  }
+} /* pool_evict_idle_backend() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Find or create the pool of a session handed off by the worker this one
+ * replaces, as described by pool_handoff_put().
+ */
+static SessionPool *
+pool_handoff_get (
+  Proxy        *proxy,
+  StringInfo    msg
+) {
+  SessionPoolKey key;
+  SessionPool *pool;
+  List *startup_gucs = NIL;
+  char *database;
+  char *username;
+  char *cmdline_options;
+  int n;
+
+  database = ng_idcp_handoff_get_string(msg);
+  username = ng_idcp_handoff_get_string(msg);
+  cmdline_options = ng_idcp_handoff_get_string(msg);
+  for (n = (int) pq_getmsgint(msg, 4); n > 0; n--)
+    startup_gucs = lappend(startup_gucs, ng_idcp_handoff_get_string(msg));
+
+  /* The startup parameters were normalized by the predecessor */
+  memset(&key, 0, sizeof(key));
+  key.database = proxy_intern(proxy, database);
+  key.username = proxy_intern(proxy, username);
+  if (!ProxyingGUCs)
+    key.options_hash = startup_options_hash(startup_gucs, cmdline_options);
+  pool = pool_enter(proxy, &key, startup_gucs, cmdline_options);
+
+  list_free_deep(startup_gucs);
+  if (cmdline_options)
+    pfree(cmdline_options);
+  pfree(username);
+  pfree(database);
+  return pool;
+} /* pool_handoff_get() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Describe the pool of a session handed off to a replacement worker.
+ */
+static void
+pool_handoff_put (
+  StringInfo    msg,
+  SessionPool  *pool
+) {
+  ListCell *cell;
+
+  ng_idcp_handoff_put_string(msg, pool->key.database);
+  ng_idcp_handoff_put_string(msg, pool->key.username);
+  ng_idcp_handoff_put_string(msg, pool->cmdline_options);
+  pq_sendint32(msg, list_length(pool->startup_gucs));
+  foreach (cell, pool->startup_gucs) {
+    ng_idcp_handoff_put_string(msg, (const char *) lfirst(cell));
+  }
+} /* pool_handoff_put() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Give back the database and role slots of a backend of this pool.
+ */
+static void
+pool_release_backend (
+  SessionPool *pool
+) {
+  ng_idcp_conn_limit_release(NG_IDCP_CONN_LIMIT_DATABASE, pool->key.database);
+  if (pool->key.username[0] != '\0')
+    ng_idcp_conn_limit_release(NG_IDCP_CONN_LIMIT_USER, pool->key.username);
+} /* pool_release_backend() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Forget a pool that has no clients and no backends left, along with the
+ * names only its key referred to, so that pools of past connections don't
+ * accumulate. The pool is created again by the next client that needs it.
+ */
+static void
+pool_remove_if_unused (
+  SessionPool *pool
+) {
+  Proxy *proxy = pool->proxy;
+  SessionPoolKey key = pool->key;
+
+  if (pool->n_connected_clients > 0 || pool->n_launched_backends > 0 ||
+      pool->is_throttled || pool->pending_clients != NULL ||
+      pool->idle_backends != NULL)
+    return;
+
+  ELOG(LOG, "Remove unused pool %s/%s", key.database, key.username);
+  proxy->state->n_pools -= 1;
+  if (pool->handshake_template != NULL)
+    pfree(pool->handshake_template);
+  MemoryContextDelete(pool->memctx);
+  hash_search(proxy->pools, &key, HASH_REMOVE, NULL);
+  proxy_unintern(proxy, key.database);
+  proxy_unintern(proxy, key.username);
+} /* pool_remove_if_unused() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Reserve the database and role slots needed to start a backend for this
+ * pool. Limits are global: the slots may be taken by backends of any proxy
+ * worker. When they are exhausted the pool is throttled: its pending clients
+ * stay queued and proxy_retry_throttled() starts backends for them once
+ * slots are released. Multitenant pools (with an empty role) are only
+ * limited per database.
+ */
+static bool
+pool_reserve_backend (
+  SessionPool *pool
+) {
+  int exhausted;
+
+  if (!ng_idcp_conn_limit_acquire(NG_IDCP_CONN_LIMIT_DATABASE,
+                                  pool->key.database,
+                                  pool->settings.max_db_connections)) {
+    exhausted = NG_IDCP_CONN_LIMIT_DATABASE;
+  } else if (pool->key.username[0] != '\0' &&
+             !ng_idcp_conn_limit_acquire(NG_IDCP_CONN_LIMIT_USER,
+                                         pool->key.username,
+                                         pool->settings.max_user_connections)) {
+    ng_idcp_conn_limit_release(NG_IDCP_CONN_LIMIT_DATABASE,
+                               pool->key.database);
+    exhausted = NG_IDCP_CONN_LIMIT_USER;
+  } else {
+    return true;
+  }
+
+  if (!pool->is_throttled) {
+    ELOG(LOG, "Pool %s/%s reached max_%s_connections", pool->key.database,
+         pool->key.username,
+         exhausted == NG_IDCP_CONN_LIMIT_DATABASE ? "db" : "user");
+    pool->is_throttled = true;
+    pool->proxy->throttled = lappend(pool->proxy->throttled, pool);
+  }
+  pool_evict_idle_backend(pool, exhausted);
+  return false;
+} /* pool_reserve_backend() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Keep the handshake response of the first backend of a pool as the
+ * template new clients are answered with, see client_admit(). Backends of a
+ * pool share database, role and startup parameters, so their responses only
+ * differ in BackendKeyData, which is left out of the template.
+ */
+static void
+pool_save_handshake (
+  SessionPool  *pool,
+  Channel      *backend
+) {
+  char *msg = backend->handshake_response;
+  char *end = msg + backend->handshake_response_size;
+  int   size = 0;
+
+  if (pool->handshake_template != NULL)
+    return;
+  pool->handshake_template = palloc(backend->handshake_response_size);
+  pool->handshake_key_offset = -1;
+  while (msg < end) {
+    int length = ng_idcp_msg_length(msg, false);
+
+    if (*msg == 'K')
+      pool->handshake_key_offset = size;
+    else {
+      memcpy(pool->handshake_template + size, msg, length);
+      size += length;
+    }
+    msg += length;
+  }
+  Assert(pool->handshake_key_offset >= 0);
+  pool->handshake_template_size = size;
+} /* pool_save_handshake() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Issue the BackendKeyData of a client. Cancel requests are not supported by
+ * the proxy yet, so the key only has to be distinct per client: the pid
+ * encodes the worker and channel slot, the secret is random.
+ */
+static void
+client_issue_key (
+  Channel *chan
+) {
+  uint32 secret;
+
+  chan->key_pid = (int32) (((uint32) MyProxyId << 24 | chan->slot) &
+                           PG_INT32_MAX);
+  if (!pg_strong_random(&secret, sizeof(secret)))
+    secret = pg_prng_uint32(&pg_global_prng_state);
+  chan->key_secret = (int32) secret;
+} /* client_issue_key() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Replace the BackendKeyData in a handshake response sent to a client by
+ * the key issued to that client.
+ */
+static void
+handshake_set_key (
+  Channel  *client,
+  char     *msgs,
+  int       size
+) {
+  char *msg = msgs;
+
+  while (msg < msgs + size) {
+    if (*msg == 'K') {
+      uint32 pid = pg_hton32((uint32) client->key_pid);
+      uint32 secret = pg_hton32((uint32) client->key_secret);
+
+      memcpy(msg + 5, &pid, sizeof(pid));
+      memcpy(msg + 9, &secret, sizeof(secret));
+      return;
+    }
+    msg += ng_idcp_msg_length(msg, false);
+  }
+} /* handshake_set_key() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Accept new connections on a listening socket until its backlog is drained,
+ * but no more than ACCEPT_BUDGET at a time so that a connection storm can't
+ * starve the established sessions. Listening sockets are level-triggered, so
+ * the rest is picked up on the next wakeup.
+ */
+static void
+proxy_accept (
+  Proxy        *proxy,
+  pgsocket      listen_socket
+) {
+  int n_accepted;
+
+  for (n_accepted = 0; n_accepted < ACCEPT_BUDGET; n_accepted++) {
+    Port *port = (Port *)palloc0(sizeof(Port));
+
+    if (ng_idcp_stream_connection(listen_socket, port) != STATUS_OK) {
+      int save_errno = errno;
+
+      if (port->sock != PGINVALID_SOCKET) {
+        /* Accepted, but the socket could not be set up */
+        StreamClose(port->sock);
+        pfree(port);
+        continue;
+      }
+      pfree(port);
+      if (save_errno == EMFILE || save_errno == ENFILE) {
+        if (proxy_shed_connection(proxy, listen_socket))
+          continue;
+        return;
+      }
+      if (save_errno == ECONNABORTED || save_errno == EINTR)
+        continue;
+      return; /* backlog is drained, or the error was logged */
+    }
+    proxy_add_client(proxy, port);
+  }
+} /* proxy_accept() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Add new client accepted by postmaster. This client will be assigned to
+ * concrete session pool when it's startup packet is received. Returns NULL
+ * if the client could not be registered (and was disconnected).
+ */
+static Channel *
+proxy_add_client (
+  Proxy    *proxy,
+  Port     *port
+) {
+  Channel *chan = channel_create(proxy);
+
+  /* The Port was set up by the caller, move it into the client's memory */
+  chan->memctx = AllocSetContextCreate(GetMemoryChunkContext(proxy),
+                                       "Proxy client",
+                                       ALLOCSET_SMALL_SIZES);
+  chan->client_port = MemoryContextAlloc(chan->memctx, sizeof(Port));
+  memcpy(chan->client_port, port, sizeof(Port));
+  pfree(port);
+  port = chan->client_port;
+  chan->backend_socket = PGINVALID_SOCKET;
+  chan->kind = CHANNEL_CLIENT;
+  chan->is_setup = true;
+#ifdef MSG_MORE
+  chan->coalesce = g_ng_idcp_coalesce_responses &&
+                   port->laddr.addr.ss_family != AF_UNIX;
+#endif
+  if (channel_register(proxy, chan)) {
+    ELOG(LOG, "Add new client %p", chan);
+    proxy->n_accepted_connections += 1;
+    proxy->state->n_clients += 1;
+  } else {
+    report_error_to_client(chan, "Too much sessions. Try to increase "
+                                 "'max_sessions' configuration parameter");
+    /* Too much sessions, error report was already logged */
+    closesocket(port->sock);
+#if defined(ENABLE_GSS) || defined(ENABLE_SSPI)
+    pfree(port->gss);
+#endif
+    chan->magic = REMOVED_CHANNEL_MAGIC;
+    MemoryContextDelete(chan->memctx);
+    pfree(chan->buf);
+    channel_free(chan);
+    chan = NULL;
+  }
+  return chan;
+} /* proxy_add_client() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Start accepting connections on a listening socket, taking the first free
+ * slot. On failure, the error is reported at elevel and the socket is closed.
+ */
+static bool
+proxy_add_listen_socket (
+  Proxy        *proxy,
+  pgsocket      socket,
+  int           elevel
+) {
+  int idx;
+
+  /* proxy_accept() drains the backlog until accept() would block */
+  if (!pg_set_noblock(socket)) {
+    ereport(elevel,
+            (errcode_for_socket_access(),
+             errmsg("PROXY: could not set listening socket to non-blocking "
+                    "mode: %m")));
+    StreamClose(socket);
+    return false;
+  }
+
+  for (idx = 0; idx < proxy->n_listen_sockets; idx++) {
+    if (proxy->listen_sockets[idx] == PGINVALID_SOCKET)
+      break;
+  }
+  Assert(idx < MAXLISTEN);
+  proxy->listen_sockets[idx] = socket;
+  if (idx == proxy->n_listen_sockets)
+    proxy->n_listen_sockets += 1;
+
+#ifdef NG_IDCP_USE_IO_URING
+  if (proxy->uring != NULL) {
+    proxy_uring_arm_accept(proxy, idx);
+    return true;
+  }
+#endif
+#ifdef PROXY_USE_EPOLL_ET
+  {
+    /* Listening sockets are identified by their slot in listen_sockets */
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_DATA(0, idx);
+    if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, socket, &event) < 0) {
+      ereport(elevel,
+              (errcode_for_socket_access(),
+               errmsg("PROXY: failed to add listening socket: %m")));
+      StreamClose(socket);
+      proxy->listen_sockets[idx] = PGINVALID_SOCKET;
+      return false;
+    }
+  }
+#else
+  AddWaitEventToSet(proxy->wait_events, WL_SOCKET_ACCEPT, socket, NULL, NULL);
+#endif
+  return true;
+} /* proxy_add_listen_socket() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Take over an idle backend handed off by the worker this one replaces. Its
+ * database and role slots come along with it.
+ */
+static void
+proxy_adopt_backend (
+  Proxy        *proxy,
+  StringInfo    msg,
+  pgsocket      sock
+) {
+  SessionPool *pool = pool_handoff_get(proxy, msg);
+  Channel *chan = channel_create(proxy);
+
+  chan->pool = pool;
+  chan->backend_socket = sock;
+  chan->backend_pid = (int) pq_getmsgint(msg, 4);
+  chan->handshake_response_size = (int) pq_getmsgint(msg, 4);
+  chan->handshake_response = palloc(chan->handshake_response_size);
+  pq_copymsgbytes(msg, chan->handshake_response,
+                  chan->handshake_response_size);
+
+  if (!channel_register(proxy, chan)) {
+    pool_release_backend(pool);
+    closesocket(sock);
+    chan->magic = REMOVED_CHANNEL_MAGIC;
+    pfree(chan->handshake_response);
+    pfree(chan->buf);
+    channel_free(chan);
+    return;
+  }
+  proxy->state->n_backends += 1;
+  pool->n_launched_backends += 1;
+  pool_save_handshake(pool, chan);
+  if (g_ng_idcp_cfg_idle_worker_timeout_in_ms)
+    chan->backend_last_activity = GetCurrentTimestamp();
+  backend_reschedule(chan, true);
+} /* proxy_adopt_backend() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Take over an idle client session handed off by the worker this one
+ * replaces. The session was authenticated and got its handshake response
+ * there, so it continues as if it had just become idle here.
+ */
+static void
+proxy_adopt_client (
+  Proxy        *proxy,
+  StringInfo    msg,
+  pgsocket      sock
+) {
+  SessionPool *pool = pool_handoff_get(proxy, msg);
+  Port *port = (Port *)palloc0(sizeof(Port));
+  MemoryContext old_ctx;
+  Channel *chan;
+
+  port->sock = sock;
+  if (ng_idcp_stream_setup(port) != STATUS_OK) {
+    StreamClose(sock);
+    pfree(port);
+    return;
+  }
+  chan = proxy_add_client(proxy, port);
+  if (chan == NULL)
+    return;
+
+  MemoryContextSetParent(chan->memctx, pool->memctx);
+  old_ctx = MemoryContextSwitchTo(chan->memctx);
+  port = chan->client_port;
+  port->database_name = ng_idcp_handoff_get_string(msg);
+  port->user_name = ng_idcp_handoff_get_string(msg);
+  port->application_name = ng_idcp_handoff_get_string(msg);
+  chan->gucs = ng_idcp_handoff_get_string(msg);
+  MemoryContextSwitchTo(old_ctx);
+  chan->ssl_done = chan->gss_done = true;
+  chan->is_setup = false;
+
+  /* As client_connect() leaves it */
+  chan->pool = pool;
+  pool->n_connected_clients += 1;
+  proxy->n_accepted_connections -= 1;
+  pool->n_idle_clients += 1;
+  proxy->state->n_idle_clients += 1;
+  chan->is_idle = true;
+#ifdef NG_IDCP_USE_IO_URING
+  if (proxy->uring != NULL)
+    channel_uring_start_recv(chan);
+#endif
+} /* proxy_adopt_client() */
+
+/* ------------------------------------------------------------------------- */
+
+static Proxy *
+proxy_create (
+  ConnectionProxyState *state,
+  int                   max_backends
+) {
+  HASHCTL ctl;
+  Proxy *proxy;
+  MemoryContext proxy_memctx =
+      AllocSetContextCreate(TopMemoryContext, "Proxy", ALLOCSET_DEFAULT_SIZES);
+  MemoryContextSwitchTo(proxy_memctx);
+  proxy = palloc0(sizeof(Proxy));
+  MemSet(&ctl, 0, sizeof(ctl));
+  ctl.keysize = sizeof(SessionPoolKey);
+  ctl.entrysize = sizeof(SessionPool);
+  ctl.hcxt = proxy_memctx;
+  proxy->pools = hash_create("Pool by database and user", DB_HASH_SIZE, &ctl,
+                             HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  MemSet(&ctl, 0, sizeof(ctl));
+  ctl.keysize = NAMEDATALEN;
+  ctl.entrysize = sizeof(InternedName);
+  ctl.hcxt = proxy_memctx;
+  proxy->names = hash_create("Interned database and role names", DB_HASH_SIZE,
+                             &ctl, HASH_ELEM | HASH_STRINGS | HASH_CONTEXT);
+
+  if (gp_ng_idcp_cfg_ignore_startup_parameters != NULL &&
+      !SplitIdentifierString(pstrdup(gp_ng_idcp_cfg_ignore_startup_parameters),
+                             ',', &proxy->ignored_startup_parameters))
+    ereport(WARNING,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("invalid list syntax in parameter \"%s\"",
+                    "nextgres_idcp.ignore_startup_parameters")));
+
+  proxy->max_backends = max_backends;
+  proxy->state = state;
+  dlist_init(&proxy->channels);
+  proxy->handoff_listen = PGINVALID_SOCKET;
+  proxy->unix_socket = PGINVALID_SOCKET;
+  proxy->spare_fd = open(DEVNULL, O_RDONLY | O_CLOEXEC);
+  if (proxy->spare_fd < 0)
+    elog(LOG, "PROXY: could not open spare descriptor: %m");
+
+#ifdef PROXY_USE_EPOLL_ET
+  {
+    /*
+     * The event loop doesn't wait on the latch, so signal handlers also
+     * write to a pipe it watches: a signal arriving just before the wait
+     * then still ends it at once.
+     */
+    int fds[2];
+
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) < 0)
+      elog(FATAL, "PROXY: could not create wakeup pipe: %m");
+    proxy->wakeup_fd = fds[0];
+    proxy_wakeup_fd = fds[1];
+  }
+#endif
+
+  if (g_ng_idcp_io_uring) {
+#ifdef NG_IDCP_USE_IO_URING
+    if (proxy_uring_init(proxy)) {
+      proxy_uring_arm_wakeup(proxy);
+      return proxy;
+    }
+#else
+    elog(WARNING, "nextgres_idcp.io_uring is set but this build has no "
+                  "io_uring support: using epoll");
+#endif
+  }
+
+#ifdef PROXY_USE_EPOLL_ET
+  proxy->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (proxy->epoll_fd < 0)
+    elog(FATAL, "PROXY: epoll_create1 failed: %m");
+
+  /* Edge-triggered: sockets have to be drained until EAGAIN */
+  WaitEventUseEpoll = true;
+
+  {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_DATA(0, EVENT_WAKEUP_SLOT);
+    if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, proxy->wakeup_fd,
+                  &event) < 0)
+      elog(FATAL, "PROXY: failed to add wakeup pipe: %m");
+  }
+#else
+  /*
+   * We need events both for clients and backends so multiply MaxConnection by
+   * two
+   */
+  proxy->wait_events = CreateWaitEventSet(TopMemoryContext, MaxSessions * 2);
+  AddWaitEventToSet(proxy->wait_events, WL_LATCH_SET, PGINVALID_SOCKET,
+                    MyLatch, NULL);
+#endif
+  return proxy;
+} /* proxy_create() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Apply a new pool configuration published by the controller, or the
+ * worker's own settings after a reload when force is set. Pools that shrank
+ * terminate their surplus idle backends (busy ones are retired by
+ * backend_reschedule() once they become idle), and pools with waiting
+ * clients are retried so that a larger size or limit takes effect at once.
+ */
+static void
+proxy_config_refresh (
+  Proxy *proxy,
+  bool   force
+) {
+  uint64 generation = ng_idcp_pool_config_generation();
+  HASH_SEQ_STATUS seq;
+  SessionPool *pool;
+
+  if (generation == proxy->config_generation && !force)
+    return;
+  proxy->config_generation = generation;
+
+  hash_seq_init(&seq, proxy->pools);
+  while ((pool = hash_seq_search(&seq)) != NULL) {
+    Channel *chan;
+    Channel *next;
+    int surplus;
+
+    pool_configure(pool);
+
+    /* Terminated backends are moved to the hangout list */
+    surplus = pool->n_launched_backends - pool->settings.pool_size;
+    for (chan = pool->idle_backends; chan != NULL && surplus > 0;
+         chan = next) {
+      next = chan->next;
+      if (!chan->is_interrupted) {
+        chan->is_interrupted = true;
+        channel_write(chan, false);
+        surplus -= 1;
+      }
+    }
+
+    if (pool->pending_clients != NULL && !pool->is_throttled) {
+      pool->is_throttled = true;
+      proxy->throttled = lappend(proxy->throttled, pool);
+    }
+  }
+} /* proxy_config_refresh() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Flush all client output held back during this event loop iteration.
+ */
+static void
+proxy_flush (
+  Proxy *proxy
+) {
+  ListCell *lc;
+
+  foreach(lc, proxy->corked) {
+    channel_flush((Channel *)lfirst(lc));
+  }
+  list_free(proxy->corked);
+  proxy->corked = NIL;
+} /* proxy_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Reload the configuration, see proxy_reload()
+ */
+static void
+proxy_handle_sighup (
+  SIGNAL_ARGS
+) {
+  int save_errno = errno;
+
+  ConfigReloadPending = true;
+  SetLatch(MyLatch);
+  proxy_wakeup();
+
+  errno = save_errno;
+} /* proxy_handle_sighup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Handle normal shutdown of Postgres instance
+ */
+static void
+proxy_handle_sigterm (
+  SIGNAL_ARGS
+) {
+  int save_errno = errno;
+
+  if (proxy) {
+    proxy->shutdown = true;
+  }
+  proxy_wakeup();
+
+  errno = save_errno;
+} /* proxy_handle_sigterm() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * The controller started a replacement for this worker: hand off to it
+ */
+static void
+proxy_handle_sigusr2 (
+  SIGNAL_ARGS
+) {
+  int save_errno = errno;
+
+  handoff_pending = true;
+  SetLatch(MyLatch);
+  proxy_wakeup();
+
+  errno = save_errno;
+} /* proxy_handle_sigusr2() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Hand off to the replacement worker the controller started for this one:
+ * first the listening sockets, so that new connections go to the
+ * replacement, then, batch by batch, the sessions that became idle since the
+ * previous batch. Busy sessions stay until they become idle or end, and the
+ * worker exits once none are left (see proxy_loop()). If the replacement
+ * doesn't show up in time, the handoff is abandoned.
+ */
+static void
+proxy_handoff (
+  Proxy *proxy
+) {
+  TimestampTz now = GetCurrentTimestamp();
+  StringInfoData msg;
+  dlist_iter iter;
+  pgsocket conn;
+  int n_sent = 0;
+  int i;
+
+  if (now < proxy->handoff_retry_at)
+    return;
+  proxy->handoff_retry_at =
+      TimestampTzPlusMilliseconds(now, HANDOFF_RETRY_INTERVAL);
+
+  if (proxy->handoff_listeners_sent) {
+    bool idle = false;
+
+    dlist_foreach(iter, &proxy->channels) {
+      if (channel_can_handoff(dlist_container(Channel, proxy_node,
+                                              iter.cur))) {
+        idle = true;
+        break;
+      }
+    }
+    if (!idle)
+      return;
+  }
+
+  conn = ng_idcp_handoff_connect(ng_idcp_handoff_target(MyProxyId));
+  if (conn == PGINVALID_SOCKET) {
+    if (!proxy->handoff_listeners_sent && now >= proxy->handoff_deadline) {
+      ereport(WARNING,
+              (errmsg("PROXY: replacement worker did not take over, "
+                      "continuing to serve connections")));
+      proxy->handoff = false;
+    }
+    return;
+  }
+
+  if (!proxy->handoff_listeners_sent) {
+    /* Sockets that couldn't be sent are kept and retried */
+    initStringInfo(&msg);
+    ng_idcp_handoff_put_string(&msg, proxy->listen_addresses);
+    pq_sendint32(&msg, proxy->listen_port);
+    proxy->handoff_listeners_sent = true;
+    for (i = 0; i < proxy->n_listen_sockets; i++) {
+      if (proxy->listen_sockets[i] == PGINVALID_SOCKET)
+        continue;
+      if (!ng_idcp_handoff_send(conn, NG_IDCP_HANDOFF_LISTEN, &msg,
+                                proxy->listen_sockets[i])) {
+        proxy->handoff_listeners_sent = false;
+        break;
+      }
+      proxy_remove_listen_socket(proxy, i, false);
+    }
+    pfree(msg.data);
+    if (proxy->handoff_listeners_sent)
+      elog(LOG, "PROXY: listening sockets were handed off to worker %d",
+           (int) ng_idcp_handoff_target(MyProxyId));
+  }
+
+  if (proxy->handoff_listeners_sent) {
+    dlist_foreach(iter, &proxy->channels) {
+      Channel *chan = dlist_container(Channel, proxy_node, iter.cur);
+
+      if (channel_can_handoff(chan)) {
+        if (!proxy_handoff_channel(conn, chan))
+          break;
+        n_sent += 1;
+      }
+    }
+  }
+  (void) ng_idcp_handoff_send(conn, NG_IDCP_HANDOFF_END, NULL,
+                              PGINVALID_SOCKET);
+  closesocket(conn);
+  ELOG(LOG, "Handed off %d sessions", n_sent);
+} /* proxy_handoff() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Pass an idle session to the replacement worker. On success the channel
+ * is dropped here, see channel_handed_off().
+ */
+static bool
+proxy_handoff_channel (
+  pgsocket      conn,
+  Channel      *chan
+) {
+  StringInfoData msg;
+  bool sent;
+
+  initStringInfo(&msg);
+  pool_handoff_put(&msg, chan->pool);
+  if (chan->client_port) {
+    ng_idcp_handoff_put_string(&msg, chan->client_port->database_name);
+    ng_idcp_handoff_put_string(&msg, chan->client_port->user_name);
+    ng_idcp_handoff_put_string(&msg, chan->client_port->application_name);
+    ng_idcp_handoff_put_string(&msg, chan->gucs);
+  } else {
+    pq_sendint32(&msg, chan->backend_pid);
+    pq_sendint32(&msg, chan->handshake_response_size);
+    appendBinaryStringInfo(&msg, chan->handshake_response,
+                           chan->handshake_response_size);
+  }
+  sent = ng_idcp_handoff_send(conn,
+                              chan->client_port ? NG_IDCP_HANDOFF_CLIENT
+                                                : NG_IDCP_HANDOFF_BACKEND,
+                              &msg, CHANNEL_SOCKET(chan));
+  pfree(msg.data);
+
+  if (sent)
+    channel_handed_off(chan);
+  return sent;
+} /* proxy_handoff_channel() */
 
-            /* request immediate response from server */
-            case 'S':    /* Sync */
-              break;
+/* ------------------------------------------------------------------------- */
 
-            case 'H':    /* Flush */
-              break;
+/*
+ * Take over what the worker this one replaces sends on the handoff socket.
+ * Returns the number of listening sockets received.
+ */
+static int
+proxy_handoff_receive (
+  Proxy *proxy
+) {
+  MemoryContext proxy_memctx = GetMemoryChunkContext(proxy);
+  StringInfoData msg;
+  pgsocket conn;
+  int n_listen = 0;
+  int n_backends = 0;
+  int n_clients = 0;
+
+  initStringInfo(&msg);
+  while ((conn = ng_idcp_handoff_accept(proxy->handoff_listen)) !=
+         PGINVALID_SOCKET) {
+    for (;;) {
+      pgsocket sock;
+      int kind = ng_idcp_handoff_recv(conn, &msg, &sock);
+
+      if (kind < 0 || kind == NG_IDCP_HANDOFF_END)
+        break;
+      if (sock == PGINVALID_SOCKET)
+        continue;
+      switch (kind) {
+        case NG_IDCP_HANDOFF_LISTEN: {
+          char *addresses = ng_idcp_handoff_get_string(&msg);
+
+          /* Remember what the sockets are bound to, see proxy_takeover() */
+          if (proxy->listen_addresses != NULL)
+            pfree(proxy->listen_addresses);
+          proxy->listen_addresses =
+              addresses ? MemoryContextStrdup(proxy_memctx, addresses) : NULL;
+          proxy->listen_port = (int) pq_getmsgint(&msg, 4);
+          if (addresses)
+            pfree(addresses);
+          if (proxy_add_listen_socket(proxy, sock, LOG)) {
+            struct sockaddr_un addr;
+            socklen_t addrlen = sizeof(addr);
+
+            /* Our predecessor's Unix socket, its files are ours now */
+            if (getsockname(sock, (struct sockaddr *) &addr, &addrlen) == 0 &&
+                addr.sun_family == AF_UNIX && addr.sun_path[0] != '\0') {
+              ng_idcp_socket_file_adopt(addr.sun_path);
+              proxy_set_unix_socket(proxy, sock, addr.sun_path);
+            }
+            n_listen += 1;
+          }
+          break;
+        }
+        case NG_IDCP_HANDOFF_BACKEND:
+          proxy_adopt_backend(proxy, &msg, sock);
+          n_backends += 1;
+          break;
+        case NG_IDCP_HANDOFF_CLIENT:
+          proxy_adopt_client(proxy, &msg, sock);
+          n_clients += 1;
+          break;
+        default:
+          closesocket(sock);
+          break;
+      }
+    }
+    closesocket(conn);
+  }
+  pfree(msg.data);
 
-            /* copy end markers */
-            case 'c':    /* CopyDone(F/B) */
-            case 'f':    /* CopyFail(F/B) */
-              break;
+  if (n_listen + n_backends + n_clients > 0)
+    elog(LOG, "PROXY: took over %d listening sockets, %d backends and %d "
+              "clients", n_listen, n_backends, n_clients);
+  return n_listen;
+} /* proxy_handoff_receive() */
 
-            /*
-             * extended protocol allows server (and thus pooler)
-             * to buffer packets until sync or flush is sent by client
-             */
-            case 'P':    /* Parse */
-              break;
+/* ------------------------------------------------------------------------- */
 
-            case 'E':    /* Execute */
-              break;
+/*
+ * Return the proxy's unique copy of a database or role name. It lives as
+ * long as a pool refers to it, see pool_enter() and proxy_unintern().
+ */
+static const char *
+proxy_intern (
+  Proxy        *proxy,
+  const char   *name
+) {
+  bool found;
+  InternedName *entry =
+      (InternedName *) hash_search(proxy->names, name, HASH_ENTER, &found);
 
-            case 'C':    /* Close */
-              break;
+  if (!found)
+    entry->refcount = 0;
+  return entry->name;
+} /* proxy_intern() */
 
-            case 'B':    /* Bind */
-              break;
+/* ------------------------------------------------------------------------- */
 
-            case 'D':    /* Describe */
-              break;
+/*
+ * Drop a pool's reference to an interned name, forgetting the name with the
+ * last one.
+ */
+static void
+proxy_unintern (
+  Proxy        *proxy,
+  const char   *name
+) {
+  InternedName *entry = (InternedName *) name;
 
-            case 'd':    /* CopyData(F/B) */
-              break;
+  Assert(entry->refcount > 0);
+  if (--entry->refcount == 0)
+    hash_search(proxy->names, entry->name, HASH_REMOVE, NULL);
+} /* proxy_unintern() */
 
-            case 'X':  /* Terminate */
-              {
-                Channel *backend = chan->peer;
-                elog(DEBUG1, "Receive 'X' to backend %d",
-                     backend != NULL ? backend->backend_pid : 0);
-                chan->is_interrupted = true;
-                if (backend != NULL && !backend->backend_is_ready) {
-                  /* If client send abort inside transaction, then mark backend as
-                   * tainted */
-                  chan->proxy->state->n_dedicated_backends += 1;
-                  chan->pool->n_dedicated_backends += 1;
-                }
-                if (backend == NULL) {
-                  /* Skip terminate message to idle and non-tainted backends */
-                  channel_hangout(chan, "terminate");
-                  return false;
-                }
-              }
-              break;
+/* ------------------------------------------------------------------------- */
 
-            /* client wants to go away */
-            default:
-              elog(WARNING, "unknown pkt from client: %c", chan->buf[msg_start]);
-          }
+/*
+ * Open listening sockets for the configured addresses and port and start
+ * accepting on them. Sockets of a previous call are closed only once the new
+ * ones accept, and connections queued on them are taken over, so clients are
+ * not refused while the listeners move. If the new sockets cannot be opened,
+ * the problem is reported at elevel and the old ones are kept.
+ */
+static bool
+proxy_listen (
+  Proxy        *proxy,
+  int           elevel
+) {
+  const char *addresses = proxy_listen_addresses();
+  MemoryContext proxy_memctx = GetMemoryChunkContext(proxy);
+  pgsocket sockets[MAXLISTEN];
+  bool was_listening[MAXLISTEN];
+  char unix_path[MAXPGPATH];
+  pgsocket unix_socket = PGINVALID_SOCKET;
+  bool keep_unix;
+  int n_old = proxy->n_listen_sockets;
+  int n_kept = 0;
+  int n_sockets;
+  int i;
 
-        }
-        msg_start += msg_len;
-      } else {
-        break; /* Incomplete message. */
+  n_sockets = proxy_open_listen_sockets(addresses, g_ng_idcp_cfg_listen_port,
+                                        sockets, elevel);
+  if (n_sockets < 0)
+    return false;
+
+  /* A Unix socket still bound to the right path is kept, with its lock */
+  if (!proxy_unix_socket_path(g_ng_idcp_cfg_listen_port, unix_path))
+    unix_path[0] = '\0';
+  keep_unix = proxy->unix_socket != PGINVALID_SOCKET &&
+              strcmp(proxy->unix_socket_path, unix_path) == 0;
+  if (!keep_unix && unix_path[0] != '\0' && n_sockets < MAXLISTEN) {
+    unix_socket = proxy_open_unix_socket(g_ng_idcp_cfg_listen_port);
+    if (unix_socket != PGINVALID_SOCKET)
+      sockets[n_sockets++] = unix_socket;
+  }
+
+  for (i = 0; i < n_old; i++) {
+    was_listening[i] = proxy->listen_sockets[i] != PGINVALID_SOCKET &&
+                       !(keep_unix &&
+                         proxy->listen_sockets[i] == proxy->unix_socket);
+    if (proxy->listen_sockets[i] != PGINVALID_SOCKET)
+      n_kept += 1;
+  }
+  if (n_kept + n_sockets > MAXLISTEN) {
+    ereport(elevel,
+            (errmsg("PROXY: too many listening sockets to move listeners "
+                    "to \"%s\"", addresses)));
+    for (i = 0; i < n_sockets; i++)
+      StreamClose(sockets[i]);
+    if (unix_socket != PGINVALID_SOCKET)
+      ng_idcp_socket_file_release(unix_path, true);
+    return false;
+  }
+
+  for (i = 0; i < n_sockets; i++) {
+    if (!proxy_add_listen_socket(proxy, sockets[i], elevel) &&
+        sockets[i] == unix_socket) {
+      ng_idcp_socket_file_release(unix_path, true);
+      unix_socket = PGINVALID_SOCKET;
+    }
+  }
+  for (i = 0; i < n_old; i++) {
+    if (was_listening[i])
+      proxy_remove_listen_socket(proxy, i, true);
+  }
+  if (unix_socket != PGINVALID_SOCKET)
+    proxy_set_unix_socket(proxy, unix_socket, unix_path);
+
+  if (proxy->listen_addresses != NULL)
+    pfree(proxy->listen_addresses);
+  proxy->listen_addresses =
+      addresses ? MemoryContextStrdup(proxy_memctx, addresses) : NULL;
+  proxy->listen_port = g_ng_idcp_cfg_listen_port;
+  return true;
+} /* proxy_listen() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Addresses the proxy listens on: nextgres_idcp.listen_addr, falling back to
+ * the server's listen_addresses.
+ */
+static const char *
+proxy_listen_addresses (
+  void
+) {
+  if (gp_ng_idcp_cfg_listen_addr != NULL &&
+      gp_ng_idcp_cfg_listen_addr[0] != '\0')
+    return gp_ng_idcp_cfg_listen_addr;
+  return ListenAddresses;
+} /* proxy_listen_addresses() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Log the clients, backends and client memory of each pool every
+ * stats_period seconds, and publish the worker's counters, including its
+ * total client memory, for _nextgres_idcp.proxy_stats().
+ */
+static void
+proxy_log_stats (
+  Proxy *proxy
+) {
+  TimestampTz now = GetCurrentTimestamp();
+  HASH_SEQ_STATUS seq;
+  SessionPool *pool;
+  uint64 client_memory = 0;
+
+  if (!TimestampDifferenceExceeds(proxy->last_stats_log, now,
+                                  g_ng_idcp_cfg_stats_period * 1000))
+    return;
+  proxy->last_stats_log = now;
+
+  hash_seq_init(&seq, proxy->pools);
+  while ((pool = hash_seq_search(&seq)) != NULL) {
+    Size allocated = MemoryContextMemAllocated(pool->memctx, true);
+
+    client_memory += allocated;
+    if (g_ng_idcp_cfg_log_stats)
+      elog(LOG, "PROXY: pool %s/%s: %d clients (%d idle, %d waiting), "
+                "%d backends (%d idle), %zu kB client memory",
+           pool->key.database, pool->key.username, pool->n_connected_clients,
+           pool->n_idle_clients, pool->n_pending_clients,
+           pool->n_launched_backends, pool->n_idle_backends,
+           allocated / 1024);
+  }
+  proxy->state->client_memory = client_memory;
+  proxy->state->pid = MyProcPid;
+
+  /* A worker being replaced leaves the slot to its successor */
+  if (ng_idcp_proxy_shared == NULL ||
+      MyProxyId >= ng_idcp_proxy_shared->n_workers ||
+      ng_idcp_handoff_worker(MyProxyId) != MyProcPid)
+    return;
+  SpinLockAcquire(&ng_idcp_proxy_shared->mutex);
+  ng_idcp_proxy_shared->workers[MyProxyId] = *proxy->state;
+  SpinLockRelease(&ng_idcp_proxy_shared->mutex);
+} /* proxy_log_stats() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Main proxy loop
+ */
+static void
+proxy_loop (
+  Proxy *proxy
+) {
+  Channel *chan, *next;
+
+  /* Main loop */
+  while (!proxy->shutdown) {
+#ifdef NG_IDCP_USE_IO_URING
+    if (proxy->uring != NULL)
+      proxy_uring_wait(proxy);
+    else
+#endif
+      proxy_wait_events(proxy);
+
+    proxy_flush(proxy);
+
+    if (ConfigReloadPending) {
+      ConfigReloadPending = false;
+      proxy_reload(proxy);
+    } else {
+      proxy_config_refresh(proxy, false);
+    }
+
+    if (handoff_pending) {
+      handoff_pending = false;
+#if defined(PROXY_USE_EPOLL_ET) || defined(NG_IDCP_USE_IO_URING)
+      if (!proxy->handoff) {
+        proxy->handoff = true;
+        proxy->handoff_retry_at = 0;
+        proxy->handoff_deadline = TimestampTzPlusMilliseconds(
+            GetCurrentTimestamp(), NG_IDCP_HANDOFF_TIMEOUT);
       }
+#else
+      /* A WaitEventSet cannot forget a socket */
+      ereport(WARNING,
+              (errmsg("PROXY: handoff to a replacement worker is not "
+                      "supported on this platform")));
+#endif
     }
-    elog(DEBUG1, "Message size %d", msg_start);
-    if (msg_start != 0) {
-      /* Has some complete messages to send to peer */
-      if (chan->peer == NULL)
-      {
-        /* client is not yet connected to backend */
-        if (!chan->client_port) {
-          /*
-           * We are not expecting messages from idle backend. Assume that it
-           * some error or shutdown.
-           */
-          channel_hangout(chan, "idle");
-          return false;
-        }
-        client_attach(chan);
-        if (handshake) {
-          /* Send handshake response to the client */
-          /*
-           * If we attach new client to the existed backend, then we need to
-           * send handshake response to the client
-           */
-          Channel *backend = chan->peer;
-          chan->rx_pos = 0;    /* Skip startup packet */
-          if (backend != NULL) /* Backend was assigned */
-          {
-            /* Ensure backend hasn't already sent handshake responses */
-            Assert(backend->handshake_response != NULL);
-            Assert(backend->handshake_response_size < backend->buf_size);
-            memcpy(backend->buf, backend->handshake_response,
-              backend->handshake_response_size);
-            backend->rx_pos = backend->tx_size =
-              backend->handshake_response_size;
-            backend->backend_is_ready = true;
-            elog(DEBUG1, "Send handshake response to the client");
-            return channel_write(chan, false);
-          } else {
-            /*
-             * Handshake response will be send to client later when backend is
-             * assigned
-             */
-            elog(DEBUG1, "Handshake response will be sent to the client later "
-                         "when backed is assigned");
-            return false;
+    if (proxy->handoff)
+      proxy_handoff(proxy);
+
+    if (g_ng_idcp_cfg_idle_worker_timeout_in_ms) {
+      TimestampTz now = GetCurrentTimestamp();
+      TimestampTz timeout_usec =
+          (TimestampTz) g_ng_idcp_cfg_idle_worker_timeout_in_ms * 1000;
+      if (proxy->last_idle_timeout_check + timeout_usec < now) {
+        HASH_SEQ_STATUS seq;
+        struct SessionPool *pool;
+        proxy->last_idle_timeout_check = now;
+        hash_seq_init(&seq, proxy->pools);
+        while ((pool = hash_seq_search(&seq)) != NULL) {
+          /* Terminated backends are moved to the hangout list */
+          for (chan = pool->idle_backends; chan != NULL; chan = next) {
+            next = chan->next;
+            if (chan->backend_last_activity + timeout_usec < now) {
+              chan->is_interrupted =
+                  true; /* interrupted flags makes channel_write to send 'X'
+                           message */
+              channel_write(chan, false);
+            }
           }
-        } else if (chan->peer == NULL) {
-          /* Backend was not assigned */
-          chan->tx_size = msg_start;
-          /* query will be send later once backend is assigned */
-          elog(DEBUG1, "Query will be sent to this client later when backed "
-                       "is assigned");
-          return false;
         }
       }
-      Assert(chan->tx_pos == 0);
-      Assert(chan->rx_pos >= msg_start);
-      chan->tx_size = msg_start;
-      if (!channel_write(chan->peer, true)) {
-        return false;
-      }
     }
-    /* If backend is out of transaction, then reschedule it */
-    if (chan->backend_is_ready) {
-      return backend_reschedule(chan, false);
+
+    /*
+     * Delayed deallocation of disconnected channels.
+     * We can not delete channels immediately because of presence of peer
+     * events.
+     */
+    for (chan = proxy->hangout; chan != NULL; chan = next) {
+      next = chan->next;
+      channel_remove(chan);
+    }
+    proxy->hangout = NULL;
+
+    proxy_retry_throttled(proxy);
+
+    if (g_ng_idcp_cfg_stats_period)
+      proxy_log_stats(proxy);
+
+    /* Wait for the sessions that couldn't be handed off to end */
+    if (proxy->handoff_listeners_sent && dlist_is_empty(&proxy->channels)) {
+      elog(LOG, "PROXY: handoff to the replacement worker is complete");
+      proxy->shutdown = true;
     }
+  }
+} /* proxy_loop() */
 
-    /* Do not try to read more data if edge-triggered mode is not supported */
-    if (!WaitEventUseEpoll) {
-      break;
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Open listening sockets on a comma-separated list of addresses ("*" for all
+ * interfaces). Returns the number of sockets stored in sockets, or -1 after
+ * reporting the problem at elevel, with any socket opened so far closed.
+ */
+static int
+proxy_open_listen_sockets (
+  const char   *addresses,
+  int           port,
+  pgsocket      sockets[],
+  int           elevel
+) {
+  char *rawstring;
+  List *elemlist;
+  ListCell *l;
+  int n_sockets = 0;
+  int i;
+
+  for (i = 0; i < MAXLISTEN; i++) {
+    sockets[i] = PGINVALID_SOCKET;
+  }
+
+  if (addresses == NULL)
+    return 0;
+
+  /* Need a modifiable copy of the address list */
+  rawstring = pstrdup(addresses);
+
+  /* Parse string into list of hostnames */
+  if (!SplitGUCList(rawstring, ',', &elemlist)) {
+    /* syntax error in list */
+    ereport(elevel, (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                     errmsg("invalid list syntax in listen addresses \"%s\"",
+                            addresses)));
+    n_sockets = -1;
+  } else {
+    foreach (l, elemlist) {
+      char *curhost = (char *)lfirst(l);
+
+      if (ng_idcp_stream_server_port(
+            AF_UNSPEC, strcmp(curhost, "*") == 0 ? NULL : curhost,
+            (unsigned short)port, NULL, sockets, MAXLISTEN) != STATUS_OK) {
+        ereport(elevel, (errmsg("could not create listen socket for \"%s\"",
+                                curhost)));
+        n_sockets = -1;
+        break;
+      }
     }
   }
-  return true;
-} /* channel_read() */
+
+  list_free(elemlist);
+  pfree(rawstring);
+
+  if (n_sockets < 0) {
+    for (i = 0; i < MAXLISTEN && sockets[i] != PGINVALID_SOCKET; i++) {
+      StreamClose(sockets[i]);
+    }
+    return -1;
+  }
+
+  /* How many server sockets do we need to wait for? */
+  while (n_sockets < MAXLISTEN && sockets[n_sockets] != PGINVALID_SOCKET)
+    ++n_sockets;
+  return n_sockets;
+} /* proxy_open_listen_sockets() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Register new channel in wait event set.
+ * Open the Unix socket for local clients in nextgres_idcp.unix_socket_dir
+ * (see proxy_unix_socket_path()). Clients still reach the proxy over TCP if
+ * it cannot be opened, including while the worker this one replaces holds
+ * its lock.
  */
-static bool
-channel_register (
-  Proxy      *proxy,
-  Channel    *chan
+static pgsocket
+proxy_open_unix_socket (
+  int port
 ) {
-  pgsocket sock =
-      chan->client_port ? chan->client_port->sock : chan->backend_socket;
-  /* Using edge epoll mode requires non-blocking sockets */
-  pg_set_noblock(sock);
-  chan->event_pos = AddWaitEventToSet(proxy->wait_events,
-                                      WL_SOCKET_READABLE |
-                                          WL_SOCKET_WRITEABLE | WL_SOCKET_EDGE,
-                                      sock, NULL, chan);
-  if (chan->event_pos < 0) {
-    elog(WARNING,
-         "PROXY: Failed to add new client - too much sessions: %d clients, %d "
-         "backends. "
-         "Try to increase 'max_sessions' configuration parameter.",
-         proxy->state->n_clients, proxy->state->n_backends);
+  const char *dir = gp_ng_idcp_cfg_unix_socket_dir;
+  pgsocket sockets[1] = { PGINVALID_SOCKET };
+
+  if (ng_idcp_stream_server_port(AF_UNIX, NULL, (unsigned short) port, dir,
+                                 sockets, 1) != STATUS_OK) {
+    ereport(WARNING,
+            (errmsg("PROXY: could not create Unix-domain socket in "
+                    "directory \"%s\"", dir)));
+    return PGINVALID_SOCKET;
+  }
+  return sockets[0];
+} /* proxy_open_unix_socket() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Remember the Unix listening socket, so that a reload keeps it and its
+ * files are removed or handed over along with it (see
+ * proxy_remove_listen_socket()).
+ */
+static void
+proxy_set_unix_socket (
+  Proxy        *proxy,
+  pgsocket      sock,
+  const char   *path
+) {
+  if (proxy->unix_socket_path != NULL)
+    pfree(proxy->unix_socket_path);
+  proxy->unix_socket = sock;
+  proxy->unix_socket_path =
+      MemoryContextStrdup(GetMemoryChunkContext(proxy), path);
+} /* proxy_set_unix_socket() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Compute the path of the Unix socket this worker listens on. A socket path
+ * can be bound only once, unlike the TCP ports the workers share with
+ * SO_REUSEPORT, so only the first worker listens on it, and none does if
+ * nextgres_idcp.unix_socket_dir is empty. Returns false if there is none.
+ */
+static bool
+proxy_unix_socket_path (
+  int           port,
+  char         *path
+) {
+  const char *dir = gp_ng_idcp_cfg_unix_socket_dir;
+
+  if (MyProxyId != 0 || dir == NULL || dir[0] == '\0')
+    return false;
+  if (port == PostPortNumber) {
+    /* The socket file and its lock belong to the postmaster */
+    ereport(WARNING,
+            (errmsg("PROXY: not listening on a Unix socket, port %d is the "
+                    "server's", port)));
     return false;
   }
+  UNIXSOCK_PATH(path, port, dir);
   return true;
-} /* channel_register() */
+} /* proxy_unix_socket_path() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Perform delayed deletion of channel
+ * Give back the slots of all backends still running when the worker exits.
  */
 static void
-channel_remove (
-  Channel *chan
+proxy_release_backends (
+  int   code,
+  Datum arg
 ) {
-  Assert(chan->is_disconnected); /* should be marked as disconnected by
-                                    channel_hangout */
-
-  // JHH FIXME
-  //  DeleteWaitEventFromSet(chan->proxy->wait_events, chan->event_pos);
-  if (chan->client_port) {
-    if (chan->pool)
-      chan->pool->n_connected_clients -= 1;
-    else
-      chan->proxy->n_accepted_connections -= 1;
-    chan->proxy->state->n_clients -= 1;
-    chan->proxy->state->n_ssl_clients -= chan->client_port->ssl_in_use;
-    closesocket(chan->client_port->sock);
-    pfree(chan->client_port);
-    if (chan->gucs)
-      pfree(chan->gucs);
-    if (chan->prev_gucs)
-      pfree(chan->prev_gucs);
-  } else {
-    chan->proxy->state->n_backends -= 1;
-    chan->pool->n_launched_backends -= 1;
-    closesocket(chan->backend_socket);
-    pfree(chan->handshake_response);
-
-    if (chan->pool->pending_clients) {
-      char *error;
-      /* Try to start new backend instead of terminated */
-      Channel *new_backend = backend_start(chan->pool, &error);
-      if (new_backend != NULL) {
-        ELOG(LOG, "Spawn new backend %p instead of terminated %p", new_backend,
-             chan);
-        backend_reschedule(new_backend, true);
-      } else
-        free(error);
-    }
+  Proxy *proxy = (Proxy *) DatumGetPointer(arg);
+  HASH_SEQ_STATUS seq;
+  SessionPool *pool;
+
+  hash_seq_init(&seq, proxy->pools);
+  while ((pool = hash_seq_search(&seq)) != NULL) {
+    for (; pool->n_launched_backends > 0; pool->n_launched_backends--)
+      pool_release_backend(pool);
   }
-  chan->magic = REMOVED_CHANNEL_MAGIC;
-  pfree(chan->buf);
-  pfree(chan);
-} /* channel_remove() */
+} /* proxy_release_backends() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Try to send some data to the channel.
- * Data is located in the peer buffer. Because of using edge-triggered mode we
- * have have to use non-blocking IO and try to write all available data. Once
- * write is completed we should try to read more data from source socket.
- * "synchronous" flag is used to avoid infinite recursion or reads-writers.
- * Returns true if there is nothing to do or operation is successfully
- * completed, false in case of error or socket buffer is full.
+ * Re-read the configuration file after SIGHUP and apply it without dropping
+ * client connections: pool sizes, modes and limits are re-applied to the
+ * existing pools, timeouts are read afresh on each use, and the listeners
+ * are moved if their address or port changed.
  */
-static bool
-channel_write (
-  Channel  *chan,
-  bool      synchronous
+static void
+proxy_reload (
+  Proxy *proxy
 ) {
-  Channel *peer = chan->peer;
-  if (!chan->client_port && chan->is_interrupted) {
-    /* Send terminate command to the backend. */
-    char const terminate[] = {'X', 0, 0, 0, 4};
-    if (socket_write(chan, terminate, sizeof(terminate)) <= 0)
-      return false;
-    channel_hangout(chan, "terminate");
-    return true;
-  }
-  if (peer == NULL)
-    return false;
+  const char *addresses;
 
-  while (peer->tx_pos < peer->tx_size) /* has something to write */
-  {
-    ssize_t rc = socket_write(chan, peer->buf + peer->tx_pos,
-                              peer->tx_size - peer->tx_pos);
+  ProcessConfigFile(PGC_SIGHUP);
 
-    ELOG(LOG, "%p: write %d tx_pos=%d, tx_size=%d: %m", chan, (int)rc,
-         peer->tx_pos, peer->tx_size);
-    if (rc <= 0)
-      return false;
+  proxy->max_backends = g_ng_idcp_cfg_session_pool_size;
+  proxy_config_refresh(proxy, true);
 
-    if (!chan->client_port)
-      ELOG(LOG, "Send command %c from client %d to backend %d (%p:ready=%d)",
-           peer->buf[peer->tx_pos], peer->client_port->sock, chan->backend_pid,
-           chan, chan->backend_is_ready);
-    else
-      ELOG(LOG, "Send reply %c to client %d from backend %d (%p:ready=%d)",
-           peer->buf[peer->tx_pos], chan->client_port->sock, peer->backend_pid,
-           peer, peer->backend_is_ready);
+  addresses = proxy_listen_addresses();
+  if (proxy->listen_port == g_ng_idcp_cfg_listen_port &&
+      string_equal(proxy->listen_addresses, addresses))
+    return;
 
-    if (chan->client_port)
-      chan->proxy->state->tx_bytes += rc;
-    else
-      chan->proxy->state->rx_bytes += rc;
-    if (rc > 0 && chan->edge_triggered) {
-      /* resume accepting all events */
-      ModifyWaitEvent(
-          chan->proxy->wait_events, chan->event_pos,
-          WL_SOCKET_WRITEABLE | WL_SOCKET_READABLE | WL_SOCKET_EDGE, NULL);
-      chan->edge_triggered = false;
+#ifndef PROXY_USE_EPOLL_ET
+  /* A WaitEventSet cannot forget a socket */
+  ereport(WARNING,
+          (errmsg("PROXY: listen address changes take effect only after "
+                  "the proxy workers are restarted on this platform")));
+  return;
+#endif
+
+  if (proxy_listen(proxy, LOG))
+    elog(LOG, "PROXY: now listening on \"%s\" port %d",
+         addresses ? addresses : "", proxy->listen_port);
+} /* proxy_reload() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Stop accepting on a listening socket and close it. With drain, connections
+ * the kernel already queued on it are accepted here rather than reset by the
+ * close; without, they are left to another process sharing the socket.
+ */
+static void
+proxy_remove_listen_socket (
+  Proxy        *proxy,
+  int           idx,
+  bool          drain
+) {
+  pgsocket sock = proxy->listen_sockets[idx];
+
+#ifdef NG_IDCP_USE_IO_URING
+  if (proxy->uring != NULL) {
+    if (proxy->uring_accept_armed[idx]) {
+      struct io_uring_sqe *sqe = proxy_uring_get_sqe(proxy);
+
+      io_uring_prep_cancel64(sqe, URING_ACCEPT_DATA(idx), 0);
+      io_uring_sqe_set_data64(sqe, URING_DATA(NULL, URING_OP_CANCEL));
+      proxy->uring_accept_armed[idx] = false;
     }
-    peer->tx_pos += rc;
+  } else
+#endif
+  {
+#ifdef PROXY_USE_EPOLL_ET
+    if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_DEL, sock, NULL) < 0)
+      elog(LOG, "PROXY: failed to remove listening socket: %m");
+#endif
   }
-  if (peer->tx_size != 0) {
-    /* Copy rest of received data to the beginning of the buffer */
-    chan->backend_is_ready = false;
-    Assert(peer->rx_pos >= peer->tx_size);
-    memmove(peer->buf, peer->buf + peer->tx_size,
-            peer->rx_pos - peer->tx_size);
-    peer->rx_pos -= peer->tx_size;
-    peer->tx_pos = peer->tx_size = 0;
-    if (peer->backend_is_ready) {
-      Assert(peer->rx_pos == 0);
-      backend_reschedule(peer, false);
-      return true;
+  proxy->listen_sockets[idx] = PGINVALID_SOCKET;
+
+  /* A Unix socket's files go with it, or to the worker it is handed to */
+  if (sock == proxy->unix_socket) {
+    ng_idcp_socket_file_release(proxy->unix_socket_path, drain);
+    pfree(proxy->unix_socket_path);
+    proxy->unix_socket_path = NULL;
+    proxy->unix_socket = PGINVALID_SOCKET;
+  }
+
+  if (drain && pg_set_noblock(sock)) {
+    for (;;) {
+      Port *port = (Port *)palloc0(sizeof(Port));
+
+      /* Accepted like proxy_accept() does: non-blocking and close-on-exec */
+      if (ng_idcp_stream_connection(sock, port) != STATUS_OK) {
+        int save_errno = errno;
+
+        if (port->sock != PGINVALID_SOCKET) {
+          StreamClose(port->sock);
+          pfree(port);
+          continue;
+        }
+        pfree(port);
+        if (save_errno == ECONNABORTED || save_errno == EINTR)
+          continue;
+        break;
+      }
+      proxy_add_client(proxy, port);
     }
   }
-  return synchronous ||
-         channel_read(peer); /* write is not invoked from read */
-} /* channel_write() */
+  StreamClose(sock);
+} /* proxy_remove_listen_socket() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Attach client to backend. Return true if new backend is attached, false
- * otherwise.
+ * Start backends for the pending clients of throttled pools, as far as the
+ * database and role limits allow by now. Pools that still can't get a slot
+ * are throttled again by pool_reserve_backend().
  */
-static bool
-client_attach (
-  Channel *chan
+static void
+proxy_retry_throttled (
+  Proxy *proxy
 ) {
-  Channel *idle_backend = chan->pool->idle_backends;
-  chan->is_idle = false;
-  chan->pool->n_idle_clients -= 1;
-  chan->pool->proxy->state->n_idle_clients -= 1;
-  if (idle_backend) {
-    /* has some idle backend */
-    Assert(!idle_backend->client_port);
-    Assert(chan != idle_backend);
-    chan->peer = idle_backend;
-    idle_backend->peer = chan;
-    chan->pool->idle_backends = idle_backend->next;
-    chan->pool->n_idle_backends -= 1;
-    chan->pool->proxy->state->n_idle_backends -= 1;
-    idle_backend->is_idle = false;
-    if (IdlePoolWorkerTimeout)
-      chan->backend_last_activity = GetCurrentTimestamp();
-    ELOG(LOG, "Attach client %p to backend %p (pid %d)", chan, idle_backend,
-         idle_backend->backend_pid);
-  } else /* all backends are busy */
-  {
-    if (chan->pool->n_launched_backends < chan->proxy->max_backends) {
-      char *error;
-      /* Try to start new backend */
-      idle_backend = backend_start(chan->pool, &error);
-      if (idle_backend != NULL) {
-        ELOG(LOG, "Start new backend %p (pid %d) for client %p", idle_backend,
-             idle_backend->backend_pid, chan);
-        Assert(chan != idle_backend);
-        chan->peer = idle_backend;
-        idle_backend->peer = chan;
-        if (IdlePoolWorkerTimeout)
-          idle_backend->backend_last_activity = GetCurrentTimestamp();
-        return true;
-      } else {
+  List *throttled = proxy->throttled;
+  ListCell *lc;
+
+  if (throttled == NIL)
+    return;
+  proxy->throttled = NIL;
+
+  foreach (lc, throttled) {
+    SessionPool *pool = (SessionPool *) lfirst(lc);
+
+    pool->is_throttled = false;
+    while (pool->pending_clients != NULL &&
+           pool->n_launched_backends < pool->settings.pool_size &&
+           pool_reserve_backend(pool)) {
+      char *error = NULL;
+      Channel *backend = backend_start(pool, &error);
+
+      if (backend == NULL) {
+        /* Fail a waiting client rather than retrying forever */
+        Channel *client = pool->pending_clients;
         if (error) {
-          report_error_to_client(chan, error);
+          report_error_to_client(client, error);
           free(error);
         }
-        channel_hangout(chan, "connect");
-        return false;
+        channel_hangout(client, "connect");
+        continue;
       }
+      ELOG(LOG, "Start new backend %p (pid %d) for throttled pool", backend,
+           backend->backend_pid);
+      backend_reschedule(backend, true);
     }
-    /* Postpone handshake until some backend is available */
-    ELOG(LOG, "Client %p is waiting for available backends", chan);
-    chan->next = chan->pool->pending_clients;
-    chan->pool->pending_clients = chan;
-    chan->pool->n_pending_clients += 1;
   }
-  return false;
-} /* client_attach() */
+  list_free(throttled);
+} /* proxy_retry_throttled() */
 
 /* ------------------------------------------------------------------------- */
 
-/**
- * Parse client's startup packet and assign client to proper connection pool
- * based on dbname/role
+/*
+ * Out of descriptors: give up the spare one to accept the oldest pending
+ * connection and close it right away, so that the client fails fast instead
+ * of waiting in the backlog while the listening socket keeps waking us up.
+ * Returns false if there was nothing to shed.
  */
 static bool
-client_connect (
-  Channel    *chan,
-  int         startup_packet_size
+proxy_shed_connection (
+  Proxy        *proxy,
+  pgsocket      listen_socket
 ) {
-  bool found;
-  SessionPoolKey key;
-  char *startup_packet = chan->buf;
-  MemoryContext proxy_ctx;
+  pgsocket sock;
 
-  Assert(chan->client_port);
-
-  /* parse startup packet in parse_ctx memory context and reset it when it is
-   * not needed any more */
-  MemoryContextReset(chan->proxy->parse_ctx);
-  proxy_ctx = MemoryContextSwitchTo(chan->proxy->parse_ctx);
+  if (proxy->spare_fd < 0 || listen_socket == PGINVALID_SOCKET)
+    return false;
+  close(proxy->spare_fd);
+  sock = accept(listen_socket, NULL, NULL);
+  if (sock != PGINVALID_SOCKET)
+    closesocket(sock);
+  proxy->spare_fd = open(DEVNULL, O_RDONLY | O_CLOEXEC);
+  return sock != PGINVALID_SOCKET;
+} /* proxy_shed_connection() */
 
-  /* Associate libpq with client's port */
-  MyProcPort = chan->client_port;
-  ng_idcp_pq_init();
+/* ------------------------------------------------------------------------- */
 
-  if (ng_idcp_parse_startup_packet(chan->client_port, chan->proxy->parse_ctx,
-                         startup_packet + 4, startup_packet_size - 4, false,
-                         false) != STATUS_OK) /* skip packet size */
-  {
-    MyProcPort = NULL;
-    MemoryContextSwitchTo(proxy_ctx);
-    elog(WARNING, "Failed to parse startup packet for client %p", chan);
-    return false;
-  }
-  MyProcPort = NULL;
-  MemoryContextSwitchTo(proxy_ctx);
-  if (am_walsender) {
-    elog(WARNING, "WAL sender should not be connected through proxy");
+/*
+ * Wait for the worker this one replaces to hand over its listening sockets
+ * (see proxy_handoff()). Returns false if none arrived in time, in which
+ * case the caller opens its own. Sessions follow later through the same
+ * socket, which the event loop keeps watching.
+ */
+static bool
+proxy_takeover (
+  Proxy *proxy
+) {
+  TimestampTz deadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+                                                     NG_IDCP_HANDOFF_TIMEOUT);
+  const char *addresses;
+  bool watch = false;
+  int n_listen = 0;
+
+  proxy->handoff_listen = ng_idcp_handoff_listen();
+  if (proxy->handoff_listen == PGINVALID_SOCKET)
     return false;
-  }
-
-  chan->proxy->state->n_ssl_clients += chan->client_port->ssl_in_use;
-  pg_set_noblock(
-      chan->client_port
-          ->sock); /* SSL handshake may switch socket to blocking mode */
-  memset(&key, 0, sizeof(key));
-  strlcpy(key.database, chan->client_port->database_name, NAMEDATALEN);
-  if (MultitenantProxy)
-    chan->gucs = psprintf("set local role %s;", chan->client_port->user_name);
-  else
-    strlcpy(key.username, chan->client_port->user_name, NAMEDATALEN);
+  pg_set_noblock(proxy->handoff_listen);
 
-  ELOG(LOG, "Client %p connects to %s/%s", chan, key.database, key.username);
+  while (n_listen == 0 && !proxy->shutdown) {
+    long timeout =
+        TimestampDifferenceMilliseconds(GetCurrentTimestamp(), deadline);
+    int rc;
 
-  chan->pool =
-      (SessionPool *)hash_search(chan->proxy->pools, &key, HASH_ENTER, &found);
-  if (!found) {
-    /* First connection to this role/dbname */
-    chan->proxy->state->n_pools += 1;
-    chan->pool->startup_gucs = NULL;
-    chan->pool->cmdline_options = NULL;
-    memset((char *)chan->pool + sizeof(SessionPoolKey), 0,
-           sizeof(SessionPool) - sizeof(SessionPoolKey));
+    if (timeout <= 0)
+      break;
+    rc = WaitLatchOrSocket(MyLatch,
+                           WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT |
+                               WL_EXIT_ON_PM_DEATH,
+                           proxy->handoff_listen, timeout, PG_WAIT_EXTENSION);
+    if (rc & WL_LATCH_SET)
+      ResetLatch(MyLatch);
+    if (rc & WL_SOCKET_READABLE)
+      n_listen += proxy_handoff_receive(proxy);
   }
-  if (ProxyingGUCs) {
-    ListCell *gucopts = list_head(chan->client_port->guc_options);
-    while (gucopts) {
-      char *name;
-      char *value;
-
-      name = lfirst(gucopts);
-      gucopts = lnext(chan->client_port->guc_options, gucopts);
-
-      value = lfirst(gucopts);
-      gucopts = lnext(chan->client_port->guc_options, gucopts);
 
-      chan->gucs = psprintf("%sset local %s='%s';",
-                            chan->gucs ? chan->gucs : "", name, value);
-    }
-  } else {
-    /* Assume that all clients are using the same set of GUCs.
-     * Use them for launching pooler worker backends and report error
-     * if GUCs in startup packets are different.
-     */
-    if (chan->pool->n_launched_backends == chan->pool->n_dedicated_backends) {
-      list_free(chan->pool->startup_gucs);
-      if (chan->pool->cmdline_options)
-        pfree(chan->pool->cmdline_options);
-
-      chan->pool->startup_gucs =
-          string_list_copy(chan->client_port->guc_options);
-      if (chan->client_port->cmdline_options)
-        chan->pool->cmdline_options =
-            pstrdup(chan->client_port->cmdline_options);
-    } else {
-      if (!string_list_equal(chan->pool->startup_gucs,
-                             chan->client_port->guc_options) ||
-          !string_equal(chan->pool->cmdline_options,
-                        chan->client_port->cmdline_options)) {
-        elog(LOG, "Ignoring startup GUCs of client %s",
-             NULLSTR(chan->client_port->application_name));
-      }
+#ifdef PROXY_USE_EPOLL_ET
+  watch = n_listen > 0;
+#ifdef NG_IDCP_USE_IO_URING
+  /* Only the epoll loop takes over sessions */
+  if (proxy->uring != NULL)
+    watch = false;
+#endif
+  if (watch) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u64 = EVENT_DATA(0, EVENT_HANDOFF_SLOT);
+    if (epoll_ctl(proxy->epoll_fd, EPOLL_CTL_ADD, proxy->handoff_listen,
+                  &event) < 0) {
+      elog(LOG, "PROXY: failed to add handoff socket: %m");
+      watch = false;
     }
   }
-  chan->pool->proxy = chan->proxy;
-  chan->pool->n_connected_clients += 1;
-  chan->proxy->n_accepted_connections -= 1;
-  chan->pool->n_idle_clients += 1;
-  chan->pool->proxy->state->n_idle_clients += 1;
-  chan->is_idle = true;
-  return true;
-} /* client_connect() */
-
-/* ------------------------------------------------------------------------- */
-
-static bool
-is_transactional_statement (
-  char *stmt
-) {
-  static char const *const non_tx_stmts[] = {
-    "create tablespace",
-    "create database",
-    "cluster",
-    "drop",
-    "discard",
-    "reindex",
-    "rollback",
-    "vacuum",
-    NULL
-  };
-  int i;
-  for (i = 0; non_tx_stmts[i]; i++) {
-    if (pg_strncasecmp(stmt, non_tx_stmts[i], strlen(non_tx_stmts[i])) == 0) {
-      return false;
-    }
+#endif
+  if (!watch) {
+    closesocket(proxy->handoff_listen);
+    proxy->handoff_listen = PGINVALID_SOCKET;
+  }
+
+  if (n_listen == 0) {
+    ereport(LOG,
+            (errmsg("PROXY: no listening sockets were handed over, "
+                    "opening new ones")));
+    return false;
   }
+
+  /* The configuration may have moved the listeners since */
+  addresses = proxy_listen_addresses();
+  if (proxy->listen_port != g_ng_idcp_cfg_listen_port ||
+      !string_equal(proxy->listen_addresses, addresses))
+    proxy_listen(proxy, LOG);
   return true;
-} /* is_transactional_statement() */
+} /* proxy_takeover() */
 
 /* ------------------------------------------------------------------------- */
 
-static bool
-is_transaction_start (
-  char *stmt
+#ifdef NG_IDCP_USE_IO_URING
+
+/*
+ * Handle completion of a multishot accept.
+ */
+static void
+proxy_uring_accept_complete (
+  Proxy    *proxy,
+  int       idx,
+  int       res,
+  uint32    flags
 ) {
-  return pg_strncasecmp(stmt, "begin", 5) == 0 ||
-         pg_strncasecmp(stmt, "start", 5) == 0;
-} /* is_transaction_start() */
+  if (res >= 0) {
+    Port *port = (Port *)palloc0(sizeof(Port));
+    port->sock = res;
+    if (ng_idcp_stream_setup(port) != STATUS_OK) {
+      StreamClose(port->sock);
+      pfree(port);
+    } else {
+      proxy_add_client(proxy, port);
+    }
+  } else if (res != -ECANCELED) {
+    errno = -res;
+    ereport(LOG,
+            (errcode_for_socket_access(),
+             errmsg("could not accept new connection: %m")));
+    if (res == -EMFILE || res == -ENFILE)
+      proxy_shed_connection(proxy, proxy->listen_sockets[idx]);
+  }
+
+  /* Accepts of sockets closed by a reload end with -ECANCELED */
+  if (!(flags & IORING_CQE_F_MORE) &&
+      proxy->listen_sockets[idx] != PGINVALID_SOCKET) {
+    /*
+     * Multishot accept terminated, most likely because we ran out of file
+     * descriptors. Re-arm it a bit later instead of spinning.
+     */
+    proxy->uring_accept_armed[idx] = false;
+    proxy->uring_accept_retry_at = TimestampTzPlusMilliseconds(
+      GetCurrentTimestamp(), URING_ACCEPT_RETRY_MS);
+  }
+} /* proxy_uring_accept_complete() */
 
 /* ------------------------------------------------------------------------- */
 
-static void *
-libpq_connectdb (
-  char const   *keywords[],
-  char const   *values[],
-  char        **error
+static void
+proxy_uring_arm_accept (
+  Proxy    *proxy,
+  int       idx
 ) {
-  PGconn *conn = PQconnectdbParams(keywords, values, false);
-  if (conn && PQstatus(conn) != CONNECTION_OK) {
-    ereport(WARNING,
-            (errcode(ERRCODE_SQLCLIENT_UNABLE_TO_ESTABLISH_SQLCONNECTION),
-             errmsg("could not setup local connect to server"),
-             errdetail_internal("%s", pchomp(PQerrorMessage(conn)))));
-    *error = strdup(PQerrorMessage(conn));
-    PQfinish(conn);
-    return NULL;
-  }
-  *error = NULL;
-  return conn;
-} /* libpq_connectdb() */
+  struct io_uring_sqe *sqe = proxy_uring_get_sqe(proxy);
+
+  io_uring_prep_multishot_accept(sqe, proxy->listen_sockets[idx], NULL, NULL,
+                                 0);
+  io_uring_sqe_set_data64(sqe, URING_ACCEPT_DATA(idx));
+  proxy->uring_accept_armed[idx] = true;
+} /* proxy_uring_arm_accept() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Add new client accepted by postmaster. This client will be assigned to
- * concrete session pool when it's startup packet is received.
+ * Watch the wakeup pipe, see proxy_wakeup().
  */
 static void
-proxy_add_client (
-  Proxy    *proxy,
-  Port     *port
+proxy_uring_arm_wakeup (
+  Proxy *proxy
 ) {
-  Channel *chan = channel_create(proxy);
-  chan->client_port = port;
-  chan->backend_socket = PGINVALID_SOCKET;
-  if (channel_register(proxy, chan)) {
-    ELOG(LOG, "Add new client %p", chan);
-    proxy->n_accepted_connections += 1;
-    proxy->state->n_clients += 1;
-  } else {
-    report_error_to_client(chan, "Too much sessions. Try to increase "
-                                 "'max_sessions' configuration parameter");
-    /* Too much sessions, error report was already logged */
-    closesocket(port->sock);
-#if defined(ENABLE_GSS) || defined(ENABLE_SSPI)
-    pfree(port->gss);
-#endif
-    chan->magic = REMOVED_CHANNEL_MAGIC;
-    pfree(port);
-    pfree(chan->buf);
-    pfree(chan);
-  }
-} /* proxy_add_client() */
+  struct io_uring_sqe *sqe = proxy_uring_get_sqe(proxy);
+
+  io_uring_prep_poll_multishot(sqe, proxy->wakeup_fd, POLLIN);
+  io_uring_sqe_set_data64(sqe, URING_DATA(NULL, URING_OP_WAKEUP));
+} /* proxy_uring_arm_wakeup() */
 
 /* ------------------------------------------------------------------------- */
 
-static void
-proxy_add_listen_socket (
-  Proxy        *proxy,
-  pgsocket      socket
+/*
+ * Get a submission queue entry, flushing the queue to the kernel if it is
+ * full. Submissions are otherwise batched until the next proxy_uring_wait().
+ */
+static struct io_uring_sqe *
+proxy_uring_get_sqe (
+  Proxy *proxy
 ) {
-  AddWaitEventToSet(proxy->wait_events, WL_SOCKET_ACCEPT, socket, NULL, NULL);
-} /* proxy_add_listen_socket() */
+  struct io_uring_sqe *sqe = io_uring_get_sqe(proxy->uring);
+
+  while (sqe == NULL) {
+    int rc = io_uring_submit(proxy->uring);
+    if (rc < 0 && rc != -EAGAIN && rc != -EBUSY)
+      elog(FATAL, "io_uring_submit failed: %s", strerror(-rc));
+    sqe = io_uring_get_sqe(proxy->uring);
+  }
+  return sqe;
+} /* proxy_uring_get_sqe() */
 
 /* ------------------------------------------------------------------------- */
 
-static Proxy *
-proxy_create (
-  ConnectionProxyState *state,
-  int                   max_backends
+/*
+ * Set up io_uring and its provided buffer ring. Returns false (leaving the
+ * proxy to use the WaitEventSet loop) when the kernel lacks the features we
+ * depend on: deferred task running (6.1) implies multishot recv (6.0) and
+ * provided buffer rings (5.19).
+ */
+static bool
+proxy_uring_init (
+  Proxy *proxy
 ) {
-  HASHCTL ctl;
-  Proxy *proxy;
-  MemoryContext proxy_memctx =
-      AllocSetContextCreate(TopMemoryContext, "Proxy", ALLOCSET_DEFAULT_SIZES);
-  MemoryContextSwitchTo(proxy_memctx);
-  proxy = palloc0(sizeof(Proxy));
-  proxy->parse_ctx = AllocSetContextCreate(
-      proxy_memctx, "Startup packet parsing context", ALLOCSET_DEFAULT_SIZES);
-  MemSet(&ctl, 0, sizeof(ctl));
-  ctl.keysize = sizeof(SessionPoolKey);
-  ctl.entrysize = sizeof(SessionPool);
-  ctl.hcxt = proxy_memctx;
-  proxy->pools = hash_create("Pool by database and user", DB_HASH_SIZE, &ctl,
-                             HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+  struct io_uring_params params;
+  int rc;
+  int i;
 
-  /*
-   * We need events both for clients and backends so multiply MaxConnection by
-   * two
-   */
-  proxy->wait_events = CreateWaitEventSet(TopMemoryContext, MaxSessions * 2);
-  proxy->max_backends = max_backends;
-  proxy->state = state;
-  return proxy;
-} /* proxy_create() */
+  proxy->uring = palloc0(sizeof(struct io_uring));
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+  rc = io_uring_queue_init_params(URING_QUEUE_DEPTH, proxy->uring, &params);
+  if (rc < 0) {
+    elog(LOG, "io_uring is not available (%s): using epoll", strerror(-rc));
+    pfree(proxy->uring);
+    proxy->uring = NULL;
+    return false;
+  }
+
+  proxy->uring_buf_ring = io_uring_setup_buf_ring(
+    proxy->uring, URING_BUF_COUNT, URING_BUF_GROUP, 0, &rc);
+  if (proxy->uring_buf_ring == NULL) {
+    elog(LOG, "io_uring buffer ring is not available (%s): using epoll",
+         strerror(-rc));
+    io_uring_queue_exit(proxy->uring);
+    pfree(proxy->uring);
+    proxy->uring = NULL;
+    return false;
+  }
+
+  proxy->uring_bufs = palloc((Size) URING_BUF_COUNT * URING_BUF_SIZE);
+  for (i = 0; i < URING_BUF_COUNT; i++) {
+    io_uring_buf_ring_add(proxy->uring_buf_ring,
+                          proxy->uring_bufs + (Size) i * URING_BUF_SIZE,
+                          URING_BUF_SIZE, i,
+                          io_uring_buf_ring_mask(URING_BUF_COUNT), i);
+  }
+  io_uring_buf_ring_advance(proxy->uring_buf_ring, URING_BUF_COUNT);
+
+  /* Multishot completions are edge-triggered: drain sockets until EAGAIN */
+  WaitEventUseEpoll = true;
+
+  elog(LOG, "proxy uses io_uring event loop");
+  return true;
+} /* proxy_uring_init() */
 
 /* ------------------------------------------------------------------------- */
 
 /*
- * Handle normal shutdown of Postgres instance
+ * Submit all requests queued since the previous call and wait for
+ * completions in a single io_uring_enter(), then dispatch them.
  */
 static void
-proxy_handle_sigterm (
-  SIGNAL_ARGS
+proxy_uring_wait (
+  Proxy *proxy
 ) {
-  if (proxy) {
-    proxy->shutdown = true;
+  struct io_uring_cqe *cqes[MAX_READY_EVENTS];
+  struct {
+    uint64 user_data;
+    int32  res;
+    uint32 flags;
+  } ready[MAX_READY_EVENTS];
+  struct io_uring_cqe *cqe;
+  struct __kernel_timespec ts;
+  int wait_timeout = g_ng_idcp_cfg_idle_worker_timeout_in_ms
+                         ? g_ng_idcp_cfg_idle_worker_timeout_in_ms
+                         : PROXY_WAIT_TIMEOUT;
+  int n_ready;
+  int i;
+
+  /* Slots may be released by other workers: poll for them */
+  if (proxy->throttled != NIL)
+    wait_timeout = Min(wait_timeout, THROTTLE_RETRY_INTERVAL);
+
+  /* Sessions becoming idle are handed off in batches */
+  if (proxy->handoff)
+    wait_timeout = Min(wait_timeout, HANDOFF_RETRY_INTERVAL);
+
+  /* Re-arm terminated multishot accepts once the retry delay has passed */
+  for (i = 0; i < proxy->n_listen_sockets; i++) {
+    if (!proxy->uring_accept_armed[i] &&
+        proxy->listen_sockets[i] != PGINVALID_SOCKET) {
+      if (GetCurrentTimestamp() >= proxy->uring_accept_retry_at)
+        proxy_uring_arm_accept(proxy, i);
+      else
+        wait_timeout = Min(wait_timeout, URING_ACCEPT_RETRY_MS);
+    }
   }
-} /* proxy_handle_sigterm() */
+
+  /* Use timeout to allow normal proxy shutdown */
+  ts.tv_sec = wait_timeout / 1000;
+  ts.tv_nsec = (long) (wait_timeout % 1000) * 1000000L;
+  (void) io_uring_submit_and_wait_timeout(proxy->uring, &cqe, 1, &ts, NULL);
+
+  /*
+   * Copy completions out and release the CQ ring before dispatching, as
+   * handlers queue new submissions and may free channels.
+   */
+  n_ready = io_uring_peek_batch_cqe(proxy->uring, cqes, MAX_READY_EVENTS);
+  for (i = 0; i < n_ready; i++) {
+    ready[i].user_data = io_uring_cqe_get_data64(cqes[i]);
+    ready[i].res = cqes[i]->res;
+    ready[i].flags = cqes[i]->flags;
+  }
+  io_uring_cq_advance(proxy->uring, n_ready);
+
+  for (i = 0; i < n_ready; i++) {
+    uint64 data = ready[i].user_data;
+    int op = URING_DATA_OP(data);
+
+    switch (op) {
+      case URING_OP_ACCEPT:
+        proxy_uring_accept_complete(proxy, URING_ACCEPT_INDEX(data),
+                                    ready[i].res, ready[i].flags);
+        break;
+
+      case URING_OP_RECV:
+        channel_uring_recv_complete((Channel *) URING_DATA_PTR(data),
+                                    ready[i].res, ready[i].flags);
+        break;
+
+      case URING_OP_POLLIN:
+      case URING_OP_POLLOUT:
+        channel_uring_poll_complete((Channel *) URING_DATA_PTR(data), op,
+                                    ready[i].res, ready[i].flags);
+        break;
+
+      case URING_OP_WAKEUP:
+        proxy_wakeup_drain(proxy);
+        if (!(ready[i].flags & IORING_CQE_F_MORE))
+          proxy_uring_arm_wakeup(proxy);
+        break;
+
+      default:
+        /* Cancellation results need no handling */
+        break;
+    }
+  }
+} /* proxy_uring_wait() */
 
 /* ------------------------------------------------------------------------- */
 
+#endif /* NG_IDCP_USE_IO_URING */
+
 /*
- * Main proxy loop
+ * Wait for socket events and dispatch them.
  */
 static void
-proxy_loop (
+proxy_wait_events (
   Proxy *proxy
 ) {
   int i, n_ready;
+  Channel *chan;
+#ifdef PROXY_USE_EPOLL_ET
+  struct epoll_event ready[MAX_READY_EVENTS];
+#else
   WaitEvent ready[MAX_READY_EVENTS];
-  Channel *chan, *next;
+#endif
 
-  /* Main loop */
-  while (!proxy->shutdown) {
-    /* Use timeout to allow normal proxy shutdown */
-    int wait_timeout =
-        IdlePoolWorkerTimeout ? IdlePoolWorkerTimeout : PROXY_WAIT_TIMEOUT;
-    n_ready = WaitEventSetWait(proxy->wait_events, wait_timeout, ready,
-                               MAX_READY_EVENTS, PG_WAIT_CLIENT);
-    for (i = 0; i < n_ready; i++) {
-      chan = (Channel *)ready[i].user_data;
-      if (chan == NULL) /* new connection from postmaster */
-      {
-        if (ready[i].events & WL_SOCKET_ACCEPT) {
-          Port *port = (Port *)palloc0(sizeof(Port));
-          if (ng_idcp_stream_connection(ready[i].fd, port) != STATUS_OK) {
-            elog(ERROR, "problem with connection");
-            if (port->sock != PGINVALID_SOCKET) {
-              StreamClose(port->sock);
-            }
-            pfree(port);
-          }
-          proxy_add_client(proxy, port);
-        }
-      }
-      /*
-       * epoll may return event for already closed session if
-       * socket is still openned. From epoll documentation: Q6
-       * Will closing a file descriptor cause it to be removed
-       * from all epoll sets automatically?
-       *
-       * A6  Yes, but be aware of the following point.  A file
-       * descriptor is a reference to an open file description
-       * (see open(2)).  Whenever a descriptor is duplicated via
-       * dup(2), dup2(2), fcntl(2) F_DUPFD, or fork(2), a new
-       * file descriptor referring to the same open file
-       * description is created.  An open file  description
-       * continues  to exist until  all  file  descriptors
-       * referring to it have been closed.  A file descriptor is
-       * removed from an epoll set only after all the file
-       * descriptors referring to the underlying open file
-       * description  have been closed  (or  before  if  the
-       * descriptor is explicitly removed using epoll_ctl(2)
-       * EPOLL_CTL_DEL).  This means that even after a file
-       * descriptor that is part of an epoll set has been
-       * closed, events may be reported  for that  file
-       * descriptor  if  other  file descriptors referring to
-       * the same underlying file description remain open.
-       *
-       * Using this check for valid magic field we try to ignore
-       * such events.
-       */
-      else if (chan->magic == ACTIVE_CHANNEL_MAGIC) {
-        if (ready[i].events & WL_SOCKET_WRITEABLE) {
-          ELOG(LOG, "Channel %p is writable", chan);
-          channel_write(chan, false);
-          if (chan->magic == ACTIVE_CHANNEL_MAGIC &&
-              (chan->peer == NULL ||
-               chan->peer->tx_size == 0)) /* nothing to write */
-          {
-            /* At systems not supporting epoll edge triggering (Win32, FreeBSD,
-             * MacOS), we need to disable writable event to avoid busy loop */
-            ModifyWaitEvent(chan->proxy->wait_events, chan->event_pos,
-                            WL_SOCKET_READABLE | WL_SOCKET_EDGE, NULL);
-            chan->edge_triggered = true;
-          }
-        }
-        if (ready[i].events & WL_SOCKET_READABLE) {
-          ELOG(LOG, "Channel %p is readable", chan);
-          channel_read(chan);
-          if (chan->magic == ACTIVE_CHANNEL_MAGIC &&
-              chan->tx_size != 0) /* pending write: read is not prohibited */
-          {
-            /* At systems not supporting epoll edge triggering (Win32, FreeBSD,
-             * MacOS), we need to disable readable event to avoid busy loop */
-            ModifyWaitEvent(chan->proxy->wait_events, chan->event_pos,
-                            WL_SOCKET_WRITEABLE | WL_SOCKET_EDGE, NULL);
-            chan->edge_triggered = true;
-          }
-        }
-      }
-    }
-    if (IdlePoolWorkerTimeout) {
-      TimestampTz now = GetCurrentTimestamp();
-      TimestampTz timeout_usec = IdlePoolWorkerTimeout * 1000;
-      if (proxy->last_idle_timeout_check + timeout_usec < now) {
-        HASH_SEQ_STATUS seq;
-        struct SessionPool *pool;
-        proxy->last_idle_timeout_check = now;
-        hash_seq_init(&seq, proxy->pools);
-        while ((pool = hash_seq_search(&seq)) != NULL) {
-          for (chan = pool->idle_backends; chan != NULL; chan = chan->next) {
-            if (chan->backend_last_activity + timeout_usec < now) {
-              chan->is_interrupted =
-                  true; /* interrupted flags makes channel_write to send 'X'
-                           message */
-              channel_write(chan, false);
-            }
-          }
-        }
+  /* Use timeout to allow normal proxy shutdown */
+  int wait_timeout = g_ng_idcp_cfg_idle_worker_timeout_in_ms
+                         ? g_ng_idcp_cfg_idle_worker_timeout_in_ms
+                         : PROXY_WAIT_TIMEOUT;
+
+  /* Slots may be released by other workers: poll for them */
+  if (proxy->throttled != NIL)
+    wait_timeout = Min(wait_timeout, THROTTLE_RETRY_INTERVAL);
+
+  /* Sessions becoming idle are handed off in batches */
+  if (proxy->handoff)
+    wait_timeout = Min(wait_timeout, HANDOFF_RETRY_INTERVAL);
+
+#ifdef PROXY_USE_EPOLL_ET
+  n_ready = epoll_wait(proxy->epoll_fd, ready, MAX_READY_EVENTS,
+                       wait_timeout);
+  if (n_ready < 0) {
+    if (errno != EINTR)
+      elog(WARNING, "PROXY: epoll_wait failed: %m");
+    return;
+  }
+  for (i = 0; i < n_ready; i++) {
+    uint64 data = ready[i].data.u64;
+    uint32 events = ready[i].events;
+
+    if (EVENT_DATA_GEN(data) == 0) {
+      if (EVENT_DATA_SLOT(data) == EVENT_HANDOFF_SLOT) {
+        /* the worker this one replaces hands off more sessions */
+        proxy_handoff_receive(proxy);
+      } else if (EVENT_DATA_SLOT(data) == EVENT_WAKEUP_SLOT) {
+        /* a signal handler woke us up, see proxy_loop() */
+        proxy_wakeup_drain(proxy);
+      } else {
+        /* new connection from postmaster */
+        proxy_accept(proxy, proxy->listen_sockets[EVENT_DATA_SLOT(data)]);
       }
+      continue;
     }
 
     /*
-     * Delayed deallocation of disconnected channels.
-     * We can not delete channels immediately because of presence of peer
-     * events.
+     * Interest is registered once, so there is nothing to re-arm. EPOLLOUT
+     * is reported with nearly every edge, so the write is only retried if
+     * there is something to write. Errors and hangups are reported by the
+     * read.
      */
-    for (chan = proxy->hangout; chan != NULL; chan = next) {
-      next = chan->next;
-      channel_remove(chan);
+    chan = channel_lookup(proxy, EVENT_DATA_SLOT(data));
+    if (chan->generation != EVENT_DATA_GEN(data) ||
+        chan->magic != ACTIVE_CHANNEL_MAGIC)
+      continue;
+    if ((events & EPOLLOUT) &&
+        (chan->write_blocked ||
+         (chan->peer != NULL && chan->peer->tx_pos < chan->peer->tx_size))) {
+      ELOG(LOG, "Channel %p is writable", chan);
+      chan->write_blocked = false;
+      channel_write(chan, false);
+    }
+    if (chan->magic == ACTIVE_CHANNEL_MAGIC &&
+        (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) {
+      ELOG(LOG, "Channel %p is readable", chan);
+      channel_read(chan);
     }
-    proxy->hangout = NULL;
   }
-} /* proxy_loop() */
+#else
+  n_ready = WaitEventSetWait(proxy->wait_events, wait_timeout, ready,
+                             MAX_READY_EVENTS, PG_WAIT_CLIENT);
+  for (i = 0; i < n_ready; i++) {
+    chan = (Channel *)ready[i].user_data;
+    if (chan == NULL) /* new connection from postmaster */
+    {
+      if (ready[i].events & WL_SOCKET_ACCEPT)
+        proxy_accept(proxy, ready[i].fd);
+      if (ready[i].events & WL_LATCH_SET)
+        ResetLatch(MyLatch);
+    }
+    /*
+     * epoll may return event for already closed session if
+     * socket is still openned. From epoll documentation: Q6
+     * Will closing a file descriptor cause it to be removed
+     * from all epoll sets automatically?
+     *
+     * A6  Yes, but be aware of the following point.  A file
+     * descriptor is a reference to an open file description
+     * (see open(2)).  Whenever a descriptor is duplicated via
+     * dup(2), dup2(2), fcntl(2) F_DUPFD, or fork(2), a new
+     * file descriptor referring to the same open file
+     * description is created.  An open file  description
+     * continues  to exist until  all  file  descriptors
+     * referring to it have been closed.  A file descriptor is
+     * removed from an epoll set only after all the file
+     * descriptors referring to the underlying open file
+     * description  have been closed  (or  before  if  the
+     * descriptor is explicitly removed using epoll_ctl(2)
+     * EPOLL_CTL_DEL).  This means that even after a file
+     * descriptor that is part of an epoll set has been
+     * closed, events may be reported  for that  file
+     * descriptor  if  other  file descriptors referring to
+     * the same underlying file description remain open.
+     *
+     * Using this check for valid magic field we try to ignore
+     * such events.
+     */
+    else if (chan->magic == ACTIVE_CHANNEL_MAGIC) {
+      if (ready[i].events & WL_SOCKET_WRITEABLE) {
+        ELOG(LOG, "Channel %p is writable", chan);
+        channel_write(chan, false);
+        if (chan->magic == ACTIVE_CHANNEL_MAGIC &&
+            (chan->peer == NULL ||
+             chan->peer->tx_size == 0)) /* nothing to write */
+        {
+          /* At systems not supporting epoll edge triggering (Win32, FreeBSD,
+           * MacOS), we need to disable writable event to avoid busy loop */
+          channel_arm(chan, WL_SOCKET_READABLE);
+        }
+      }
+      if (ready[i].events & WL_SOCKET_READABLE) {
+        ELOG(LOG, "Channel %p is readable", chan);
+        channel_read(chan);
+        if (chan->magic == ACTIVE_CHANNEL_MAGIC &&
+            chan->tx_size != 0) /* pending write: read is not prohibited */
+        {
+          /* At systems not supporting epoll edge triggering (Win32, FreeBSD,
+           * MacOS), we need to disable readable event to avoid busy loop */
+          channel_arm(chan, WL_SOCKET_WRITEABLE);
+        }
+      }
+    }
+  }
+#endif
+} /* proxy_wait_events() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Wake the event loop from a signal handler, after setting the flag it
+ * checks once the wait returns.
+ */
+static void
+proxy_wakeup (
+  void
+) {
+  int rc;
+
+  if (proxy_wakeup_fd < 0)
+    return;
+  do {
+    /* A full pipe already wakes the loop */
+    rc = write(proxy_wakeup_fd, "", 1);
+  } while (rc < 0 && errno == EINTR);
+} /* proxy_wakeup() */
+
+/* ------------------------------------------------------------------------- */
+
+#ifdef PROXY_USE_EPOLL_ET
+/*
+ * Empty the wakeup pipe. The flags signal handlers set are checked after
+ * this, so none of them is missed.
+ */
+static void
+proxy_wakeup_drain (
+  Proxy *proxy
+) {
+  char buf[64];
+
+  while (read(proxy->wakeup_fd, buf, sizeof(buf)) > 0)
+    ;
+} /* proxy_wakeup_drain() */
 
 /* ------------------------------------------------------------------------- */
+#endif
 
 /*
  * Send error message to the client. This function is called when new backend
@@ -1683,7 +5313,7 @@ report_error_to_client (
   pq_sendbyte(&msgbuf, PG_DIAG_MESSAGE_PRIMARY);
   pq_sendstring(&msgbuf, error);
   pq_sendbyte(&msgbuf, '\0');
-  socket_write(chan, msgbuf.data, msgbuf.len);
+  socket_write(chan, msgbuf.data, msgbuf.len, false);
   pfree(msgbuf.data);
 } /* report_error_to_client() */
 
@@ -1696,25 +5326,120 @@ static ssize_t
 socket_write (
   Channel        *chan,
   char const     *buf,
-  size_t          size
+  size_t          size,
+  bool            more
 ) {
   ssize_t rc;
-#ifdef USE_SSL
-  int waitfor = 0;
-  if (chan->client_port && chan->client_port->ssl_in_use)
-    rc = be_tls_write(chan->client_port, (char *)buf, size, &waitfor);
-  else
+#ifdef MSG_MORE
+  if (more) {
+    /* Only set for plain TCP and kTLS clients, see channel_write() */
+    rc = send(chan->client_port->sock, buf, size, MSG_MORE);
+    if (rc > 0 && !chan->corked) {
+      chan->corked = true;
+      chan->proxy->corked = lappend(chan->proxy->corked, chan);
+    }
+  } else
 #endif
-    rc = chan->client_port ? secure_raw_write(chan->client_port, buf, size)
-                           : send(chan->backend_socket, buf, size, 0);
+    rc = CHANNEL_OPS(chan)->send(chan, buf, size);
+  if (rc > 0 && !more)
+    chan->corked = false; /* sending without MSG_MORE pushed everything */
   if (rc == 0 || (rc < 0 && (errno != EAGAIN && errno != EWOULDBLOCK))) {
     channel_hangout(chan, "write");
+  } else if (rc < 0) {
+    channel_wait_writable(chan);
   }
   return rc;
 } /* socket_write() */
 
 /* ------------------------------------------------------------------------- */
 
+static int
+startup_option_compare (
+  const void *a,
+  const void *b
+) {
+  return strcmp(((const StartupOption *) a)->name,
+                ((const StartupOption *) b)->name);
+} /* startup_option_compare() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Fingerprint of the startup parameters a pool's backends are started with.
+ */
+static uint64
+startup_options_hash (
+  List         *gucs,
+  const char   *cmdline_options
+) {
+  StringInfoData buf;
+  ListCell *cell;
+  uint64 hash;
+
+  initStringInfo(&buf);
+  foreach (cell, gucs) {
+    const char *str = (const char *) lfirst(cell);
+    appendBinaryStringInfo(&buf, str, strlen(str) + 1);
+  }
+  if (cmdline_options)
+    appendStringInfoString(&buf, cmdline_options);
+  hash = hash_bytes_extended((const unsigned char *) buf.data, buf.len, 0);
+  pfree(buf.data);
+
+  /* Zero is reserved for pools whose GUCs are set per transaction */
+  return hash != 0 ? hash : 1;
+} /* startup_options_hash() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Startup parameters that select a pool's backends, as a name/value list:
+ * the client's GUCs except application_name (reported per client) and those
+ * listed in nextgres_idcp.ignore_startup_parameters, with lowercase names
+ * (GUC names are case-insensitive) in sorted order.
+ */
+static List *
+startup_options_normalize (
+  Proxy    *proxy,
+  List     *guc_options
+) {
+  StartupOption *options = palloc(sizeof(StartupOption) *
+                                  (list_length(guc_options) / 2 + 1));
+  List *result = NIL;
+  ListCell *gucopts = list_head(guc_options);
+  int n = 0;
+
+  while (gucopts) {
+    char *name = pstrdup(lfirst(gucopts));
+    char *value;
+    bool ignored;
+    ListCell *cell;
+
+    gucopts = lnext(guc_options, gucopts);
+    value = lfirst(gucopts);
+    gucopts = lnext(guc_options, gucopts);
+
+    for (char *c = name; *c; c++)
+      *c = pg_tolower((unsigned char) *c);
+    ignored = strcmp(name, "application_name") == 0;
+    foreach (cell, proxy->ignored_startup_parameters)
+      ignored = ignored || strcmp(name, (char *) lfirst(cell)) == 0;
+    if (ignored)
+      continue;
+    options[n].name = name;
+    options[n].value = value;
+    n++;
+  }
+
+  qsort(options, n, sizeof(StartupOption), startup_option_compare);
+  for (int ii = 0; ii < n; ii++)
+    result = lappend(lappend(result, options[ii].name), options[ii].value);
+  pfree(options);
+  return result;
+} /* startup_options_normalize() */
+
+/* ------------------------------------------------------------------------- */
+
 static char *
 string_append (
   char         *dst,
@@ -0,0 +1,283 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Registry of the pooled backends of all proxy workers.
+ *
+ * A proxy worker that dies takes its end of the backend connections with it.
+ * Idle backends notice at once and exit, but a backend in the middle of a
+ * query keeps its connection slot until it next talks to its client, which
+ * may be a long time. The controller uses this registry to find and
+ * terminate such orphans when it restarts a worker, and to give back the
+ * database and role slots (see connlimit.c) the dead worker held for them,
+ * so that the replacement gets the capacity back.
+ *
+ * There is one entry per PGPROC, holding the pids of the backend and of the
+ * worker that owns it along with the backend's database and role, under a
+ * spinlock of its own, so workers registering and dropping backends never
+ * contend with each other. An entry is only cleared by its owner (or by the
+ * controller once the owner is gone), and only while it still names the
+ * same backend, as the PGPROC may already have been reused.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "storage/proc.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+#include <signal.h>
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/storage/ipc.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* Pooled backends are regular backends, numbered below MaxBackends */
+#define BACKEND_REGISTRY_ENTRIES    MaxBackends
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct BackendRegistryEntry;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Pooled backend using a PGPROC.
+ */
+typedef struct BackendRegistryEntry {
+  slock_t               mutex;
+
+  /** Pid of the backend, 0 when the entry is unused */
+  int                   backend_pid;
+
+  /** Pid of the proxy worker owning the backend */
+  pid_t                 worker_pid;
+
+  /** Database and role slots held for the backend, role empty if none */
+  NameData              database;
+  NameData              role;
+} BackendRegistryEntry;
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static BackendRegistryEntry *backend_registry_entry (PGPROC *proc);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* By pgprocno */
+static BackendRegistryEntry *ng_idcp_backend_registry = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Record that the calling proxy worker owns a pooled backend, which holds a
+ * slot of its database and, unless role is empty, of its role. A backend
+ * handed off by another worker changes owner.
+ */
+void
+ng_idcp_backend_registry_add (
+  PGPROC       *proc,
+  int           backend_pid,
+  const char   *database,
+  const char   *role
+) {
+  BackendRegistryEntry *entry = backend_registry_entry(proc);
+
+  if (entry == NULL)
+    return;
+  SpinLockAcquire(&entry->mutex);
+  entry->backend_pid = backend_pid;
+  entry->worker_pid = MyProcPid;
+  strlcpy(NameStr(entry->database), database, NAMEDATALEN);
+  strlcpy(NameStr(entry->role), role, NAMEDATALEN);
+  SpinLockRelease(&entry->mutex);
+} /* ng_idcp_backend_registry_add() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Terminate the backends still registered to a proxy worker that is gone,
+ * and give back the database and role slots it held for them. Returns the
+ * number of backends signalled.
+ */
+int
+ng_idcp_backend_registry_reclaim (
+  pid_t worker_pid
+) {
+  int n_terminated = 0;
+
+  for (int ii = 0; ii < BACKEND_REGISTRY_ENTRIES; ++ii) {
+    BackendRegistryEntry *entry = &ng_idcp_backend_registry[ii];
+    NameData database;
+    NameData role;
+    int backend_pid;
+
+    SpinLockAcquire(&entry->mutex);
+    backend_pid = entry->backend_pid;
+    if (backend_pid == 0 || entry->worker_pid != worker_pid) {
+      SpinLockRelease(&entry->mutex);
+      continue;
+    }
+    database = entry->database;
+    role = entry->role;
+    entry->backend_pid = 0;
+    SpinLockRelease(&entry->mutex);
+
+    /* The slots were the dead worker's, whether or not the backend lives */
+    ng_idcp_conn_limit_release(NG_IDCP_CONN_LIMIT_DATABASE,
+                               NameStr(database));
+    if (NameStr(role)[0] != '\0')
+      ng_idcp_conn_limit_release(NG_IDCP_CONN_LIMIT_USER, NameStr(role));
+
+    /* Make sure the pid wasn't recycled by an unrelated process */
+    if (BackendPidGetProc(backend_pid) == NULL)
+      continue;
+    if (kill(backend_pid, SIGTERM) < 0) {
+      ereport(LOG,
+              (errmsg("could not terminate orphaned pooled backend %d: %m",
+                      backend_pid)));
+      continue;
+    }
+    n_terminated += 1;
+  }
+  return n_terminated;
+} /* ng_idcp_backend_registry_reclaim() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Forget a pooled backend of the calling proxy worker, unless it has been
+ * handed off to another worker in the meantime.
+ */
+void
+ng_idcp_backend_registry_remove (
+  PGPROC   *proc,
+  int       backend_pid
+) {
+  BackendRegistryEntry *entry = backend_registry_entry(proc);
+
+  if (entry == NULL)
+    return;
+  SpinLockAcquire(&entry->mutex);
+  if (entry->backend_pid == backend_pid && entry->worker_pid == MyProcPid)
+    entry->backend_pid = 0;
+  SpinLockRelease(&entry->mutex);
+} /* ng_idcp_backend_registry_remove() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared registry of pooled backends.
+ */
+void
+ng_idcp_backend_registry_shmem_init (
+  void
+) {
+  bool found;
+
+  ng_idcp_backend_registry = ShmemInitStruct(
+    NEXTGRES_EXTNAME " pooled backends", ng_idcp_backend_registry_shmem_size(),
+    &found);
+  if (!found) {
+    memset(ng_idcp_backend_registry, 0, ng_idcp_backend_registry_shmem_size());
+    for (int ii = 0; ii < BACKEND_REGISTRY_ENTRIES; ++ii)
+      SpinLockInit(&ng_idcp_backend_registry[ii].mutex);
+  }
+} /* ng_idcp_backend_registry_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the registry of pooled backends.
+ */
+Size
+ng_idcp_backend_registry_shmem_size (
+  void
+) {
+  return mul_size(sizeof(BackendRegistryEntry), BACKEND_REGISTRY_ENTRIES);
+} /* ng_idcp_backend_registry_shmem_size() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Registry entry of a backend's PGPROC, NULL if it isn't a regular backend.
+ */
+static BackendRegistryEntry *
+backend_registry_entry (
+  PGPROC *proc
+) {
+  if (proc == NULL || proc->pgprocno >= BACKEND_REGISTRY_ENTRIES)
+    return NULL;
+  return &ng_idcp_backend_registry[proc->pgprocno];
+} /* backend_registry_entry() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
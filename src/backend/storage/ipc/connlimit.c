@@ -0,0 +1,281 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Backend counters shared by all proxy workers.
+ *
+ * nextgres_idcp.max_db_connections and nextgres_idcp.max_user_connections
+ * bound the number of pooled backends of a database or role across the whole
+ * instance, whichever worker (and pool) started them. Each database and role
+ * has an atomic counter in a shared hash table: a worker reserves a slot
+ * before starting a backend and gives it back when the backend is gone. The
+ * LWLock only protects the table itself, so workers starting backends for
+ * the same database don't serialize on it.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/storage/ipc.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * A counter is only in use while some backend holds a slot, so there are at
+ * most MaxConnections busy counters of each kind and a full table always has
+ * an idle one to recycle.
+ */
+#define CONN_LIMIT_ENTRIES      (2 * MaxConnections)
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct ConnLimitEntry;
+struct ConnLimitKey;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct ConnLimitKey {
+  /** NG_IDCP_CONN_LIMIT_DATABASE or NG_IDCP_CONN_LIMIT_USER */
+  int                   kind;
+  NameData              name;
+} ConnLimitKey;
+
+/*
+ * Counter of a database or role, in a shared hash table protected by
+ * NG_IDCP_LWLOCK_CONN_LIMITS. The count itself is changed with atomics under
+ * a shared lock; an exclusive lock is only taken to add or recycle entries.
+ */
+typedef struct ConnLimitEntry {
+  ConnLimitKey          key;
+
+  /** Number of backends started by all proxy workers */
+  pg_atomic_uint32      n_backends;
+} ConnLimitEntry;
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static ConnLimitEntry *conn_limit_enter (const ConnLimitKey *key);
+static void conn_limit_key (ConnLimitKey *key, int kind, const char *name);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static HTAB *ng_idcp_conn_limits = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Reserve a backend slot of a database or role. Returns false if "limit"
+ * backends (0 meaning no limit) are already running, in which case nothing
+ * is reserved. A successful reservation must be given back with
+ * ng_idcp_conn_limit_release().
+ */
+bool
+ng_idcp_conn_limit_acquire (
+  int           kind,
+  const char   *name,
+  int           limit
+) {
+  ConnLimitKey key;
+  ConnLimitEntry *entry;
+  bool acquired = true;
+
+  conn_limit_key(&key, kind, name);
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS), LW_SHARED);
+  entry = hash_search(ng_idcp_conn_limits, &key, HASH_FIND, NULL);
+  if (entry == NULL) {
+    LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS));
+    LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS), LW_EXCLUSIVE);
+    entry = conn_limit_enter(&key);
+  }
+
+  /* Optimistically take the slot, back out if that went over the limit */
+  if (pg_atomic_fetch_add_u32(&entry->n_backends, 1) >= (uint32) limit
+      && limit > 0) {
+    pg_atomic_fetch_sub_u32(&entry->n_backends, 1);
+    acquired = false;
+  }
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS));
+
+  return acquired;
+} /* ng_idcp_conn_limit_acquire() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Give back a slot reserved by ng_idcp_conn_limit_acquire().
+ */
+void
+ng_idcp_conn_limit_release (
+  int           kind,
+  const char   *name
+) {
+  ConnLimitKey key;
+  ConnLimitEntry *entry;
+
+  conn_limit_key(&key, kind, name);
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS), LW_SHARED);
+  entry = hash_search(ng_idcp_conn_limits, &key, HASH_FIND, NULL);
+
+  /* Entries holding slots are never recycled */
+  Assert(entry != NULL && pg_atomic_read_u32(&entry->n_backends) > 0);
+  if (entry != NULL)
+    pg_atomic_fetch_sub_u32(&entry->n_backends, 1);
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_CONN_LIMITS));
+} /* ng_idcp_conn_limit_release() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared backend counters.
+ */
+void
+ng_idcp_conn_limit_shmem_init (
+  void
+) {
+  HASHCTL info;
+
+  info.keysize = sizeof(ConnLimitKey);
+  info.entrysize = sizeof(ConnLimitEntry);
+  ng_idcp_conn_limits = ShmemInitHash(NEXTGRES_EXTNAME " backend counters",
+                                      CONN_LIMIT_ENTRIES, CONN_LIMIT_ENTRIES,
+                                      &info, HASH_ELEM | HASH_BLOBS);
+} /* ng_idcp_conn_limit_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the backend counters.
+ */
+Size
+ng_idcp_conn_limit_shmem_size (
+  void
+) {
+  return hash_estimate_size(CONN_LIMIT_ENTRIES, sizeof(ConnLimitEntry));
+} /* ng_idcp_conn_limit_shmem_size() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Find or add the counter of a key, holding the lock exclusively. When the
+ * table is full, an unused counter is recycled.
+ */
+static ConnLimitEntry *
+conn_limit_enter (
+  const ConnLimitKey *key
+) {
+  ConnLimitEntry *entry;
+  bool found;
+
+  entry = hash_search(ng_idcp_conn_limits, key, HASH_FIND, NULL);
+  if (entry != NULL)
+    return entry;
+
+  if (hash_get_num_entries(ng_idcp_conn_limits) >= CONN_LIMIT_ENTRIES) {
+    HASH_SEQ_STATUS status;
+    ConnLimitEntry *victim;
+
+    hash_seq_init(&status, ng_idcp_conn_limits);
+    while ((victim = hash_seq_search(&status)) != NULL) {
+      if (pg_atomic_read_u32(&victim->n_backends) == 0) {
+        (void) hash_search(ng_idcp_conn_limits, &victim->key, HASH_REMOVE,
+                           NULL);
+        hash_seq_term(&status);
+        break;
+      }
+    }
+  }
+
+  entry = hash_search(ng_idcp_conn_limits, key, HASH_ENTER, &found);
+  if (!found)
+    pg_atomic_init_u32(&entry->n_backends, 0);
+  return entry;
+} /* conn_limit_enter() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+conn_limit_key (
+  ConnLimitKey *key,
+  int           kind,
+  const char   *name
+) {
+  memset(key, 0, sizeof(*key));
+  key->kind = kind;
+  strlcpy(NameStr(key->name), name, NAMEDATALEN);
+} /* conn_limit_key() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
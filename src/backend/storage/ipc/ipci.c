@@ -0,0 +1,216 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Shared memory and LWLocks of the extension.
+ *
+ * Space and locks are requested from the postmaster through the
+ * shmem_request_hook while shared_preload_libraries are processed, and each
+ * module's structures are created (or attached to, in EXEC_BACKEND children)
+ * from the shmem_startup_hook. Modules provide a *_shmem_size() and
+ * *_shmem_init() pair, which are listed here.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "libpq/libpq-be.h"
+#include "miscadmin.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/libpq/libpq.h"
+#include "nextgres/idcp/postmaster/handoff.h"
+#include "nextgres/idcp/postmaster/proxy.h"
+#include "nextgres/idcp/storage/ipc.h"
+#include "nextgres/idcp/util/poolconfig.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static void ng_idcp_shmem_request (void);
+static Size ng_idcp_shmem_size (void);
+static void ng_idcp_shmem_startup (void);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* First lock of our tranche, resolved at shared memory startup */
+static LWLockPadded *ng_idcp_lwlocks = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Get one of the extension's LWLocks (NG_IDCP_LWLOCK_*).
+ */
+LWLock *
+ng_idcp_lwlock (
+  int id
+) {
+  Assert(id >= 0 && id < NG_IDCP_NUM_LWLOCKS);
+  Assert(ng_idcp_lwlocks != NULL);
+  return &ng_idcp_lwlocks[id].lock;
+} /* ng_idcp_lwlock() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Install the shared memory hooks. Must be called from _PG_init() while
+ * shared_preload_libraries are being processed.
+ */
+void
+ng_idcp_shmem_init (
+  void
+) {
+  Assert(process_shared_preload_libraries_in_progress);
+
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = ng_idcp_shmem_request;
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = ng_idcp_shmem_startup;
+} /* ng_idcp_shmem_init() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Reserve shared memory and LWLocks for all modules.
+ */
+static void
+ng_idcp_shmem_request (
+  void
+) {
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+
+  RequestAddinShmemSpace(ng_idcp_shmem_size());
+  RequestNamedLWLockTranche(NEXTGRES_EXTNAME, NG_IDCP_NUM_LWLOCKS);
+} /* ng_idcp_shmem_request() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Total amount of shared memory used by the extension.
+ */
+static Size
+ng_idcp_shmem_size (
+  void
+) {
+  Size size = 0;
+
+  size = add_size(size, ng_idcp_auth_shmem_size());
+  size = add_size(size, ng_idcp_backend_registry_shmem_size());
+  size = add_size(size, ng_idcp_conn_limit_shmem_size());
+  size = add_size(size, ng_idcp_handoff_shmem_size());
+  size = add_size(size, ng_idcp_pool_config_shmem_size());
+  size = add_size(size, ng_idcp_proxy_shmem_size());
+#ifdef USE_SSL
+  size = add_size(size, ng_idcp_tls_shmem_size());
+#endif
+
+  return size;
+} /* ng_idcp_shmem_size() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Create or attach to the shared structures of all modules.
+ */
+static void
+ng_idcp_shmem_startup (
+  void
+) {
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  ng_idcp_lwlocks = GetNamedLWLockTranche(NEXTGRES_EXTNAME);
+
+  ng_idcp_auth_shmem_init();
+  ng_idcp_backend_registry_shmem_init();
+  ng_idcp_conn_limit_shmem_init();
+  ng_idcp_handoff_shmem_init();
+  ng_idcp_pool_config_shmem_init();
+  ng_idcp_proxy_shmem_init();
+#ifdef USE_SSL
+  ng_idcp_tls_shmem_init();
+#endif
+
+  LWLockRelease(AddinShmemInitLock);
+} /* ng_idcp_shmem_startup() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
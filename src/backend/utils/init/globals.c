@@ -79,6 +79,9 @@ bool MultitenantProxy = false;
 
 /* ------------------------------ Boolean GUCs ----------------------------- */
 
+bool g_ng_idcp_client_tls_ktls = false;
+bool g_ng_idcp_coalesce_responses = true;
+bool g_ng_idcp_io_uring = false;
 bool g_ng_idcp_multitenant_proxy = false;
 bool g_ng_idcp_proxying_gucs = false;
 bool g_ng_idcp_restart_pooler_on_reload = false;
@@ -91,12 +94,17 @@ int g_ng_idcp_cfg_session_scheduler = 0;
 int g_ng_idcp_cfg_idle_worker_timeout_in_ms = 0;
 int g_ng_idcp_cfg_thread_count = 0;
 int g_ng_idcp_cfg_max_sessions_per_thread = 0;
-int g_ng_idcp_cfg_pool_mode = NG_IDCP_POOL_MODE_SESSION;
+int g_ng_idcp_cfg_pool_mode = NG_IDCP_POOL_MODE_TRANSACTION;
 int g_ng_idcp_cfg_application_name_add_host = 0;
+int g_ng_idcp_cfg_auth_cache_size = 0;
+int g_ng_idcp_cfg_auth_cache_ttl = 0;
 int g_ng_idcp_cfg_autodb_idle_timeout = 0;
 int g_ng_idcp_cfg_cancel_wait_timeout = 0;
 int g_ng_idcp_cfg_client_idle_timeout = 0;
 int g_ng_idcp_cfg_client_login_timeout = 0;
+int g_ng_idcp_cfg_client_tls_session_cache_size = 0;
+int g_ng_idcp_cfg_client_tls_session_timeout = 0;
+int g_ng_idcp_cfg_config_refresh_interval = 0;
 int g_ng_idcp_cfg_default_pool_size = 0;
 int g_ng_idcp_cfg_disable_pqexec = 0;
 int g_ng_idcp_cfg_dns_max_ttl = 0;
@@ -134,6 +142,7 @@ int g_ng_idcp_cfg_so_reuseport = 0;
 int g_ng_idcp_cfg_stats_period = 0;
 int g_ng_idcp_cfg_suspend_timeout = 0;
 int g_ng_idcp_cfg_tcp_defer_accept = 0;
+int g_ng_idcp_cfg_tcp_fastopen = 0;
 int g_ng_idcp_cfg_tcp_keepcnt = 0;
 int g_ng_idcp_cfg_tcp_keepidle = 0;
 int g_ng_idcp_cfg_tcp_keepintvl = 0;
@@ -158,6 +167,7 @@ char *gp_ng_idcp_cfg_client_tls_ecdhcurve = NULL;
 char *gp_ng_idcp_cfg_client_tls_key_file = NULL;
 char *gp_ng_idcp_cfg_client_tls_protocols = NULL;
 char *gp_ng_idcp_cfg_client_tls_sslmode = NULL;
+char *gp_ng_idcp_cfg_database_name = NULL;
 char *gp_ng_idcp_cfg_ignore_startup_parameters = NULL;
 char *gp_ng_idcp_cfg_job_name = NULL;
 char *gp_ng_idcp_cfg_listen_addr = NULL;
@@ -47,6 +47,8 @@
 /* ========================================================================= */
 
 #define DEFAULT_IDCP_APPLICATION_NAME_ADD_HOST  0
+#define DEFAULT_IDCP_AUTH_CACHE_SIZE            1024
+#define DEFAULT_IDCP_AUTH_CACHE_TTL             60
 #define DEFAULT_IDCP_AUTH_DBNAME                NULL
 #define DEFAULT_IDCP_AUTH_FILE                  NULL
 #define DEFAULT_IDCP_AUTH_HBA_FILE              "pg_hba.conf"
@@ -63,8 +65,14 @@
 #define DEFAULT_IDCP_CLIENT_TLS_DHEPARAMS       "auto"
 #define DEFAULT_IDCP_CLIENT_TLS_ECDHCURVE       "auto"
 #define DEFAULT_IDCP_CLIENT_TLS_KEY_FILE        NULL
+#define DEFAULT_IDCP_CLIENT_TLS_KTLS            false
 #define DEFAULT_IDCP_CLIENT_TLS_PROTOCOLS       "secure"
+#define DEFAULT_IDCP_CLIENT_TLS_SESSION_CACHE_SIZE 1024
+#define DEFAULT_IDCP_CLIENT_TLS_SESSION_TIMEOUT 3600
 #define DEFAULT_IDCP_CLIENT_TLS_SSLMODE         "disable"
+#define DEFAULT_IDCP_COALESCE_RESPONSES         true
+#define DEFAULT_IDCP_CONFIG_REFRESH_INTERVAL    60
+#define DEFAULT_IDCP_DATABASE_NAME              "postgres"
 #define DEFAULT_IDCP_DEFAULT_POOL_SIZE          20
 #define DEFAULT_IDCP_DISABLE_PQEXEC             0
 #define DEFAULT_IDCP_DNS_MAX_TTL                15
@@ -73,6 +81,7 @@
 #define DEFAULT_IDCP_IDLE_TRANSACTION_TIMEOUT   0
 #define DEFAULT_IDCP_IDLE_WORKER_TIMEOUT_IN_MS  0
 #define DEFAULT_IDCP_IGNORE_STARTUP_PARAMETERS  NULL
+#define DEFAULT_IDCP_IO_URING                   false
 #define DEFAULT_IDCP_JOB_NAME                   "pgbouncer"
 #define DEFAULT_IDCP_LISTEN_ADDR                NULL
 #define DEFAULT_IDCP_LISTEN_BACKLOG             128
@@ -93,7 +102,7 @@
 #define DEFAULT_IDCP_PEER_ID                    0
 #define DEFAULT_IDCP_PIDFILE                    NULL
 #define DEFAULT_IDCP_PKT_BUF                    4096
-#define DEFAULT_IDCP_POOL_MODE                  NG_IDCP_POOL_MODE_SESSION
+#define DEFAULT_IDCP_POOL_MODE                  NG_IDCP_POOL_MODE_TRANSACTION
 #define DEFAULT_IDCP_PORT                       6543
 #define DEFAULT_IDCP_PROXYING_GUCS              false
 #define DEFAULT_IDCP_QUERY_TIMEOUT              0
@@ -126,6 +135,7 @@
 #define DEFAULT_IDCP_STATS_PERIOD               60
 #define DEFAULT_IDCP_SUSPEND_TIMEOUT            10
 #define DEFAULT_IDCP_TCP_DEFER_ACCEPT           0
+#define DEFAULT_IDCP_TCP_FASTOPEN               0
 #define DEFAULT_IDCP_TCP_KEEPALIVE              NULL
 #define DEFAULT_IDCP_TCP_KEEPCNT                0
 #define DEFAULT_IDCP_TCP_KEEPIDLE               0
@@ -204,10 +214,12 @@ static const struct ng_idcp_bool_guc_s {
   {
     .name = "nextgres_idcp.restart_pooler_on_reload",
     .short_desc = gettext_noop("Restart session pool workers on pg_reload_conf()"),
-    .long_desc = gettext_noop("Restart session pool workers on pg_reload_conf()"),
+    .long_desc = gettext_noop("By default the workers apply reloaded settings "
+      "in place; when set, they are replaced by new workers which take over "
+      "their listeners and idle sessions."),
     .valueAddr = &g_ng_idcp_restart_pooler_on_reload,
     .bootValue = DEFAULT_IDCP_RESTART_POOLER_ON_RELOAD,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -237,6 +249,52 @@ static const struct ng_idcp_bool_guc_s {
     .assign_hook = NULL,
     .show_hook = NULL,
   },
+  {
+    .name = "nextgres_idcp.io_uring",
+    .short_desc = gettext_noop("Use io_uring for the proxy event loop."),
+    .long_desc = gettext_noop("Proxy workers batch socket I/O through io_uring "
+      "(multishot accept/recv with provided buffers) instead of epoll. "
+      "Requires a build with io_uring support; falls back to epoll when the "
+      "kernel does not provide the required features."),
+    .valueAddr = &g_ng_idcp_io_uring,
+    .bootValue = DEFAULT_IDCP_IO_URING,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL,
+  },
+  {
+    .name = "nextgres_idcp.coalesce_responses",
+    .short_desc = gettext_noop("Coalesce small responses sent to clients."),
+    .long_desc = gettext_noop("Responses forwarded to plain TCP clients are sent with MSG_MORE until "
+      "ReadyForQuery, and flushed at the end of each event loop iteration, so "
+      "a query result does not turn into many small TCP segments."),
+    .valueAddr = &g_ng_idcp_coalesce_responses,
+    .bootValue = DEFAULT_IDCP_COALESCE_RESPONSES,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL,
+  },
+  {
+    .name = "nextgres_idcp.client_tls_ktls",
+    .short_desc = gettext_noop("Terminate client TLS in the proxy using kernel TLS offload."),
+    .long_desc = gettext_noop("The proxy performs the client TLS handshake with its own context "
+      "(client_tls_* settings, falling back to the server ssl_* files). With "
+      "this setting it also installs the session keys into the socket, so "
+      "that encryption of responses is done by the kernel, and offers TLS "
+      "even when the server has ssl disabled. Requires OpenSSL and a kernel "
+      "with kTLS support."),
+    .valueAddr = &g_ng_idcp_client_tls_ktls,
+    .bootValue = DEFAULT_IDCP_CLIENT_TLS_KTLS,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL,
+  },
 }; /* ng_idcp_bool_gucs */
 
 /* ------------------------------ Integer GUCs ----------------------------- */
@@ -411,8 +469,8 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.listen_backlog",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the length of the accept queue of the proxy's listening sockets."),
+    .long_desc = gettext_noop("0 uses twice max_connections."),
     .valueAddr = &g_ng_idcp_cfg_listen_backlog,
     .bootValue = DEFAULT_IDCP_LISTEN_BACKLOG,
     .minValue = 0,
@@ -425,13 +483,14 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.listen_port",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the TCP port the proxy workers listen on."),
+    .long_desc = gettext_noop("Changing it on reload moves the listeners to the "
+      "new port without dropping established client connections."),
     .valueAddr = &g_ng_idcp_cfg_listen_port,
     .bootValue = DEFAULT_IDCP_LISTEN_PORT,
     .minValue = 0,
     .maxValue = 65535,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -509,13 +568,13 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.max_db_connections",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Maximum number of pooled backends per database across all proxy workers."),
+    .long_desc = gettext_noop("Clients needing a backend beyond this limit wait until one is released. Zero means no limit."),
     .valueAddr = &g_ng_idcp_cfg_max_db_connections,
     .bootValue = DEFAULT_IDCP_MAX_DB_CONNECTIONS,
     .minValue = 0,
     .maxValue = 65535,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -551,13 +610,13 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.max_user_connections",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Maximum number of pooled backends per role across all proxy workers."),
+    .long_desc = gettext_noop("Clients needing a backend beyond this limit wait until one is released. Zero means no limit."),
     .valueAddr = &g_ng_idcp_cfg_max_user_connections,
     .bootValue = DEFAULT_IDCP_MAX_USER_CONNECTIONS,
     .minValue = 0,
     .maxValue = 65535,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -831,8 +890,8 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_defer_accept",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets TCP_DEFER_ACCEPT on the proxy's TCP listeners, in seconds."),
+    .long_desc = gettext_noop("Connections are accepted only once the client sent data, 0 disables it."),
     .valueAddr = &g_ng_idcp_cfg_tcp_defer_accept,
     .bootValue = DEFAULT_IDCP_TCP_DEFER_ACCEPT,
     .minValue = 0,
@@ -843,10 +902,25 @@ static const struct ng_idcp_int_guc_s {
     .assign_hook = NULL,
     .show_hook = NULL
   },
+  {
+    .name = "nextgres_idcp.tcp_fastopen",
+    .short_desc = gettext_noop("Sets the TCP Fast Open queue length of the proxy's TCP listeners."),
+    .long_desc = gettext_noop("Clients may then send their first packet with the SYN, if the "
+      "net.ipv4.tcp_fastopen sysctl allows it for servers. 0 disables it."),
+    .valueAddr = &g_ng_idcp_cfg_tcp_fastopen,
+    .bootValue = DEFAULT_IDCP_TCP_FASTOPEN,
+    .minValue = 0,
+    .maxValue = 65535,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
+  },
   {
     .name = "nextgres_idcp.tcp_keepcnt",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the number of TCP keepalive probes sent to proxy clients."),
+    .long_desc = gettext_noop("0 uses the system default."),
     .valueAddr = &g_ng_idcp_cfg_tcp_keepcnt,
     .bootValue = DEFAULT_IDCP_TCP_KEEPCNT,
     .minValue = 0,
@@ -859,8 +933,8 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_keepidle",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the idle time before TCP keepalive probes are sent to proxy clients, in seconds."),
+    .long_desc = gettext_noop("0 uses the system default."),
     .valueAddr = &g_ng_idcp_cfg_tcp_keepidle,
     .bootValue = DEFAULT_IDCP_TCP_KEEPIDLE,
     .minValue = 0,
@@ -873,8 +947,8 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_keepintvl",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the interval between TCP keepalive probes sent to proxy clients, in seconds."),
+    .long_desc = gettext_noop("0 uses the system default."),
     .valueAddr = &g_ng_idcp_cfg_tcp_keepintvl,
     .bootValue = DEFAULT_IDCP_TCP_KEEPINTVL,
     .minValue = 0,
@@ -887,12 +961,12 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_socket_buffer",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the send and receive buffer sizes of proxy client sockets, in bytes."),
+    .long_desc = gettext_noop("Set on the listeners so that accepted connections scale their window to it. 0 uses the system default."),
     .valueAddr = &g_ng_idcp_cfg_tcp_socket_buffer,
     .bootValue = DEFAULT_IDCP_TCP_SOCKET_BUFFER,
     .minValue = 0,
-    .maxValue = 65535,
+    .maxValue = INT_MAX,
     .context = PGC_POSTMASTER,
     .flags = 0,
     .check_hook = NULL,
@@ -901,12 +975,12 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_user_timeout",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets TCP_USER_TIMEOUT of proxy client sockets, in milliseconds."),
+    .long_desc = gettext_noop("A client that does not acknowledge sent data for this long is disconnected. 0 uses the system default."),
     .valueAddr = &g_ng_idcp_cfg_tcp_user_timeout,
     .bootValue = DEFAULT_IDCP_TCP_USER_TIMEOUT,
     .minValue = 0,
-    .maxValue = 65535,
+    .maxValue = INT_MAX,
     .context = PGC_POSTMASTER,
     .flags = 0,
     .check_hook = NULL,
@@ -915,8 +989,8 @@ static const struct ng_idcp_int_guc_s {
   },
   {
     .name = "nextgres_idcp.unix_socket_mode",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the access permissions of the proxy's Unix-domain socket."),
+    .long_desc = gettext_noop("Given as a numeric mode, as for unix_socket_permissions."),
     .valueAddr = &g_ng_idcp_cfg_unix_socket_mode,
     .bootValue = DEFAULT_IDCP_UNIX_SOCKET_MODE,
     .minValue = 0,
@@ -953,7 +1027,7 @@ static const struct ng_idcp_int_guc_s {
     .bootValue = DEFAULT_IDCP_SESSION_POOL_SIZE,
     .minValue = 0,
     .maxValue = INT_MAX,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -967,7 +1041,7 @@ static const struct ng_idcp_int_guc_s {
     .bootValue = DEFAULT_IDCP_IDLE_WORKER_TIMEOUT_IN_MS,
     .minValue = 0,
     .maxValue = INT_MAX,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -1017,6 +1091,83 @@ static const struct ng_idcp_int_guc_s {
     .check_hook = NULL,
     .assign_hook = NULL,
     .show_hook = NULL
+  },
+  {
+    .name = "nextgres_idcp.client_tls_session_cache_size",
+    .short_desc = gettext_noop("Number of client TLS sessions cached in shared memory for session-ID resumption."),
+    .long_desc = gettext_noop("The cache is shared by all proxy workers. Zero disables session-ID "
+      "resumption; session tickets are not affected."),
+    .valueAddr = &g_ng_idcp_cfg_client_tls_session_cache_size,
+    .bootValue = DEFAULT_IDCP_CLIENT_TLS_SESSION_CACHE_SIZE,
+    .minValue = 0,
+    .maxValue = 1048576,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
+  },
+  {
+    .name = "nextgres_idcp.client_tls_session_timeout",
+    .short_desc = gettext_noop("Lifetime of resumable client TLS sessions."),
+    .long_desc = gettext_noop("Session ticket keys shared by the proxy workers are rotated at this "
+      "interval. Zero disables TLS session resumption."),
+    .valueAddr = &g_ng_idcp_cfg_client_tls_session_timeout,
+    .bootValue = DEFAULT_IDCP_CLIENT_TLS_SESSION_TIMEOUT,
+    .minValue = 0,
+    .maxValue = 86400,
+    .context = PGC_POSTMASTER,
+    .flags = GUC_UNIT_S,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
+  },
+  {
+    .name = "nextgres_idcp.auth_cache_size",
+    .short_desc = gettext_noop("Number of users whose password verifier is cached in shared memory."),
+    .long_desc = gettext_noop("Verifiers found by client authentication in the proxy are shared by "
+      "all proxy workers. When the cache is full, lookups are not cached "
+      "until entries expire."),
+    .valueAddr = &g_ng_idcp_cfg_auth_cache_size,
+    .bootValue = DEFAULT_IDCP_AUTH_CACHE_SIZE,
+    .minValue = 0,
+    .maxValue = 1048576,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
+  },
+  {
+    .name = "nextgres_idcp.auth_cache_ttl",
+    .short_desc = gettext_noop("Time a cached password verifier is used before being looked up again."),
+    .long_desc = gettext_noop("Password changes take effect for proxied clients after at most this "
+      "delay. Zero disables the cache."),
+    .valueAddr = &g_ng_idcp_cfg_auth_cache_ttl,
+    .bootValue = DEFAULT_IDCP_AUTH_CACHE_TTL,
+    .minValue = 0,
+    .maxValue = 86400,
+    .context = PGC_SIGHUP,
+    .flags = GUC_UNIT_S,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
+  },
+  {
+    .name = "nextgres_idcp.config_refresh_interval",
+    .short_desc = gettext_noop("Interval at which the pool configuration tables are read again."),
+    .long_desc = gettext_noop("Changes to the _nextgres_idcp tables reach the proxy workers after at "
+      "most this delay, or at once on configuration reload. Zero reads them "
+      "only at startup and on reload."),
+    .valueAddr = &g_ng_idcp_cfg_config_refresh_interval,
+    .bootValue = DEFAULT_IDCP_CONFIG_REFRESH_INTERVAL,
+    .minValue = 0,
+    .maxValue = 86400,
+    .context = PGC_SIGHUP,
+    .flags = GUC_UNIT_S,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL
   }
 }; /* ng_idcp_int_gucs */
 
@@ -1037,8 +1188,8 @@ static const struct ng_idcp_string_guc_s {
 } ng_idcp_string_gucs[] = {
   {
     .name = "nextgres_idcp.auth_dbname",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Database in which nextgres_idcp.auth_query is run."),
+    .long_desc = gettext_noop("If not set, client passwords are looked up in pg_authid."),
     .valueAddr = &gp_ng_idcp_cfg_auth_dbname,
     .bootValue = DEFAULT_IDCP_AUTH_DBNAME,
     .context = PGC_POSTMASTER,
@@ -1050,8 +1201,9 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.auth_file",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("File listing the users and passwords accepted by the proxy."),
+    .long_desc = gettext_noop("Each line holds a double-quoted user name and password (plaintext, MD5 "
+      "hash or SCRAM verifier). Takes precedence over auth_query."),
     .valueAddr = &gp_ng_idcp_cfg_auth_file,
     .bootValue = DEFAULT_IDCP_AUTH_FILE,
     .context = PGC_POSTMASTER,
@@ -1089,8 +1241,8 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.auth_query",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Query returning the user name and password of the user given as $1."),
+    .long_desc = gettext_noop("Run in nextgres_idcp.auth_dbname to authenticate proxied clients."),
     .valueAddr = &gp_ng_idcp_cfg_auth_query,
     .bootValue = DEFAULT_IDCP_AUTH_QUERY,
     .context = PGC_POSTMASTER,
@@ -1102,8 +1254,9 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.auth_type",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Client authentication method used by the proxy."),
+    .long_desc = gettext_noop("One of trust, any, plain, md5, scram-sha-256 or cert. As in "
+      "pg_hba.conf, md5 uses SCRAM for roles with a SCRAM verifier."),
     .valueAddr = &gp_ng_idcp_cfg_auth_type,
     .bootValue = DEFAULT_IDCP_AUTH_TYPE,
     .context = PGC_POSTMASTER,
@@ -1219,8 +1372,10 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.ignore_startup_parameters",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Startup parameters that do not select a separate pool."),
+    .long_desc = gettext_noop("Clients are pooled by database, user and startup parameters. "
+      "Parameters in this comma-separated list are ignored, and are not "
+      "passed to pooled backends."),
     .valueAddr = &gp_ng_idcp_cfg_ignore_startup_parameters,
     .bootValue = DEFAULT_IDCP_IGNORE_STARTUP_PARAMETERS,
     .context = PGC_POSTMASTER,
@@ -1245,11 +1400,13 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.listen_addr",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the host name(s) or IP address(es) the proxy workers listen on."),
+    .long_desc = gettext_noop("An empty value uses listen_addresses. Changing it "
+      "on reload moves the listeners without dropping established client "
+      "connections."),
     .valueAddr = &gp_ng_idcp_cfg_listen_addr,
     .bootValue = DEFAULT_IDCP_LISTEN_ADDR,
-    .context = PGC_POSTMASTER,
+    .context = PGC_SIGHUP,
     .flags = 0,
     .check_hook = NULL,
     .assign_hook = NULL,
@@ -1414,8 +1571,8 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.tcp_keepalive",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Whether TCP keepalive probes are sent to proxy clients."),
+    .long_desc = gettext_noop("Takes a boolean value, unset means on."),
     .valueAddr = &gp_ng_idcp_cfg_tcp_keepalive,
     .bootValue = DEFAULT_IDCP_TCP_KEEPALIVE,
     .context = PGC_POSTMASTER,
@@ -1440,8 +1597,9 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.unix_socket_dir",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the directory of the proxy's Unix-domain socket."),
+    .long_desc = gettext_noop("The first proxy worker listens on a socket for listen_port "
+      "there. An empty string disables it."),
     .valueAddr = &gp_ng_idcp_cfg_unix_socket_dir,
     .bootValue = DEFAULT_IDCP_UNIX_SOCKET_DIR,
     .context = PGC_POSTMASTER,
@@ -1453,8 +1611,8 @@ static const struct ng_idcp_string_guc_s {
   },
   {
     .name = "nextgres_idcp.unix_socket_group",
-    .short_desc = gettext_noop(""),
-    .long_desc = gettext_noop(""),
+    .short_desc = gettext_noop("Sets the owning group of the proxy's Unix-domain socket."),
+    .long_desc = gettext_noop("An empty string keeps the default group of the server user."),
     .valueAddr = &gp_ng_idcp_cfg_unix_socket_group,
     .bootValue = DEFAULT_IDCP_UNIX_SOCKET_GROUP,
     .context = PGC_POSTMASTER,
@@ -1464,6 +1622,20 @@ static const struct ng_idcp_string_guc_s {
     .show_hook = NULL,
     .original_name = "unix_socket_group"
   },
+  {
+    .name = "nextgres_idcp.database_name",
+    .short_desc = gettext_noop("Database in which the extension and its configuration tables are created."),
+    .long_desc = gettext_noop("The controller connects to this database to read the _nextgres_idcp "
+      "tables."),
+    .valueAddr = &gp_ng_idcp_cfg_database_name,
+    .bootValue = DEFAULT_IDCP_DATABASE_NAME,
+    .context = PGC_POSTMASTER,
+    .flags = 0,
+    .check_hook = NULL,
+    .assign_hook = NULL,
+    .show_hook = NULL,
+    .original_name = "database_name"
+  },
 }; /* ng_idcp_string_guc_s */
 
 /* ========================================================================= */
@@ -1485,7 +1657,7 @@ ng_idcp_guc_define (
     &g_ng_idcp_cfg_pool_mode,
     DEFAULT_IDCP_POOL_MODE,
     ng_idcp_pool_modes,
-    PGC_POSTMASTER,
+    PGC_SIGHUP,
     0,
     NULL,
     NULL,
@@ -0,0 +1,460 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Pool configuration from the extension's catalog tables.
+ *
+ * The controller reads _nextgres_idcp.databases and _nextgres_idcp.users at
+ * startup, on configuration reload and every
+ * nextgres_idcp.config_refresh_interval seconds, and publishes them as a
+ * snapshot in shared memory. Each publication that changes anything bumps a
+ * generation counter, which proxy workers compare with the generation they
+ * last applied once per loop iteration; only when it moved do they take the
+ * lock and look up the settings of their pools again. This way pool size,
+ * pool mode and connection limits can be changed with plain DML.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "postgres.h"
+
+#include "access/xact.h"
+#include "catalog/namespace.h"
+#include "executor/spi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/memutils.h"
+#include "utils/snapmgr.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp.h"
+#include "nextgres/idcp/storage/ipc.h"
+#include "nextgres/idcp/util/poolconfig.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* Rows of each table kept in the snapshot */
+#define POOL_CONFIG_MAX_ROWS    1024
+
+#define POOL_CONFIG_SCHEMA      "_nextgres_idcp"
+
+/* Columns that are NULL (or negative) in the tables */
+#define POOL_CONFIG_UNSET       (-1)
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct PoolConfigDatabase;
+struct PoolConfigShared;
+struct PoolConfigUser;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* Row of _nextgres_idcp.databases */
+typedef struct PoolConfigDatabase {
+  NameData              database_name;
+  int                   pool_size;
+  int                   pool_mode;
+  int                   max_db_connections;
+} PoolConfigDatabase;
+
+/* Row of _nextgres_idcp.users */
+typedef struct PoolConfigUser {
+  NameData              user_name;
+  int                   pool_mode;
+  int                   max_user_connections;
+} PoolConfigUser;
+
+/*
+ * Snapshot of the tables, with rows sorted by name. Rows are protected by
+ * NG_IDCP_LWLOCK_POOL_CONFIG; the generation can be read without it.
+ */
+typedef struct PoolConfigShared {
+  /** Bumped by every publication that changed the snapshot */
+  pg_atomic_uint64      generation;
+
+  int                   n_databases;
+  int                   n_users;
+  PoolConfigDatabase    databases[POOL_CONFIG_MAX_ROWS];
+  PoolConfigUser        users[POOL_CONFIG_MAX_ROWS];
+} PoolConfigShared;
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION PROTOTYPES ------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static int pool_config_compare_name (const void *a, const void *b);
+static int pool_config_int (HeapTuple tuple, TupleDesc desc, int column);
+static int pool_config_mode (HeapTuple tuple, TupleDesc desc, int column);
+static void pool_config_publish (PoolConfigShared *snapshot);
+static void pool_config_read_databases (PoolConfigShared *snapshot);
+static void pool_config_read_users (PoolConfigShared *snapshot);
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PRIVATE VARIABLES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static PoolConfigShared *ng_idcp_pool_config = NULL;
+
+/* ========================================================================= */
+/* -- STATIC ASSERTIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* Rows are searched by their leading name */
+StaticAssertDecl(offsetof(PoolConfigDatabase, database_name) == 0,
+                 "database rows must start with their name");
+StaticAssertDecl(offsetof(PoolConfigUser, user_name) == 0,
+                 "user rows must start with their name");
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+/*
+ * Generation of the published snapshot, 0 until the tables were read.
+ */
+uint64
+ng_idcp_pool_config_generation (
+  void
+) {
+  return pg_atomic_read_u64(&ng_idcp_pool_config->generation);
+} /* ng_idcp_pool_config_generation() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read the configuration tables and publish them to the proxy workers. Must
+ * be called by a process connected to nextgres_idcp.database_name, outside
+ * of a transaction. If the extension is not created there, an empty
+ * configuration is published. Returns false (keeping the previous snapshot)
+ * if the tables could not be read.
+ */
+bool
+ng_idcp_pool_config_load (
+  void
+) {
+  MemoryContext oldcontext = CurrentMemoryContext;
+  PoolConfigShared *snapshot = palloc0(sizeof(PoolConfigShared));
+  volatile bool ok = false;
+
+  PG_TRY();
+  {
+    SetCurrentStatementStartTimestamp();
+    StartTransactionCommand();
+    SPI_connect();
+    PushActiveSnapshot(GetTransactionSnapshot());
+    pgstat_report_activity(STATE_RUNNING, "reading pool configuration");
+
+    if (OidIsValid(get_namespace_oid(POOL_CONFIG_SCHEMA, true))) {
+      pool_config_read_databases(snapshot);
+      pool_config_read_users(snapshot);
+    }
+
+    SPI_finish();
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+    pgstat_report_activity(STATE_IDLE, NULL);
+    ok = true;
+  }
+  PG_CATCH();
+  {
+    MemoryContextSwitchTo(oldcontext);
+    EmitErrorReport();
+    FlushErrorState();
+    AbortCurrentTransaction();
+    pgstat_report_activity(STATE_IDLE, NULL);
+  }
+  PG_END_TRY();
+
+  MemoryContextSwitchTo(oldcontext);
+  if (ok)
+    pool_config_publish(snapshot);
+  pfree(snapshot);
+  return ok;
+} /* ng_idcp_pool_config_load() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Resolve the settings of the pool of a database and role.
+ */
+void
+ng_idcp_pool_config_lookup (
+  const char           *database,
+  const char           *user,
+  NgIdcpPoolSettings   *settings
+) {
+  PoolConfigShared *config = ng_idcp_pool_config;
+  PoolConfigDatabase *db;
+  PoolConfigUser *role;
+  NameData key;
+
+  settings->pool_size = 0;
+  settings->pool_mode = g_ng_idcp_cfg_pool_mode;
+  settings->max_db_connections = g_ng_idcp_cfg_max_db_connections;
+  settings->max_user_connections = g_ng_idcp_cfg_max_user_connections;
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_POOL_CONFIG), LW_SHARED);
+
+  namestrcpy(&key, database);
+  db = bsearch(&key, config->databases, config->n_databases,
+               sizeof(PoolConfigDatabase), pool_config_compare_name);
+  if (db != NULL) {
+    if (db->pool_size != POOL_CONFIG_UNSET)
+      settings->pool_size = db->pool_size;
+    if (db->pool_mode != POOL_CONFIG_UNSET)
+      settings->pool_mode = db->pool_mode;
+    if (db->max_db_connections != POOL_CONFIG_UNSET)
+      settings->max_db_connections = db->max_db_connections;
+  }
+
+  namestrcpy(&key, user);
+  role = bsearch(&key, config->users, config->n_users,
+                 sizeof(PoolConfigUser), pool_config_compare_name);
+  if (role != NULL) {
+    if (role->pool_mode != POOL_CONFIG_UNSET)
+      settings->pool_mode = role->pool_mode;
+    if (role->max_user_connections != POOL_CONFIG_UNSET)
+      settings->max_user_connections = role->max_user_connections;
+  }
+
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_POOL_CONFIG));
+} /* ng_idcp_pool_config_lookup() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared configuration snapshot, empty until the controller reads the tables.
+ */
+void
+ng_idcp_pool_config_shmem_init (
+  void
+) {
+  bool found;
+
+  ng_idcp_pool_config = ShmemInitStruct(NEXTGRES_EXTNAME " pool configuration",
+                                        sizeof(PoolConfigShared), &found);
+  if (!found) {
+    memset(ng_idcp_pool_config, 0, sizeof(PoolConfigShared));
+    pg_atomic_init_u64(&ng_idcp_pool_config->generation, 0);
+  }
+} /* ng_idcp_pool_config_shmem_init() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Shared memory needed for the configuration snapshot.
+ */
+Size
+ng_idcp_pool_config_shmem_size (
+  void
+) {
+  return MAXALIGN(sizeof(PoolConfigShared));
+} /* ng_idcp_pool_config_shmem_size() */
+
+/* ========================================================================= */
+/* -- PRIVATE FUNCTION DEFINITIONS ----------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+static int
+pool_config_compare_name (
+  const void *a,
+  const void *b
+) {
+  return strcmp(NameStr(*(const NameData *) a), NameStr(*(const NameData *) b));
+} /* pool_config_compare_name() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Integer column of a row read by SPI, POOL_CONFIG_UNSET if NULL or
+ * negative. Columns are cast to int4 by the queries.
+ */
+static int
+pool_config_int (
+  HeapTuple     tuple,
+  TupleDesc     desc,
+  int           column
+) {
+  bool isnull;
+  Datum value = SPI_getbinval(tuple, desc, column, &isnull);
+
+  if (isnull || DatumGetInt32(value) < 0)
+    return POOL_CONFIG_UNSET;
+  return DatumGetInt32(value);
+} /* pool_config_int() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * nextgres_idcp_pool_mode column of a row read by SPI.
+ */
+static int
+pool_config_mode (
+  HeapTuple     tuple,
+  TupleDesc     desc,
+  int           column
+) {
+  char *mode = SPI_getvalue(tuple, desc, column);
+
+  if (mode == NULL)
+    return POOL_CONFIG_UNSET;
+  if (strcmp(mode, "session") == 0)
+    return NG_IDCP_POOL_MODE_SESSION;
+  if (strcmp(mode, "statement") == 0)
+    return NG_IDCP_POOL_MODE_STATEMENT;
+  return NG_IDCP_POOL_MODE_TRANSACTION;
+} /* pool_config_mode() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Replace the shared snapshot with the rows just read, bumping the
+ * generation only if something changed so that workers don't look up their
+ * pools again on every refresh.
+ */
+static void
+pool_config_publish (
+  PoolConfigShared *snapshot
+) {
+  PoolConfigShared *config = ng_idcp_pool_config;
+  Size databases_size = sizeof(PoolConfigDatabase) * snapshot->n_databases;
+  Size users_size = sizeof(PoolConfigUser) * snapshot->n_users;
+
+  qsort(snapshot->databases, snapshot->n_databases,
+        sizeof(PoolConfigDatabase), pool_config_compare_name);
+  qsort(snapshot->users, snapshot->n_users, sizeof(PoolConfigUser),
+        pool_config_compare_name);
+
+  LWLockAcquire(ng_idcp_lwlock(NG_IDCP_LWLOCK_POOL_CONFIG), LW_EXCLUSIVE);
+  if (config->n_databases != snapshot->n_databases ||
+      config->n_users != snapshot->n_users ||
+      memcmp(config->databases, snapshot->databases, databases_size) != 0 ||
+      memcmp(config->users, snapshot->users, users_size) != 0 ||
+      pg_atomic_read_u64(&config->generation) == 0) {
+    config->n_databases = snapshot->n_databases;
+    config->n_users = snapshot->n_users;
+    memcpy(config->databases, snapshot->databases, databases_size);
+    memcpy(config->users, snapshot->users, users_size);
+    pg_atomic_fetch_add_u64(&config->generation, 1);
+    elog(LOG, "pool configuration loaded: %d databases, %d users",
+         config->n_databases, config->n_users);
+  }
+  LWLockRelease(ng_idcp_lwlock(NG_IDCP_LWLOCK_POOL_CONFIG));
+} /* pool_config_publish() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+pool_config_read_databases (
+  PoolConfigShared *snapshot
+) {
+  int ret = SPI_execute(
+    "SELECT database_name, pool_size, pool_mode, max_db_connections "
+    "FROM " POOL_CONFIG_SCHEMA ".databases", true, 0);
+
+  if (ret != SPI_OK_SELECT)
+    elog(ERROR, "could not read " POOL_CONFIG_SCHEMA ".databases: %s",
+         SPI_result_code_string(ret));
+  if (SPI_processed > POOL_CONFIG_MAX_ROWS)
+    ereport(WARNING,
+            (errmsg("only the first %d rows of " POOL_CONFIG_SCHEMA
+                    ".databases are used", POOL_CONFIG_MAX_ROWS)));
+
+  for (uint64 ii = 0; ii < SPI_processed && ii < POOL_CONFIG_MAX_ROWS; ii++) {
+    HeapTuple tuple = SPI_tuptable->vals[ii];
+    TupleDesc desc = SPI_tuptable->tupdesc;
+    PoolConfigDatabase *db = &snapshot->databases[snapshot->n_databases++];
+
+    namestrcpy(&db->database_name, SPI_getvalue(tuple, desc, 1));
+    db->pool_size = pool_config_int(tuple, desc, 2);
+    db->pool_mode = pool_config_mode(tuple, desc, 3);
+    db->max_db_connections = pool_config_int(tuple, desc, 4);
+  }
+} /* pool_config_read_databases() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+pool_config_read_users (
+  PoolConfigShared *snapshot
+) {
+  int ret = SPI_execute(
+    "SELECT user_name, pool_mode, "
+    "least(max_user_connections, 2147483647)::int4 "
+    "FROM " POOL_CONFIG_SCHEMA ".users", true, 0);
+
+  if (ret != SPI_OK_SELECT)
+    elog(ERROR, "could not read " POOL_CONFIG_SCHEMA ".users: %s",
+         SPI_result_code_string(ret));
+  if (SPI_processed > POOL_CONFIG_MAX_ROWS)
+    ereport(WARNING,
+            (errmsg("only the first %d rows of " POOL_CONFIG_SCHEMA
+                    ".users are used", POOL_CONFIG_MAX_ROWS)));
+
+  for (uint64 ii = 0; ii < SPI_processed && ii < POOL_CONFIG_MAX_ROWS; ii++) {
+    HeapTuple tuple = SPI_tuptable->vals[ii];
+    TupleDesc desc = SPI_tuptable->tupdesc;
+    PoolConfigUser *role = &snapshot->users[snapshot->n_users++];
+
+    namestrcpy(&role->user_name, SPI_getvalue(tuple, desc, 1));
+    role->pool_mode = pool_config_mode(tuple, desc, 2);
+    role->max_user_connections = pool_config_int(tuple, desc, 3);
+  }
+} /* pool_config_read_users() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
@@ -0,0 +1,780 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Load generator for the connection pool, run by "make bench".
+ *
+ * A number of client threads, each with its own connection, run one
+ * workload for a fixed time against the proxy port and, when a direct port
+ * is given, against the server itself as a baseline. Throughput and latency
+ * percentiles of both are reported side by side, so that a change to the
+ * proxy can be checked for regressions. The workloads cover the paths the
+ * proxy treats differently:
+ *
+ *   simple    one-message queries ('Q')
+ *   extended  Parse/Bind/Execute/Sync with an unnamed statement
+ *   pipeline  batches of extended queries sent before reading any result
+ *   churn     a new connection for each query
+ *   large     a large result set per query
+ *   copy      COPY ... TO STDOUT
+ *
+ * The program only needs libpq, which speaks protocol version 3 for us.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+#include "libpq-fe.h"
+
+/* --------------------------- System Inclusions --------------------------- */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+#define BENCH_DEFAULT_PROXY_PORT    "6432"
+#define BENCH_DEFAULT_CLIENTS       8
+#define BENCH_DEFAULT_DURATION      10    /* seconds */
+#define BENCH_DEFAULT_BATCH         16    /* queries per pipeline batch */
+#define BENCH_DEFAULT_ROWS          10000 /* rows of large and copy results */
+#define BENCH_DEFAULT_ROW_SIZE      100   /* bytes per row */
+
+#define BENCH_INITIAL_SAMPLES       65536
+
+#define NS_PER_SEC                  INT64_C(1000000000)
+#define NS_PER_USEC                 INT64_C(1000)
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct BenchClient;
+struct BenchOptions;
+struct BenchResult;
+struct BenchWorkload;
+
+typedef bool (*BenchOperation) (struct BenchClient *client);
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+typedef struct BenchOptions {
+  const char           *host;
+  const char           *proxy_port;
+  const char           *direct_port;
+  const char           *dbname;
+  const char           *user;
+  int                   clients;
+  int                   duration;
+  int                   batch;
+  int                   rows;
+  int                   row_size;
+} BenchOptions;
+
+typedef struct BenchWorkload {
+  const char           *name;
+
+  /** Runs one operation, returns false on error */
+  BenchOperation        run;
+
+  /** The connection is opened by the operation itself */
+  bool                  own_connection;
+} BenchWorkload;
+
+/*
+ * Client thread, with the measurements of its operations.
+ */
+typedef struct BenchClient {
+  const BenchOptions   *options;
+  const BenchWorkload  *workload;
+  const char           *port;
+  pthread_t             thread;
+  PGconn               *conn;
+
+  /** Query text of the workload */
+  char                 *query;
+
+  /** Latency of each operation in nanoseconds */
+  int64_t              *samples;
+  size_t                n_samples;
+  size_t                max_samples;
+
+  /** Queries (several per pipeline batch), result bytes and errors */
+  int64_t               n_queries;
+  int64_t               n_bytes;
+  int64_t               n_errors;
+
+  /** The client could not connect at all */
+  bool                  failed;
+} BenchClient;
+
+/*
+ * Combined measurements of all clients against one port.
+ */
+typedef struct BenchResult {
+  double                elapsed;
+  int64_t               n_operations;
+  int64_t               n_queries;
+  int64_t               n_bytes;
+  int64_t               n_errors;
+  int64_t               p50;
+  int64_t               p90;
+  int64_t               p99;
+  int64_t               p999;
+  int64_t               max;
+  bool                  valid;
+} BenchResult;
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static PGconn *bench_connect (const BenchClient *client);
+static int bench_compare_samples (const void *a, const void *b);
+static bool bench_consume (BenchClient *client, PGresult *result);
+static int64_t bench_now (void);
+static bool bench_op_churn (BenchClient *client);
+static bool bench_op_copy (BenchClient *client);
+static bool bench_op_extended (BenchClient *client);
+static bool bench_op_pipeline (BenchClient *client);
+static bool bench_op_simple (BenchClient *client);
+static int64_t bench_percentile (const int64_t *sorted, size_t n, double p);
+static void bench_print (const char *workload, const char *target,
+  const BenchResult *result);
+static void bench_record (BenchClient *client, int64_t latency);
+static bool bench_run (const BenchOptions *options,
+  const BenchWorkload *workload, const char *port, BenchResult *result);
+static void *bench_thread (void *arg);
+static void bench_usage (const char *progname);
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static const BenchWorkload bench_workloads[] = {
+  {"simple", bench_op_simple, false},
+  {"extended", bench_op_extended, false},
+  {"pipeline", bench_op_pipeline, false},
+  {"churn", bench_op_churn, true},
+  {"large", bench_op_simple, false},
+  {"copy", bench_op_copy, false},
+  {NULL, NULL, false}
+};
+
+/* Shared by the client threads of a run */
+static volatile bool bench_stop = false;
+static int64_t bench_deadline = 0;
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+int
+main (
+  int     argc,
+  char  **argv
+) {
+  static const struct option long_options[] = {
+    {"host", required_argument, NULL, 'h'},
+    {"port", required_argument, NULL, 'p'},
+    {"direct-port", required_argument, NULL, 'P'},
+    {"dbname", required_argument, NULL, 'd'},
+    {"username", required_argument, NULL, 'U'},
+    {"clients", required_argument, NULL, 'c'},
+    {"time", required_argument, NULL, 'T'},
+    {"workload", required_argument, NULL, 'w'},
+    {"batch", required_argument, NULL, 'b'},
+    {"rows", required_argument, NULL, 'r'},
+    {"row-size", required_argument, NULL, 's'},
+    {"help", no_argument, NULL, 1},
+    {NULL, 0, NULL, 0}
+  };
+  BenchOptions options = {
+    .host = NULL,
+    .proxy_port = BENCH_DEFAULT_PROXY_PORT,
+    .direct_port = NULL,
+    .dbname = NULL,
+    .user = NULL,
+    .clients = BENCH_DEFAULT_CLIENTS,
+    .duration = BENCH_DEFAULT_DURATION,
+    .batch = BENCH_DEFAULT_BATCH,
+    .rows = BENCH_DEFAULT_ROWS,
+    .row_size = BENCH_DEFAULT_ROW_SIZE
+  };
+  const char *workload_name = "all";
+  bool matched = false;
+  int status = 0;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "h:p:P:d:U:c:T:w:b:r:s:",
+                          long_options, NULL)) != -1) {
+    switch (c) {
+      case 'h': options.host = optarg; break;
+      case 'p': options.proxy_port = optarg; break;
+      case 'P': options.direct_port = optarg; break;
+      case 'd': options.dbname = optarg; break;
+      case 'U': options.user = optarg; break;
+      case 'c': options.clients = atoi(optarg); break;
+      case 'T': options.duration = atoi(optarg); break;
+      case 'w': workload_name = optarg; break;
+      case 'b': options.batch = atoi(optarg); break;
+      case 'r': options.rows = atoi(optarg); break;
+      case 's': options.row_size = atoi(optarg); break;
+      case 1:
+        bench_usage(argv[0]);
+        return 0;
+      default:
+        fprintf(stderr, "Try \"%s --help\" for more information.\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc || options.clients <= 0 || options.duration <= 0 ||
+      options.batch <= 0 || options.rows <= 0 || options.row_size <= 0) {
+    bench_usage(argv[0]);
+    return 1;
+  }
+
+  printf("%-9s %-6s %10s %10s %9s %8s %8s %8s %8s %8s %6s\n",
+         "workload", "target", "ops/s", "queries/s", "MB/s",
+         "p50 us", "p90 us", "p99 us", "p99.9 us", "max us", "errors");
+
+  for (const BenchWorkload *workload = bench_workloads;
+       workload->name != NULL; workload++) {
+    BenchResult proxy_result;
+    BenchResult direct_result;
+
+    if (strcmp(workload_name, "all") != 0 &&
+        strcmp(workload_name, workload->name) != 0)
+      continue;
+    matched = true;
+
+    if (!bench_run(&options, workload, options.proxy_port, &proxy_result))
+      status = 1;
+    bench_print(workload->name, "proxy", &proxy_result);
+
+    if (options.direct_port != NULL) {
+      if (!bench_run(&options, workload, options.direct_port,
+                     &direct_result))
+        status = 1;
+      bench_print(workload->name, "direct", &direct_result);
+    }
+  }
+
+  if (!matched) {
+    fprintf(stderr, "%s: unknown workload \"%s\"\n", argv[0], workload_name);
+    return 1;
+  }
+  return status;
+} /* main() */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+static int
+bench_compare_samples (
+  const void *a,
+  const void *b
+) {
+  int64_t x = *(const int64_t *) a;
+  int64_t y = *(const int64_t *) b;
+
+  return (x > y) - (x < y);
+} /* bench_compare_samples() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Open a connection for a client, NULL on failure (which is reported).
+ */
+static PGconn *
+bench_connect (
+  const BenchClient *client
+) {
+  const char *keywords[] = {
+    "host", "port", "dbname", "user", "application_name", NULL
+  };
+  const char *values[] = {
+    client->options->host, client->port, client->options->dbname,
+    client->options->user, "ng_idcp_bench", NULL
+  };
+  PGconn *conn = PQconnectdbParams(keywords, values, 0);
+
+  if (PQstatus(conn) != CONNECTION_OK) {
+    fprintf(stderr, "connection to port %s failed: %s", client->port,
+            PQerrorMessage(conn));
+    PQfinish(conn);
+    return NULL;
+  }
+  return conn;
+} /* bench_connect() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Account for and free the result of a query. Returns false on error.
+ */
+static bool
+bench_consume (
+  BenchClient  *client,
+  PGresult     *result
+) {
+  ExecStatusType status = PQresultStatus(result);
+  bool ok = status == PGRES_TUPLES_OK || status == PGRES_COMMAND_OK;
+
+  if (status == PGRES_TUPLES_OK) {
+    int n_rows = PQntuples(result);
+    int n_fields = PQnfields(result);
+
+    for (int row = 0; row < n_rows; row++) {
+      for (int field = 0; field < n_fields; field++)
+        client->n_bytes += PQgetlength(result, row, field);
+    }
+  } else if (!ok) {
+    fprintf(stderr, "query failed: %s", PQresultErrorMessage(result));
+  }
+  PQclear(result);
+  return ok;
+} /* bench_consume() */
+
+/* ------------------------------------------------------------------------- */
+
+static int64_t
+bench_now (
+  void
+) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+} /* bench_now() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Connect, run a query and disconnect.
+ */
+static bool
+bench_op_churn (
+  BenchClient *client
+) {
+  bool ok;
+
+  client->conn = bench_connect(client);
+  if (client->conn == NULL)
+    return false;
+  ok = bench_consume(client, PQexec(client->conn, client->query));
+  client->n_queries += 1;
+  PQfinish(client->conn);
+  client->conn = NULL;
+  return ok;
+} /* bench_op_churn() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Stream a result set with COPY ... TO STDOUT.
+ */
+static bool
+bench_op_copy (
+  BenchClient *client
+) {
+  PGresult *result = PQexec(client->conn, client->query);
+  char *buf;
+  int len;
+
+  client->n_queries += 1;
+  if (PQresultStatus(result) != PGRES_COPY_OUT)
+    return bench_consume(client, result);
+  PQclear(result);
+
+  while ((len = PQgetCopyData(client->conn, &buf, 0)) > 0) {
+    client->n_bytes += len;
+    PQfreemem(buf);
+  }
+  if (len == -2) {
+    fprintf(stderr, "COPY failed: %s", PQerrorMessage(client->conn));
+    return false;
+  }
+  return bench_consume(client, PQgetResult(client->conn)) &&
+         PQgetResult(client->conn) == NULL;
+} /* bench_op_copy() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Run a query with a parameter through the extended protocol. The statement
+ * is unnamed, so this works with transaction pooling.
+ */
+static bool
+bench_op_extended (
+  BenchClient *client
+) {
+  const char *params[1] = {"42"};
+
+  client->n_queries += 1;
+  return bench_consume(client, PQexecParams(client->conn, client->query, 1,
+                                            NULL, params, NULL, NULL, 0));
+} /* bench_op_extended() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Send a batch of extended queries in pipeline mode, then read all results.
+ */
+static bool
+bench_op_pipeline (
+  BenchClient *client
+) {
+  const char *params[1] = {"42"};
+  PGresult *result;
+  bool ok = true;
+
+  if (PQpipelineStatus(client->conn) == PQ_PIPELINE_OFF &&
+      !PQenterPipelineMode(client->conn)) {
+    fprintf(stderr, "pipeline mode failed: %s", PQerrorMessage(client->conn));
+    return false;
+  }
+
+  for (int ii = 0; ii < client->options->batch; ii++) {
+    if (!PQsendQueryParams(client->conn, client->query, 1, NULL, params,
+                           NULL, NULL, 0)) {
+      fprintf(stderr, "send failed: %s", PQerrorMessage(client->conn));
+      return false;
+    }
+  }
+  if (!PQpipelineSync(client->conn)) {
+    fprintf(stderr, "sync failed: %s", PQerrorMessage(client->conn));
+    return false;
+  }
+
+  /* Each query's results end with a NULL, the batch with the sync */
+  for (;;) {
+    result = PQgetResult(client->conn);
+    if (result == NULL) {
+      if (PQstatus(client->conn) == CONNECTION_BAD) {
+        fprintf(stderr, "pipeline failed: %s",
+                PQerrorMessage(client->conn));
+        return false;
+      }
+      continue;
+    }
+    if (PQresultStatus(result) == PGRES_PIPELINE_SYNC) {
+      PQclear(result);
+      break;
+    }
+    if (PQresultStatus(result) == PGRES_FATAL_ERROR &&
+        PQstatus(client->conn) == CONNECTION_BAD) {
+      fprintf(stderr, "pipeline failed: %s", PQerrorMessage(client->conn));
+      PQclear(result);
+      return false;
+    }
+    client->n_queries += 1;
+    ok = bench_consume(client, result) && ok;
+  }
+  return ok;
+} /* bench_op_pipeline() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Run a query with the simple protocol.
+ */
+static bool
+bench_op_simple (
+  BenchClient *client
+) {
+  client->n_queries += 1;
+  return bench_consume(client, PQexec(client->conn, client->query));
+} /* bench_op_simple() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Value at fraction p of n sorted samples.
+ */
+static int64_t
+bench_percentile (
+  const int64_t    *sorted,
+  size_t            n,
+  double            p
+) {
+  size_t idx;
+
+  if (n == 0)
+    return 0;
+  idx = (size_t) (p * (double) (n - 1) + 0.5);
+  return sorted[idx < n ? idx : n - 1];
+} /* bench_percentile() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+bench_print (
+  const char          *workload,
+  const char          *target,
+  const BenchResult   *result
+) {
+  if (!result->valid) {
+    printf("%-9s %-6s %10s\n", workload, target, "failed");
+    return;
+  }
+  printf("%-9s %-6s %10.0f %10.0f %9.2f %8.0f %8.0f %8.0f %8.0f %8.0f "
+         "%6" PRId64 "\n",
+         workload, target,
+         (double) result->n_operations / result->elapsed,
+         (double) result->n_queries / result->elapsed,
+         (double) result->n_bytes / result->elapsed / (1024.0 * 1024.0),
+         (double) result->p50 / NS_PER_USEC,
+         (double) result->p90 / NS_PER_USEC,
+         (double) result->p99 / NS_PER_USEC,
+         (double) result->p999 / NS_PER_USEC,
+         (double) result->max / NS_PER_USEC,
+         result->n_errors);
+  fflush(stdout);
+} /* bench_print() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+bench_record (
+  BenchClient  *client,
+  int64_t       latency
+) {
+  if (client->n_samples == client->max_samples) {
+    size_t max_samples = client->max_samples * 2;
+    int64_t *samples = realloc(client->samples,
+                               max_samples * sizeof(int64_t));
+
+    /* Keep measuring, just stop sampling latencies */
+    if (samples == NULL)
+      return;
+    client->samples = samples;
+    client->max_samples = max_samples;
+  }
+  client->samples[client->n_samples++] = latency;
+} /* bench_record() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Run a workload against a port with all clients and combine their
+ * measurements. Returns false if no client could run.
+ */
+static bool
+bench_run (
+  const BenchOptions   *options,
+  const BenchWorkload  *workload,
+  const char           *port,
+  BenchResult          *result
+) {
+  BenchClient *clients = calloc(options->clients, sizeof(BenchClient));
+  int64_t *all_samples;
+  size_t n_samples = 0;
+  int64_t started;
+  int n_started = 0;
+
+  memset(result, 0, sizeof(*result));
+  if (clients == NULL)
+    return false;
+
+  bench_stop = false;
+  started = bench_now();
+  bench_deadline = started + (int64_t) options->duration * NS_PER_SEC;
+
+  for (int ii = 0; ii < options->clients; ii++) {
+    BenchClient *client = &clients[ii];
+
+    client->options = options;
+    client->workload = workload;
+    client->port = port;
+    if (pthread_create(&client->thread, NULL, bench_thread, client) != 0) {
+      fprintf(stderr, "could not start client thread: %s\n",
+              strerror(errno));
+      client->failed = true;
+      break;
+    }
+    n_started += 1;
+  }
+  for (int ii = 0; ii < n_started; ii++)
+    pthread_join(clients[ii].thread, NULL);
+  result->elapsed = (double) (bench_now() - started) / NS_PER_SEC;
+
+  for (int ii = 0; ii < options->clients; ii++) {
+    if (clients[ii].failed)
+      continue;
+    result->valid = true;
+    result->n_operations += clients[ii].n_samples;
+    result->n_queries += clients[ii].n_queries;
+    result->n_bytes += clients[ii].n_bytes;
+    result->n_errors += clients[ii].n_errors;
+    n_samples += clients[ii].n_samples;
+  }
+
+  all_samples = malloc((n_samples > 0 ? n_samples : 1) * sizeof(int64_t));
+  if (all_samples != NULL) {
+    size_t pos = 0;
+
+    for (int ii = 0; ii < options->clients; ii++) {
+      memcpy(all_samples + pos, clients[ii].samples,
+             clients[ii].n_samples * sizeof(int64_t));
+      pos += clients[ii].n_samples;
+    }
+    qsort(all_samples, n_samples, sizeof(int64_t), bench_compare_samples);
+    result->p50 = bench_percentile(all_samples, n_samples, 0.50);
+    result->p90 = bench_percentile(all_samples, n_samples, 0.90);
+    result->p99 = bench_percentile(all_samples, n_samples, 0.99);
+    result->p999 = bench_percentile(all_samples, n_samples, 0.999);
+    result->max = n_samples > 0 ? all_samples[n_samples - 1] : 0;
+    free(all_samples);
+  }
+
+  for (int ii = 0; ii < options->clients; ii++) {
+    free(clients[ii].samples);
+    free(clients[ii].query);
+  }
+  free(clients);
+  return result->valid;
+} /* bench_run() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Client thread: run operations until the deadline.
+ */
+static void *
+bench_thread (
+  void *arg
+) {
+  BenchClient *client = (BenchClient *) arg;
+  const BenchOptions *options = client->options;
+  const char *name = client->workload->name;
+  size_t query_len = 256;
+
+  client->max_samples = BENCH_INITIAL_SAMPLES;
+  client->samples = malloc(client->max_samples * sizeof(int64_t));
+  client->query = malloc(query_len);
+  if (client->samples == NULL || client->query == NULL) {
+    client->failed = true;
+    return NULL;
+  }
+
+  if (strcmp(name, "large") == 0)
+    snprintf(client->query, query_len,
+             "SELECT repeat('x', %d) FROM generate_series(1, %d)",
+             options->row_size, options->rows);
+  else if (strcmp(name, "copy") == 0)
+    snprintf(client->query, query_len,
+             "COPY (SELECT repeat('x', %d) FROM generate_series(1, %d)) "
+             "TO STDOUT", options->row_size, options->rows);
+  else if (strcmp(name, "extended") == 0 || strcmp(name, "pipeline") == 0)
+    snprintf(client->query, query_len, "SELECT $1::int");
+  else
+    snprintf(client->query, query_len, "SELECT 1");
+
+  if (!client->workload->own_connection) {
+    client->conn = bench_connect(client);
+    if (client->conn == NULL) {
+      client->failed = true;
+      return NULL;
+    }
+  }
+
+  while (!bench_stop) {
+    int64_t started = bench_now();
+
+    if (started >= bench_deadline)
+      break;
+    if (!client->workload->run(client)) {
+      client->n_errors += 1;
+
+      /* A broken connection is replaced, unless that fails too */
+      if (client->conn != NULL && PQstatus(client->conn) == CONNECTION_BAD) {
+        PQfinish(client->conn);
+        client->conn = bench_connect(client);
+        if (client->conn == NULL)
+          break;
+      }
+      continue;
+    }
+    bench_record(client, bench_now() - started);
+  }
+
+  if (client->conn != NULL)
+    PQfinish(client->conn);
+  client->conn = NULL;
+  return NULL;
+} /* bench_thread() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+bench_usage (
+  const char *progname
+) {
+  printf("%s runs a workload against the connection pool and, optionally,\n"
+         "against the server directly as a baseline.\n\n"
+         "Usage:\n"
+         "  %s [OPTION]...\n\n"
+         "Options:\n"
+         "  -h, --host=HOST          server host or socket directory\n"
+         "  -p, --port=PORT          proxy port (default: %s)\n"
+         "  -P, --direct-port=PORT   server port for the baseline\n"
+         "  -d, --dbname=DBNAME      database to connect to\n"
+         "  -U, --username=NAME      user to connect as\n"
+         "  -c, --clients=NUM        concurrent clients (default: %d)\n"
+         "  -T, --time=SECS          duration of each run (default: %d)\n"
+         "  -w, --workload=NAME      simple, extended, pipeline, churn, "
+         "large, copy\n"
+         "                           or all (default)\n"
+         "  -b, --batch=NUM          queries per pipeline batch "
+         "(default: %d)\n"
+         "  -r, --rows=NUM           rows of large and copy results "
+         "(default: %d)\n"
+         "  -s, --row-size=BYTES     bytes per row (default: %d)\n",
+         progname, progname, BENCH_DEFAULT_PROXY_PORT, BENCH_DEFAULT_CLIENTS,
+         BENCH_DEFAULT_DURATION, BENCH_DEFAULT_BATCH, BENCH_DEFAULT_ROWS,
+         BENCH_DEFAULT_ROW_SIZE);
+} /* bench_usage() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
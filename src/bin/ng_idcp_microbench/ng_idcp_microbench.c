@@ -0,0 +1,1252 @@
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * OVERVIEW
+ *
+ * Hermetic microbenchmark of the proxy's relay path, run by
+ * "make microbench".
+ *
+ * Everything runs in one thread of one process, so results are repeatable
+ * and need no PostgreSQL installation. Mock clients and mock backends sit at
+ * the far ends of socket pairs; in between, relay channels move messages the
+ * way channel_read() and channel_write() in proxy.c do: the same buffer
+ * discipline (one buffer per channel, complete messages forwarded to the
+ * peer, the remainder moved to the front), the same framing code from
+ * nextgres/idcp/libpq/framing.h, and transaction pooling of a smaller number
+ * of backends among the clients, with clients queued while none is idle.
+ *
+ * Reading, receiving and sending go through a per-kind operation table like
+ * channel_ops of proxy.c. With --tcp, clients are connected over loopback
+ * TCP, and responses to them are held back with MSG_MORE until
+ * ReadyForQuery and flushed at the end of each event loop iteration, as
+ * nextgres_idcp.coalesce_responses does (--no-coalesce turns that off).
+ *
+ * A mock backend answers the startup packet with a canned handshake, which
+ * the relay saves and replays to every client just like a pooled backend's
+ * handshake response, and every query with a canned RowDescription,
+ * DataRow..., CommandComplete, ReadyForQuery sequence of configurable size.
+ *
+ * Only time spent in the relay is counted as proxy time; the mocks are
+ * excluded. Reported are nanoseconds per relayed message and per query,
+ * bytes relayed and copied in user space, and relay syscalls per query.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* -------------------------- Interface Inclusions ------------------------- */
+
+/* --------------------------- System Inclusions --------------------------- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+/* --------------------------- Project Inclusions -------------------------- */
+
+#include "nextgres/idcp/libpq/framing.h"
+
+/* ========================================================================= */
+/* -- LOCAL DEFINITIONS ---------------------------------------------------- */
+/* ========================================================================= */
+
+#define MB_DEFAULT_CLIENTS          16
+#define MB_DEFAULT_BACKENDS         4
+#define MB_DEFAULT_QUERIES          200000
+#define MB_DEFAULT_ROWS             1
+#define MB_DEFAULT_ROW_SIZE         8
+#define MB_DEFAULT_DEPTH            1
+
+/* Same as INIT_BUF_SIZE of the proxy */
+#define MB_DEFAULT_BUF_SIZE         (64 * 1024)
+
+#define MB_MOCK_BUF_SIZE            (64 * 1024)
+#define MB_MAX_EVENTS               128
+
+#define NS_PER_SEC                  INT64_C(1000000000)
+
+/* ========================================================================= */
+/* -- LOCAL MACROS --------------------------------------------------------- */
+/* ========================================================================= */
+
+#define CHANNEL_OPS(chan)           (&channel_ops[(chan)->kind])
+
+/* ========================================================================= */
+/* -- LOCAL TYPEDEFS ------------------------------------------------------- */
+/* ========================================================================= */
+
+struct Channel;
+struct Mock;
+
+/* ========================================================================= */
+/* -- LOCAL STRUCTURES ----------------------------------------------------- */
+/* ========================================================================= */
+
+typedef enum EndpointKind {
+  ENDPOINT_CHANNEL,
+  ENDPOINT_MOCK
+} EndpointKind;
+
+/* Kind of a relay channel, which selects its operations (see channel_ops) */
+typedef enum ChannelKind {
+  CHANNEL_BACKEND,
+  CHANNEL_CLIENT,
+  CHANNEL_KIND_COUNT
+} ChannelKind;
+
+/*
+ * I/O operations of a channel kind, as ChannelOps of proxy.c.
+ */
+typedef struct ChannelOps {
+  bool                (*read) (struct Channel *chan);
+  ssize_t             (*recv) (struct Channel *chan, char *buf, size_t size);
+  ssize_t             (*send) (struct Channel *chan, const char *buf,
+                               size_t size);
+} ChannelOps;
+
+/*
+ * Relay side of a client or backend connection, a stripped down Channel of
+ * proxy.c.
+ */
+typedef struct Channel {
+  /** Must be first, epoll events point here */
+  EndpointKind          endpoint;
+  int                   sock;
+
+  /** ChannelKind, which selects channel_ops */
+  uint8_t               kind;
+
+  struct Channel       *peer;
+
+  /** Next idle backend or waiting client */
+  struct Channel       *next;
+
+  char                 *buf;
+  int                   buf_size;
+  int                   rx_pos;
+  int                   tx_pos;
+  int                   tx_size;
+
+  /** Coalesce writes to this (TCP client) socket with MSG_MORE */
+  bool                  coalesce;
+
+  /** Data was sent with MSG_MORE and is held back until flushed */
+  bool                  corked;
+
+  /** The client has sent its startup packet */
+  bool                  is_admitted;
+
+  /** The backend has finished a transaction */
+  bool                  backend_is_ready;
+
+  /** The client is queued for a backend */
+  bool                  is_waiting;
+} Channel;
+
+/*
+ * Far end of a connection: a mock client or a mock backend.
+ */
+typedef struct Mock {
+  /** Must be first, epoll events point here */
+  EndpointKind          endpoint;
+  int                   sock;
+
+  bool                  is_client;
+
+  /** Startup packet (backend) or handshake (client) not seen yet */
+  bool                  in_startup;
+
+  char                 *in;
+  size_t                in_len;
+  size_t                in_size;
+
+  char                 *out;
+  size_t                out_pos;
+  size_t                out_len;
+  size_t                out_size;
+
+  /** Queries sent and answered by a mock client */
+  int64_t               n_sent;
+  int64_t               n_done;
+  int64_t               n_queries;
+} Mock;
+
+typedef struct MicrobenchOptions {
+  int                   clients;
+  int                   backends;
+  int64_t               queries;
+  int                   rows;
+  int                   row_size;
+  int                   depth;
+  int                   buf_size;
+
+  /** Connect clients over loopback TCP instead of Unix socket pairs */
+  bool                  tcp;
+
+  /** Hold back responses to TCP clients with MSG_MORE */
+  bool                  coalesce;
+} MicrobenchOptions;
+
+/*
+ * Measurements of the relay.
+ */
+typedef struct MicrobenchStats {
+  int64_t               relay_ns;
+  int64_t               n_messages;
+  int64_t               n_recv;
+  int64_t               n_send;
+  int64_t               n_flush;
+  int64_t               n_epoll_wait;
+  int64_t               bytes_relayed;
+  int64_t               bytes_copied;
+} MicrobenchStats;
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION PROTOTYPES -------------------------------------------- */
+/* ========================================================================= */
+
+static void backend_attach (Channel *client, Channel *backend);
+static bool backend_read (Channel *chan);
+static ssize_t backend_recv (Channel *chan, char *buf, size_t size);
+static void backend_reschedule (Channel *backend);
+static ssize_t backend_send (Channel *chan, const char *buf, size_t size);
+static void canned_append (char **buf, size_t *len, size_t *size,
+  char type, const char *body, int body_len);
+static void canned_build (const MicrobenchOptions *options);
+static Channel *channel_create (int sock, ChannelKind kind, int buf_size);
+static void channel_flush (Channel *chan);
+static bool channel_read (Channel *chan);
+static ssize_t channel_recv (Channel *chan);
+static bool channel_write (Channel *chan, bool synchronous);
+static bool client_read (Channel *chan);
+static ssize_t client_recv (Channel *chan, char *buf, size_t size);
+static ssize_t client_send (Channel *chan, const char *buf, size_t size);
+static void fatal (const char *what);
+static void mock_append (Mock *mock, const char *data, size_t len);
+static Mock *mock_create (int sock, bool is_client, int64_t n_queries);
+static bool mock_flush (Mock *mock);
+static void mock_message (Mock *mock, const char *msg, int msg_len);
+static bool mock_read (Mock *mock);
+static void mock_send_query (Mock *mock);
+static int64_t now_ns (void);
+static void relay_flush (void);
+static ssize_t socket_write (Channel *chan, const char *buf, size_t size,
+  bool more);
+static void tcp_socketpair (int socks[2]);
+static void usage (const char *progname);
+
+/* ========================================================================= */
+/* -- LOCAL VARIABLES ------------------------------------------------------ */
+/* ========================================================================= */
+
+static MicrobenchStats stats;
+
+static const ChannelOps channel_ops[CHANNEL_KIND_COUNT] = {
+  [CHANNEL_BACKEND] = {backend_read, backend_recv, backend_send},
+  [CHANNEL_CLIENT] = {client_read, client_recv, client_send},
+};
+
+/* Canned messages, built once from the options */
+static char *canned_startup = NULL;
+static size_t canned_startup_len = 0;
+static char *canned_handshake = NULL;
+static size_t canned_handshake_len = 0;
+static char *canned_query = NULL;
+static size_t canned_query_len = 0;
+static char *canned_result = NULL;
+static size_t canned_result_len = 0;
+
+/* Backend handshake response saved by the relay, as in backend_start() */
+static char *saved_handshake = NULL;
+static size_t saved_handshake_len = 0;
+
+/* Transaction pooling state */
+static Channel *idle_backends = NULL;
+static Channel *waiting_clients = NULL;
+static Channel **waiting_tail = &waiting_clients;
+
+/* Client channels with output held back by MSG_MORE, see relay_flush() */
+static Channel **corked = NULL;
+static int n_corked = 0;
+
+static int n_clients_done = 0;
+static int epoll_fd = -1;
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION DEFINITIONS ------------------------------------------ */
+/* ========================================================================= */
+
+int
+main (
+  int     argc,
+  char  **argv
+) {
+  static const struct option long_options[] = {
+    {"clients", required_argument, NULL, 'c'},
+    {"backends", required_argument, NULL, 'b'},
+    {"queries", required_argument, NULL, 'n'},
+    {"rows", required_argument, NULL, 'r'},
+    {"row-size", required_argument, NULL, 's'},
+    {"depth", required_argument, NULL, 'd'},
+    {"buffer-size", required_argument, NULL, 'B'},
+    {"tcp", no_argument, NULL, 't'},
+    {"no-coalesce", no_argument, NULL, 2},
+    {"help", no_argument, NULL, 1},
+    {NULL, 0, NULL, 0}
+  };
+  MicrobenchOptions options = {
+    .clients = MB_DEFAULT_CLIENTS,
+    .backends = MB_DEFAULT_BACKENDS,
+    .queries = MB_DEFAULT_QUERIES,
+    .rows = MB_DEFAULT_ROWS,
+    .row_size = MB_DEFAULT_ROW_SIZE,
+    .depth = MB_DEFAULT_DEPTH,
+    .buf_size = MB_DEFAULT_BUF_SIZE,
+    .tcp = false,
+    .coalesce = true
+  };
+  struct epoll_event events[MB_MAX_EVENTS];
+  Mock **clients;
+  int64_t started;
+  int64_t elapsed;
+  int64_t n_queries = 0;
+  double per_query;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "c:b:n:r:s:d:B:t", long_options,
+                          NULL)) != -1) {
+    switch (c) {
+      case 'c': options.clients = atoi(optarg); break;
+      case 'b': options.backends = atoi(optarg); break;
+      case 'n': options.queries = strtoll(optarg, NULL, 10); break;
+      case 'r': options.rows = atoi(optarg); break;
+      case 's': options.row_size = atoi(optarg); break;
+      case 'd': options.depth = atoi(optarg); break;
+      case 'B': options.buf_size = atoi(optarg); break;
+      case 't': options.tcp = true; break;
+      case 2: options.coalesce = false; break;
+      case 1:
+        usage(argv[0]);
+        return 0;
+      default:
+        fprintf(stderr, "Try \"%s --help\" for more information.\n",
+                argv[0]);
+        return 1;
+    }
+  }
+  if (optind < argc || options.clients <= 0 || options.backends <= 0 ||
+      options.queries < options.clients || options.rows < 0 ||
+      options.row_size < 0 || options.depth <= 0 ||
+      options.buf_size < NG_IDCP_MSG_READY_SIZE) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  canned_build(&options);
+  epoll_fd = epoll_create1(0);
+  if (epoll_fd < 0)
+    fatal("epoll_create1");
+
+  /*
+   * Start the backends: send the startup packet, let the mock answer and
+   * save the handshake response, as backend_start() does through libpq.
+   */
+  for (int ii = 0; ii < options.backends; ii++) {
+    int socks[2];
+    Channel *backend;
+    Mock *mock;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks) < 0)
+      fatal("socketpair");
+    backend = channel_create(socks[0], CHANNEL_BACKEND, options.buf_size);
+    mock = mock_create(socks[1], false, 0);
+
+    if (send(backend->sock, canned_startup, canned_startup_len, 0) !=
+        (ssize_t) canned_startup_len)
+      fatal("send startup packet");
+    if (!mock_read(mock))
+      fatal("mock backend handshake");
+    if (saved_handshake == NULL) {
+      saved_handshake = malloc(canned_handshake_len);
+      if (saved_handshake == NULL)
+        fatal("malloc");
+    }
+    saved_handshake_len = recv(backend->sock, saved_handshake,
+                               canned_handshake_len, 0);
+    if (saved_handshake_len != canned_handshake_len)
+      fatal("recv handshake");
+
+    backend->next = idle_backends;
+    idle_backends = backend;
+  }
+
+  /* Connect the clients, which start by sending their startup packet */
+  clients = calloc(options.clients, sizeof(Mock *));
+  corked = calloc(options.clients, sizeof(Channel *));
+  if (clients == NULL || corked == NULL)
+    fatal("calloc");
+  for (int ii = 0; ii < options.clients; ii++) {
+    int socks[2];
+    int64_t share = options.queries / options.clients +
+                    (ii < options.queries % options.clients ? 1 : 0);
+    Channel *client;
+
+    if (options.tcp)
+      tcp_socketpair(socks);
+    else if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, socks) < 0)
+      fatal("socketpair");
+    client = channel_create(socks[0], CHANNEL_CLIENT, options.buf_size);
+#ifdef MSG_MORE
+    /* As for clients of the proxy, Unix sockets are never coalesced */
+    client->coalesce = options.tcp && options.coalesce;
+#endif
+    clients[ii] = mock_create(socks[1], true, share);
+    mock_append(clients[ii], canned_startup, canned_startup_len);
+    mock_flush(clients[ii]);
+  }
+
+  memset(&stats, 0, sizeof(stats));
+  started = now_ns();
+  while (n_clients_done < options.clients) {
+    int n = epoll_wait(epoll_fd, events, MB_MAX_EVENTS, 1000);
+
+    stats.n_epoll_wait += 1;
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      fatal("epoll_wait");
+    }
+    if (n == 0) {
+      fprintf(stderr, "stalled with %d of %d clients done\n",
+              n_clients_done, options.clients);
+      return 1;
+    }
+    for (int ii = 0; ii < n; ii++) {
+      EndpointKind *endpoint = events[ii].data.ptr;
+
+      if (*endpoint == ENDPOINT_CHANNEL) {
+        Channel *chan = (Channel *) endpoint;
+        int64_t relay_started = now_ns();
+
+        if (events[ii].events & EPOLLOUT)
+          channel_write(chan, false);
+        if (events[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          channel_read(chan);
+        stats.relay_ns += now_ns() - relay_started;
+      } else {
+        Mock *mock = (Mock *) endpoint;
+
+        if (events[ii].events & EPOLLOUT)
+          mock_flush(mock);
+        if (events[ii].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+          mock_read(mock);
+      }
+    }
+    if (n_corked > 0) {
+      int64_t relay_started = now_ns();
+
+      relay_flush();
+      stats.relay_ns += now_ns() - relay_started;
+    }
+  }
+  elapsed = now_ns() - started;
+
+  for (int ii = 0; ii < options.clients; ii++)
+    n_queries += clients[ii]->n_done;
+  per_query = n_queries > 0 ? 1.0 / (double) n_queries : 0.0;
+
+  printf("clients %d (%s%s), backends %d, depth %d, %d rows of %d bytes\n",
+         options.clients, options.tcp ? "tcp" : "unix",
+         options.tcp && options.coalesce ? ", coalesced" : "",
+         options.backends, options.depth, options.rows, options.row_size);
+  printf("%-24s %14" PRId64 "\n", "queries", n_queries);
+  printf("%-24s %14" PRId64 "\n", "messages relayed", stats.n_messages);
+  printf("%-24s %14.3f\n", "wall time (s)", (double) elapsed / NS_PER_SEC);
+  printf("%-24s %14.0f\n", "queries/s",
+         (double) n_queries * NS_PER_SEC / (double) elapsed);
+  printf("%-24s %14.1f\n", "proxy ns/message",
+         stats.n_messages > 0 ?
+           (double) stats.relay_ns / (double) stats.n_messages : 0.0);
+  printf("%-24s %14.1f\n", "proxy ns/query", stats.relay_ns * per_query);
+  printf("%-24s %14.1f\n", "bytes relayed/query",
+         stats.bytes_relayed * per_query);
+  printf("%-24s %14.1f\n", "bytes copied/query",
+         stats.bytes_copied * per_query);
+  printf("%-24s %14.2f\n", "recv calls/query", stats.n_recv * per_query);
+  printf("%-24s %14.2f\n", "send calls/query", stats.n_send * per_query);
+  printf("%-24s %14.2f\n", "flush calls/query", stats.n_flush * per_query);
+  printf("%-24s %14.2f\n", "epoll_wait calls/query",
+         stats.n_epoll_wait * per_query);
+  return 0;
+} /* main() */
+
+/* ========================================================================= */
+/* -- LOCAL FUNCTION DEFINITIONS ------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Attach a client to an idle backend, as client_attach() does.
+ */
+static void
+backend_attach (
+  Channel  *client,
+  Channel  *backend
+) {
+  client->peer = backend;
+  backend->peer = client;
+} /* backend_attach() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read from a backend and pass its complete messages on to its client, the
+ * read operation of backend channels, following backend_read() of the
+ * proxy.
+ */
+static bool
+backend_read (
+  Channel *chan
+) {
+  while (chan->tx_size == 0) {
+    int msg_start = 0;
+    ssize_t rc = channel_recv(chan);
+
+    if (rc <= 0) {
+      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        fatal("relay recv");
+      return false;
+    }
+    chan->rx_pos += rc;
+
+    while (chan->rx_pos - msg_start >= NG_IDCP_MSG_HEADER_SIZE) {
+      int msg_len = ng_idcp_msg_length(chan->buf + msg_start, false);
+
+      if (msg_start + msg_len > chan->buf_size) {
+        /* Grow the buffer to fit the complete message, as repalloc() */
+        chan->buf_size = msg_start + msg_len;
+        chan->buf = realloc(chan->buf, chan->buf_size);
+        if (chan->buf == NULL)
+          fatal("realloc");
+        stats.bytes_copied += chan->rx_pos;
+      }
+      if (chan->rx_pos - msg_start < msg_len)
+        break;
+      if (ng_idcp_msg_is_ready_idle(chan->buf + msg_start))
+        chan->backend_is_ready = true;
+      stats.n_messages += 1;
+      msg_start += msg_len;
+    }
+
+    if (msg_start != 0) {
+      if (chan->peer == NULL)
+        fatal("message from idle backend");
+      chan->tx_size = msg_start;
+      if (!channel_write(chan->peer, true))
+        return false;
+    }
+    if (chan->backend_is_ready) {
+      backend_reschedule(chan);
+      return true;
+    }
+  }
+  return true;
+} /* backend_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+backend_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  return recv(chan->sock, buf, size, 0);
+} /* backend_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Detach a backend from its client at the end of a transaction and give it
+ * to the first waiting client, or put it on the idle list.
+ */
+static void
+backend_reschedule (
+  Channel *backend
+) {
+  Channel *client = waiting_clients;
+
+  backend->backend_is_ready = false;
+  if (backend->peer != NULL)
+    backend->peer->peer = NULL;
+  backend->peer = NULL;
+
+  if (client == NULL) {
+    backend->next = idle_backends;
+    idle_backends = backend;
+    return;
+  }
+
+  waiting_clients = client->next;
+  if (waiting_clients == NULL)
+    waiting_tail = &waiting_clients;
+  client->is_waiting = false;
+  backend_attach(client, backend);
+
+  /* Send the queries held back while the client waited */
+  channel_write(backend, false);
+} /* backend_reschedule() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+backend_send (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  return send(chan->sock, buf, size, 0);
+} /* backend_send() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+canned_append (
+  char        **buf,
+  size_t       *len,
+  size_t       *size,
+  char          type,
+  const char   *body,
+  int           body_len
+) {
+  uint32_t word = htonl((uint32_t) (sizeof(word) + body_len));
+
+  while (*len + NG_IDCP_MSG_HEADER_SIZE + body_len > *size) {
+    *size = *size > 0 ? *size * 2 : 1024;
+    *buf = realloc(*buf, *size);
+    if (*buf == NULL)
+      fatal("realloc");
+  }
+
+  /* A type of '\0' makes a startup packet, which has none */
+  if (type != '\0')
+    (*buf)[(*len)++] = type;
+  memcpy(*buf + *len, &word, sizeof(word));
+  *len += sizeof(word);
+  memcpy(*buf + *len, body, body_len);
+  *len += body_len;
+} /* canned_append() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Build the startup packet, handshake, query and result messages.
+ */
+static void
+canned_build (
+  const MicrobenchOptions *options
+) {
+  static const char startup[] =
+    "\0\3\0\0user\0bench\0database\0bench\0";
+  static const char auth_ok[] = "\0\0\0\0";
+  static const char param[] = "server_version\00016.0";
+  static const char key[] = "\0\0\0\1\0\0\0\2";
+  static const char ready[] = "I";
+  static const char statement[] = "SELECT x FROM bench;";
+  static const char row_desc[] =
+    "\0\1" "x\0" "\0\0\0\0" "\0\0" "\0\0\0\31" "\377\377" "\377\377\377\377"
+    "\0\0";
+  size_t size = 0;
+  char complete[32];
+  char *query;
+  char *row;
+  int row_len = 2 + 4 + options->row_size;
+  uint32_t field_len = htonl((uint32_t) options->row_size);
+
+  canned_append(&canned_startup, &canned_startup_len, &size, '\0', startup,
+                sizeof(startup));
+
+  size = 0;
+  canned_append(&canned_handshake, &canned_handshake_len, &size, 'R',
+                auth_ok, 4);
+  canned_append(&canned_handshake, &canned_handshake_len, &size, 'S',
+                param, sizeof(param));
+  canned_append(&canned_handshake, &canned_handshake_len, &size, 'K',
+                key, 8);
+  canned_append(&canned_handshake, &canned_handshake_len, &size, 'Z',
+                ready, 1);
+
+  /* Several statements in one query are answered with one ReadyForQuery */
+  query = malloc((sizeof(statement) - 1) * options->depth + 1);
+  if (query == NULL)
+    fatal("malloc");
+  for (int ii = 0; ii < options->depth; ii++)
+    memcpy(query + (sizeof(statement) - 1) * ii, statement,
+           sizeof(statement) - 1);
+  query[(sizeof(statement) - 1) * options->depth] = '\0';
+  size = 0;
+  canned_append(&canned_query, &canned_query_len, &size, 'Q', query,
+                (int) strlen(query) + 1);
+  free(query);
+
+  row = malloc(row_len);
+  if (row == NULL)
+    fatal("malloc");
+  memcpy(row, "\0\1", 2);
+  memcpy(row + 2, &field_len, 4);
+  memset(row + 6, 'x', options->row_size);
+
+  snprintf(complete, sizeof(complete), "SELECT %d", options->rows);
+  size = 0;
+  for (int ii = 0; ii < options->depth; ii++) {
+    canned_append(&canned_result, &canned_result_len, &size, 'T', row_desc,
+                  sizeof(row_desc) - 1);
+    for (int jj = 0; jj < options->rows; jj++)
+      canned_append(&canned_result, &canned_result_len, &size, 'D', row,
+                    row_len);
+    canned_append(&canned_result, &canned_result_len, &size, 'C', complete,
+                  (int) strlen(complete) + 1);
+  }
+  canned_append(&canned_result, &canned_result_len, &size, 'Z', ready, 1);
+  free(row);
+} /* canned_build() */
+
+/* ------------------------------------------------------------------------- */
+
+static Channel *
+channel_create (
+  int           sock,
+  ChannelKind   kind,
+  int           buf_size
+) {
+  Channel *chan = calloc(1, sizeof(Channel));
+  struct epoll_event event;
+
+  if (chan == NULL || (chan->buf = malloc(buf_size)) == NULL)
+    fatal("malloc");
+  chan->endpoint = ENDPOINT_CHANNEL;
+  chan->sock = sock;
+  chan->kind = kind;
+  chan->buf_size = buf_size;
+
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = chan;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0)
+    fatal("epoll_ctl");
+  return chan;
+} /* channel_create() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Push out output held back by MSG_MORE, as channel_flush() of the proxy:
+ * enabling TCP_NODELAY (which is already set) transmits pending segments.
+ */
+static void
+channel_flush (
+  Channel *chan
+) {
+  int on = 1;
+
+  if (!chan->corked)
+    return;
+  chan->corked = false;
+  stats.n_flush += 1;
+  if (setsockopt(chan->sock, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)
+    fatal("setsockopt(TCP_NODELAY)");
+} /* channel_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Try to read more data from the channel and send it to the peer.
+ */
+static bool
+channel_read (
+  Channel *chan
+) {
+  return CHANNEL_OPS(chan)->read(chan);
+} /* channel_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+channel_recv (
+  Channel *chan
+) {
+  stats.n_recv += 1;
+  return CHANNEL_OPS(chan)->recv(chan, chan->buf + chan->rx_pos,
+                                 chan->buf_size - chan->rx_pos);
+} /* channel_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Write the pending messages of the peer to the channel, following
+ * channel_write() of the proxy.
+ */
+static bool
+channel_write (
+  Channel  *chan,
+  bool      synchronous
+) {
+  Channel *peer = chan->peer;
+
+  if (peer == NULL)
+    return false;
+
+  while (peer->tx_pos < peer->tx_size) {
+    /* Hold back responses until ReadyForQuery, see relay_flush() */
+    bool more = chan->coalesce &&
+                !ng_idcp_msgs_end_with_ready(peer->buf, peer->tx_size);
+    ssize_t rc = socket_write(chan, peer->buf + peer->tx_pos,
+                              peer->tx_size - peer->tx_pos, more);
+
+    if (rc < 0)
+      return false;
+    stats.bytes_relayed += rc;
+    peer->tx_pos += rc;
+  }
+  if (peer->tx_size != 0) {
+    /* Move the rest of the received data to the beginning of the buffer */
+    memmove(peer->buf, peer->buf + peer->tx_size,
+            peer->rx_pos - peer->tx_size);
+    stats.bytes_copied += peer->rx_pos - peer->tx_size;
+    peer->rx_pos -= peer->tx_size;
+    peer->tx_pos = peer->tx_size = 0;
+    if (peer->backend_is_ready) {
+      backend_reschedule(peer);
+      return true;
+    }
+  }
+  return synchronous || channel_read(peer);
+} /* channel_write() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Read from a client and pass its complete messages on to its backend, the
+ * read operation of client channels, following client_read() of the proxy.
+ * Clients wait for a backend while none is idle.
+ */
+static bool
+client_read (
+  Channel *chan
+) {
+  while (chan->tx_size == 0) {
+    int msg_start = 0;
+    ssize_t rc = channel_recv(chan);
+
+    if (rc <= 0) {
+      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        fatal("relay recv");
+      return false;
+    }
+    chan->rx_pos += rc;
+
+    while (chan->rx_pos - msg_start >= NG_IDCP_MSG_HEADER_SIZE) {
+      bool startup = !chan->is_admitted;
+      int msg_len = ng_idcp_msg_length(chan->buf + msg_start, startup);
+
+      if (msg_start + msg_len > chan->buf_size) {
+        /* Grow the buffer to fit the complete message, as repalloc() */
+        chan->buf_size = msg_start + msg_len;
+        chan->buf = realloc(chan->buf, chan->buf_size);
+        if (chan->buf == NULL)
+          fatal("realloc");
+        stats.bytes_copied += chan->rx_pos;
+      }
+      if (chan->rx_pos - msg_start < msg_len)
+        break;
+
+      if (startup) {
+        /* Answer with the saved handshake response, as client_admit() */
+        chan->is_admitted = true;
+        chan->rx_pos = 0;
+        if (socket_write(chan, saved_handshake, saved_handshake_len,
+                         false) != (ssize_t) saved_handshake_len)
+          fatal("send handshake");
+        return client_read(chan);
+      }
+      stats.n_messages += 1;
+      msg_start += msg_len;
+    }
+
+    if (msg_start != 0) {
+      if (chan->peer == NULL) {
+        if (idle_backends != NULL) {
+          Channel *backend = idle_backends;
+
+          idle_backends = backend->next;
+          backend_attach(chan, backend);
+        } else {
+          /* Queries are sent once a backend is assigned */
+          chan->tx_size = msg_start;
+          chan->is_waiting = true;
+          chan->next = NULL;
+          *waiting_tail = chan;
+          waiting_tail = &chan->next;
+          return false;
+        }
+      }
+      chan->tx_size = msg_start;
+      if (!channel_write(chan->peer, true))
+        return false;
+    }
+  }
+  return true;
+} /* client_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_recv (
+  Channel  *chan,
+  char     *buf,
+  size_t    size
+) {
+  return recv(chan->sock, buf, size, 0);
+} /* client_recv() */
+
+/* ------------------------------------------------------------------------- */
+
+static ssize_t
+client_send (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size
+) {
+  return send(chan->sock, buf, size, 0);
+} /* client_send() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+fatal (
+  const char *what
+) {
+  fprintf(stderr, "%s failed: %s\n", what, strerror(errno));
+  exit(1);
+} /* fatal() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+mock_append (
+  Mock         *mock,
+  const char   *data,
+  size_t        len
+) {
+  if (mock->out_pos == mock->out_len)
+    mock->out_pos = mock->out_len = 0;
+  while (mock->out_len + len > mock->out_size) {
+    mock->out_size *= 2;
+    mock->out = realloc(mock->out, mock->out_size);
+    if (mock->out == NULL)
+      fatal("realloc");
+  }
+  memcpy(mock->out + mock->out_len, data, len);
+  mock->out_len += len;
+} /* mock_append() */
+
+/* ------------------------------------------------------------------------- */
+
+static Mock *
+mock_create (
+  int       sock,
+  bool      is_client,
+  int64_t   n_queries
+) {
+  Mock *mock = calloc(1, sizeof(Mock));
+  struct epoll_event event;
+
+  if (mock == NULL)
+    fatal("calloc");
+  mock->endpoint = ENDPOINT_MOCK;
+  mock->sock = sock;
+  mock->is_client = is_client;
+  mock->in_startup = true;
+  mock->n_queries = n_queries;
+  mock->in_size = mock->out_size = MB_MOCK_BUF_SIZE;
+  mock->in = malloc(mock->in_size);
+  mock->out = malloc(mock->out_size);
+  if (mock->in == NULL || mock->out == NULL)
+    fatal("malloc");
+
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = mock;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0)
+    fatal("epoll_ctl");
+  return mock;
+} /* mock_create() */
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+mock_flush (
+  Mock *mock
+) {
+  while (mock->out_pos < mock->out_len) {
+    ssize_t rc = send(mock->sock, mock->out + mock->out_pos,
+                      mock->out_len - mock->out_pos, 0);
+
+    if (rc < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        fatal("mock send");
+      return false;
+    }
+    mock->out_pos += rc;
+  }
+  return true;
+} /* mock_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Handle a complete message received by a mock.
+ */
+static void
+mock_message (
+  Mock         *mock,
+  const char   *msg,
+  int           msg_len
+) {
+  (void) msg_len;
+
+  if (!mock->is_client) {
+    /* Backend: answer the startup packet and queries */
+    if (mock->in_startup) {
+      mock->in_startup = false;
+      mock_append(mock, canned_handshake, canned_handshake_len);
+    } else if (msg[0] == 'Q') {
+      mock_append(mock, canned_result, canned_result_len);
+    }
+    return;
+  }
+
+  /* Client: every ReadyForQuery completes the handshake or a query */
+  if (msg[0] != 'Z')
+    return;
+  if (mock->in_startup) {
+    mock->in_startup = false;
+    mock_send_query(mock);
+    return;
+  }
+  mock->n_done += 1;
+  if (mock->n_done == mock->n_queries)
+    n_clients_done += 1;
+  else
+    mock_send_query(mock);
+} /* mock_message() */
+
+/* ------------------------------------------------------------------------- */
+
+static bool
+mock_read (
+  Mock *mock
+) {
+  for (;;) {
+    size_t msg_start = 0;
+    ssize_t rc;
+
+    if (mock->in_len == mock->in_size) {
+      mock->in_size *= 2;
+      mock->in = realloc(mock->in, mock->in_size);
+      if (mock->in == NULL)
+        fatal("realloc");
+    }
+    rc = recv(mock->sock, mock->in + mock->in_len,
+              mock->in_size - mock->in_len, 0);
+    if (rc <= 0) {
+      if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+        fatal("mock recv");
+      break;
+    }
+    mock->in_len += rc;
+
+    while (mock->in_len - msg_start >= NG_IDCP_MSG_HEADER_SIZE) {
+      bool startup = !mock->is_client && mock->in_startup;
+      int msg_len = ng_idcp_msg_length(mock->in + msg_start, startup);
+
+      if (mock->in_len - msg_start < (size_t) msg_len)
+        break;
+      mock_message(mock, mock->in + msg_start, msg_len);
+      msg_start += msg_len;
+    }
+    memmove(mock->in, mock->in + msg_start, mock->in_len - msg_start);
+    mock->in_len -= msg_start;
+  }
+  return mock_flush(mock);
+} /* mock_read() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+mock_send_query (
+  Mock *mock
+) {
+  mock_append(mock, canned_query, canned_query_len);
+  mock->n_sent += 1;
+} /* mock_send_query() */
+
+/* ------------------------------------------------------------------------- */
+
+static int64_t
+now_ns (
+  void
+) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+} /* now_ns() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Flush all client output held back during this event loop iteration, as
+ * proxy_flush() does.
+ */
+static void
+relay_flush (
+  void
+) {
+  for (int ii = 0; ii < n_corked; ii++)
+    channel_flush(corked[ii]);
+  n_corked = 0;
+} /* relay_flush() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Write to the channel's socket, following socket_write() of the proxy.
+ * Returns the count, or -1 when the socket is full.
+ */
+static ssize_t
+socket_write (
+  Channel      *chan,
+  const char   *buf,
+  size_t        size,
+  bool          more
+) {
+  ssize_t rc;
+
+  stats.n_send += 1;
+#ifdef MSG_MORE
+  if (more) {
+    rc = send(chan->sock, buf, size, MSG_MORE);
+    if (rc > 0 && !chan->corked) {
+      chan->corked = true;
+      corked[n_corked++] = chan;
+    }
+  } else
+#endif
+    rc = CHANNEL_OPS(chan)->send(chan, buf, size);
+  if (rc > 0 && !more)
+    chan->corked = false; /* sending without MSG_MORE pushed everything */
+  if (rc < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    fatal("relay send");
+  return rc;
+} /* socket_write() */
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Connect a pair of non-blocking loopback TCP sockets with TCP_NODELAY set,
+ * as on client connections of the proxy.
+ */
+static void
+tcp_socketpair (
+  int socks[2]
+) {
+  static int listen_sock = -1;
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int on = 1;
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listen_sock < 0) {
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0 ||
+        bind(listen_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listen_sock, SOMAXCONN) < 0)
+      fatal("listen");
+  }
+  if (getsockname(listen_sock, (struct sockaddr *) &addr, &addr_len) < 0)
+    fatal("getsockname");
+
+  socks[1] = socket(AF_INET, SOCK_STREAM, 0);
+  if (socks[1] < 0 ||
+      connect(socks[1], (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    fatal("connect");
+  socks[0] = accept(listen_sock, NULL, NULL);
+  if (socks[0] < 0)
+    fatal("accept");
+  for (int ii = 0; ii < 2; ii++) {
+    if (fcntl(socks[ii], F_SETFL, O_NONBLOCK) < 0)
+      fatal("fcntl");
+    if (setsockopt(socks[ii], IPPROTO_TCP, TCP_NODELAY, &on,
+                   sizeof(on)) < 0)
+      fatal("setsockopt(TCP_NODELAY)");
+  }
+} /* tcp_socketpair() */
+
+/* ------------------------------------------------------------------------- */
+
+static void
+usage (
+  const char *progname
+) {
+  printf("%s measures the overhead of the proxy relay path against mock\n"
+         "clients and backends, without a server.\n\n"
+         "Usage:\n"
+         "  %s [OPTION]...\n\n"
+         "Options:\n"
+         "  -c, --clients=NUM        mock clients (default: %d)\n"
+         "  -b, --backends=NUM       pooled mock backends (default: %d)\n"
+         "  -n, --queries=NUM        total queries (default: %d)\n"
+         "  -r, --rows=NUM           rows per result (default: %d)\n"
+         "  -s, --row-size=BYTES     bytes per row (default: %d)\n"
+         "  -d, --depth=NUM          statements per query message "
+         "(default: %d)\n"
+         "  -B, --buffer-size=BYTES  relay buffer size (default: %d)\n"
+         "  -t, --tcp                connect clients over loopback TCP\n"
+         "      --no-coalesce        do not hold back responses to TCP\n"
+         "                           clients with MSG_MORE\n",
+         progname, progname, MB_DEFAULT_CLIENTS, MB_DEFAULT_BACKENDS,
+         MB_DEFAULT_QUERIES, MB_DEFAULT_ROWS, MB_DEFAULT_ROW_SIZE,
+         MB_DEFAULT_DEPTH, MB_DEFAULT_BUF_SIZE);
+} /* usage() */
+
+/* vim: set ts=2 et sw=2 ft=c: */
@@ -49,12 +49,19 @@
 /* --------------------------- Project Inclusions -------------------------- */
 
 #include "nextgres/idcp.h"                      /* Our base extension header */
+#include "nextgres/idcp/storage/ipc.h"      /* Our extension's shared memory */
 #include "nextgres/idcp/util/guc.h"          /* Our extension's GUC handling */
 
 /* ========================================================================= */
 /* -- PRIVATE DEFINITIONS -------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * The controller is restarted if it fails, or after a crash of any process
+ * made the postmaster reinitialize, so that the pool comes back on its own.
+ */
+#define NG_IDCP_CONTROLLER_RESTART_TIME 5 /* seconds */
+
 /* ========================================================================= */
 /* -- PRIVATE MACROS ------------------------------------------------------- */
 /* ========================================================================= */
@@ -105,7 +112,7 @@ _PG_init (
     .bgw_type = NEXTGRES_EXTNAME,
     .bgw_library_name = NEXTGRES_LIBNAME,
     .bgw_function_name = "ng_idcp_controller_main",
-    .bgw_restart_time = BGW_NEVER_RESTART,
+    .bgw_restart_time = NG_IDCP_CONTROLLER_RESTART_TIME,
     .bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION,
     .bgw_main_arg = (Datum) 0,
     .bgw_notify_pid = 0,
@@ -130,6 +137,9 @@ _PG_init (
     return;
   }
 
+  /* Reserve shared memory used by the proxy workers */
+  ng_idcp_shmem_init();
+
   /* Register the Background Worker */
   RegisterBackgroundWorker(&ng_idcp_controller_bgworker);
 
@@ -73,6 +73,7 @@ typedef struct ConnectionProxyState
   uint64 tx_bytes;          /* amount of data sent to client */
   uint64 rx_bytes;          /* amount of data send to server */
   uint64 n_transactions;    /* total number of proroceeded transactions */
+  uint64 client_memory;     /* memory of client sessions, see stats_period */
 } ConnectionProxyState;
 
 /* ========================================================================= */
@@ -100,6 +101,9 @@ extern PGDLLIMPORT pgsocket MyProxySocket;
 
 /* ------------------------------ Boolean GUCs ----------------------------- */
 
+extern bool g_ng_idcp_client_tls_ktls;
+extern bool g_ng_idcp_coalesce_responses;
+extern bool g_ng_idcp_io_uring;
 extern bool g_ng_idcp_multitenant_proxy;
 extern bool g_ng_idcp_proxying_gucs;
 extern bool g_ng_idcp_restart_pooler_on_reload;
@@ -114,10 +118,15 @@ extern int g_ng_idcp_cfg_thread_count;
 extern int g_ng_idcp_cfg_max_sessions_per_thread;
 extern int g_ng_idcp_cfg_pool_mode;
 extern int g_ng_idcp_cfg_application_name_add_host;
+extern int g_ng_idcp_cfg_auth_cache_size;
+extern int g_ng_idcp_cfg_auth_cache_ttl;
 extern int g_ng_idcp_cfg_autodb_idle_timeout;
 extern int g_ng_idcp_cfg_cancel_wait_timeout;
 extern int g_ng_idcp_cfg_client_idle_timeout;
 extern int g_ng_idcp_cfg_client_login_timeout;
+extern int g_ng_idcp_cfg_client_tls_session_cache_size;
+extern int g_ng_idcp_cfg_client_tls_session_timeout;
+extern int g_ng_idcp_cfg_config_refresh_interval;
 extern int g_ng_idcp_cfg_default_pool_size;
 extern int g_ng_idcp_cfg_disable_pqexec;
 extern int g_ng_idcp_cfg_dns_max_ttl;
@@ -155,6 +164,7 @@ extern int g_ng_idcp_cfg_so_reuseport;
 extern int g_ng_idcp_cfg_stats_period;
 extern int g_ng_idcp_cfg_suspend_timeout;
 extern int g_ng_idcp_cfg_tcp_defer_accept;
+extern int g_ng_idcp_cfg_tcp_fastopen;
 extern int g_ng_idcp_cfg_tcp_keepcnt;
 extern int g_ng_idcp_cfg_tcp_keepidle;
 extern int g_ng_idcp_cfg_tcp_keepintvl;
@@ -179,6 +189,7 @@ extern char *gp_ng_idcp_cfg_client_tls_ecdhcurve;
 extern char *gp_ng_idcp_cfg_client_tls_key_file;
 extern char *gp_ng_idcp_cfg_client_tls_protocols;
 extern char *gp_ng_idcp_cfg_client_tls_sslmode;
+extern char *gp_ng_idcp_cfg_database_name;
 extern char *gp_ng_idcp_cfg_ignore_startup_parameters;
 extern char *gp_ng_idcp_cfg_job_name;
 extern char *gp_ng_idcp_cfg_listen_addr;
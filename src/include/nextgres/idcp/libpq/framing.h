@@ -0,0 +1,136 @@
+#ifndef NG_IDCP_LIBPQ_FRAMING_H                  /* Multiple Inclusion Guard */
+#define NG_IDCP_LIBPQ_FRAMING_H
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/*
+ * Protocol version 3 message framing used by the proxy to split the byte
+ * streams it relays into messages. This header has no dependencies on the
+ * server, so that the microbenchmark in src/bin can use the same framing
+ * code without a PostgreSQL installation.
+ */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include <arpa/inet.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/* ========================================================================= */
+/* -- PUBLIC DEFINITIONS --------------------------------------------------- */
+/* ========================================================================= */
+
+/* Type byte and int32 length, which counts itself but not the type */
+#define NG_IDCP_MSG_HEADER_SIZE     5
+
+/* ReadyForQuery: header and transaction status */
+#define NG_IDCP_MSG_READY_SIZE      6
+
+/* ========================================================================= */
+/* -- PUBLIC MACROS -------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC TYPEDEFS ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC STRUCTURES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Total length of the message at msg, of which at least
+ * NG_IDCP_MSG_HEADER_SIZE bytes must be available. Startup packets have no
+ * type byte, their length is the first word.
+ */
+static inline int
+ng_idcp_msg_length (
+  const char   *msg,
+  bool          startup
+) {
+  uint32_t len;
+
+  if (startup) {
+    memcpy(&len, msg, sizeof(len));
+    return (int) ntohl(len);
+  }
+  memcpy(&len, msg + 1, sizeof(len));
+  return (int) ntohl(len) + 1;
+} /* ng_idcp_msg_length() */
+
+/*
+ * Store the total length of the message at msg into its header.
+ */
+static inline void
+ng_idcp_msg_set_length (
+  char   *msg,
+  int     msg_len
+) {
+  uint32_t len = htonl((uint32_t) (msg_len - 1));
+
+  memcpy(msg + 1, &len, sizeof(len));
+} /* ng_idcp_msg_set_length() */
+
+/*
+ * Whether the complete message at msg is ReadyForQuery outside of a
+ * transaction block, after which the backend can be given to another client.
+ */
+static inline bool
+ng_idcp_msg_is_ready_idle (
+  const char *msg
+) {
+  return msg[0] == 'Z' && msg[5] == 'I';
+} /* ng_idcp_msg_is_ready_idle() */
+
+/*
+ * Whether the messages in buf end with ReadyForQuery, which is always the
+ * last message the backend sends for a batch of queries.
+ */
+static inline bool
+ng_idcp_msgs_end_with_ready (
+  const char   *buf,
+  int           size
+) {
+  return size >= NG_IDCP_MSG_READY_SIZE &&
+         buf[size - NG_IDCP_MSG_READY_SIZE] == 'Z' &&
+         memcmp(&buf[size - NG_IDCP_MSG_READY_SIZE + 1], "\0\0\0\5", 4) == 0;
+} /* ng_idcp_msgs_end_with_ready() */
+
+/* ========================================================================= */
+/* -- PUBLIC HELPER FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* vim: set ts=2 et sw=2 ft=c: */
+
+#endif /* NG_IDCP_LIBPQ_FRAMING_H */
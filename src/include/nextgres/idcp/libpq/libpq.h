@@ -27,6 +27,11 @@
 /* -- PUBLIC DEFINITIONS --------------------------------------------------- */
 /* ========================================================================= */
 
+/* Outcome of a client authentication step */
+#define NG_IDCP_AUTH_FAILED     (-1)
+#define NG_IDCP_AUTH_OK         0
+#define NG_IDCP_AUTH_CONTINUE   1
+
 /* ========================================================================= */
 /* -- PUBLIC MACROS -------------------------------------------------------- */
 /* ========================================================================= */
@@ -35,6 +40,9 @@
 /* -- PUBLIC TYPEDEFS ------------------------------------------------------ */
 /* ========================================================================= */
 
+/* Password exchange with a client, private to auth.c */
+typedef struct NgIdcpClientAuth NgIdcpClientAuth;
+
 /* ========================================================================= */
 /* -- PUBLIC STRUCTURES ---------------------------------------------------- */
 /* ========================================================================= */
@@ -47,14 +55,25 @@
 /* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
 /* ========================================================================= */
 
+extern void ng_idcp_auth_end (NgIdcpClientAuth *auth);
+extern int ng_idcp_auth_exchange (NgIdcpClientAuth *auth, char msgtype,
+  const char *body, int len, StringInfo out);
+extern void ng_idcp_auth_shmem_init (void);
+extern Size ng_idcp_auth_shmem_size (void);
+extern int ng_idcp_auth_start (Port *port, StringInfo out,
+  NgIdcpClientAuth **auth);
 extern int ng_idcp_stream_server_port (int family, const char *hostName,
   unsigned short portNumber, const char *unixSocketDir,
   pgsocket ListenSocket[], int MaxListen);
 int ng_idcp_stream_connection (pgsocket server_fd, Port *port);
+extern int ng_idcp_stream_setup (Port *port);
 extern int StreamConnection(pgsocket server_fd, Port *port);
 extern void StreamClose(pgsocket sock);
 extern void TouchSocketFiles(void);
 extern void RemoveSocketFiles(void);
+extern void ng_idcp_socket_file_adopt(const char *unixSocketPath);
+extern void ng_idcp_socket_file_release(const char *unixSocketPath,
+  bool remove);
 extern void ng_idcp_pq_init(void);
 extern int ng_idcp_pq_getbytes(char *s, size_t len);
 extern void ng_idcp_pq_startmsgread(void);
@@ -68,6 +87,16 @@ extern bool ng_idcp_pq_buffer_has_data(void);
 extern int ng_idcp_pq_putmessage_v2(char msgtype, const char *s, size_t len);
 extern bool ng_idcp_pq_check_connection(void);
 
+#ifdef USE_SSL
+extern int ng_idcp_tls_accept (Port *port, int *waitfor);
+extern bool ng_idcp_tls_init (void);
+extern bool ng_idcp_tls_ktls_send (Port *port);
+extern bool ng_idcp_tls_loaded (void);
+extern void ng_idcp_tls_shmem_init (void);
+extern Size ng_idcp_tls_shmem_size (void);
+extern int ng_idcp_tls_start (Port *port);
+#endif
+
 /* ========================================================================= */
 /* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
 /* ========================================================================= */
@@ -0,0 +1,89 @@
+#ifndef NG_IDCP_POSTMASTER_HANDOFF_H             /* Multiple Inclusion Guard */
+#define NG_IDCP_POSTMASTER_HANDOFF_H
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include "lib/stringinfo.h"
+
+/* ========================================================================= */
+/* -- PUBLIC DEFINITIONS --------------------------------------------------- */
+/* ========================================================================= */
+
+/* Messages sent by a worker handing off to its replacement */
+#define NG_IDCP_HANDOFF_LISTEN          1  /* listening socket */
+#define NG_IDCP_HANDOFF_BACKEND         2  /* idle pooled backend */
+#define NG_IDCP_HANDOFF_CLIENT          3  /* idle client session */
+#define NG_IDCP_HANDOFF_END             4  /* end of a batch */
+
+/* How long the two workers wait for each other */
+#define NG_IDCP_HANDOFF_TIMEOUT         10000 /* milliseconds */
+
+/* ========================================================================= */
+/* -- PUBLIC MACROS -------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC TYPEDEFS ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC STRUCTURES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+/* ========================================================================= */
+
+extern pgsocket ng_idcp_handoff_accept (pgsocket listen_sock);
+extern pgsocket ng_idcp_handoff_connect (pid_t pid);
+extern char *ng_idcp_handoff_get_string (StringInfo buf);
+extern pgsocket ng_idcp_handoff_listen (void);
+extern void ng_idcp_handoff_put_string (StringInfo buf, const char *str);
+extern int ng_idcp_handoff_recv (pgsocket sock, StringInfo payload,
+  pgsocket *fd);
+extern uint32 ng_idcp_handoff_requests (void);
+extern bool ng_idcp_handoff_send (pgsocket sock, int kind,
+  StringInfo payload, pgsocket fd);
+extern void ng_idcp_handoff_set_controller (void);
+extern void ng_idcp_handoff_set_target (int worker_id, pid_t pid);
+extern void ng_idcp_handoff_set_worker (int worker_id, pid_t pid);
+extern void ng_idcp_handoff_shmem_init (void);
+extern Size ng_idcp_handoff_shmem_size (void);
+extern pid_t ng_idcp_handoff_target (int worker_id);
+extern pid_t ng_idcp_handoff_worker (int worker_id);
+
+/* ========================================================================= */
+/* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC HELPER FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* vim: set ts=2 et sw=2 ft=c: */
+
+#endif /* NG_IDCP_POSTMASTER_HANDOFF_H */
@@ -23,6 +23,10 @@
 /* -- INCLUSIONS ----------------------------------------------------------- */
 /* ========================================================================= */
 
+#include "lib/stringinfo.h"
+#include "libpq/pqcomm.h"
+#include "nodes/pg_list.h"
+
 /* ========================================================================= */
 /* -- PUBLIC DEFINITIONS --------------------------------------------------- */
 /* ========================================================================= */
@@ -39,6 +43,32 @@
 /* -- PUBLIC STRUCTURES ---------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * Contents of a client's startup packet. Strings point into the copy of the
+ * packet made by ng_idcp_startup_packet_parse().
+ */
+typedef struct NgIdcpStartupPacket {
+  /** Requested protocol version */
+  ProtocolVersion proto;
+
+  /** Database and user names, truncated to NAMEDATALEN */
+  char *database_name;
+  char *user_name;
+
+  /** Command line options and application name, if given */
+  char *cmdline_options;
+  char *application_name;
+
+  /** Pairs of GUC names and values */
+  List *guc_options;
+
+  /** Whether a replication connection was requested */
+  bool replication;
+
+  /** NegotiateProtocolVersion message for the client, or NULL */
+  StringInfo negotiate;
+} NgIdcpStartupPacket;
+
 /* ========================================================================= */
 /* -- PUBLIC VARIABLES ----------------------------------------------------- */
 /* ========================================================================= */
@@ -47,8 +77,8 @@
 /* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
 /* ========================================================================= */
 
-extern int ng_idcp_parse_startup_packet (Port *port, MemoryContext memctx,
-  char *buf, int len, bool ssl_done, bool gss_done);
+extern int ng_idcp_startup_packet_parse (MemoryContext memctx,
+  const char *data, int len, NgIdcpStartupPacket *packet, char **error);
 
 /* ========================================================================= */
 /* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
@@ -39,6 +39,17 @@
 /* -- PUBLIC STRUCTURES ---------------------------------------------------- */
 /* ========================================================================= */
 
+/*
+ * Start arguments of a proxy worker, passed in bgw_extra.
+ */
+typedef struct NgIdcpProxyArgs {
+  /** Index of the worker, 0 .. nextgres_idcp.thread_count - 1 */
+  int                   worker_id;
+
+  /** Take over the listeners and sessions of the worker being replaced */
+  bool                  takeover;
+} NgIdcpProxyArgs;
+
 /* ========================================================================= */
 /* -- PUBLIC VARIABLES ----------------------------------------------------- */
 /* ========================================================================= */
@@ -48,6 +59,8 @@
 /* ========================================================================= */
 
 PGDLLEXPORT void ng_idcp_proxy_main (Datum main_arg) pg_attribute_noreturn();
+extern void ng_idcp_proxy_shmem_init (void);
+extern Size ng_idcp_proxy_shmem_size (void);
 
 /* ========================================================================= */
 /* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
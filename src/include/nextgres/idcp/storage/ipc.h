@@ -0,0 +1,88 @@
+#ifndef NG_IDCP_STORAGE_IPC_H                    /* Multiple Inclusion Guard */
+#define NG_IDCP_STORAGE_IPC_H
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+
+/* ========================================================================= */
+/* -- PUBLIC DEFINITIONS --------------------------------------------------- */
+/* ========================================================================= */
+
+/* Locks of the extension's LWLock tranche */
+#define NG_IDCP_LWLOCK_TLS_CACHE        0 /* client TLS session cache */
+#define NG_IDCP_LWLOCK_AUTH_CACHE       1 /* client verifier cache */
+#define NG_IDCP_LWLOCK_CONN_LIMITS      2 /* backend counters */
+#define NG_IDCP_LWLOCK_POOL_CONFIG      3 /* catalog configuration snapshot */
+#define NG_IDCP_NUM_LWLOCKS             4
+
+/* Backend counters kept per database and per role, see connlimit.c */
+#define NG_IDCP_CONN_LIMIT_DATABASE     0
+#define NG_IDCP_CONN_LIMIT_USER         1
+
+/* ========================================================================= */
+/* -- PUBLIC MACROS -------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC TYPEDEFS ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC STRUCTURES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+/* ========================================================================= */
+
+extern void ng_idcp_backend_registry_add (PGPROC *proc, int backend_pid,
+  const char *database, const char *role);
+extern int ng_idcp_backend_registry_reclaim (pid_t worker_pid);
+extern void ng_idcp_backend_registry_remove (PGPROC *proc, int backend_pid);
+extern void ng_idcp_backend_registry_shmem_init (void);
+extern Size ng_idcp_backend_registry_shmem_size (void);
+extern bool ng_idcp_conn_limit_acquire (int kind, const char *name,
+  int limit);
+extern void ng_idcp_conn_limit_release (int kind, const char *name);
+extern void ng_idcp_conn_limit_shmem_init (void);
+extern Size ng_idcp_conn_limit_shmem_size (void);
+extern LWLock *ng_idcp_lwlock (int id);
+extern void ng_idcp_shmem_init (void);
+
+/* ========================================================================= */
+/* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC HELPER FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* vim: set ts=2 et sw=2 ft=c: */
+
+#endif /* NG_IDCP_STORAGE_IPC_H */
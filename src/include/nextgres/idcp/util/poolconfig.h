@@ -0,0 +1,84 @@
+#ifndef NG_IDCP_UTIL_POOLCONFIG_H                /* Multiple Inclusion Guard */
+#define NG_IDCP_UTIL_POOLCONFIG_H
+/* ========================================================================= **
+**                    _  _______  ________________  ________                 **
+**                   / |/ / __/ |/_/_  __/ ___/ _ \/ __/ __/                 **
+**                  /    / _/_>  <  / / / (_ / , _/ _/_\ \                   **
+**                 /_/|_/___/_/|_| /_/  \___/_/|_/___/___/                   **
+**                                                                           **
+** ========================================================================= **
+**                  IN-DATABASE CONNECTION POOLING EXTENSION                 **
+** ========================================================================= **
+** NEXTGRES Database Compatibility System                                    **
+** Portions Copyright (C) NEXTGRES, INC. <info@nextgres.com>                 **
+** Portions Copyright (C) PostgresPro                                        **
+** Portions Copyright (C) Konstantin Knizhnik                                **
+** All Rights Reserved.                                                      **
+**                                                                           **
+** Permission to use, copy, modify, and/or distribute this software for any  **
+** purpose is subject to the terms specified in the License Agreement.       **
+** ========================================================================= */
+/* ========================================================================= */
+/* -- INCLUSIONS ----------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC DEFINITIONS --------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC MACROS -------------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC TYPEDEFS ------------------------------------------------------ */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC STRUCTURES ---------------------------------------------------- */
+/* ========================================================================= */
+
+/*
+ * Settings of a pool, from the _nextgres_idcp tables where given and the
+ * nextgres_idcp.* GUCs otherwise.
+ */
+typedef struct NgIdcpPoolSettings {
+  /** Backends per pool, 0 if not configured */
+  int                   pool_size;
+
+  /** NG_IDCP_POOL_MODE_*: users.pool_mode overrides databases.pool_mode */
+  int                   pool_mode;
+
+  /** Backends of the database across all workers, 0 means no limit */
+  int                   max_db_connections;
+
+  /** Backends of the role across all workers, 0 means no limit */
+  int                   max_user_connections;
+} NgIdcpPoolSettings;
+
+/* ========================================================================= */
+/* -- PUBLIC VARIABLES ----------------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC FUNCTION PROTOTYPES ------------------------------------------- */
+/* ========================================================================= */
+
+extern uint64 ng_idcp_pool_config_generation (void);
+extern bool ng_idcp_pool_config_load (void);
+extern void ng_idcp_pool_config_lookup (const char *database,
+  const char *user, NgIdcpPoolSettings *settings);
+extern void ng_idcp_pool_config_shmem_init (void);
+extern Size ng_idcp_pool_config_shmem_size (void);
+
+/* ========================================================================= */
+/* -- PUBLIC INLINE FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* ========================================================================= */
+/* -- PUBLIC HELPER FUNCTIONS ---------------------------------------------- */
+/* ========================================================================= */
+
+/* vim: set ts=2 et sw=2 ft=c: */
+
+#endif /* NG_IDCP_UTIL_POOLCONFIG_H */